@@ -64,10 +64,41 @@ PYTHONLIB = get_python_lib(plat_specific=1, standard_lib=0,
 config_h = sysconfig.get_config_h_filename()
 config_h_vars = sysconfig.parse_config_h(open(config_h))
 
+# Bundled expat, used by cprimary and by the in-tree cElementTree.
+EXPAT_SOURCES = ["smart/util/celementtree/expat/xmlparse.c",
+                 "smart/util/celementtree/expat/xmlrole.c",
+                 "smart/util/celementtree/expat/xmltok.c"]
+EXPAT_DEFINES = [
+    ("XML_STATIC", None),
+    ("XML_NS", "1"),
+    ("XML_DTD", "1"),
+    ("XML_CONTEXT_BYTES", "1024")
+    ]
+
+if "HAVE_MEMMOVE" in config_h_vars:
+    EXPAT_DEFINES.append(("HAVE_MEMMOVE", "1"))
+if "HAVE_BCOPY" in config_h_vars:
+    EXPAT_DEFINES.append(("HAVE_BCOPY", "1"))
+if sys.byteorder == "little":
+    EXPAT_DEFINES.append(("BYTEORDER", "1234"))
+else:
+    EXPAT_DEFINES.append(("BYTEORDER", "4321"))
+
+# GCC can't tell that findEncoding() in the bundled xmltok_ns.c always
+# fills its buffer, and expat is kept as released upstream.
+EXPAT_CFLAGS = []
+if "gcc" in (sysconfig.get_config_var("CC") or ""):
+    EXPAT_CFLAGS.append("-Wno-maybe-uninitialized")
+
 ext_modules = [
                Extension("smart.ccache", ["smart/ccache.c"]),
                Extension("smart.backends.rpm.crpmver",
                          ["smart/backends/rpm/crpmver.c"]),
+               Extension("smart.backends.rpm.cprimary",
+                         ["smart/backends/rpm/cprimary.c"]+EXPAT_SOURCES,
+                         include_dirs=["smart/util/celementtree/expat"],
+                         define_macros=EXPAT_DEFINES,
+                         extra_compile_args=EXPAT_CFLAGS),
                Extension("smart.backends.deb.cdebver",
                          ["smart/backends/deb/cdebver.c"]),
                Extension("smart.backends.deb._base",
@@ -105,31 +136,12 @@ except ImportError:
         from xml.etree import cElementTree
     except ImportError:
         # we need to build in-tree cElementTree
-        # cElementTree needed defines
-        CET_DEFINES = [
-            ("XML_STATIC", None),
-            ("XML_NS", "1"),
-            ("XML_DTD", "1"),
-            ("XML_CONTEXT_BYTES", "1024")
-            ]
-        
-        if "HAVE_MEMMOVE" in config_h_vars:
-            CET_DEFINES.append(("HAVE_MEMMOVE", "1"))
-        if "HAVE_BCOPY" in config_h_vars:
-            CET_DEFINES.append(("HAVE_BCOPY", "1"))
-        if sys.byteorder == "little":
-            CET_DEFINES.append(("BYTEORDER", "1234"))
-        else:
-            CET_DEFINES.append(("BYTEORDER", "4321"))
-
         ext_modules.append(
           Extension("smart.util.cElementTree",
-                    ["smart/util/celementtree/cElementTree.c",
-                     "smart/util/celementtree/expat/xmlparse.c",
-                     "smart/util/celementtree/expat/xmlrole.c",
-                     "smart/util/celementtree/expat/xmltok.c"],
+                    ["smart/util/celementtree/cElementTree.c"]+EXPAT_SOURCES,
                     include_dirs=["smart/util/celementtree/expat"],
-                    define_macros=CET_DEFINES)
+                    define_macros=EXPAT_DEFINES,
+                    extra_compile_args=EXPAT_CFLAGS)
                    )
         packages.append("smart.util.elementtree")
 
@@ -26,7 +26,9 @@ import sys
 import os
 import re
 
-from smart.backends.deb.debver import vercmp, checkdep, splitrelease
+from smart.backends.deb.debver import vercmp, checkdep, checkdeps
+from smart.backends.deb.debver import splitrelease
+from smart.backends.deb.cdebver import _C_checkdep
 from smart.backends.deb.pm import DebPackageManager
 from smart.util.strtools import isGlob
 from smart.cache import *
@@ -129,6 +131,11 @@ class DebDepends(Depends):
             return False
         return checkdep(prv.version, self.relation, self.version)
 
+    def getMatches(self, provides):
+        return checkdeps(self, [prv for prv in provides
+                                if isinstance(prv, DebProvides) or
+                                   type(prv) is Provides])
+
 class DebPreRequires(DebDepends,PreRequires): __slots__ = ()
 class DebRequires(DebDepends,Requires):       __slots__ = ()
 
@@ -177,9 +184,21 @@ class DebUpgrades(DebDepends,Upgrades):
             return True
         return checkdep(prv.version, self.relation, self.version)
 
+    def getMatches(self, provides):
+        return checkdeps(self, [prv for prv in provides
+                                if isinstance(prv, DebNameProvides) or
+                                   type(prv) is Provides], True)
+
 class DebConflicts(DebDepends,Conflicts): __slots__ = ()
 class DebBreaks(DebDepends,Conflicts): __slots__ = ()
 
+# Must be kept in sync with the matches() and getMatches() methods
+# of DebDepends and DebUpgrades.
+for cls in (DebPreRequires, DebRequires, DebConflicts, DebBreaks):
+    registerMatcher(cls, DebProvides, _C_checkdep, False, False)
+registerMatcher(DebUpgrades, DebNameProvides, _C_checkdep, True, False)
+del cls
+
 class NullSystemProvides(object):
 
     def matches(self, requires):
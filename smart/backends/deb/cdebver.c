@@ -29,10 +29,6 @@
 #include <string.h>
 #include <stdlib.h>
 
-#ifdef __sun
-#include <alloca.h>
-#endif
-
 static int ORDER[256];
 
 static void
@@ -55,8 +51,7 @@ _buildORDER(void)
 static int
 vercmppart(const char *a, const char *b)
 {
-    char *str1, *str2;
-    char *one, *two;
+    const char *one, *two;
 
     if ((!a || !*a) && (!b || !*b))
         return 0;
@@ -74,14 +69,8 @@ vercmppart(const char *a, const char *b)
 
     if (!strcmp(a, b)) return 0;
 
-    str1 = alloca(strlen(a) + 1);
-    str2 = alloca(strlen(b) + 1);
-
-    strcpy(str1, a);
-    strcpy(str2, b);
-
-    one = str1;
-    two = str2;
+    one = a;
+    two = b;
 
     while (*one && *two) {
         int first_diff = 0;
@@ -182,6 +171,90 @@ vercmp(const char *s1, const char *s2)
     return vercmpparts(e1, v1, r1, e2, v2, r2);
 }
 
+/*
+   Split versions are kept around in a cache, since the same few
+   thousand versions get compared over and over when linking
+   dependencies and sorting packages.
+*/
+
+#define VERSIONCACHESIZE 65536
+
+typedef struct {
+    char *e, *v, *r;
+    char buf[64];
+} Version;
+
+static PyObject *Versions = NULL;
+
+static PyObject *VersionName = NULL;
+static PyObject *RelationName = NULL;
+
+/*
+   Returns a new reference to the split version, which must be held
+   while the version is in use, since the cache may be cleared.
+*/
+static PyObject *
+getversion(PyObject *str)
+{
+    PyObject *obj = PyDict_GetItem(Versions, str);
+    Version *ver;
+    if (obj) {
+        Py_INCREF(obj);
+        return obj;
+    }
+    ver = malloc(sizeof(Version));
+    if (!ver)
+        return PyErr_NoMemory();
+    strncpy(ver->buf, PyString_AS_STRING(str), sizeof(ver->buf)-1);
+    ver->buf[sizeof(ver->buf)-1] = '\0';
+    splitversion(ver->buf, &ver->e, &ver->v, &ver->r);
+    obj = PyCObject_FromVoidPtr(ver, free);
+    if (!obj) {
+        free(ver);
+        return NULL;
+    }
+    if (PyDict_Size(Versions) >= VERSIONCACHESIZE)
+        PyDict_Clear(Versions);
+    if (PyDict_SetItem(Versions, str, obj) == -1) {
+        Py_DECREF(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+#define VERSION(obj) ((Version *)PyCObject_AsVoidPtr(obj))
+
+/* Versions with null bytes are left to the unsplit functions. */
+#define PARSABLE(obj) (PyString_Check(obj) && \
+                       strlen(PyString_AS_STRING(obj)) == \
+                       PyString_GET_SIZE(obj))
+
+static int
+versioncmp(Version *a, Version *b)
+{
+    if (a == b) return 0;
+    return vercmpparts(a->e, a->v, a->r, b->e, b->v, b->r);
+}
+
+/* Same as vercmp() with the split versions. Returns -2 on errors. */
+static int
+cachedvercmp(PyObject *s1, PyObject *s2)
+{
+    PyObject *v1, *v2;
+    int rc;
+    v1 = getversion(s1);
+    if (!v1) return -2;
+    v2 = getversion(s2);
+    if (!v2) {
+        Py_DECREF(v1);
+        return -2;
+    }
+    rc = versioncmp(VERSION(v1), VERSION(v2));
+    Py_DECREF(v1);
+    Py_DECREF(v2);
+    return rc;
+}
+
 static void
 parserelation(char *buf, char **n, char **r, char **v)
 {
@@ -414,34 +487,244 @@ error:
     return NULL;
 }
 
+static int
+checkdep(const char *v1, const char *rel, const char *v2)
+{
+    int rc = vercmp(v1, v2);
+    if (rc == 0)
+        return strchr(rel, '=') != NULL;
+    else if (rc < 0)
+        return rel[0] == '<';
+    else
+        return rel[0] == '>';
+}
+
+/* Whether a comparison result satisfies the relation. */
+static int
+checkrel(int rc, const char *rel)
+{
+    if (rc == 0)
+        return strchr(rel, '=') != NULL;
+    else if (rc < 0)
+        return rel[0] == '<';
+    else
+        return rel[0] == '>';
+}
+
+/*
+   Same as checkdep(), with the split versions. The splitarch
+   argument is there for ccache, and is unused since debian versions
+   have no @arch suffix. Returns -1 on errors.
+*/
+static int
+cachedcheckdep(PyObject *v1, const char *rel, PyObject *v2, int splitarch)
+{
+    int rc = cachedvercmp(v1, v2);
+    if (rc == -2)
+        return -1;
+    return checkrel(rc, rel);
+}
+
 static PyObject *
 cdebver_checkdep(PyObject *self, PyObject *args)
 {
+    PyObject *o1, *o2;
     const char *v1, *rel, *v2;
     PyObject *ret;
     int rc;
-    if (!PyArg_ParseTuple(args, "sss", &v1, &rel, &v2))
-        return NULL;
-    rc = vercmp(v1, v2);
-    if (rc == 0)
-        ret = (strchr(rel, '=') != NULL) ? Py_True : Py_False;
-    else if (rc < 0)
-        ret = (rel[0] == '<') ? Py_True : Py_False;
-    else
-        ret = (rel[0] == '>') ? Py_True : Py_False;
+    if (PyTuple_GET_SIZE(args) == 3 &&
+        PARSABLE(PyTuple_GET_ITEM(args, 0)) &&
+        PARSABLE(PyTuple_GET_ITEM(args, 2))) {
+        if (!PyArg_ParseTuple(args, "OsO", &o1, &rel, &o2))
+            return NULL;
+        rc = cachedcheckdep(o1, rel, o2, 0);
+        if (rc == -1) return NULL;
+    } else {
+        if (!PyArg_ParseTuple(args, "sss", &v1, &rel, &v2))
+            return NULL;
+        rc = checkdep(v1, rel, v2);
+    }
+    ret = rc ? Py_True : Py_False;
     Py_INCREF(ret);
     return ret;
 }
 
+/*
+   Returns the items of provides whose version satisfies the
+   relation and version of depends. Unversioned provides only match when anyprvversion is
+   true, as in DebUpgrades.matches(), and not otherwise, as in
+   DebDepends.matches().
+*/
+static PyObject *
+cdebver_checkdeps(PyObject *self, PyObject *args)
+{
+    PyObject *depends, *provides;
+    PyObject *relation = NULL, *version = NULL;
+    PyObject *seq = NULL, *depver = NULL;
+    PyObject *ret = NULL;
+    const char *rel;
+    int anyprvversion = 0;
+    int i, len;
+    if (!PyArg_ParseTuple(args, "OO|i", &depends, &provides, &anyprvversion))
+        return NULL;
+    seq = PySequence_Fast(provides, "provides must be a sequence");
+    if (!seq) return NULL;
+    version = PyObject_GetAttr(depends, VersionName);
+    if (!version) goto done;
+    len = PySequence_Fast_GET_SIZE(seq);
+    if (!PyObject_IsTrue(version)) {
+        ret = PySequence_List(seq);
+        goto done;
+    }
+    relation = PyObject_GetAttr(depends, RelationName);
+    if (!relation) goto done;
+    if (!PARSABLE(version) || !PyString_Check(relation)) {
+        PyErr_SetString(PyExc_TypeError, "version string expected");
+        goto done;
+    }
+    rel = PyString_AS_STRING(relation);
+    depver = getversion(version);
+    if (!depver) goto done;
+    ret = PyList_New(0);
+    if (!ret) goto done;
+    for (i = 0; i != len; i++) {
+        PyObject *prv = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *prvversion, *prvver;
+        int match;
+        prvversion = PyObject_GetAttr(prv, VersionName);
+        if (!prvversion) goto error;
+        if (!PyObject_IsTrue(prvversion)) {
+            match = anyprvversion;
+        } else {
+            if (!PARSABLE(prvversion)) {
+                PyErr_SetString(PyExc_TypeError, "version string expected");
+                Py_DECREF(prvversion);
+                goto error;
+            }
+            prvver = getversion(prvversion);
+            if (!prvver) {
+                Py_DECREF(prvversion);
+                goto error;
+            }
+            match = checkrel(versioncmp(VERSION(prvver), VERSION(depver)),
+                             rel);
+            Py_DECREF(prvver);
+        }
+        Py_DECREF(prvversion);
+        if (match && PyList_Append(ret, prv) == -1)
+            goto error;
+    }
+    goto done;
+error:
+    Py_CLEAR(ret);
+done:
+    Py_XDECREF(depver);
+    Py_XDECREF(relation);
+    Py_XDECREF(version);
+    Py_DECREF(seq);
+    return ret;
+}
+
 static PyObject *
 cdebver_vercmp(PyObject *self, PyObject *args)
 {
     const char *v1, *v2;
+    int rc;
+    if (PyTuple_GET_SIZE(args) == 2 &&
+        PARSABLE(PyTuple_GET_ITEM(args, 0)) &&
+        PARSABLE(PyTuple_GET_ITEM(args, 1))) {
+        rc = cachedvercmp(PyTuple_GET_ITEM(args, 0),
+                          PyTuple_GET_ITEM(args, 1));
+        if (rc == -2) return NULL;
+        return PyInt_FromLong(rc);
+    }
     if (!PyArg_ParseTuple(args, "ss", &v1, &v2))
         return NULL;
     return PyInt_FromLong(vercmp(v1, v2));
 }
 
+typedef struct {
+    PyObject *str;
+    Version *ver;
+} SortItem;
+
+/* Stable merge sort, using tmp for half of the items. */
+static void
+sortitems(SortItem *items, SortItem *tmp, int n)
+{
+    int mid = n/2;
+    int i = 0, j = mid, k = 0;
+    if (n < 2) return;
+    sortitems(items, tmp, mid);
+    sortitems(items+mid, tmp, n-mid);
+    memcpy(tmp, items, mid*sizeof(SortItem));
+    while (i < mid && j < n) {
+        if (versioncmp(items[j].ver, tmp[i].ver) < 0)
+            items[k++] = items[j++];
+        else
+            items[k++] = tmp[i++];
+    }
+    while (i < mid)
+        items[k++] = tmp[i++];
+}
+
+static PyObject *
+cdebver_sortversions(PyObject *self, PyObject *list)
+{
+    PyObject **parsed = NULL;
+    PyObject *copy, *result = NULL;
+    SortItem *items = NULL;
+    PyObject *ret = NULL;
+    int i = 0, n;
+    if (!PyList_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "list expected");
+        return NULL;
+    }
+    n = PyList_GET_SIZE(list);
+    copy = PyList_GetSlice(list, 0, n);
+    if (!copy) return NULL;
+    parsed = PyMem_New(PyObject *, n);
+    items = PyMem_New(SortItem, n+n/2+1);
+    if (!parsed || !items) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i != n; i++) {
+        PyObject *str = PyList_GET_ITEM(copy, i);
+        if (!PARSABLE(str)) {
+            PyErr_SetString(PyExc_TypeError, "version string expected");
+            goto error;
+        }
+        parsed[i] = getversion(str);
+        if (!parsed[i])
+            goto error;
+        items[i].str = str;
+        items[i].ver = VERSION(parsed[i]);
+    }
+    sortitems(items, items+n, n);
+    result = PyList_New(n);
+    if (!result)
+        goto error;
+    for (i = 0; i != n; i++) {
+        Py_INCREF(items[i].str);
+        PyList_SET_ITEM(result, i, items[i].str);
+    }
+    if (PyList_SetSlice(list, 0, PyList_GET_SIZE(list), result) == -1)
+        goto error;
+    Py_INCREF(Py_None);
+    ret = Py_None;
+error:
+    if (parsed) {
+        while (i--)
+            Py_DECREF(parsed[i]);
+        PyMem_Free(parsed);
+    }
+    PyMem_Free(items);
+    Py_XDECREF(result);
+    Py_DECREF(copy);
+    return ret;
+}
+
 static PyObject *
 cdebver_vercmpparts(PyObject *self, PyObject *args)
 {
@@ -468,6 +751,8 @@ static PyMethodDef cdebver_methods[] = {
     {"vercmp", (PyCFunction)cdebver_vercmp, METH_VARARGS, NULL},
     {"vercmpparts", (PyCFunction)cdebver_vercmpparts, METH_VARARGS, NULL},
     {"vercmppart", (PyCFunction)cdebver_vercmppart, METH_VARARGS, NULL},
+    {"checkdeps", (PyCFunction)cdebver_checkdeps, METH_VARARGS, NULL},
+    {"sortversions", (PyCFunction)cdebver_sortversions, METH_O, NULL},
     {NULL, NULL}
 };
 
@@ -478,6 +763,13 @@ initcdebver(void)
     m = Py_InitModule3("cdebver", cdebver_methods, "");
     if (m == NULL)
         return;
+    /* Used by ccache to check dependencies without going through
+       Python. */
+    PyModule_AddObject(m, "_C_checkdep",
+                       PyCObject_FromVoidPtr((void *)cachedcheckdep, NULL));
+    Versions = PyDict_New();
+    VersionName = PyString_InternFromString("version");
+    RelationName = PyString_InternFromString("relation");
     _buildORDER();
 }
 
@@ -66,6 +66,20 @@ def checkdep(s1, rel, s2):
     else:
         return '>' in rel
 
+def checkdeps(depends, provides, anyprvversion=False):
+    if not depends.version:
+        return list(provides)
+    relation = depends.relation
+    version = depends.version
+    result = []
+    for prv in provides:
+        if not prv.version:
+            if anyprvversion:
+                result.append(prv)
+        elif checkdep(prv.version, relation, version):
+            result.append(prv)
+    return result
+
 def vercmp(s1, s2):
     return vercmpparts(*(VERRE.match(s1).groups()+VERRE.match(s2).groups()))
 
@@ -154,6 +168,9 @@ for i in range(256):
     else:
         ORDER[c] = i+256
 
+def sortversions(versions):
+    versions.sort(vercmp)
+
 from cdebver import *
 
 # vim:ts=4:sw=4
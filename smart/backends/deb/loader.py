@@ -23,6 +23,8 @@
 from smart.cache import Loader, PackageInfo
 from smart.util.strtools import globdistance
 from smart.util.tagfile import TagFile
+from smart.util.infofile import LRUCache
+from smart.uncompress import Uncompressor, COMPRESSIONRATIO
 from smart.channel import FileChannel
 from smart.backends.deb.debver import parserelation, parserelations
 from smart.backends.deb.base import *
@@ -135,6 +137,14 @@ class DebPackageInfo(PackageInfo):
     def pathIsFile(self, path):
         return self._paths[path] == "f"
 
+RECORDCLASSES = (DebPreRequires, DebRequires, DebOrRequires,
+                 DebOrPreRequires, DebConflicts, DebBreaks)
+
+# Fields used by DebTagLoader.parse().
+PARSEFIELDS = frozenset(["architecture", "status", "package", "version",
+                         "provides", "depends", "pre-depends", "recommends",
+                         "conflicts", "breaks", "section"])
+
 class DebTagLoader(Loader):
 
     __stateversion__ = Loader.__stateversion__+2
@@ -157,20 +167,20 @@ class DebTagLoader(Loader):
         Loader.reset(self)
 
     def load(self):
-        Pkg = DebPackage
-        Prv = DebProvides
-        NPrv = DebNameProvides
-        PreReq = DebPreRequires
-        Req = DebRequires
-        OrReq = DebOrRequires
-        OrPreReq = DebOrPreRequires
-        Upg = DebUpgrades
-        Cnf = DebConflicts
-        Brk = DebBreaks
         prog = iface.getProgress(self._cache)
+        self.loadRecords(self.parse(prog))
+
+    def canParse(self):
+        return True
+
+    def parse(self, prog):
+        # Relation classes are referenced by their index in
+        # RECORDCLASSES, so that records may be marshalled.
+        PreReq, Req, OrReq, OrPreReq, Cnf, Brk = range(6)
+        Classes = RECORDCLASSES
         inst = self.getInstalled()
         sysarch = DEBARCH
-        for section, offset in self.getSections(prog):
+        for section, offset in self.getParseSections(prog):
             arch = section.get("architecture")
             if arch and arch != sysarch and arch != "all":
                 continue
@@ -186,14 +196,11 @@ class DebTagLoader(Loader):
             name = section.get("package")
             version = section.get("version")
 
-            prvargs = [(NPrv, name, version)]
-            prvdict = {name: True}
+            prvnames = []
             value = section.get("provides")
             if value:
                 for prvname in value.split(","):
-                    prvname = prvname.strip()
-                    prvargs.append((Prv, intern(prvname), None))
-                    prvdict[prvname] = True
+                    prvnames.append(intern(prvname.strip()))
 
             reqargs = []
             value = section.get("depends")
@@ -213,8 +220,6 @@ class DebTagLoader(Loader):
                     else:
                         reqargs.append((OrPreReq, tuple(relation)))
 
-            upgargs = [(Upg, name, '<', version)]
-
             recargs = []
             value = section.get("recommends")
             if value:
@@ -240,15 +245,33 @@ class DebTagLoader(Loader):
 
             newargs = []
             for args in reqargs:
-                req = args[0](*args[1:])
+                req = Classes[args[0]](*args[1:])
                 if not system_provides.matches(req):
                     newargs.append(args)
             reqargs = newargs
 
+            yield (name, version, prvnames, reqargs, recargs, cnfargs,
+                   offset, section.get("section", ""))
+
+    def loadRecords(self, records):
+        Pkg = DebPackage
+        Prv = DebProvides
+        NPrv = DebNameProvides
+        Upg = DebUpgrades
+        Classes = RECORDCLASSES
+        for (name, version, prvnames, reqargs, recargs, cnfargs,
+             offset, group) in records:
+            prvargs = [(NPrv, name, version)]
+            for prvname in prvnames:
+                prvargs.append((Prv, prvname, None))
+            reqargs = [(Classes[x[0]],)+x[1:] for x in reqargs]
+            recargs = [(Classes[x[0]],)+x[1:] for x in recargs]
+            cnfargs = [(Classes[x[0]],)+x[1:] for x in cnfargs]
+            upgargs = [(Upg, name, '<', version)]
             pkg = self.buildPackage((Pkg, name, version),
                                     prvargs, reqargs, upgargs, cnfargs, recargs)
             pkg.loaders[self] = offset
-            self._sections[pkg] = intern(section.get("section", ""))
+            self._sections[pkg] = intern(group)
 
     def search(self, searcher):
         offsets = {}
@@ -298,6 +321,11 @@ class DebTagLoader(Loader):
         raise TypeError, "Subclasses of DebTagLoader must " \
                          "implement the getSections() method"
 
+    def getParseSections(self, prog):
+        # Sections given to parse(), which only needs PARSEFIELDS.
+        # Loaders may leave the other fields out.
+        return self.getSections(prog)
+
     def getDict(self, pkg):
         raise TypeError, "Subclasses of DebTagLoader must " \
                          "implement the getDict() method"
@@ -324,21 +352,38 @@ class DebTagFileLoader(DebTagLoader):
     _filelistsname = None
     _changelogname = None
 
+    # Recently parsed sections, opened on demand and never pickled.
+    _dictcache = None
+    _tagfile = None
+
     def __init__(self, filename, baseurl=None, filelistsname="", changelogname=""):
         DebTagLoader.__init__(self, baseurl)
         self._filename = filename
         self._filelistsname = filelistsname
         self._changelogname = changelogname
-        self._tagfile = TagFile(self._filename)
+
+    def getTagFile(self):
+        if self._tagfile is None:
+            # Compressed files are read through a stream which
+            # uncompresses them on the fly.
+            if Uncompressor.getHandler(self._filename):
+                file = Uncompressor().open(self._filename)
+                self._tagfile = TagFile(file)
+            else:
+                self._tagfile = TagFile(self._filename)
+        return self._tagfile
 
     def getLoadSteps(self):
-        return os.path.getsize(self._filename)/800
+        size = os.path.getsize(self._filename)
+        if Uncompressor.getHandler(self._filename):
+            size *= COMPRESSIONRATIO
+        return size/800
 
-    def getSections(self, prog):
-        tf = self._tagfile
+    def getSections(self, prog, fields=None):
+        tf = self.getTagFile()
         tf.setOffset(0)
         lastoffset = offset = mod = 0
-        while tf.advanceSection():
+        while tf.advanceSection(fields):
             yield tf, offset
             offset = tf.getOffset()
             div, mod = divmod(offset-lastoffset+mod, 800)
@@ -346,10 +391,35 @@ class DebTagFileLoader(DebTagLoader):
             prog.show()
             lastoffset = offset
 
+    def getParseSections(self, prog):
+        return self.getSections(prog, PARSEFIELDS)
+
+    def __getstate__(self):
+        state = DebTagLoader.__getstate__(self)
+        if "_dictcache" in state:
+            del state["_dictcache"]
+        if "_tagfile" in state:
+            del state["_tagfile"]
+        return state
+
+    def reset(self):
+        DebTagLoader.reset(self)
+        self._dictcache = None
+
     def getDict(self, pkg):
-        self._tagfile.setOffset(pkg.loaders[self])
-        self._tagfile.advanceSection()
-        return self._tagfile.copy()
+        offset = pkg.loaders[self]
+        if self._dictcache is None:
+            self._dictcache = LRUCache()
+        dict = self._dictcache.get(offset)
+        if dict is None:
+            tf = self.getTagFile()
+            tf.setOffset(offset)
+            tf.advanceSection()
+            dict = tf.copy()
+            self._dictcache.set(offset, dict)
+        # A copy, so that changes made by callers don't end up in
+        # the cache.
+        return dict.copy()
 
     def getFileName(self, info):
         return info._dict.get("filename")
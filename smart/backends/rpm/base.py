@@ -25,6 +25,8 @@
 import zlib
 
 from rpmver import checkdep, checkver, vercmp, splitarch, splitrelease
+from rpmver import checkdeps
+from crpmver import _C_checkdep
 from smart.util.strtools import isGlob
 from smart.cache import *
 from smart import *
@@ -364,11 +366,21 @@ class RPMDepends(Depends):
         prvver, prvarch = splitarch(prv.version)
         return checkdep(prvver, self.relation, selfver)
 
+    def getMatches(self, provides):
+        return checkdeps(self, [prv for prv in provides
+                                if isinstance(prv, RPMProvides) or
+                                   type(prv) is Provides])
+
 class RPMPreRequires(RPMDepends,PreRequires): __slots__ = ()
 class RPMRequires(RPMDepends,Requires):       __slots__ = ()
 class RPMUpgrades(RPMDepends,Upgrades):       __slots__ = ()
 class RPMConflicts(RPMDepends,Conflicts):     __slots__ = ()
 
+# Must be kept in sync with RPMDepends.matches() and getMatches().
+for cls in (RPMPreRequires, RPMRequires, RPMUpgrades, RPMConflicts):
+    registerMatcher(cls, RPMProvides, _C_checkdep, True, True)
+del cls
+
 class RPMObsoletes(Depends):
     __slots__ = ()
 
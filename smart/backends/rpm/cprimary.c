@@ -0,0 +1,916 @@
+/*
+
+ This file is part of Smart Package Manager.
+
+ Smart Package Manager is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as published
+ by the Free Software Foundation; either version 2 of the License, or (at
+ your option) any later version.
+
+ Smart Package Manager is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Smart Package Manager; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include <Python.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "expat.h"
+
+/* Expat gives namespaced names as "uri}local". */
+#define NS_COMMON "http://linux.duke.edu/metadata/common}"
+#define NS_RPM "http://linux.duke.edu/metadata/rpm}"
+
+/* Bytes read from the file at once. */
+#define READSIZE 65536
+
+enum {
+    TAG_OTHER = 0,
+    TAG_PACKAGE,
+    TAG_NAME,
+    TAG_ARCH,
+    TAG_VERSION,
+    TAG_SUMMARY,
+    TAG_DESCRIPTION,
+    TAG_URL,
+    TAG_TIME,
+    TAG_SIZE,
+    TAG_LOCATION,
+    TAG_CHECKSUM,
+    TAG_FILE,
+    TAG_SOURCERPM,
+    TAG_GROUP,
+    TAG_LICENSE,
+    TAG_ENTRY,
+    TAG_REQUIRES,
+    TAG_RECOMMENDS,
+    TAG_PROVIDES,
+    TAG_CONFLICTS,
+    TAG_OBSOLETES,
+    TAG_DISTTAG,
+    TAG_DISTEPOCH
+};
+
+typedef struct {
+    const char *name;
+    int tag;
+} TagName;
+
+/* Most frequent tags come first. */
+static TagName CommonTags[] = {
+    {"file", TAG_FILE},
+    {"package", TAG_PACKAGE},
+    {"name", TAG_NAME},
+    {"arch", TAG_ARCH},
+    {"version", TAG_VERSION},
+    {"checksum", TAG_CHECKSUM},
+    {"summary", TAG_SUMMARY},
+    {"description", TAG_DESCRIPTION},
+    {"url", TAG_URL},
+    {"time", TAG_TIME},
+    {"size", TAG_SIZE},
+    {"location", TAG_LOCATION},
+    {NULL, TAG_OTHER}
+};
+
+static TagName RPMTags[] = {
+    {"entry", TAG_ENTRY},
+    {"requires", TAG_REQUIRES},
+    {"provides", TAG_PROVIDES},
+    {"conflicts", TAG_CONFLICTS},
+    {"obsoletes", TAG_OBSOLETES},
+    {"recommends", TAG_RECOMMENDS},
+    {"sourcerpm", TAG_SOURCERPM},
+    {"group", TAG_GROUP},
+    {"license", TAG_LICENSE},
+    {"disttag", TAG_DISTTAG},
+    {"distepoch", TAG_DISTEPOCH},
+    {NULL, TAG_OTHER}
+};
+
+static int
+gettag(const char *name)
+{
+    TagName *names;
+    if (strncmp(name, NS_RPM, sizeof(NS_RPM)-1) == 0) {
+        names = RPMTags;
+        name += sizeof(NS_RPM)-1;
+    } else if (strncmp(name, NS_COMMON, sizeof(NS_COMMON)-1) == 0) {
+        names = CommonTags;
+        name += sizeof(NS_COMMON)-1;
+    } else {
+        return TAG_OTHER;
+    }
+    for (; names->name; names++) {
+        if (names->name[0] == name[0] && strcmp(names->name, name) == 0)
+            return names->tag;
+    }
+    return TAG_OTHER;
+}
+
+static PyObject *RPMProvides = NULL;
+static PyObject *RPMNameProvides = NULL;
+static PyObject *RPMRequires = NULL;
+static PyObject *RPMPreRequires = NULL;
+static PyObject *RPMObsoletes = NULL;
+static PyObject *RPMConflicts = NULL;
+static PyObject *checkver = NULL;
+
+static int
+getBaseObjects(void)
+{
+    PyObject *module;
+    if (checkver)
+        return 0;
+    module = PyImport_ImportModule("smart.backends.rpm.base");
+    if (!module)
+        return -1;
+    RPMProvides = PyObject_GetAttrString(module, "RPMProvides");
+    RPMNameProvides = PyObject_GetAttrString(module, "RPMNameProvides");
+    RPMRequires = PyObject_GetAttrString(module, "RPMRequires");
+    RPMPreRequires = PyObject_GetAttrString(module, "RPMPreRequires");
+    RPMObsoletes = PyObject_GetAttrString(module, "RPMObsoletes");
+    RPMConflicts = PyObject_GetAttrString(module, "RPMConflicts");
+    Py_DECREF(module);
+    if (!RPMProvides || !RPMNameProvides || !RPMRequires ||
+        !RPMPreRequires || !RPMObsoletes || !RPMConflicts)
+        return -1;
+    module = PyImport_ImportModule("smart.backends.rpm.rpmver");
+    if (!module)
+        return -1;
+    checkver = PyObject_GetAttrString(module, "checkver");
+    Py_DECREF(module);
+    return checkver ? 0 : -1;
+}
+
+static PyObject *str_summary;
+static PyObject *str_description;
+static PyObject *str_url;
+static PyObject *str_time;
+static PyObject *str_build_time;
+static PyObject *str_size;
+static PyObject *str_installed_size;
+static PyObject *str_location;
+static PyObject *str_sourcerpm;
+static PyObject *str_group;
+static PyObject *str_license;
+static PyObject *str_eq;
+static PyObject *str_lt;
+static PyObject *str_le;
+static PyObject *str_gt;
+static PyObject *str_ge;
+static PyObject *str_versionarch;
+
+/* As in cElementTree, ASCII data is a str, and anything else unicode. */
+static PyObject *
+makestring(const char *s, Py_ssize_t len)
+{
+    Py_ssize_t i;
+    for (i = 0; i != len; i++) {
+        if (s[i] & 0x80)
+            return PyUnicode_DecodeUTF8(s, len, "strict");
+    }
+    return PyString_FromStringAndSize(s, len);
+}
+
+/* Same as makestring(), for a str built here. Steals str. */
+static PyObject *
+fixstring(PyObject *str)
+{
+    PyObject *res;
+    Py_ssize_t i, len;
+    char *s;
+    if (!str)
+        return NULL;
+    s = PyString_AS_STRING(str);
+    len = PyString_GET_SIZE(str);
+    for (i = 0; i != len; i++) {
+        if (s[i] & 0x80) {
+            res = PyUnicode_DecodeUTF8(s, len, "strict");
+            Py_DECREF(str);
+            return res;
+        }
+    }
+    return str;
+}
+
+static const char *
+getattr(const char **atts, const char *name)
+{
+    for (; *atts; atts += 2) {
+        if (strcmp(*atts, name) == 0)
+            return atts[1];
+    }
+    return NULL;
+}
+
+typedef struct {
+    PyObject_HEAD
+    XML_Parser _parser;
+    PyObject *_file;
+    PyObject *_queue;       /* Parsed packages not returned yet. */
+    Py_ssize_t _queuepos;
+    int _done;
+    int _failed;            /* A handler raised a Python exception. */
+    int _skip;              /* Inside a package which isn't an rpm. */
+    int _section;           /* Dependency tag around the entries. */
+    int _texttag;           /* Tag whose text is being collected. */
+    char *_text;
+    int _textlen;
+    int _textsize;
+    int _hastext;
+    PyObject *_checksumtype;
+    int _checksumpkgid;
+    PyObject *_name;
+    PyObject *_version;
+    PyObject *_arch;
+    PyObject *_disttag;
+    PyObject *_distepoch;
+    PyObject *_pkgid;
+    PyObject *_info;
+    PyObject *_reqdict;
+    PyObject *_recdict;
+    PyObject *_prvdict;
+    PyObject *_upgdict;
+    PyObject *_cnfdict;
+    PyObject *_filedict;
+} PrimaryParserObject;
+
+static void
+PrimaryParser_fail(PrimaryParserObject *self)
+{
+    self->_failed = 1;
+    XML_StopParser(self->_parser, XML_FALSE);
+}
+
+static int
+PrimaryParser_reset(PrimaryParserObject *self)
+{
+    Py_CLEAR(self->_name);
+    Py_CLEAR(self->_version);
+    Py_CLEAR(self->_arch);
+    Py_CLEAR(self->_disttag);
+    Py_CLEAR(self->_distepoch);
+    Py_CLEAR(self->_pkgid);
+    Py_XDECREF(self->_info);
+    Py_XDECREF(self->_reqdict);
+    Py_XDECREF(self->_recdict);
+    Py_XDECREF(self->_prvdict);
+    Py_XDECREF(self->_upgdict);
+    Py_XDECREF(self->_cnfdict);
+    Py_XDECREF(self->_filedict);
+    self->_info = PyDict_New();
+    self->_reqdict = PyDict_New();
+    self->_recdict = PyDict_New();
+    self->_prvdict = PyDict_New();
+    self->_upgdict = PyDict_New();
+    self->_cnfdict = PyDict_New();
+    self->_filedict = PyDict_New();
+    if (!self->_info || !self->_reqdict || !self->_recdict ||
+        !self->_prvdict || !self->_upgdict || !self->_cnfdict ||
+        !self->_filedict)
+        return -1;
+    return 0;
+}
+
+/* Set dict[key] = value, stealing value. */
+static int
+setitem(PyObject *dict, PyObject *key, PyObject *value)
+{
+    int res;
+    if (!value)
+        return -1;
+    res = PyDict_SetItem(dict, key, value);
+    Py_DECREF(value);
+    return res;
+}
+
+static int
+setint(PyObject *dict, PyObject *key, const char *value)
+{
+    if (!value) {
+        PyErr_SetString(PyExc_TypeError,
+                        "int() argument must be a string or a number, "
+                        "not 'NoneType'");
+        return -1;
+    }
+    return setitem(dict, key, PyInt_FromString((char *)value, NULL, 10));
+}
+
+/* Set dict[(cls, name, relation, version)] = True. */
+static int
+setrelation(PyObject *dict, PyObject *cls, PyObject *name,
+            PyObject *relation, PyObject *version)
+{
+    PyObject *tup = PyTuple_Pack(4, cls, name, relation, version);
+    int res;
+    if (!tup)
+        return -1;
+    res = PyDict_SetItem(dict, tup, Py_True);
+    Py_DECREF(tup);
+    return res;
+}
+
+static PyObject *
+PrimaryParser_getVersion(const char **atts)
+{
+    const char *e = getattr(atts, "epoch");
+    const char *v = getattr(atts, "ver");
+    const char *r = getattr(atts, "rel");
+    if (!v) v = "None";
+    if (!r) r = "None";
+    if (e && *e && strcmp(e, "0") != 0)
+        return fixstring(PyString_FromFormat("%s:%s-%s", e, v, r));
+    return fixstring(PyString_FromFormat("%s-%s", v, r));
+}
+
+static int
+PrimaryParser_handleEntry(PrimaryParserObject *self, const char **atts)
+{
+    const char *ename = getattr(atts, "name");
+    const char *v;
+    PyObject *name, *version, *relation;
+    int res = -1;
+
+    if (self->_section == TAG_OTHER ||
+        !ename || !*ename ||
+        strncmp(ename, "rpmlib(", 7) == 0 ||
+        strncmp(ename, "config(", 7) == 0)
+        return 0;
+
+    v = getattr(atts, "ver");
+    if (v) {
+        const char *e = getattr(atts, "epoch");
+        const char *r = getattr(atts, "rel");
+        const char *flags = getattr(atts, "flags");
+        int hasepoch = (e && *e && strcmp(e, "0") != 0);
+        if (r && *r) {
+            if (hasepoch)
+                version = PyString_FromFormat("%s:%s-%s", e, v, r);
+            else
+                version = PyString_FromFormat("%s-%s", v, r);
+        } else {
+            if (hasepoch)
+                version = PyString_FromFormat("%s:%s", e, v);
+            else
+                version = PyString_FromString(v);
+        }
+        version = fixstring(version);
+        if (!version)
+            return -1;
+        relation = Py_None;
+        if (flags && flags[0] && flags[1] && !flags[2]) {
+            switch (flags[0]) {
+                case 'E':
+                    if (flags[1] == 'Q') relation = str_eq;
+                    break;
+                case 'L':
+                    if (flags[1] == 'T') relation = str_lt;
+                    else if (flags[1] == 'E') relation = str_le;
+                    break;
+                case 'G':
+                    if (flags[1] == 'T') relation = str_gt;
+                    else if (flags[1] == 'E') relation = str_ge;
+                    break;
+            }
+        }
+    } else {
+        version = Py_None;
+        Py_INCREF(version);
+        relation = Py_None;
+    }
+
+    switch (self->_section) {
+        case TAG_REQUIRES: {
+            const char *pre = getattr(atts, "pre");
+            const char *hint, *missingok;
+            PyObject *dict = self->_reqdict;
+            PyObject *cls = RPMRequires;
+            name = makestring(ename, strlen(ename));
+            if (!name)
+                break;
+            if (pre && strcmp(pre, "1") == 0) {
+                cls = RPMPreRequires;
+            } else {
+                hint = getattr(atts, "hint");
+                missingok = getattr(atts, "missingok");
+                if ((hint && strcmp(hint, "1") == 0) ||
+                    (missingok && strcmp(missingok, "1") == 0))
+                    dict = self->_recdict;
+            }
+            res = setrelation(dict, cls, name, relation, version);
+            Py_DECREF(name);
+            break;
+        }
+        case TAG_RECOMMENDS:
+            name = makestring(ename, strlen(ename));
+            if (!name)
+                break;
+            res = setrelation(self->_recdict, RPMRequires,
+                              name, relation, version);
+            Py_DECREF(name);
+            break;
+        case TAG_PROVIDES: {
+            PyObject *cls = RPMProvides;
+            int isname;
+            if (ename[0] == '/') {
+                name = makestring(ename, strlen(ename));
+                if (!name)
+                    break;
+                res = PyDict_SetItem(self->_filedict, name, Py_True);
+                Py_DECREF(name);
+                break;
+            }
+            /* Provided names are always UTF-8 strings. */
+            name = PyString_FromString(ename);
+            if (!name)
+                break;
+            if (!self->_name) {
+                isname = 0;
+            } else if (PyString_Check(self->_name)) {
+                isname = strcmp(PyString_AS_STRING(self->_name), ename) == 0;
+            } else {
+                PyObject *uname = makestring(ename, strlen(ename));
+                if (!uname) {
+                    Py_DECREF(name);
+                    break;
+                }
+                isname = PyObject_RichCompareBool(uname, self->_name, Py_EQ);
+                Py_DECREF(uname);
+            }
+            if (isname == 1) {
+                PyObject *ret = PyObject_CallFunctionObjArgs(
+                                    checkver, version,
+                                    self->_version ? self->_version : Py_None,
+                                    NULL);
+                if (!ret) {
+                    isname = -1;
+                } else {
+                    isname = PyObject_IsTrue(ret);
+                    Py_DECREF(ret);
+                }
+                if (isname == 1) {
+                    PyObject *args = PyTuple_Pack(2, version, self->_arch ?
+                                                  self->_arch : Py_None);
+                    Py_DECREF(version);
+                    version = NULL;
+                    if (args) {
+                        version = PyString_Format(str_versionarch, args);
+                        Py_DECREF(args);
+                    }
+                    if (!version)
+                        isname = -1;
+                    cls = RPMNameProvides;
+                }
+            }
+            if (isname != -1) {
+                PyObject *tup = PyTuple_Pack(3, cls, name, version);
+                if (tup) {
+                    res = PyDict_SetItem(self->_prvdict, tup, Py_True);
+                    Py_DECREF(tup);
+                }
+            }
+            Py_DECREF(name);
+            break;
+        }
+        case TAG_OBSOLETES:
+            name = makestring(ename, strlen(ename));
+            if (!name)
+                break;
+            res = setrelation(self->_upgdict, RPMObsoletes,
+                              name, relation, version);
+            if (res == 0)
+                res = setrelation(self->_cnfdict, RPMObsoletes,
+                                  name, relation, version);
+            Py_DECREF(name);
+            break;
+        case TAG_CONFLICTS:
+            name = makestring(ename, strlen(ename));
+            if (!name)
+                break;
+            res = setrelation(self->_cnfdict, RPMConflicts,
+                              name, relation, version);
+            Py_DECREF(name);
+            break;
+        default:
+            res = 0;
+            break;
+    }
+    Py_XDECREF(version);
+    return res;
+}
+
+static void
+PrimaryParser_startElement(void *data, const XML_Char *tagname,
+                           const XML_Char **atts)
+{
+    PrimaryParserObject *self = (PrimaryParserObject *)data;
+    PyObject *info = self->_info;
+    const char *value;
+    int tag, res = 0;
+
+    if (self->_failed || self->_skip)
+        return;
+
+    tag = gettag(tagname);
+    switch (tag) {
+        case TAG_OTHER:
+            return;
+        case TAG_PACKAGE:
+            value = getattr(atts, "type");
+            if (!value || strcmp(value, "rpm") != 0)
+                self->_skip = 1;
+            return;
+        case TAG_ENTRY:
+            res = PrimaryParser_handleEntry(self, atts);
+            break;
+        case TAG_REQUIRES:
+        case TAG_RECOMMENDS:
+        case TAG_PROVIDES:
+        case TAG_CONFLICTS:
+        case TAG_OBSOLETES:
+            self->_section = tag;
+            return;
+        case TAG_VERSION:
+            Py_XDECREF(self->_version);
+            self->_version = PrimaryParser_getVersion(atts);
+            if (!self->_version)
+                res = -1;
+            break;
+        case TAG_TIME:
+            res = setint(info, str_time, getattr(atts, "file"));
+            if (res == 0)
+                res = setint(info, str_build_time, getattr(atts, "build"));
+            break;
+        case TAG_SIZE:
+            res = setint(info, str_size, getattr(atts, "package"));
+            value = getattr(atts, "installed");
+            if (res == 0 && value && *value)
+                res = setint(info, str_installed_size, value);
+            break;
+        case TAG_LOCATION:
+            value = getattr(atts, "href");
+            if (value) {
+                res = setitem(info, str_location,
+                              makestring(value, strlen(value)));
+            } else {
+                res = PyDict_SetItem(info, str_location, Py_None);
+            }
+            break;
+        case TAG_CHECKSUM:
+            value = getattr(atts, "type");
+            Py_XDECREF(self->_checksumtype);
+            if (value) {
+                self->_checksumtype = makestring(value, strlen(value));
+                if (!self->_checksumtype)
+                    res = -1;
+            } else {
+                self->_checksumtype = Py_None;
+                Py_INCREF(Py_None);
+            }
+            value = getattr(atts, "pkgid");
+            self->_checksumpkgid = (value && strcmp(value, "YES") == 0);
+            /* Fall through to collect the text. */
+        default:
+            self->_texttag = tag;
+            self->_textlen = 0;
+            self->_hastext = 0;
+            break;
+    }
+    if (res == -1)
+        PrimaryParser_fail(self);
+}
+
+static void
+PrimaryParser_characterData(void *data, const XML_Char *s, int len)
+{
+    PrimaryParserObject *self = (PrimaryParserObject *)data;
+    if (!self->_texttag || self->_failed)
+        return;
+    if (self->_textlen+len > self->_textsize) {
+        int size = (self->_textlen+len)*2;
+        char *text = realloc(self->_text, size);
+        if (!text) {
+            PyErr_NoMemory();
+            PrimaryParser_fail(self);
+            return;
+        }
+        self->_text = text;
+        self->_textsize = size;
+    }
+    memcpy(self->_text+self->_textlen, s, len);
+    self->_textlen += len;
+    self->_hastext = 1;
+}
+
+static int
+PrimaryParser_endText(PrimaryParserObject *self, int tag)
+{
+    PyObject *text, *key = NULL;
+    int res;
+
+    if (self->_hastext) {
+        text = makestring(self->_text, self->_textlen);
+        if (!text)
+            return -1;
+    } else {
+        text = Py_None;
+        Py_INCREF(text);
+    }
+
+    switch (tag) {
+        case TAG_NAME:
+            Py_XDECREF(self->_name);
+            self->_name = text;
+            return 0;
+        case TAG_ARCH:
+            Py_XDECREF(self->_arch);
+            self->_arch = text;
+            return 0;
+        case TAG_DISTTAG:
+            Py_XDECREF(self->_disttag);
+            self->_disttag = text;
+            return 0;
+        case TAG_DISTEPOCH:
+            Py_XDECREF(self->_distepoch);
+            self->_distepoch = text;
+            return 0;
+        case TAG_FILE:
+            res = PyDict_SetItem(self->_filedict, text, Py_True);
+            Py_DECREF(text);
+            return res;
+        case TAG_CHECKSUM:
+            res = PyDict_SetItem(self->_info, self->_checksumtype, text);
+            if (res == 0 && self->_checksumpkgid) {
+                Py_XDECREF(self->_pkgid);
+                self->_pkgid = text;
+            } else {
+                Py_DECREF(text);
+            }
+            return res;
+        case TAG_SUMMARY: key = str_summary; break;
+        case TAG_DESCRIPTION: key = str_description; break;
+        case TAG_URL: key = str_url; break;
+        case TAG_SOURCERPM: key = str_sourcerpm; break;
+        case TAG_GROUP: key = str_group; break;
+        case TAG_LICENSE: key = str_license; break;
+    }
+    res = 0;
+    if (key && self->_hastext && self->_textlen)
+        res = PyDict_SetItem(self->_info, key, text);
+    Py_DECREF(text);
+    return res;
+}
+
+static int
+PrimaryParser_endPackage(PrimaryParserObject *self)
+{
+#define OBJ(x) ((x) ? (x) : Py_None)
+    PyObject *item = PyTuple_Pack(13,
+                                  OBJ(self->_name),
+                                  OBJ(self->_version),
+                                  OBJ(self->_arch),
+                                  OBJ(self->_disttag),
+                                  OBJ(self->_distepoch),
+                                  OBJ(self->_pkgid),
+                                  self->_info,
+                                  self->_reqdict,
+                                  self->_recdict,
+                                  self->_prvdict,
+                                  self->_upgdict,
+                                  self->_cnfdict,
+                                  self->_filedict);
+#undef OBJ
+    int res;
+    if (!item)
+        return -1;
+    res = PyList_Append(self->_queue, item);
+    Py_DECREF(item);
+    if (res == -1)
+        return -1;
+    return PrimaryParser_reset(self);
+}
+
+static void
+PrimaryParser_endElement(void *data, const XML_Char *tagname)
+{
+    PrimaryParserObject *self = (PrimaryParserObject *)data;
+    int tag, res = 0;
+
+    if (self->_failed)
+        return;
+
+    tag = gettag(tagname);
+    if (self->_skip) {
+        if (tag == TAG_PACKAGE)
+            self->_skip = 0;
+        return;
+    }
+
+    if (tag == TAG_OTHER) {
+        return;
+    } else if (tag == self->_texttag) {
+        self->_texttag = TAG_OTHER;
+        res = PrimaryParser_endText(self, tag);
+    } else if (tag == self->_section) {
+        self->_section = TAG_OTHER;
+    } else if (tag == TAG_PACKAGE) {
+        res = PrimaryParser_endPackage(self);
+    }
+    if (res == -1)
+        PrimaryParser_fail(self);
+}
+
+static void
+PrimaryParser_dealloc(PrimaryParserObject *self)
+{
+    if (self->_parser)
+        XML_ParserFree(self->_parser);
+    Py_XDECREF(self->_file);
+    Py_XDECREF(self->_queue);
+    Py_XDECREF(self->_checksumtype);
+    Py_XDECREF(self->_name);
+    Py_XDECREF(self->_version);
+    Py_XDECREF(self->_arch);
+    Py_XDECREF(self->_disttag);
+    Py_XDECREF(self->_distepoch);
+    Py_XDECREF(self->_pkgid);
+    Py_XDECREF(self->_info);
+    Py_XDECREF(self->_reqdict);
+    Py_XDECREF(self->_recdict);
+    Py_XDECREF(self->_prvdict);
+    Py_XDECREF(self->_upgdict);
+    Py_XDECREF(self->_cnfdict);
+    Py_XDECREF(self->_filedict);
+    free(self->_text);
+    PyObject_Del(self);
+}
+
+static PyObject *
+PrimaryParser_iternext(PrimaryParserObject *self)
+{
+    PyObject *item;
+    while (self->_queuepos == PyList_GET_SIZE(self->_queue)) {
+        PyObject *data;
+        int final;
+        if (self->_done)
+            return NULL;
+        if (PyList_SetSlice(self->_queue, 0, self->_queuepos, NULL) == -1)
+            return NULL;
+        self->_queuepos = 0;
+        data = PyObject_CallMethod(self->_file, "read", "i", READSIZE);
+        if (!data)
+            return NULL;
+        if (!PyString_Check(data)) {
+            Py_DECREF(data);
+            PyErr_SetString(PyExc_TypeError,
+                            "file.read() must return a string");
+            return NULL;
+        }
+        final = (PyString_GET_SIZE(data) == 0);
+        if (final)
+            self->_done = 1;
+        if (XML_Parse(self->_parser, PyString_AS_STRING(data),
+                      PyString_GET_SIZE(data), final) == XML_STATUS_ERROR) {
+            Py_DECREF(data);
+            self->_done = 1;
+            if (!self->_failed) {
+                XML_Parser p = self->_parser;
+                PyErr_Format(PyExc_SyntaxError, "%s: line %ld, column %ld",
+                             XML_ErrorString(XML_GetErrorCode(p)),
+                             (long)XML_GetCurrentLineNumber(p),
+                             (long)XML_GetCurrentColumnNumber(p));
+            }
+            return NULL;
+        }
+        Py_DECREF(data);
+    }
+    item = PyList_GET_ITEM(self->_queue, self->_queuepos++);
+    Py_INCREF(item);
+    return item;
+}
+
+statichere PyTypeObject PrimaryParser_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                      /*ob_size*/
+    "smart.backends.rpm.cprimary.PrimaryParser", /*tp_name*/
+    sizeof(PrimaryParserObject), /*tp_basicsize*/
+    0,                      /*tp_itemsize*/
+    (destructor)PrimaryParser_dealloc, /*tp_dealloc*/
+    0,                      /*tp_print*/
+    0,                      /*tp_getattr*/
+    0,                      /*tp_setattr*/
+    0,                      /*tp_compare*/
+    0,                      /*tp_repr*/
+    0,                      /*tp_as_number*/
+    0,                      /*tp_as_sequence*/
+    0,                      /*tp_as_mapping*/
+    0,                      /*tp_hash*/
+    0,                      /*tp_call*/
+    0,                      /*tp_str*/
+    0,                      /*tp_getattro*/
+    0,                      /*tp_setattro*/
+    0,                      /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,     /*tp_flags*/
+    0,                      /*tp_doc*/
+    0,                      /*tp_traverse*/
+    0,                      /*tp_clear*/
+    0,                      /*tp_richcompare*/
+    0,                      /*tp_weaklistoffset*/
+    PyObject_SelfIter,      /*tp_iter*/
+    (iternextfunc)PrimaryParser_iternext, /*tp_iternext*/
+    0,                      /*tp_methods*/
+    0,                      /*tp_members*/
+    0,                      /*tp_getset*/
+    0,                      /*tp_base*/
+    0,                      /*tp_dict*/
+    0,                      /*tp_descr_get*/
+    0,                      /*tp_descr_set*/
+    0,                      /*tp_dictoffset*/
+    0,                      /*tp_init*/
+    0,                      /*tp_alloc*/
+    0,                      /*tp_new*/
+    0,                      /*tp_free*/
+    0,                      /*tp_is_gc*/
+};
+
+static PyObject *
+cprimary_parsePrimary(PyObject *self, PyObject *file)
+{
+    PrimaryParserObject *parser;
+
+    if (getBaseObjects() == -1)
+        return NULL;
+
+    parser = PyObject_New(PrimaryParserObject, &PrimaryParser_Type);
+    if (!parser)
+        return NULL;
+    memset((char *)parser+sizeof(PyObject), 0,
+           sizeof(PrimaryParserObject)-sizeof(PyObject));
+
+    Py_INCREF(file);
+    parser->_file = file;
+    parser->_queue = PyList_New(0);
+    if (!parser->_queue || PrimaryParser_reset(parser) == -1) {
+        Py_DECREF(parser);
+        return NULL;
+    }
+
+    parser->_parser = XML_ParserCreateNS(NULL, '}');
+    if (!parser->_parser) {
+        Py_DECREF(parser);
+        return PyErr_NoMemory();
+    }
+    XML_SetUserData(parser->_parser, parser);
+    XML_SetElementHandler(parser->_parser, PrimaryParser_startElement,
+                          PrimaryParser_endElement);
+    XML_SetCharacterDataHandler(parser->_parser,
+                                PrimaryParser_characterData);
+
+    return (PyObject *)parser;
+}
+
+static PyMethodDef cprimary_methods[] = {
+    {"parsePrimary", (PyCFunction)cprimary_parsePrimary, METH_O, NULL},
+    {NULL, NULL}
+};
+
+DL_EXPORT(void)
+initcprimary(void)
+{
+    if (PyType_Ready(&PrimaryParser_Type) < 0)
+        return;
+    if (!Py_InitModule3("cprimary", cprimary_methods, ""))
+        return;
+#define STRING(var, str) \
+    if (!(var = PyString_InternFromString(str))) return
+    STRING(str_summary, "summary");
+    STRING(str_description, "description");
+    STRING(str_url, "url");
+    STRING(str_time, "time");
+    STRING(str_build_time, "build_time");
+    STRING(str_size, "size");
+    STRING(str_installed_size, "installed_size");
+    STRING(str_location, "location");
+    STRING(str_sourcerpm, "sourcerpm");
+    STRING(str_group, "group");
+    STRING(str_license, "license");
+    STRING(str_eq, "=");
+    STRING(str_lt, "<");
+    STRING(str_le, "<=");
+    STRING(str_gt, ">");
+    STRING(str_ge, ">=");
+    STRING(str_versionarch, "%s@%s");
+#undef STRING
+}
+
+/* vim:ts=4:sw=4:et
+*/
@@ -175,6 +175,219 @@ vercmp(const char *s1, const char *s2)
     return vercmpparts(e1, v1, r1, d1, e2, v2, r2, d2);
 }
 
+/*
+   Parsed versions are kept around in a cache, since the same few
+   thousand versions get compared over and over when linking
+   dependencies and sorting packages. A version is split once into
+   epoch, version and release, and these into their alpha and
+   numeric segments, so that comparing doesn't need to copy or
+   scan the strings again.
+*/
+
+#define VERSIONCACHESIZE 65536
+
+/* A segment at buf+start, with leading zeros stripped when numeric. */
+typedef struct {
+    unsigned char start;
+    unsigned char len;
+    unsigned char isnum;
+} Segment;
+
+typedef struct {
+    const char *str;
+    int nsegs;
+    int trailing; /* Non-alphanumeric characters after the last segment. */
+    Segment *segs;
+} VersionPart;
+
+typedef struct {
+    int epoch;
+    int hasrelease;
+    VersionPart version;
+    VersionPart release;
+    char buf[64];
+    Segment segs[1];
+} Version;
+
+static PyObject *Versions = NULL;
+static PyObject *ArchVersions = NULL;
+
+static PyObject *VersionName = NULL;
+static PyObject *RelationName = NULL;
+
+static int
+splitsegments(const char *buf, const char *str, Segment *segs, int *trailing)
+{
+    const char *p = str;
+    const char *s;
+    int n = 0;
+    *trailing = 0;
+    while (*p) {
+        while (*p && !isalnum(*p)) p++;
+        if (!*p) {
+            *trailing = 1;
+            break;
+        }
+        s = p;
+        if (isdigit(*p)) {
+            while (*p && isdigit(*p)) p++;
+            while (*s == '0') s++;
+            segs[n].isnum = 1;
+        } else {
+            while (*p && isalpha(*p)) p++;
+            segs[n].isnum = 0;
+        }
+        segs[n].start = s-buf;
+        segs[n].len = p-s;
+        n++;
+    }
+    return n;
+}
+
+/* Same as vercmppart(a->str, b->str). */
+static int
+partcmp(Version *va, VersionPart *a, Version *vb, VersionPart *b)
+{
+    int i, rc, len;
+    if (!strcmp(a->str, b->str)) return 0;
+    for (i = 0;; i++) {
+        Segment *sa, *sb;
+        int amore = i < a->nsegs || (i == a->nsegs && a->trailing);
+        int bmore = i < b->nsegs || (i == b->nsegs && b->trailing);
+        if (!amore || !bmore) {
+            if (!amore && !bmore) return 0;
+            return amore ? 1 : -1;
+        }
+        if (i == a->nsegs) return -1;
+        sa = &a->segs[i];
+        if (i == b->nsegs || b->segs[i].isnum != sa->isnum)
+            return (sa->isnum ? 1 : -1);
+        sb = &b->segs[i];
+        if (sa->isnum && sa->len != sb->len)
+            return (sa->len > sb->len ? 1 : -1);
+        len = sa->len < sb->len ? sa->len : sb->len;
+        rc = memcmp(va->buf+sa->start, vb->buf+sb->start, len);
+        if (rc) return (rc < 1 ? -1 : 1);
+        if (sa->len != sb->len)
+            return (sa->len > sb->len ? 1 : -1);
+    }
+}
+
+/* Same as vercmp() with the unparsed versions. */
+static int
+versioncmp(Version *a, Version *b)
+{
+    int rc;
+    if (a == b) return 0;
+    if (a->epoch > b->epoch) return 1;
+    if (a->epoch < b->epoch) return -1;
+    rc = partcmp(a, &a->version, b, &b->version);
+    if (rc)
+        return rc;
+    else if (!a->hasrelease || !b->hasrelease)
+        return 0;
+    return partcmp(a, &a->release, b, &b->release);
+}
+
+static Version *
+parseversion(const char *str, int splitarch)
+{
+    char buf[64];
+    Segment segs[128];
+    char *e, *v, *r, *d;
+    int len = strlen(str);
+    int nversion, nrelease = 0;
+    int vtrailing, rtrailing = 0;
+    Version *ver;
+    if (splitarch) {
+        /* Same as splitarch(str)[0]. */
+        const char *at = strrchr(str, '@');
+        const char *slash = strrchr(str, '-');
+        if (at && slash && at > slash && slash != str)
+            len = at-str;
+    }
+    if (len > sizeof(buf)-1)
+        len = sizeof(buf)-1;
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    splitversion(buf, &e, &v, &r, &d);
+    nversion = splitsegments(buf, v, segs, &vtrailing);
+    if (r)
+        nrelease = splitsegments(buf, r, segs+nversion, &rtrailing);
+    ver = malloc(sizeof(Version)+(nversion+nrelease)*sizeof(Segment));
+    if (!ver) return NULL;
+    memcpy(ver->buf, buf, sizeof(buf));
+    memcpy(ver->segs, segs, (nversion+nrelease)*sizeof(Segment));
+    ver->epoch = (*e ? atoi(e) : 0);
+    ver->hasrelease = (r != NULL);
+    ver->version.str = ver->buf+(v-buf);
+    ver->version.nsegs = nversion;
+    ver->version.trailing = vtrailing;
+    ver->version.segs = ver->segs;
+    ver->release.str = r ? ver->buf+(r-buf) : NULL;
+    ver->release.nsegs = nrelease;
+    ver->release.trailing = rtrailing;
+    ver->release.segs = ver->segs+nversion;
+    return ver;
+}
+
+/*
+   Returns a new reference to the parsed version, which must be held
+   while the version is in use, since the cache may be cleared.
+*/
+static PyObject *
+getversion(PyObject *str, int splitarch)
+{
+    PyObject *cache = splitarch ? ArchVersions : Versions;
+    PyObject *obj = PyDict_GetItem(cache, str);
+    Version *ver;
+    if (obj) {
+        Py_INCREF(obj);
+        return obj;
+    }
+    ver = parseversion(PyString_AS_STRING(str), splitarch);
+    if (!ver)
+        return PyErr_NoMemory();
+    obj = PyCObject_FromVoidPtr(ver, free);
+    if (!obj) {
+        free(ver);
+        return NULL;
+    }
+    if (PyDict_Size(cache) >= VERSIONCACHESIZE)
+        PyDict_Clear(cache);
+    if (PyDict_SetItem(cache, str, obj) == -1) {
+        Py_DECREF(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+#define VERSION(obj) ((Version *)PyCObject_AsVoidPtr(obj))
+
+/* Versions with null bytes are left to the unparsed functions. */
+#define PARSABLE(obj) (PyString_Check(obj) && \
+                       strlen(PyString_AS_STRING(obj)) == \
+                       PyString_GET_SIZE(obj))
+
+/* Returns -2 on errors. */
+static int
+cachedvercmp(PyObject *s1, PyObject *s2, int splitarch)
+{
+    PyObject *v1, *v2;
+    int rc;
+    v1 = getversion(s1, splitarch);
+    if (!v1) return -2;
+    v2 = getversion(s2, splitarch);
+    if (!v2) {
+        Py_DECREF(v1);
+        return -2;
+    }
+    rc = versioncmp(VERSION(v1), VERSION(v2));
+    Py_DECREF(v1);
+    Py_DECREF(v2);
+    return rc;
+}
+
 static PyObject *
 crpmver_splitarch(PyObject *self, PyObject *version)
 {
@@ -271,42 +484,264 @@ crpmver_checkver(PyObject *self, PyObject *args)
         Py_INCREF(ret);
         return ret;
     }
-    s1 = PyString_AS_STRING(v1);
-    s2 = PyString_AS_STRING(v2);
-    rc = vercmp(s1, s2);
+    if (PARSABLE(v1) && PARSABLE(v2)) {
+        rc = cachedvercmp(v1, v2, 0);
+        if (rc == -2) return NULL;
+    } else {
+        s1 = PyString_AS_STRING(v1);
+        s2 = PyString_AS_STRING(v2);
+        rc = vercmp(s1, s2);
+    }
     ret = (rc == 0) ? Py_True : Py_False;
     Py_INCREF(ret);
     return ret;
 }
 
+static int
+checkdep(const char *v1, const char *rel, const char *v2)
+{
+    int rc = vercmp(v1, v2);
+    if (rc == 0)
+        return strchr(rel, '=') != NULL;
+    else if (rc < 0)
+        return rel[0] == '<';
+    else
+        return rel[0] == '>';
+}
+
+/* Whether a comparison result satisfies the relation. */
+static int
+checkrel(int rc, const char *rel)
+{
+    if (rc == 0)
+        return strchr(rel, '=') != NULL;
+    else if (rc < 0)
+        return rel[0] == '<';
+    else
+        return rel[0] == '>';
+}
+
+/*
+   Same as checkdep(), with the parsed versions. When splitarch is
+   true, the @arch suffix of the versions is ignored. Returns -1 on
+   errors.
+*/
+static int
+cachedcheckdep(PyObject *v1, const char *rel, PyObject *v2, int splitarch)
+{
+    int rc = cachedvercmp(v1, v2, splitarch);
+    if (rc == -2)
+        return -1;
+    return checkrel(rc, rel);
+}
+
 static PyObject *
 crpmver_checkdep(PyObject *self, PyObject *args)
 {
+    PyObject *o1, *o2;
     const char *v1, *rel, *v2;
     PyObject *ret;
     int rc;
-    if (!PyArg_ParseTuple(args, "sss", &v1, &rel, &v2))
-        return NULL;
-    rc = vercmp(v1, v2);
-    if (rc == 0)
-        ret = (strchr(rel, '=') != NULL) ? Py_True : Py_False;
-    else if (rc < 0)
-        ret = (rel[0] == '<') ? Py_True : Py_False;
-    else
-        ret = (rel[0] == '>') ? Py_True : Py_False;
+    if (PyTuple_GET_SIZE(args) == 3 &&
+        PARSABLE(PyTuple_GET_ITEM(args, 0)) &&
+        PARSABLE(PyTuple_GET_ITEM(args, 2))) {
+        if (!PyArg_ParseTuple(args, "OsO", &o1, &rel, &o2))
+            return NULL;
+        rc = cachedcheckdep(o1, rel, o2, 0);
+        if (rc == -1) return NULL;
+    } else {
+        if (!PyArg_ParseTuple(args, "sss", &v1, &rel, &v2))
+            return NULL;
+        rc = checkdep(v1, rel, v2);
+    }
+    ret = rc ? Py_True : Py_False;
     Py_INCREF(ret);
     return ret;
 }
 
+/*
+   Returns the items of provides whose version satisfies the
+   relation and version of depends. Unversioned provides match,
+   unless anyprvversion is false, and the @arch suffix of versions
+   is ignored, as in RPMDepends.matches().
+*/
+static PyObject *
+crpmver_checkdeps(PyObject *self, PyObject *args)
+{
+    PyObject *depends, *provides;
+    PyObject *relation = NULL, *version = NULL;
+    PyObject *seq = NULL, *depver = NULL;
+    PyObject *ret = NULL;
+    const char *rel;
+    int anyprvversion = 1;
+    int i, len, istrue;
+    if (!PyArg_ParseTuple(args, "OO|i", &depends, &provides, &anyprvversion))
+        return NULL;
+    seq = PySequence_Fast(provides, "provides must be a sequence");
+    if (!seq) return NULL;
+    version = PyObject_GetAttr(depends, VersionName);
+    if (!version) goto done;
+    len = PySequence_Fast_GET_SIZE(seq);
+    istrue = PyObject_IsTrue(version);
+    if (istrue == -1) goto done;
+    if (!istrue) {
+        ret = PySequence_List(seq);
+        goto done;
+    }
+    relation = PyObject_GetAttr(depends, RelationName);
+    if (!relation) goto done;
+    if (!PARSABLE(version) || !PyString_Check(relation)) {
+        PyErr_SetString(PyExc_TypeError, "version string expected");
+        goto done;
+    }
+    rel = PyString_AS_STRING(relation);
+    depver = getversion(version, 1);
+    if (!depver) goto done;
+    ret = PyList_New(0);
+    if (!ret) goto done;
+    for (i = 0; i != len; i++) {
+        PyObject *prv = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *prvversion, *prvver;
+        int match;
+        prvversion = PyObject_GetAttr(prv, VersionName);
+        if (!prvversion) goto error;
+        istrue = PyObject_IsTrue(prvversion);
+        if (istrue == -1) {
+            Py_DECREF(prvversion);
+            goto error;
+        }
+        if (!istrue) {
+            match = anyprvversion;
+        } else {
+            if (!PARSABLE(prvversion)) {
+                PyErr_SetString(PyExc_TypeError, "version string expected");
+                Py_DECREF(prvversion);
+                goto error;
+            }
+            prvver = getversion(prvversion, 1);
+            if (!prvver) {
+                Py_DECREF(prvversion);
+                goto error;
+            }
+            match = checkrel(versioncmp(VERSION(prvver), VERSION(depver)),
+                             rel);
+            Py_DECREF(prvver);
+        }
+        Py_DECREF(prvversion);
+        if (match && PyList_Append(ret, prv) == -1)
+            goto error;
+    }
+    goto done;
+error:
+    Py_CLEAR(ret);
+done:
+    Py_XDECREF(depver);
+    Py_XDECREF(relation);
+    Py_XDECREF(version);
+    Py_DECREF(seq);
+    return ret;
+}
+
 static PyObject *
 crpmver_vercmp(PyObject *self, PyObject *args)
 {
     const char *v1, *v2;
+    int rc;
+    if (PyTuple_GET_SIZE(args) == 2 &&
+        PARSABLE(PyTuple_GET_ITEM(args, 0)) &&
+        PARSABLE(PyTuple_GET_ITEM(args, 1))) {
+        rc = cachedvercmp(PyTuple_GET_ITEM(args, 0),
+                          PyTuple_GET_ITEM(args, 1), 0);
+        if (rc == -2) return NULL;
+        return PyInt_FromLong(rc);
+    }
     if (!PyArg_ParseTuple(args, "ss", &v1, &v2))
         return NULL;
     return PyInt_FromLong(vercmp(v1, v2));
 }
 
+typedef struct {
+    PyObject *str;
+    Version *ver;
+} SortItem;
+
+/* Stable merge sort, using tmp for half of the items. */
+static void
+sortitems(SortItem *items, SortItem *tmp, int n)
+{
+    int mid = n/2;
+    int i = 0, j = mid, k = 0;
+    if (n < 2) return;
+    sortitems(items, tmp, mid);
+    sortitems(items+mid, tmp, n-mid);
+    memcpy(tmp, items, mid*sizeof(SortItem));
+    while (i < mid && j < n) {
+        if (versioncmp(items[j].ver, tmp[i].ver) < 0)
+            items[k++] = items[j++];
+        else
+            items[k++] = tmp[i++];
+    }
+    while (i < mid)
+        items[k++] = tmp[i++];
+}
+
+static PyObject *
+crpmver_sortversions(PyObject *self, PyObject *list)
+{
+    PyObject **parsed = NULL;
+    PyObject *copy, *result = NULL;
+    SortItem *items = NULL;
+    PyObject *ret = NULL;
+    int i = 0, n;
+    if (!PyList_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "list expected");
+        return NULL;
+    }
+    n = PyList_GET_SIZE(list);
+    copy = PyList_GetSlice(list, 0, n);
+    if (!copy) return NULL;
+    parsed = PyMem_New(PyObject *, n);
+    items = PyMem_New(SortItem, n+n/2+1);
+    if (!parsed || !items) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i != n; i++) {
+        PyObject *str = PyList_GET_ITEM(copy, i);
+        if (!PARSABLE(str)) {
+            PyErr_SetString(PyExc_TypeError, "version string expected");
+            goto error;
+        }
+        parsed[i] = getversion(str, 0);
+        if (!parsed[i])
+            goto error;
+        items[i].str = str;
+        items[i].ver = VERSION(parsed[i]);
+    }
+    sortitems(items, items+n, n);
+    result = PyList_New(n);
+    if (!result)
+        goto error;
+    for (i = 0; i != n; i++) {
+        Py_INCREF(items[i].str);
+        PyList_SET_ITEM(result, i, items[i].str);
+    }
+    if (PyList_SetSlice(list, 0, PyList_GET_SIZE(list), result) == -1)
+        goto error;
+    Py_INCREF(Py_None);
+    ret = Py_None;
+error:
+    if (parsed) {
+        while (i--)
+            Py_DECREF(parsed[i]);
+        PyMem_Free(parsed);
+    }
+    PyMem_Free(items);
+    Py_XDECREF(result);
+    Py_DECREF(copy);
+    return ret;
+}
+
 static PyObject *
 crpmver_vercmpparts(PyObject *self, PyObject *args)
 {
@@ -333,6 +768,8 @@ static PyMethodDef crpmver_methods[] = {
     {"vercmp", (PyCFunction)crpmver_vercmp, METH_VARARGS, NULL},
     {"vercmpparts", (PyCFunction)crpmver_vercmpparts, METH_VARARGS, NULL},
     {"vercmppart", (PyCFunction)crpmver_vercmppart, METH_VARARGS, NULL},
+    {"checkdeps", (PyCFunction)crpmver_checkdeps, METH_VARARGS, NULL},
+    {"sortversions", (PyCFunction)crpmver_sortversions, METH_O, NULL},
     {NULL, NULL}
 };
 
@@ -343,6 +780,14 @@ initcrpmver(void)
     m = Py_InitModule3("crpmver", crpmver_methods, "");
     if (m == NULL)
         return;
+    /* Used by ccache to check dependencies without going through
+       Python. */
+    PyModule_AddObject(m, "_C_checkdep",
+                       PyCObject_FromVoidPtr((void *)cachedcheckdep, NULL));
+    Versions = PyDict_New();
+    ArchVersions = PyDict_New();
+    VersionName = PyString_InternFromString("version");
+    RelationName = PyString_InternFromString("relation");
 }
 
 /* vim:ts=4:sw=4:et
@@ -21,7 +21,8 @@
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
 from smart.backends.rpm.rpmver import checkver, splitarch
-from smart.util.strtools import globdistance
+from smart.util.strtools import GlobPattern
+from smart.util.infofile import LRUCache
 from smart.cache import Loader, PackageInfo
 from smart.channel import FileChannel
 from smart.backends.rpm.base import *
@@ -38,6 +39,9 @@ try:
 except ImportError:
     rpmhelper = None
 
+# Headers are large, so only a few recently read ones are kept.
+HEADERCACHESIZE = 32
+
 CRPMTAG_FILENAME          = 1000000
 CRPMTAG_FILESIZE          = 1000001
 CRPMTAG_MD5               = 1000005
@@ -410,17 +414,20 @@ class RPMHeaderLoader(Loader):
 
     def search(self, searcher):
         ic = searcher.ignorecase
+        urls = [GlobPattern(url, cutoff, ic) for url, cutoff in searcher.url]
+        spaths = [GlobPattern(spath, cutoff, ic)
+                  for spath, cutoff in searcher.path]
         for h, offset in self.getHeaders(Progress()):
             pkg = self._offsets.get(offset)
             if not pkg:
                 continue
 
             ratio = 0
-            if searcher.url:
+            if urls:
                 refurl = h[rpm.RPMTAG_URL]
                 if refurl:
-                    for url, cutoff in searcher.url:
-                        _, newratio = globdistance(url, refurl, cutoff, ic)
+                    for url in urls:
+                        _, newratio = url.match(refurl)
                         if newratio > ratio:
                             ratio = newratio
                             if ratio == 1:
@@ -428,19 +435,15 @@ class RPMHeaderLoader(Loader):
             if ratio == 1:
                 searcher.addResult(pkg, ratio)
                 continue
-            if searcher.path:
+            if spaths:
                 paths = get_header_filenames(h)
                 if paths:
-                    for spath, cutoff in searcher.path:
-                        for path in paths:
-                            _, newratio = globdistance(spath, path, cutoff, ic)
+                    for spath in spaths:
+                        for _, newratio in spath.match_many(paths):
                             if newratio > ratio:
                                 ratio = newratio
-                                if ratio == 1:
-                                    break
-                        else:
-                            continue
-                        break
+                        if ratio == 1:
+                            break
             if ratio == 1:
                 searcher.addResult(pkg, ratio)
                 continue
@@ -473,6 +476,9 @@ class RPMHeaderLoader(Loader):
 
 class RPMHeaderListLoader(RPMHeaderLoader):
 
+    # Recently read headers, created on demand and never pickled.
+    _headercache = None
+
     def __init__(self, filename, baseurl, count=None):
         RPMHeaderLoader.__init__(self)
         self._filename = filename
@@ -485,12 +491,18 @@ class RPMHeaderListLoader(RPMHeaderLoader):
         state = RPMHeaderLoader.__getstate__(self)
         if "_hdl" in state:
             del state["_hdl"]
+        if "_headercache" in state:
+            del state["_headercache"]
         return state
 
     def __setstate__(self, state):
         RPMHeaderLoader.__setstate__(self, state)
         self._checkRPM()
 
+    def reset(self):
+        RPMHeaderLoader.reset(self)
+        self._headercache = None
+
     def _checkRPM(self):
         if not hasattr(rpm, "readHeaderFromFD"):
 
@@ -548,10 +560,17 @@ class RPMHeaderListLoader(RPMHeaderLoader):
             prog.show()
 
     def getHeader(self, pkg):
-        file = open(self._filename)
-        file.seek(pkg.loaders[self])
-        h, offset = rpm.readHeaderFromFD(file.fileno())
-        file.close()
+        offset = pkg.loaders[self]
+        if self._headercache is None:
+            self._headercache = LRUCache(HEADERCACHESIZE)
+        h = self._headercache.get(offset)
+        if h is None:
+            file = open(self._filename)
+            file.seek(offset)
+            h = rpm.readHeaderFromFD(file.fileno())[0]
+            file.close()
+            if h:
+                self._headercache.set(offset, h)
         return h
 
     def getHeaderHDL(self, pkg):
@@ -20,8 +20,12 @@
 # along with Smart Package Manager; if not, write to the Free Software
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
-from smart.backends.rpm.rpmver import checkver
-from smart.cache import PackageInfo, Loader
+from smart.backends.rpm.primary import parsePrimary
+from smart.util.pathindex import PathIndex, writePathIndex
+from smart.util.pathindex import writeSortedPathIndex, dumpRun, loadRun
+from smart.util.infofile import InfoFile, InfoFileWriter
+from smart.uncompress import Uncompressor, COMPRESSIONRATIO
+from smart.cache import PackageInfo, Loader, getLoadJobs
 from smart.backends.rpm.base import *
 
 try:
@@ -33,19 +37,175 @@ except ImportError:
         from smart.util import cElementTree
 
 from smart import *
+from cStringIO import StringIO
 import posixpath
+import tempfile
+import marshal
 import locale
+import select
 import os
 
-NS_COMMON    = "http://linux.duke.edu/metadata/common"
-NS_RPM       = "http://linux.duke.edu/metadata/rpm"
 NS_FILELISTS = "http://linux.duke.edu/metadata/filelists"
 
 BYTESPERPKG = 3000
 
+# Bytes of the file list given to each process building the path index.
+CHUNKSIZE = 8*1024*1024
+
 def nstag(ns, tag):
     return "{%s}%s" % (ns, tag)
 
+def parseFileListPaths(file):
+    """
+    Parse the filelists.xml in file, yielding a (path, pkgid) pair
+    for each file of binary packages.
+    """
+    PACKAGE = nstag(NS_FILELISTS, "package")
+    FILE    = nstag(NS_FILELISTS, "file")
+    pkgid = None
+    for event, elem in cElementTree.iterparse(file, ("start", "end")):
+        if event == "start":
+            if elem.tag == PACKAGE:
+                if elem.get("arch") == "src":
+                    pkgid = None
+                else:
+                    pkgid = elem.get("pkgid")
+        elif elem.tag == FILE:
+            path = elem.text
+            if pkgid and path:
+                if type(path) is unicode:
+                    path = path.encode("utf-8")
+                yield path, pkgid
+            elem.clear()
+        elif elem.tag == PACKAGE:
+            pkgid = None
+            elem.clear()
+
+def _findPackage(data, start=0, reverse=False):
+    # Find a <package> start tag, rather than some other tag
+    # beginning with the same name.
+    while True:
+        if reverse:
+            i = data.rfind("<package", 0, start)
+        else:
+            i = data.find("<package", start)
+        if i == -1 or data[i+8:i+9] in " \t\r\n>":
+            return i
+        start = i+(not reverse)
+
+def splitPackages(file, size=CHUNKSIZE):
+    """
+    Split the XML in file at <package> elements. The first string
+    yielded has everything before the first package, and each of
+    the following ones about size bytes of whole packages, without
+    the closing tag of the root element.
+    """
+    blocks = []
+    buffered = 0
+    head = None
+    while True:
+        block = file.read(1024*1024)
+        blocks.append(block)
+        buffered += len(block)
+        if block and buffered < size:
+            continue
+        data = "".join(blocks)
+        if head is None:
+            i = _findPackage(data)
+            if i == -1:
+                if block:
+                    blocks = [data]
+                    continue
+                i = data.rfind("</")
+                if i == -1:
+                    i = len(data)
+            head = data[:i]
+            yield head
+            data = data[i:]
+        if not block:
+            if data:
+                i = data.rfind("</")
+                if i != -1:
+                    data = data[:i]
+                yield data
+            break
+        i = _findPackage(data, len(data), reverse=True)
+        if i > 0:
+            yield data[:i]
+            data = data[i:]
+        blocks = [data]
+        buffered = len(data)
+
+def sortFileListPaths(file, jobs, tmpdir):
+    """
+    Parse the filelists.xml in file in up to jobs forked processes,
+    each one taking a chunk of whole packages and dumping its sorted
+    (path, pkgid) pairs to a temporary file. Return the number of
+    pairs, and the list of runs to be merged.
+    """
+    chunks = splitPackages(file, CHUNKSIZE)
+    head = chunks.next()
+    root = [x for x in head.split("<")
+            if x[:1] not in ("", "?", "!", "/")]
+    if not root:
+        raise Error, _("Invalid file list")
+    tail = "</%s>" % root[-1].split(None, 1)[0].rstrip(">/")
+    total = 0
+    runs = []
+    running = {}
+    try:
+        while chunks or running:
+            while chunks and len(running) < jobs:
+                try:
+                    chunk = chunks.next()
+                except StopIteration:
+                    chunks = None
+                    break
+                runfile = tempfile.TemporaryFile(dir=tmpdir)
+                rfd, wfd = os.pipe()
+                pid = os.fork()
+                if not pid:
+                    status = 1
+                    try:
+                        try:
+                            os.close(rfd)
+                            pairs = list(parseFileListPaths(
+                                            StringIO(head+chunk+tail)))
+                            pairs.sort()
+                            dumpRun(pairs, runfile)
+                            runfile.flush()
+                            os.write(wfd, str(len(pairs)))
+                            status = 0
+                        except:
+                            pass
+                    finally:
+                        os._exit(status)
+                os.close(wfd)
+                del chunk
+                running[rfd] = (pid, runfile, [])
+            if not running:
+                break
+            for fd in select.select(running.keys(), [], [])[0]:
+                data = os.read(fd, 64)
+                if data:
+                    running[fd][2].append(data)
+                    continue
+                os.close(fd)
+                pid, runfile, count = running.pop(fd)
+                if os.waitpid(pid, 0)[1] != 0:
+                    runfile.close()
+                    raise Error, _("Failed parsing file list")
+                runfile.seek(0)
+                runs.append(loadRun(runfile))
+                total += int("".join(count))
+    finally:
+        for fd in running:
+            pid, runfile, count = running[fd]
+            os.close(fd)
+            os.waitpid(pid, 0)
+            runfile.close()
+    return total, runs
+
 class RPMMetaDataPackageInfo(PackageInfo):
 
     def __init__(self, package, loader, info):
@@ -101,7 +261,10 @@ class RPMMetaDataPackageInfo(PackageInfo):
 
 class RPMMetaDataLoader(Loader):
 
-    __stateversion__ = Loader.__stateversion__+3
+    __stateversion__ = Loader.__stateversion__+4
+
+    # Opened on demand, and never pickled.
+    _infofile = None
  
     def __init__(self, filename, filelistsname, baseurl):
         Loader.__init__(self)
@@ -117,292 +280,139 @@ class RPMMetaDataLoader(Loader):
         self._fileprovides.clear()
         self._parsedflist = False
         self._pkgids.clear()
+        if self._infofile:
+            self._infofile.close()
+            self._infofile = None
+
+    def __getstate__(self):
+        state = Loader.__getstate__(self)
+        if "_infofile" in state:
+            del state["_infofile"]
+        return state
+
+    def getInfoFileName(self):
+        return self._filename+".info"
 
     def getInfo(self, pkg):
-        return RPMMetaDataPackageInfo(pkg, self, pkg.loaders[self])
+        # Package information is kept in the record file written by
+        # load(), and pkg.loaders[self] has the record offset. When
+        # the file couldn't be written, it has the information itself.
+        info = pkg.loaders[self]
+        if type(info) is not dict:
+            if not self._infofile:
+                self._infofile = InfoFile(self.getInfoFileName())
+            record = self._infofile.get(info)
+            if (record and record[0] == pkg.name and
+                record[1] == pkg.version):
+                info = record[2]
+            else:
+                info = {}
+        return RPMMetaDataPackageInfo(pkg, self, info)
 
     def getLoadSteps(self):
-        return os.path.getsize(self._filename)/BYTESPERPKG
+        size = os.path.getsize(self._filename)
+        if Uncompressor.getHandler(self._filename):
+            size *= COMPRESSIONRATIO
+        return size/BYTESPERPKG
 
     def load(self):
-        METADATA    = nstag(NS_COMMON, "metadata")
-        PACKAGE     = nstag(NS_COMMON, "package")
-        NAME        = nstag(NS_COMMON, "name")
-        ARCH        = nstag(NS_COMMON, "arch")
-        VERSION     = nstag(NS_COMMON, "version")
-        SUMMARY     = nstag(NS_COMMON, "summary")
-        DESCRIPTION = nstag(NS_COMMON, "description")
-        URL         = nstag(NS_COMMON, "url")
-        TIME        = nstag(NS_COMMON, "time")
-        SIZE        = nstag(NS_COMMON, "size")
-        LOCATION    = nstag(NS_COMMON, "location")
-        FORMAT      = nstag(NS_COMMON, "format")
-        CHECKSUM    = nstag(NS_COMMON, "checksum")
-        FILE        = nstag(NS_COMMON, "file")
-        SOURCERPM   = nstag(NS_RPM, "sourcerpm")
-        GROUP       = nstag(NS_RPM, "group")
-        LICENSE     = nstag(NS_RPM, "license")
-        ENTRY       = nstag(NS_RPM, "entry")
-        REQUIRES    = nstag(NS_RPM, "requires")
-        RECOMMENDS  = nstag(NS_RPM, "recommends")
-        PROVIDES    = nstag(NS_RPM, "provides")
-        CONFLICTS   = nstag(NS_RPM, "conflicts")
-        OBSOLETES   = nstag(NS_RPM, "obsoletes")
-        DISTTAG     = nstag(NS_RPM, "disttag")
-        DISTEPOCH   = nstag(NS_RPM, "distepoch")
-
-        COMPMAP = { "EQ":"=", "LT":"<", "LE":"<=", "GT":">", "GE":">="}
-
+        if self._infofile:
+            self._infofile.close()
+            self._infofile = None
+        try:
+            writer = InfoFileWriter(self.getInfoFileName())
+        except (IOError, OSError):
+            writer = None
+        try:
+            self.loadPackages(writer)
+        except:
+            if writer:
+                writer.abort()
+            raise
+        if writer:
+            writer.close()
+
+    def loadPackages(self, writer):
         # Prepare progress reporting.
         lastoffset = 0
         mod = 0
         progress = iface.getProgress(self._cache)
 
-        # Prepare package information.
-        name = None
-        version = None
-        arch = None
-        disttag = None
-        distepoch = None
-        info = {}
-        reqdict = {}
-        recdict = {}
-        prvdict = {}
-        upgdict = {}
-        cnfdict = {}
-        filedict = {}
-
-        # Prepare data useful for the iteration
-        skip = None
-        queue = []
+        file = Uncompressor().open(self._filename)
+        for (name, version, arch, disttag, distepoch, pkgid, info,
+             reqdict, recdict, prvdict, upgdict, cnfdict,
+             filedict) in parsePrimary(file):
 
-        file = open(self._filename)
-        for event, elem in cElementTree.iterparse(file, ("start", "end")):
-            tag = elem.tag
+            if getArchScore(arch) == 0:
+                continue
 
-            if event == "start":
+            # Use all the information acquired to build the package.
 
-                if not skip and tag == PACKAGE:
-                    if elem.get("type") != "rpm":
-                        skip = PACKAGE
+            versionarch = "%s@%s" % (version, arch)
 
-                queue.append(elem)
+            upgdict[(RPMObsoletes,
+                     name, '<', versionarch)] = True
 
-            elif event == "end":
+            reqargs = [x for x in reqdict
+                       if not ((x[2] is None or "=" in x[2]) and
+                               (RPMProvides, x[1], x[3]) in prvdict or
+                               system_provides.match(x[1], x[2], x[3]))]
+            reqargs = collapse_libc_requires(reqargs)
 
-                popped = queue.pop()
-                assert popped is elem
+            recargs = [x for x in recdict
+                       if not ((x[2] is None or "=" in x[2]) and
+                               (RPMProvides, x[1], x[3]) in prvdict or
+                               system_provides.match(x[1], x[2], x[3]))]
 
-                if skip:
-                    if tag == skip:
-                        skip = None
+            prvargs = prvdict.keys()
+            cnfargs = cnfdict.keys()
+            upgargs = upgdict.keys()
 
-                elif tag == ARCH:
-                    if getArchScore(elem.text) == 0:
-                        skip = PACKAGE
-                    else:
-                        arch = elem.text
-
-                elif tag == NAME:
-                    name = elem.text
+            if disttag:
+                distversion = "%s-%s" % (version, disttag)
+                if distepoch:
+                    distversion += distepoch
+                versionarch = "%s@%s" % (distversion, arch)
 
-                elif tag == VERSION:
-                    e = elem.get("epoch")
-                    if e and e != "0":
-                        version = "%s:%s-%s" % \
-                                  (e, elem.get("ver"), elem.get("rel"))
-                    else:
-                        version = "%s-%s" % \
-                                  (elem.get("ver"), elem.get("rel"))
-
-                elif tag == DISTTAG:
-                    disttag = elem.text
-
-                elif tag == DISTEPOCH:
-                    distepoch = elem.text
-
-                elif tag == SUMMARY:
-                    if elem.text:
-                        info["summary"] = elem.text
-
-                elif tag == DESCRIPTION:
-                    if elem.text:
-                        info["description"] = elem.text
-
-                elif tag == URL:
-                    if elem.text:
-                        info["url"] = elem.text
-
-                elif tag == TIME:
-                    info["time"] = int(elem.get("file"))
-                    info["build_time"] = int(elem.get("build"))
-
-                elif tag == SIZE:
-                    info["size"] = int(elem.get("package"))
-                    if elem.get("installed"):
-                        info["installed_size"] = int(elem.get("installed"))
-
-                elif tag == CHECKSUM:
-                    info[elem.get("type")] = elem.text
-                    if elem.get("pkgid") == "YES":
-                        pkgid = elem.text
-
-                elif tag == LOCATION:
-                    info["location"] = elem.get("href")
-
-                elif tag == SOURCERPM:
-                    if elem.text:
-                        info["sourcerpm"] = elem.text
-
-                elif tag == GROUP:
-                    if elem.text:
-                        info["group"] = elem.text
-
-                elif tag == LICENSE:
-                    if elem.text:
-                        info["license"] = elem.text
-
-                elif tag == FILE:
-                    filedict[elem.text] = True
-
-                elif tag == ENTRY:
-                    ename = elem.get("name")
-                    if (not ename or
-                        ename[:7] in ("rpmlib(", "config(")):
-                        continue
-
-                    if "ver" in elem.keys():
-                        e = elem.get("epoch")
-                        v = elem.get("ver")
-                        r = elem.get("rel")
-                        eversion = v
-                        if e and e != "0":
-                            eversion = "%s:%s" % (e, eversion)
-                        if r:
-                            eversion = "%s-%s" % (eversion, r)
-                        if "flags" in elem.keys():
-                            erelation = COMPMAP.get(elem.get("flags"))
-                        else:
-                            erelation = None
+            pkg = self.buildPackage((RPMPackage, name, versionarch),
+                                    prvargs, reqargs, upgargs, cnfargs, recargs)
+            if writer:
+                pkg.loaders[self] = writer.write((name, versionarch, info))
+            else:
+                pkg.loaders[self] = info
+
+            # Store the provided files for future usage.
+            if filedict:
+                for filename in filedict:
+                    lst = self._fileprovides.get(filename)
+                    if not lst:
+                        self._fileprovides[filename] = [pkg]
                     else:
-                        eversion = None
-                        erelation = None
-
-                    lasttag = queue[-1].tag
-                    if lasttag == REQUIRES:
-                        if elem.get("pre") == "1":
-                            reqdict[(RPMPreRequires,
-                                     ename, erelation, eversion)] = True
-                        elif elem.get("hint") == "1" or elem.get("missingok") == "1":
-                            recdict[(RPMRequires,
-                                     ename, erelation, eversion)] = True
-                        else:
-                            reqdict[(RPMRequires,
-                                     ename, erelation, eversion)] = True
-
-                    elif lasttag == RECOMMENDS:
-                        recdict[(RPMRequires,
-                                 ename, erelation, eversion)] = True
-
-                    elif lasttag == PROVIDES:
-                        if ename[0] == "/":
-                            filedict[ename] = True
-                        else:
-                            if ename == name and checkver(eversion, version):
-                                eversion = "%s@%s" % (eversion, arch)
-                                Prv = RPMNameProvides
-                            else:
-                                Prv = RPMProvides
-                            prvdict[(Prv, ename.encode('utf-8'), eversion)] = True
-
-                    elif lasttag == OBSOLETES:
-                        tup = (RPMObsoletes, ename, erelation, eversion)
-                        upgdict[tup] = True
-                        cnfdict[tup] = True
-
-                    elif lasttag == CONFLICTS:
-                        cnfdict[(RPMConflicts,
-                                 ename, erelation, eversion)] = True
-                                    
-                elif elem.tag == PACKAGE:
-
-                    # Use all the information acquired to build the package.
-
-                    versionarch = "%s@%s" % (version, arch)
-
-                    upgdict[(RPMObsoletes,
-                             name, '<', versionarch)] = True
-
-                    reqargs = [x for x in reqdict
-                               if not ((x[2] is None or "=" in x[2]) and
-                                       (RPMProvides, x[1], x[3]) in prvdict or
-                                       system_provides.match(x[1], x[2], x[3]))]
-                    reqargs = collapse_libc_requires(reqargs)
-
-                    recargs = [x for x in recdict
-                               if not ((x[2] is None or "=" in x[2]) and
-                                       (RPMProvides, x[1], x[3]) in prvdict or
-                                       system_provides.match(x[1], x[2], x[3]))]
-
-                    prvargs = prvdict.keys()
-                    cnfargs = cnfdict.keys()
-                    upgargs = upgdict.keys()
-
-                    if disttag:
-                        distversion = "%s-%s" % (version, disttag)
-                        if distepoch:
-                            distversion += distepoch
-                        versionarch = "%s@%s" % (distversion, arch)
-
-                    pkg = self.buildPackage((RPMPackage, name, versionarch),
-                                            prvargs, reqargs, upgargs, cnfargs, recargs)
-                    pkg.loaders[self] = info
-
-                    # Store the provided files for future usage.
-                    if filedict:
-                        for filename in filedict:
-                            lst = self._fileprovides.get(filename)
-                            if not lst:
-                                self._fileprovides[filename] = [pkg]
-                            else:
-                                lst.append(pkg)
-
-                    if pkgid:
-                        self._pkgids[pkgid] = pkg
-
-                    # Reset all information.
-                    name = None
-                    version = None
-                    arch = None
-                    disttag = None
-                    distepoch = None
-                    pkgid = None
-                    reqdict.clear()
-                    recdict.clear()
-                    prvdict.clear()
-                    upgdict.clear()
-                    cnfdict.clear()
-                    filedict.clear()
-                    # Do not clear it. pkg.loaders has a reference.
-                    info = {}
-
-                    # Update progress
-                    offset = file.tell()
-                    div, mod = divmod(offset-lastoffset+mod, BYTESPERPKG)
-                    lastoffset = offset
-                    progress.add(div)
-                    progress.show()
+                        lst.append(pkg)
 
-                elem.clear()
+            if pkgid:
+                self._pkgids[pkgid] = pkg
+
+            # Update progress
+            offset = file.tell()
+            div, mod = divmod(offset-lastoffset+mod, BYTESPERPKG)
+            lastoffset = offset
+            progress.add(div)
+            progress.show()
 
         file.close()
 
     def loadFileProvides(self, fndict):
         bfp = self.buildFileProvides
         parsed = self._parsedflist
+        index = self.getPathIndex()
         for fn in fndict:
             if fn not in self._fileprovides:
-                if not parsed:
+                if index:
+                    pkgids = self._pkgids
+                    pkgs = [pkgids[x] for x in index.get(fn) if x in pkgids]
+                    self._fileprovides[fn] = pkgs or ()
+                elif not parsed:
                     self._parsedflist = parsed = True
                     self.parseFilesList(fndict)
                     if fn not in self._fileprovides:
@@ -417,7 +427,41 @@ class RPMMetaDataLoader(Loader):
             if pkgs:
                 for pkg in pkgs:
                     bfp(pkg, (RPMProvides, fn, None))
-
+        if index:
+            index.close()
+
+    def getPathIndexName(self):
+        return self._filelistsname+".idx"
+
+    def getPathIndex(self):
+        # The path index is built by buildPathIndex() when the channel
+        # is updated. Without it, or when it's older than the file
+        # list, the whole file list is parsed instead.
+        indexname = self.getPathIndexName()
+        try:
+            if (os.path.getmtime(indexname) >=
+                os.path.getmtime(self._filelistsname)):
+                return PathIndex(indexname)
+        except (OSError, IOError, Error):
+            pass
+        return None
+
+    def buildPathIndex(self):
+        # With more than one load job, the file list is split in chunks
+        # of whole packages, parsed and sorted in forked processes, and
+        # their runs of sorted paths are merged into the index.
+        filename = self.getPathIndexName()
+        file = Uncompressor().open(self._filelistsname)
+        try:
+            jobs = getLoadJobs()
+            if jobs < 2 or not hasattr(os, "fork"):
+                writePathIndex(filename, parseFileListPaths(file))
+            else:
+                tmpdir = os.path.dirname(filename) or "."
+                total, runs = sortFileListPaths(file, jobs, tmpdir)
+                writeSortedPathIndex(filename, total, runs)
+        finally:
+            file.close()
 
     def parseFilesList(self, fndict):
         FILE    = nstag(NS_FILELISTS, "file")
@@ -428,7 +472,7 @@ class RPMMetaDataLoader(Loader):
 
         pkg = None
         skip = None
-        file = open(self._filelistsname)
+        file = Uncompressor().open(self._filelistsname)
         for event, elem in cElementTree.iterparse(file, ("start", "end")):
             if event == "start":
                 if not skip and elem.tag == PACKAGE:
@@ -452,7 +496,7 @@ class RPMMetaDataLoader(Loader):
         file.close()
 
 def enablePsyco(psyco):
-    psyco.bind(RPMMetaDataLoader.load)
+    psyco.bind(RPMMetaDataLoader.loadPackages)
     psyco.bind(RPMMetaDataLoader.loadFileProvides)
     psyco.bind(RPMMetaDataLoader.parseFilesList)
 
@@ -0,0 +1,267 @@
+#
+# Copyright (c) 2005 Canonical
+# Copyright (c) 2004 Conectiva, Inc.
+#
+# Written by Gustavo Niemeyer <niemeyer@conectiva.com>
+#
+# This file is part of Smart Package Manager.
+#
+# Smart Package Manager is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as published
+# by the Free Software Foundation; either version 2 of the License, or (at
+# your option) any later version.
+#
+# Smart Package Manager is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Smart Package Manager; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+"""
+Parser for the primary.xml file of rpm-md repositories.
+"""
+from smart.backends.rpm.rpmver import checkver
+from smart.backends.rpm.base import *
+
+try:
+    from xml.etree import cElementTree
+except ImportError:
+    try:
+        import cElementTree
+    except ImportError:
+        from smart.util import cElementTree
+
+NS_COMMON    = "http://linux.duke.edu/metadata/common"
+NS_RPM       = "http://linux.duke.edu/metadata/rpm"
+
+def nstag(ns, tag):
+    return "{%s}%s" % (ns, tag)
+
+def parsePrimary(file):
+    """
+    Parse the primary.xml in file, yielding a tuple with
+
+        (name, version, arch, disttag, distepoch, pkgid, info,
+         reqdict, recdict, prvdict, upgdict, cnfdict, filedict)
+
+    for each rpm package in it. The dictionaries have as keys the
+    relation tuples given to Loader.buildPackage(), and filedict has
+    the provided file paths.
+    """
+    PACKAGE     = nstag(NS_COMMON, "package")
+    NAME        = nstag(NS_COMMON, "name")
+    ARCH        = nstag(NS_COMMON, "arch")
+    VERSION     = nstag(NS_COMMON, "version")
+    SUMMARY     = nstag(NS_COMMON, "summary")
+    DESCRIPTION = nstag(NS_COMMON, "description")
+    URL         = nstag(NS_COMMON, "url")
+    TIME        = nstag(NS_COMMON, "time")
+    SIZE        = nstag(NS_COMMON, "size")
+    LOCATION    = nstag(NS_COMMON, "location")
+    CHECKSUM    = nstag(NS_COMMON, "checksum")
+    FILE        = nstag(NS_COMMON, "file")
+    SOURCERPM   = nstag(NS_RPM, "sourcerpm")
+    GROUP       = nstag(NS_RPM, "group")
+    LICENSE     = nstag(NS_RPM, "license")
+    ENTRY       = nstag(NS_RPM, "entry")
+    REQUIRES    = nstag(NS_RPM, "requires")
+    RECOMMENDS  = nstag(NS_RPM, "recommends")
+    PROVIDES    = nstag(NS_RPM, "provides")
+    CONFLICTS   = nstag(NS_RPM, "conflicts")
+    OBSOLETES   = nstag(NS_RPM, "obsoletes")
+    DISTTAG     = nstag(NS_RPM, "disttag")
+    DISTEPOCH   = nstag(NS_RPM, "distepoch")
+
+    COMPMAP = { "EQ":"=", "LT":"<", "LE":"<=", "GT":">", "GE":">="}
+
+    # Prepare package information.
+    name = None
+    version = None
+    arch = None
+    disttag = None
+    distepoch = None
+    pkgid = None
+    info = {}
+    reqdict = {}
+    recdict = {}
+    prvdict = {}
+    upgdict = {}
+    cnfdict = {}
+    filedict = {}
+
+    # Prepare data useful for the iteration
+    skip = None
+    queue = []
+
+    for event, elem in cElementTree.iterparse(file, ("start", "end")):
+        tag = elem.tag
+
+        if event == "start":
+
+            if not skip and tag == PACKAGE:
+                if elem.get("type") != "rpm":
+                    skip = PACKAGE
+
+            queue.append(elem)
+
+        elif event == "end":
+
+            popped = queue.pop()
+            assert popped is elem
+
+            if skip:
+                if tag == skip:
+                    skip = None
+
+            elif tag == ARCH:
+                arch = elem.text
+
+            elif tag == NAME:
+                name = elem.text
+
+            elif tag == VERSION:
+                e = elem.get("epoch")
+                if e and e != "0":
+                    version = "%s:%s-%s" % \
+                              (e, elem.get("ver"), elem.get("rel"))
+                else:
+                    version = "%s-%s" % \
+                              (elem.get("ver"), elem.get("rel"))
+
+            elif tag == DISTTAG:
+                disttag = elem.text
+
+            elif tag == DISTEPOCH:
+                distepoch = elem.text
+
+            elif tag == SUMMARY:
+                if elem.text:
+                    info["summary"] = elem.text
+
+            elif tag == DESCRIPTION:
+                if elem.text:
+                    info["description"] = elem.text
+
+            elif tag == URL:
+                if elem.text:
+                    info["url"] = elem.text
+
+            elif tag == TIME:
+                info["time"] = int(elem.get("file"))
+                info["build_time"] = int(elem.get("build"))
+
+            elif tag == SIZE:
+                info["size"] = int(elem.get("package"))
+                if elem.get("installed"):
+                    info["installed_size"] = int(elem.get("installed"))
+
+            elif tag == CHECKSUM:
+                info[elem.get("type")] = elem.text
+                if elem.get("pkgid") == "YES":
+                    pkgid = elem.text
+
+            elif tag == LOCATION:
+                info["location"] = elem.get("href")
+
+            elif tag == SOURCERPM:
+                if elem.text:
+                    info["sourcerpm"] = elem.text
+
+            elif tag == GROUP:
+                if elem.text:
+                    info["group"] = elem.text
+
+            elif tag == LICENSE:
+                if elem.text:
+                    info["license"] = elem.text
+
+            elif tag == FILE:
+                filedict[elem.text] = True
+
+            elif tag == ENTRY:
+                ename = elem.get("name")
+                if (not ename or
+                    ename[:7] in ("rpmlib(", "config(")):
+                    continue
+
+                if "ver" in elem.keys():
+                    e = elem.get("epoch")
+                    v = elem.get("ver")
+                    r = elem.get("rel")
+                    eversion = v
+                    if e and e != "0":
+                        eversion = "%s:%s" % (e, eversion)
+                    if r:
+                        eversion = "%s-%s" % (eversion, r)
+                    if "flags" in elem.keys():
+                        erelation = COMPMAP.get(elem.get("flags"))
+                    else:
+                        erelation = None
+                else:
+                    eversion = None
+                    erelation = None
+
+                lasttag = queue[-1].tag
+                if lasttag == REQUIRES:
+                    if elem.get("pre") == "1":
+                        reqdict[(RPMPreRequires,
+                                 ename, erelation, eversion)] = True
+                    elif elem.get("hint") == "1" or elem.get("missingok") == "1":
+                        recdict[(RPMRequires,
+                                 ename, erelation, eversion)] = True
+                    else:
+                        reqdict[(RPMRequires,
+                                 ename, erelation, eversion)] = True
+
+                elif lasttag == RECOMMENDS:
+                    recdict[(RPMRequires,
+                             ename, erelation, eversion)] = True
+
+                elif lasttag == PROVIDES:
+                    if ename[0] == "/":
+                        filedict[ename] = True
+                    else:
+                        if ename == name and checkver(eversion, version):
+                            eversion = "%s@%s" % (eversion, arch)
+                            Prv = RPMNameProvides
+                        else:
+                            Prv = RPMProvides
+                        prvdict[(Prv, ename.encode('utf-8'), eversion)] = True
+
+                elif lasttag == OBSOLETES:
+                    tup = (RPMObsoletes, ename, erelation, eversion)
+                    upgdict[tup] = True
+                    cnfdict[tup] = True
+
+                elif lasttag == CONFLICTS:
+                    cnfdict[(RPMConflicts,
+                             ename, erelation, eversion)] = True
+
+            elif elem.tag == PACKAGE:
+
+                yield (name, version, arch, disttag, distepoch, pkgid, info,
+                       reqdict, recdict, prvdict, upgdict, cnfdict, filedict)
+
+                # Reset all information.
+                name = None
+                version = None
+                arch = None
+                disttag = None
+                distepoch = None
+                pkgid = None
+                info = {}
+                reqdict = {}
+                recdict = {}
+                prvdict = {}
+                upgdict = {}
+                cnfdict = {}
+                filedict = {}
+
+            elem.clear()
+
+from cprimary import *
+
+# vim:ts=4:sw=4:et
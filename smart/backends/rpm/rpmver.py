@@ -54,6 +54,20 @@ def checkdep(s1, rel, s2):
     else:
         return '>' in rel
 
+def checkdeps(depends, provides, anyprvversion=True):
+    if not depends.version:
+        return list(provides)
+    relation = depends.relation
+    version = splitarch(depends.version)[0]
+    result = []
+    for prv in provides:
+        if not prv.version:
+            if anyprvversion:
+                result.append(prv)
+        elif checkdep(splitarch(prv.version)[0], relation, version):
+            result.append(prv)
+    return result
+
 def vercmp(s1, s2):
     return vercmpparts(*(VERRE.match(s1).groups()+VERRE.match(s2).groups()))
 
@@ -124,6 +138,9 @@ def vercmppart(a, b):
     else:
         return 1
 
+def sortversions(versions):
+    versions.sort(vercmp)
+
 from crpmver import *
 
 # vim:ts=4:sw=4:et
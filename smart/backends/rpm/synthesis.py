@@ -27,6 +27,7 @@
 #
 from smart.backends.rpm.rpmver import splitarch, checkver
 from smart.cache import PackageInfo, Loader
+from smart.uncompress import Uncompressor
 from smart.backends.rpm.base import *
 try:
     from xml.etree import cElementTree        
@@ -124,7 +125,7 @@ class URPMISynthesisLoader(Loader):
         return filename
 	
     def getLoadSteps(self):
-        indexfile = open(self._filename)
+        indexfile = Uncompressor().open(self._filename)
         total = 0
         for line in indexfile:
             if line.startswith("@info@"):
@@ -186,7 +187,7 @@ class URPMISynthesisLoader(Loader):
         else:
             infoxml = None
 
-        for line in open(self._filename):
+        for line in Uncompressor().open(self._filename):
 
             element = line[1:-1].split("@")
             id = element.pop(0)
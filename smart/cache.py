@@ -19,10 +19,15 @@
 # along with Smart Package Manager; if not, write to the Free Software
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
-from smart.util.strtools import globdistance
+from smart.util.strtools import globdistance, GlobPattern
 from smart.const import BLOCKSIZE
+from smart.progress import Progress
 from smart import *
+import marshal
+import select
+import sys
 import os
+import gc
 
 class StateVersionError(Error): pass
 
@@ -335,6 +340,9 @@ class Depends(object):
     def matches(self, prv):
         return False
 
+    def getMatches(self, provides):
+        return [prv for prv in provides if self.matches(prv)]
+
     def __repr__(self):
         return str(self)
 
@@ -401,6 +409,20 @@ class Loader(object):
     def load(self):
         pass
 
+    def canParse(self):
+        return False
+
+    def parse(self, prog):
+        # Loaders returning True in canParse() split load() into
+        # parse(), an iterator over records which doesn't touch the
+        # cache, and loadRecords(), which builds packages out of them.
+        # parse() may then run in a forked process, so records must
+        # be marshallable (strings, numbers, None, tuples and lists).
+        return []
+
+    def loadRecords(self, records):
+        pass
+
     def unload(self):
         self.reset()
 
@@ -417,6 +439,7 @@ class Loader(object):
                 prv = cache._objmap.get(args)
                 if not prv:
                     prv = args[0](*args[1:])
+                    poolRelation(prv)
                     cache._objmap[args] = prv
                     cache._provides.append(prv)
                 relpkgs.append(prv.packages)
@@ -428,6 +451,7 @@ class Loader(object):
                 req = cache._objmap.get(args)
                 if not req:
                     req = args[0](*args[1:])
+                    poolRelation(req)
                     cache._objmap[args] = req
                     cache._requires.append(req)
                 relpkgs.append(req.packages)
@@ -439,6 +463,7 @@ class Loader(object):
                 rec = cache._objmap.get(args)
                 if not rec:
                     rec = args[0](*args[1:])
+                    poolRelation(rec)
                     cache._objmap[args] = rec
                     cache._recommends.append(rec)
                 relpkgs.append(rec.packages)
@@ -450,6 +475,7 @@ class Loader(object):
                 upg = cache._objmap.get(args)
                 if not upg:
                     upg = args[0](*args[1:])
+                    poolRelation(upg)
                     cache._objmap[args] = upg
                     cache._upgrades.append(upg)
                 relpkgs.append(upg.packages)
@@ -461,6 +487,7 @@ class Loader(object):
                 cnf = cache._objmap.get(args)
                 if not cnf:
                     cnf = args[0](*args[1:])
+                    poolRelation(cnf)
                     cache._objmap[args] = cnf
                     cache._conflicts.append(cnf)
                 relpkgs.append(cnf.packages)
@@ -480,6 +507,8 @@ class Loader(object):
             cache._objmap[pkgargs] = [pkg]
 
         if not found:
+            pkg.name = poolString(pkg.name)
+            pkg.version = poolString(pkg.version)
             cache._packages.append(pkg)
             for pkgs in relpkgs:
                 pkgs.append(pkg)
@@ -494,6 +523,7 @@ class Loader(object):
         prv = cache._objmap.get(prvargs)
         if not prv:
             prv = prvargs[0](*prvargs[1:])
+            poolRelation(prv)
             cache._objmap[prvargs] = prv
             cache._provides.append(prv)
         elif prv in pkg.provides:
@@ -514,34 +544,31 @@ class Loader(object):
         # should use the fastest possible method. The one here is
         # generic, and should be replaced if possible.
         ic = searcher.ignorecase
+        urls = [GlobPattern(url, cutoff, ic) for url, cutoff in searcher.url]
+        paths = [GlobPattern(path, cutoff, ic)
+                 for path, cutoff in searcher.path]
         for pkg in self._packages:
             info = self.getInfo(pkg)
             ratio = 0
-            if searcher.url:
-                for url, cutoff in searcher.url:
-                    for refurl in info.getReferenceURLs():
-                        _, newratio = globdistance(url, refurl, cutoff, ic)
+            if urls:
+                refurls = info.getReferenceURLs()
+                for url in urls:
+                    for _, newratio in url.match_many(refurls):
                         if newratio > ratio:
                             ratio = newratio
-                            if ratio == 1:
-                                break
-                    else:
-                        continue
-                    break
+                    if ratio == 1:
+                        break
             if ratio == 1:
                 searcher.addResult(pkg, ratio)
                 continue
-            if searcher.path:
-                for spath, cutoff in searcher.path:
-                    for path in info.getPathList():
-                        _, newratio = globdistance(spath, path, cutoff, ic)
+            if paths:
+                pathlist = info.getPathList()
+                for path in paths:
+                    for _, newratio in path.match_many(pathlist):
                         if newratio > ratio:
                             ratio = newratio
-                            if ratio == 1:
-                                break
-                    else:
-                        continue
-                    break
+                    if ratio == 1:
+                        break
             if ratio == 1:
                 searcher.addResult(pkg, ratio)
                 continue
@@ -582,6 +609,10 @@ class Loader(object):
         self.__dict__.update(state)
         del self.__stateversion__
 
+# Attributes of provides linked to requires, recommends, upgrades and
+# conflicts by Cache.linkDeps().
+LINKATTRS = ("requiredby", "recommendedby", "upgradedby", "conflictedby")
+
 class Cache(object):
 
     def __init__(self):
@@ -593,8 +624,12 @@ class Cache(object):
         self._upgrades = []
         self._conflicts = []
         self._objmap = {}
+        self._loaded = {}
+        self._compacted = False
+        self._searchindex = None
 
     def reset(self):
+        self._thaw()
         for prv in self._provides:
             del prv.packages[:]
             if prv.requiredby:
@@ -628,6 +663,7 @@ class Cache(object):
         del self._upgrades[:]
         del self._conflicts[:]
         self._objmap.clear()
+        self._loaded.clear()
 
     def addLoader(self, loader):
         if loader:
@@ -639,19 +675,108 @@ class Cache(object):
         if loader:
             if loader in self._loaders:
                 self._loaders.remove(loader)
+                if loader in self._loaded:
+                    self._retract(loader)
                 loader.setCache(None)
                 loader.unload()
 
+    def _retract(self, loader):
+        # Take out of the cache the packages which were only available
+        # in the given loader, together with the relations which are
+        # left without packages, and the dependency links they had.
+        self._thaw()
+        del self._loaded[loader]
+        pkgs = dict.fromkeys(loader._packages, False)
+        kept = {}
+        for other in self._loaded:
+            installed = other._installed
+            for pkg in other._packages:
+                if pkg in pkgs:
+                    kept[pkg] = kept.get(pkg) or installed
+        removed = {}
+        for pkg in pkgs:
+            if pkg in kept:
+                pkg.installed = kept[pkg]
+                if loader in pkg.loaders:
+                    del pkg.loaders[loader]
+            else:
+                removed[pkg] = True
+        if not removed:
+            return
+        touched = {}
+        for pkg in removed:
+            for prv in pkg.provides:
+                touched[prv] = True
+            for req in pkg.requires:
+                touched[req] = True
+            for rec in pkg.recommends:
+                touched[rec] = True
+            for upg in pkg.upgrades:
+                touched[upg] = True
+            for cnf in pkg.conflicts:
+                touched[cnf] = True
+        dead = {}
+        for rel in touched:
+            rel.packages[:] = [x for x in rel.packages if x not in removed]
+            if not rel.packages:
+                dead[rel] = True
+        self._packages[:] = [x for x in self._packages if x not in removed]
+        if not dead:
+            return
+        fixprv = {}
+        fixdep = {}
+        for prv in self._provides:
+            if prv in dead:
+                for dep in (prv.requiredby, prv.recommendedby,
+                            prv.upgradedby, prv.conflictedby):
+                    fixdep.update(dict.fromkeys(dep, True))
+        for lst in (self._requires, self._recommends,
+                    self._upgrades, self._conflicts):
+            for dep in lst:
+                if dep in dead:
+                    fixprv.update(dict.fromkeys(dep.providedby, True))
+            lst[:] = [x for x in lst if x not in dead]
+        self._provides[:] = [x for x in self._provides if x not in dead]
+        for dep in fixdep:
+            if dep not in dead:
+                dep.providedby[:] = [x for x in dep.providedby
+                                     if x not in dead]
+        for prv in fixprv:
+            if prv not in dead:
+                for lst in (prv.requiredby, prv.recommendedby,
+                            prv.upgradedby, prv.conflictedby):
+                    if lst:
+                        lst[:] = [x for x in lst if x not in dead]
+
     def _reload(self):
-        packages = {}
-        provides = {}
-        requires = {}
-        recommends = {}
-        upgrades = {}
-        conflicts = {}
-        objmap = self._objmap
         loaders = dict.fromkeys(self._loaders, True)
-        for loader in loaders:
+        for loader in self._loaded.keys():
+            if loader not in loaders:
+                self._retract(loader)
+        if not self._loaded:
+            self.reset()
+        elif not [x for x in self._loaders if x not in self._loaded]:
+            return
+        self._thaw()
+        packages = dict.fromkeys(self._packages, True)
+        provides = dict.fromkeys(self._provides, True)
+        requires = dict.fromkeys(self._requires, True)
+        recommends = dict.fromkeys(self._recommends, True)
+        upgrades = dict.fromkeys(self._upgrades, True)
+        conflicts = dict.fromkeys(self._conflicts, True)
+        objmap = self._objmap
+        if self._loaded:
+            # Packages built from now on must be merged with the ones
+            # already available.
+            for pkg in self._packages:
+                objmap.setdefault(pkg.getInitArgs(), []).append(pkg)
+            for lst in (self._provides, self._requires, self._recommends,
+                        self._upgrades, self._conflicts):
+                for rel in lst:
+                    objmap[rel.getInitArgs()] = rel
+        for loader in self._loaders:
+            if loader in self._loaded:
+                continue
             for pkg in loader._packages:
                 if pkg in packages:
                     pkg.installed |= loader._installed
@@ -695,6 +820,27 @@ class Cache(object):
         self._conflicts[:] = conflicts.keys()
 
     def load(self):
+        # Loading creates lots of objects which are not garbage, so
+        # the cyclic garbage collector is paused meanwhile, instead
+        # of going over the growing cache again and again.
+        enabled = gc.isenabled()
+        gc.disable()
+        try:
+            self._load()
+        finally:
+            if enabled:
+                gc.enable()
+
+    def _load(self):
+        # Relations already linked are only linked again against
+        # the ones introduced by new loaders.
+        linked = None
+        if self._loaded:
+            linked = [dict.fromkeys(lst, True)
+                      for lst in (self._provides, self._requires,
+                                  self._recommends, self._upgrades,
+                                  self._conflicts)]
+        index = self._searchindex
         self._reload()
         prog = iface.getProgress(self)
         prog.start()
@@ -702,18 +848,31 @@ class Cache(object):
         prog.set(0, 1)
         prog.show()
         total = 1
-        for loader in self._loaders:
-            if not loader._packages:
-                total += loader.getLoadSteps()
+        loaders = [x for x in self._loaders
+                   if not x._packages and x not in self._loaded]
+        for loader in loaders:
+            total += loader.getLoadSteps()
         prog.set(0, total)
         prog.show()
-        for loader in self._loaders:
-            if not loader._packages:
+        records = parseLoaders(loaders, prog)
+        for loader in loaders:
+            if loader in records:
+                loader.loadRecords(records[loader])
+            else:
                 loader.load()
-        self.loadFileProvides()
+        self.loadFileProvides(linked)
         hooks.call("cache-loaded-pre-link", self)
         self._objmap.clear()
-        self.linkDeps()
+        self.linkDeps(linked)
+        for loader in self._loaders:
+            self._loaded[loader] = True
+        # A cache from the cache file is rebuilt out of the same
+        # packages, so its search index is still good for them.
+        if (index and self._searchindex is not index and
+            index.covers(self._packages, self._provides)):
+            self._searchindex = index
+        if sysconf.get("cache-compact", False):
+            self.compact()
         prog.setDone()
         prog.show()
         prog.stop()
@@ -724,97 +883,125 @@ class Cache(object):
         for loader in self._loaders:
             loader.unload()
 
-    def loadFileProvides(self):
+    def loadFileProvides(self, linked=None):
         fndict = {}
+        newfndict = {}
         for req in self._requires:
             name = req.name
             if name[0] == "/":
                 fndict[name] = name
+                if linked and req not in linked[1]:
+                    newfndict[name] = name
         for loader in self._loaders:
-            loader.loadFileProvides(fndict)
-
-    def linkDeps(self):
-        reqnames = {}
-        for req in self._requires:
-            for name in req.getMatchNames():
-                lst = reqnames.get(name)
-                if lst:
-                    lst.append(req)
-                else:
-                    reqnames[name] = [req]
-        recnames = {}
-        for rec in self._recommends:
-            for name in rec.getMatchNames():
-                lst = recnames.get(name)
-                if lst:
-                    lst.append(rec)
-                else:
-                    recnames[name] = [rec]
-        upgnames = {}
-        for upg in self._upgrades:
-            for name in upg.getMatchNames():
-                lst = upgnames.get(name)
+            if loader not in self._loaded:
+                loader.loadFileProvides(fndict)
+            elif newfndict:
+                loader.loadFileProvides(newfndict)
+
+    def linkDeps(self, linked=None):
+        # When linked is given, it holds the provides, requires,
+        # recommends, upgrades and conflicts which were already
+        # linked, and only pairs involving a new relation are checked.
+        # Provides are grouped by name, so that each dependency
+        # filters all the candidates with the same name at once.
+        prvnames = {}
+        newprvnames = {}
+        for prv in self._provides:
+            lst = prvnames.get(prv.name)
+            if lst:
+                lst.append(prv)
+            else:
+                prvnames[prv.name] = [prv]
+            if linked and prv not in linked[0]:
+                lst = newprvnames.get(prv.name)
                 if lst:
-                    lst.append(upg)
+                    lst.append(prv)
                 else:
-                    upgnames[name] = [upg]
-        cnfnames = {}
-        for cnf in self._conflicts:
-            for name in cnf.getMatchNames():
-                lst = cnfnames.get(name)
-                if lst:
-                    lst.append(cnf)
+                    newprvnames[prv.name] = [prv]
+        for deps, attr, deplinked in ((self._requires, "requiredby",
+                                       linked and linked[1]),
+                                      (self._recommends, "recommendedby",
+                                       linked and linked[2]),
+                                      (self._upgrades, "upgradedby",
+                                       linked and linked[3]),
+                                      (self._conflicts, "conflictedby",
+                                       linked and linked[4])):
+            for dep in deps:
+                if linked and dep in deplinked:
+                    names = newprvnames
                 else:
-                    cnfnames[name] = [cnf]
-        for prv in self._provides:
-            lst = reqnames.get(prv.name)
-            if lst:
-                for req in lst:
-                    if req.matches(prv):
-                        if req.providedby:
-                            req.providedby.append(prv)
-                        else:
-                            req.providedby = [prv]
-                        if prv.requiredby:
-                            prv.requiredby.append(req)
-                        else:
-                            prv.requiredby = [req]
-            lst = recnames.get(prv.name)
-            if lst:
-                for rec in lst:
-                    if rec.matches(prv):
-                        if rec.providedby:
-                            rec.providedby.append(prv)
-                        else:
-                            rec.providedby = [prv]
-                        if prv.recommendedby:
-                            prv.recommendedby.append(rec)
-                        else:
-                            prv.recommendedby = [rec]
-            lst = upgnames.get(prv.name)
-            if lst:
-                for upg in lst:
-                    if upg.matches(prv):
-                        if upg.providedby:
-                            upg.providedby.append(prv)
-                        else:
-                            upg.providedby = [prv]
-                        if prv.upgradedby:
-                            prv.upgradedby.append(upg)
-                        else:
-                            prv.upgradedby = [upg]
-            lst = cnfnames.get(prv.name)
-            if lst:
-                for cnf in lst:
-                    if cnf.matches(prv):
-                        if cnf.providedby:
-                            cnf.providedby.append(prv)
+                    names = prvnames
+                for name in dep.getMatchNames():
+                    lst = names.get(name)
+                    if not lst:
+                        continue
+                    for prv in dep.getMatches(lst):
+                        if dep.providedby:
+                            dep.providedby.append(prv)
                         else:
-                            cnf.providedby = [prv]
-                        if prv.conflictedby:
-                            prv.conflictedby.append(cnf)
+                            dep.providedby = [prv]
+                        by = getattr(prv, attr)
+                        if by:
+                            by.append(dep)
                         else:
-                            prv.conflictedby = [cnf]
+                            setattr(prv, attr, [dep])
+
+    def compact(self):
+        # Relation lists don't change until the next reload, so they
+        # are turned into tuples, which take less memory. They are
+        # turned back into lists by _thaw() before being changed.
+        if self._compacted:
+            return
+        for pkg in self._packages:
+            for prv in pkg.provides:
+                if type(prv.packages) is list:
+                    prv.packages = tuple(prv.packages)
+                    prv.requiredby = tuple(prv.requiredby)
+                    prv.recommendedby = tuple(prv.recommendedby)
+                    prv.upgradedby = tuple(prv.upgradedby)
+                    prv.conflictedby = tuple(prv.conflictedby)
+            for lst in (pkg.requires, pkg.recommends,
+                        pkg.upgrades, pkg.conflicts):
+                for dep in lst:
+                    if type(dep.packages) is list:
+                        dep.packages = tuple(dep.packages)
+                        dep.providedby = tuple(dep.providedby)
+            pkg.provides = tuple(pkg.provides)
+            pkg.requires = tuple(pkg.requires)
+            pkg.recommends = tuple(pkg.recommends)
+            pkg.upgrades = tuple(pkg.upgrades)
+            pkg.conflicts = tuple(pkg.conflicts)
+        self._compacted = True
+
+    def _thaw(self):
+        # The search index only knows about the packages it was
+        # built for.
+        self._searchindex = None
+        if not self._compacted:
+            return
+        loaders = self._loaders + [x for x in self._loaded
+                                   if x not in self._loaders]
+        for lst in [self._packages] + [x._packages for x in loaders]:
+            for pkg in lst:
+                for prv in pkg.provides:
+                    if type(prv.packages) is tuple:
+                        prv.packages = list(prv.packages)
+                        prv.requiredby = list(prv.requiredby) or ()
+                        prv.recommendedby = list(prv.recommendedby) or ()
+                        prv.upgradedby = list(prv.upgradedby) or ()
+                        prv.conflictedby = list(prv.conflictedby) or ()
+                for deps in (pkg.requires, pkg.recommends,
+                             pkg.upgrades, pkg.conflicts):
+                    for dep in deps:
+                        if type(dep.packages) is tuple:
+                            dep.packages = list(dep.packages)
+                            dep.providedby = list(dep.providedby) or ()
+                pkg.provides = list(pkg.provides)
+                pkg.requires = list(pkg.requires)
+                pkg.recommends = list(pkg.recommends)
+                pkg.upgrades = list(pkg.upgrades)
+                pkg.conflicts = list(pkg.conflicts)
+        self._compacted = False
 
     def getPackages(self, name=None):
         if not name:
@@ -852,12 +1039,22 @@ class Cache(object):
         else:
             return [x for x in self._conflicts if x.name == name]
 
+    def setSearchIndex(self, index):
+        self._searchindex = index
+
     def search(self, searcher):
+        index = self._searchindex
         if searcher.nameversion:
-            for pkg in self._packages:
+            packages = index and index.getPackages(searcher)
+            if packages is None:
+                packages = self._packages
+            for pkg in packages:
                 pkg.search(searcher)
         if searcher.provides:
-            for prv in self._provides:
+            provides = index and index.getProvides(searcher)
+            if provides is None:
+                provides = self._provides
+            for prv in provides:
                 prv.search(searcher)
         if searcher.requires:
             for prv in searcher.requires:
@@ -887,6 +1084,29 @@ class Cache(object):
             for loader in self._loaders:
                 loader.search(searcher)
 
+    def _getLinks(self):
+        # Pairs of relations and what they're linked to by linkDeps(),
+        # in providedby, requiredby, recommendedby, upgradedby and
+        # conflictedby order.
+        providedby = {}
+        for lst in (self._requires, self._recommends,
+                    self._upgrades, self._conflicts):
+            for dep in lst:
+                if dep.providedby:
+                    providedby[dep] = list(dep.providedby)
+        links = [providedby.items()]
+        for attr in LINKATTRS:
+            links.append([(prv, list(getattr(prv, attr)))
+                          for prv in self._provides if getattr(prv, attr)])
+        return links
+
+    def _setLinks(self, links):
+        for dep, prvs in links[0]:
+            dep.providedby = list(prvs)
+        for attr, lst in zip(LINKATTRS, links[1:]):
+            for prv, deps in lst:
+                setattr(prv, attr, list(deps))
+
     __stateversion__ = 1
 
     def __getstate__(self):
@@ -894,6 +1114,10 @@ class Cache(object):
         state["__stateversion__"] = self.__stateversion__
         state["_loaders"] = self._loaders
         state["_packages"] = self._packages
+        # Loaders already linked are saved with the links, so that
+        # loading again only links the relations of new loaders.
+        state["_loaded"] = self._loaded.keys()
+        state["_links"] = self._getLinks()
         return state
 
     def __setstate__(self, state):
@@ -928,6 +1152,125 @@ class Cache(object):
         self._upgrades = upgrades.keys()
         self._conflicts = conflicts.keys()
         self._objmap = {}
+        self._loaded = {}
+        self._searchindex = None
+        # The links may also have been restored by the caller,
+        # as smart.cachefile does.
+        if "_links" in state:
+            self._setLinks(state["_links"])
+        if "_loaded" in state:
+            self._loaded = dict.fromkeys(state["_loaded"], True)
+        # Packages were compacted when saved if their relations are
+        # in tuples.
+        self._compacted = bool(self._packages and
+                               type(self._packages[0].provides) is tuple)
+
+def getLoadJobs():
+    jobs = sysconf.get("load-jobs")
+    if jobs is None:
+        try:
+            jobs = os.sysconf("SC_NPROCESSORS_ONLN")
+        except (AttributeError, ValueError, OSError):
+            jobs = 1
+    return jobs
+
+def parseLoaders(loaders, prog):
+    """
+    Run parse() for the given loaders in forked processes, up to
+    the number of jobs set in the "load-jobs" option (by default,
+    the number of processors), and return a dictionary mapping each
+    of them to the list of records parsed. Records are marshalled
+    back, which is much cheaper than pickling them. Loaders which can't
+    parse, or which failed to, are left out and must be loaded as
+    usual.
+    """
+    result = {}
+    loaders = [x for x in loaders if x.canParse()]
+    jobs = getLoadJobs()
+    if jobs < 2 or len(loaders) < 2 or not hasattr(os, "fork"):
+        return result
+    running = {}
+    while loaders or running:
+        while loaders and len(running) < jobs:
+            loader = loaders.pop(0)
+            rfd, wfd = os.pipe()
+            pid = os.fork()
+            if not pid:
+                status = 1
+                try:
+                    try:
+                        os.close(rfd)
+                        data = marshal.dumps(list(loader.parse(Progress())))
+                        offset = 0
+                        while offset < len(data):
+                            offset += os.write(wfd, buffer(data, offset))
+                        status = 0
+                    except:
+                        pass
+                finally:
+                    os._exit(status)
+            os.close(wfd)
+            running[rfd] = (pid, loader, [])
+        for fd in select.select(running.keys(), [], [])[0]:
+            data = os.read(fd, 65536)
+            if data:
+                running[fd][2].append(data)
+                continue
+            os.close(fd)
+            pid, loader, chunks = running.pop(fd)
+            if os.waitpid(pid, 0)[1] == 0:
+                result[loader] = marshal.loads("".join(chunks))
+                prog.add(loader.getLoadSteps())
+                prog.show()
+            else:
+                iface.debug(_("Failed parsing %s in a separate process")
+                            % loader)
+    return result
+
+# Names, versions, relations and paths kept by the cache are interned,
+# so that the same string coming from different packages and channels
+# is stored once.
+def poolString(s):
+    if type(s) is str:
+        return intern(s)
+    return s
+
+def poolRelation(rel):
+    rel.name = poolString(rel.name)
+    rel.version = poolString(rel.version)
+    if isinstance(rel, Depends):
+        rel.relation = poolString(rel.relation)
+
+def getStringPoolStats(cache):
+    """
+    Return how many of the names, versions and relations in the cache
+    are shared with an earlier one, rather than being a copy of their
+    own, and the memory those copies would take. They may have been
+    pooled when built, or shared by the cache file.
+    """
+    seen = {}
+    strings = saved = 0
+    for lst in (cache.getPackages(), cache.getProvides(),
+                cache.getRequires(), cache.getRecommends(),
+                cache.getUpgrades(), cache.getConflicts()):
+        for obj in lst:
+            values = [obj.name, obj.version]
+            if isinstance(obj, Depends):
+                values.append(obj.relation)
+            for s in values:
+                if type(s) is str:
+                    if id(s) in seen:
+                        strings += 1
+                        saved += sys.getsizeof(s)
+                    else:
+                        seen[id(s)] = s
+    return {"strings": strings, "saved": saved}
+
+def registerMatcher(depcls, prvcls, checkdep, anyprvversion, splitarch):
+    # With ccache, relations of depcls are checked against provides
+    # in C during linkDeps(), using the given C checkdep function,
+    # instead of calling depcls.matches(). Here matches() is used.
+    pass
 
 from ccache import *
 
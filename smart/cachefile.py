@@ -0,0 +1,353 @@
+#
+# This file is part of Smart Package Manager.
+#
+# Smart Package Manager is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as published
+# by the Free Software Foundation; either version 2 of the License, or (at
+# your option) any later version.
+#
+# Smart Package Manager is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Smart Package Manager; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+"""
+On-disk cache format.
+
+The package graph (packages and their relations) is the bulk of the
+saved state, and pickling it object by object makes loading the cache
+dominate the startup time. This module stores it as flat tables
+instead:
+
+  - a string table with every name, version and relation, stored once;
+  - a relation table (class, argument string ids);
+  - a package table (class, name, version, flags, priority);
+  - per package relation counts and the relation ids themselves, in
+    provides, requires, recommends, upgrades, conflicts order;
+  - the links between relations made by Cache.linkDeps(), so that
+    they don't have to be computed again when loading;
+  - trigram indexes of the package and provides names, used to speed
+    up searching (see smart.searcher).
+
+Everything else (loaders, channels, per package loader information,
+the rest of the cache state) is pickled as usual, with packages and relations replaced by their
+index in the tables above. The file is mapped in memory when loaded,
+and the tables are handed to ccache to build the objects in bulk.
+"""
+from smart.cache import StateVersionError, Package, Provides, Depends
+from smart.cache import Cache, LINKATTRS
+from smart.searcher import SearchIndex, dumpGramIndex
+from smart import *
+from cStringIO import StringIO
+import cPickle
+import struct
+import array
+import mmap
+import os
+
+MAGIC = "SMARTCACHE\0\0"
+
+FORMATVERSION = 4
+
+BYTEORDER = 0x01020304
+
+# Section indexes in the header.
+(STRINGS, CLASSES, RELATIONS, PACKAGES, COUNTS,
+ RELIDS, LINKS, PKGGRAMS, PRVGRAMS, STATE) = range(10)
+
+SECTIONS = 10
+
+HEADER = "=%dsIIII%dQ" % (len(MAGIC), SECTIONS*2)
+
+# Package flags.
+INSTALLED = 1
+ESSENTIAL = 2
+ISLIST = 4 # Shifted by the relation kind.
+
+RELKINDS = ("provides", "requires", "recommends", "upgrades", "conflicts")
+
+NONE = -1
+
+def _intarray(values=()):
+    a = array.array("i")
+    if values:
+        a.extend(values)
+    return a
+
+def _getSearchObjects(cache, relations):
+    # The provides are taken in relation table order, which is the
+    # same when loading, unlike the order of cache._provides.
+    provides = {}
+    for pkg in cache._packages:
+        for prv in pkg.provides:
+            provides[prv] = True
+    return cache._packages, [x for x in relations if x in provides]
+
+def dumpCache(state, filename):
+    cache = state[1]
+
+    # Collect the package graph.
+    packages = []
+    pkgindex = {}
+    for lst in [loader._packages for loader in cache._loaders] + \
+               [cache._packages]:
+        for pkg in lst:
+            if pkg not in pkgindex:
+                pkgindex[pkg] = len(packages)
+                packages.append(pkg)
+
+    relations = []
+    relindex = {}
+    strings = []
+    strindex = {}
+    classes = []
+    clsindex = {}
+    extras = []
+
+    def getstr(s):
+        if s is None:
+            return NONE
+        id = strindex.get(s)
+        if id is None:
+            id = strindex[s] = len(strings)
+            strings.append(s)
+        return id
+
+    def getcls(cls):
+        id = clsindex.get(cls)
+        if id is None:
+            id = clsindex[cls] = len(classes)
+            classes.append(cls)
+        return id
+
+    relbuf = _intarray()
+    pkgbuf = _intarray()
+    cntbuf = _intarray()
+    idsbuf = _intarray()
+
+    for pkg in packages:
+        flags = 0
+        if pkg.installed:
+            flags |= INSTALLED
+        if pkg.essential:
+            flags |= ESSENTIAL
+        for kind in range(len(RELKINDS)):
+            lst = getattr(pkg, RELKINDS[kind])
+            if type(lst) is list:
+                flags |= ISLIST<<kind
+            cntbuf.append(len(lst))
+            for rel in lst:
+                id = relindex.get(rel)
+                if id is None:
+                    id = relindex[rel] = len(relations)
+                    relations.append(rel)
+                    cls, args = rel.__reduce__()[:2]
+                    if (len(args) <= 3 and
+                        [x for x in args
+                         if x is None or type(x) is str] == list(args)):
+                        relbuf.extend([getcls(cls), len(args)] +
+                                      [getstr(x) for x in args] +
+                                      [NONE]*(3-len(args)))
+                    else:
+                        relbuf.extend([NONE]*5)
+                        extras.append((id, cls, args))
+                idsbuf.append(id)
+        pkgbuf.extend([getcls(pkg.__class__),
+                       getstr(pkg.name),
+                       getstr(pkg.version),
+                       flags,
+                       pkg.priority])
+
+    # The links are stored as, for each attribute in turn, the number
+    # of relations with links, and for each one its id, the number of
+    # links and their ids.
+    cachestate = cache.__getstate__()
+    linkbuf = _intarray()
+    try:
+        for pairs in cachestate.pop("_links"):
+            linkbuf.append(len(pairs))
+            for rel, linked in pairs:
+                linkbuf.extend([relindex[rel], len(linked)])
+                linkbuf.extend([relindex[x] for x in linked])
+    except KeyError:
+        # Linked to a relation of no package, so everything is
+        # linked again when loading.
+        linkbuf = _intarray([0]*(len(LINKATTRS)+1))
+        cachestate["_loaded"] = []
+
+    # The cache itself is rebuilt out of the tables and cachestate.
+    npackages = len(packages)
+    objindex = pkgindex
+    for rel in relindex:
+        objindex[rel] = relindex[rel]+npackages
+    objindex[cache] = npackages+len(relations)
+
+    def persistent_id(obj, objindex=objindex,
+                      types=(Package, Provides, Depends, Cache)):
+        if isinstance(obj, types):
+            return objindex.get(obj)
+        return None
+
+    pkgloaders = [pkg.loaders for pkg in packages]
+
+    sections = [None]*SECTIONS
+    sections[STRINGS] = "\0".join(strings)
+    sections[CLASSES] = cPickle.dumps((classes, extras, cache.__class__), 2)
+    sections[RELATIONS] = relbuf.tostring()
+    sections[PACKAGES] = pkgbuf.tostring()
+    sections[COUNTS] = cntbuf.tostring()
+    sections[RELIDS] = idsbuf.tostring()
+    sections[LINKS] = linkbuf.tostring()
+    if sysconf.get("search-index", True):
+        packages, provides = _getSearchObjects(cache, relations)
+        sections[PKGGRAMS] = dumpGramIndex(packages)
+        sections[PRVGRAMS] = dumpGramIndex(provides)
+    else:
+        sections[PKGGRAMS] = sections[PRVGRAMS] = ""
+
+    file = open(filename, "wb")
+    try:
+        file.write("\0"*struct.calcsize(HEADER))
+        offsets = []
+        for i in range(SECTIONS):
+            data = sections[i]
+            if data is None:
+                continue
+            offsets.append((file.tell(), len(data)))
+            file.write(data)
+            sections[i] = None
+
+        # The pickled state goes last, directly into the file.
+        offset = file.tell()
+        pickler = cPickle.Pickler(file, 2)
+        pickler.inst_persistent_id = persistent_id
+        pickler.dump((state, pkgloaders, cachestate))
+        offsets.append((offset, file.tell()-offset))
+
+        header = [MAGIC, FORMATVERSION, state[0], BYTEORDER,
+                  array.array("i").itemsize]
+        for offset, length in offsets:
+            header.extend([offset, length])
+        file.seek(0)
+        file.write(struct.pack(HEADER, *header))
+    finally:
+        file.close()
+
+def loadCache(filename, stateversion):
+    file = open(filename, "rb")
+    try:
+        size = os.fstat(file.fileno()).st_size
+        if size < struct.calcsize(HEADER):
+            raise StateVersionError
+        map = mmap.mmap(file.fileno(), size, access=mmap.ACCESS_READ)
+    finally:
+        file.close()
+    try:
+        header = struct.unpack(HEADER, map[:struct.calcsize(HEADER)])
+        if (header[0] != MAGIC or
+            header[1] != FORMATVERSION or
+            header[2] != stateversion or
+            header[3] != BYTEORDER or
+            header[4] != array.array("i").itemsize):
+            raise StateVersionError
+        sections = []
+        for i in range(SECTIONS):
+            offset, length = header[5+i*2:7+i*2]
+            if offset+length > size:
+                raise StateVersionError
+            sections.append(buffer(map, offset, length))
+
+        classes, extras, cachecls = cPickle.loads(str(sections[CLASSES]))
+        strings = str(sections[STRINGS]).split("\0")
+
+        relations = buildRelations(classes, strings, sections[RELATIONS])
+        for id, cls, args in extras:
+            relations[id] = cls(*args)
+        packages = buildPackages(classes, strings, relations,
+                                 sections[PACKAGES], sections[COUNTS],
+                                 sections[RELIDS])
+
+        cache = cachecls.__new__(cachecls)
+        unpickler = cPickle.Unpickler(StringIO(str(sections[STATE])))
+        unpickler.persistent_load = (packages+relations+[cache]).__getitem__
+        state, pkgloaders, cachestate = unpickler.load()
+        for i in range(len(packages)):
+            packages[i].loaders = pkgloaders[i]
+        buildLinks(relations, sections[LINKS])
+        cache.__setstate__(cachestate)
+
+        if len(sections[PKGGRAMS]):
+            packages, provides = _getSearchObjects(cache, relations)
+            cache.setSearchIndex(SearchIndex(packages,
+                                             str(sections[PKGGRAMS]),
+                                             provides,
+                                             str(sections[PRVGRAMS])))
+    finally:
+        map.close()
+
+    return state
+
+def buildRelations(classes, strings, relbuf):
+    relbuf = array.array("i", str(relbuf))
+    relations = []
+    for i in range(0, len(relbuf), 5):
+        if relbuf[i] == NONE:
+            # Built by the caller.
+            relations.append(None)
+            continue
+        args = []
+        for x in relbuf[i+2:i+2+relbuf[i+1]]:
+            if x == NONE:
+                args.append(None)
+            else:
+                args.append(strings[x])
+        relations.append(classes[relbuf[i]](*args))
+    return relations
+
+def buildPackages(classes, strings, relations, pkgbuf, cntbuf, idsbuf):
+    pkgbuf = array.array("i", str(pkgbuf))
+    cntbuf = array.array("i", str(cntbuf))
+    idsbuf = array.array("i", str(idsbuf))
+    packages = []
+    nkinds = len(RELKINDS)
+    ids = 0
+    for i in range(len(pkgbuf)/5):
+        cls, name, version, flags, priority = pkgbuf[i*5:i*5+5]
+        state = [strings[name], strings[version]]
+        for kind in range(nkinds):
+            count = cntbuf[i*nkinds+kind]
+            lst = [relations[x] for x in idsbuf[ids:ids+count]]
+            ids += count
+            if not flags&(ISLIST<<kind):
+                lst = tuple(lst)
+            state.append(lst)
+        state.extend([bool(flags&INSTALLED), bool(flags&ESSENTIAL),
+                      priority, {}])
+        pkg = classes[cls].__new__(classes[cls])
+        pkg.__setstate__(tuple(state))
+        packages.append(pkg)
+    return packages
+
+def buildLinks(relations, linkbuf):
+    linkbuf = array.array("i", str(linkbuf))
+    pos = 0
+    for attr in ("providedby",)+LINKATTRS:
+        count = linkbuf[pos]
+        pos += 1
+        for i in range(count):
+            rel, n = linkbuf[pos:pos+2]
+            pos += 2
+            setattr(relations[rel], attr,
+                    [relations[x] for x in linkbuf[pos:pos+n]])
+            pos += n
+
+try:
+    from smart.ccache import buildRelations, buildPackages, buildLinks
+except ImportError:
+    pass
+
+# vim:ts=4:sw=4:et
@@ -44,6 +44,8 @@
 
 #define STR(obj) PyString_AS_STRING(obj)
 
+#define SEQ_CHECK(x) (PyList_Check(x) || PyTuple_Check(x))
+
 
 #ifndef Py_VISIT
 #define Py_VISIT(op)					\
@@ -129,6 +131,9 @@ typedef struct {
     PyObject *_upgrades;
     PyObject *_conflicts;
     PyObject *_objmap;
+    PyObject *_loaded;
+    PyObject *_searchindex;
+    int _compacted;
 } CacheObject;
 
 static PyObject *
@@ -159,6 +164,29 @@ getPkgConf(void)
     return pkgconf;
 }
 
+static PyObject *
+getSysConf(void)
+{
+    static PyObject *sysconf = NULL;
+    if (sysconf == NULL) {
+        PyObject *module = PyImport_ImportModule("smart");
+        if (module) {
+            sysconf = PyObject_GetAttrString(module, "sysconf");
+            Py_DECREF(module);
+        }
+    }
+    return sysconf;
+}
+
+static PyObject *
+getGC(void)
+{
+    static PyObject *gc = NULL;
+    if (gc == NULL)
+        gc = PyImport_ImportModule("gc");
+    return gc;
+}
+
 static PyObject *
 getIface(void)
 {
@@ -173,6 +201,20 @@ getIface(void)
     return iface;
 }
 
+static PyObject *
+getParseLoaders(void)
+{
+    static PyObject *parseloaders = NULL;
+    if (parseloaders == NULL) {
+        PyObject *module = PyImport_ImportModule("smart.cache");
+        if (module) {
+            parseloaders = PyObject_GetAttrString(module, "parseLoaders");
+            Py_DECREF(module);
+        }
+    }
+    return parseloaders;
+}
+
 static PyObject *
 getGlobDistance(void)
 {
@@ -348,18 +390,18 @@ Package_equals(PackageObject *self, PackageObject *other)
 
     if (strcmp(STR(self->name), STR(other->name)) != 0 ||
         strcmp(STR(self->version), STR(other->version)) != 0 ||
-        PyList_GET_SIZE(self->upgrades) != PyList_GET_SIZE(other->upgrades) ||
-        PyList_GET_SIZE(self->conflicts) != PyList_GET_SIZE(other->conflicts)) {
+        PySequence_Fast_GET_SIZE(self->upgrades) != PySequence_Fast_GET_SIZE(other->upgrades) ||
+        PySequence_Fast_GET_SIZE(self->conflicts) != PySequence_Fast_GET_SIZE(other->conflicts)) {
         ret = Py_False;
         goto exit;
     }
 
-    ilen = PyList_GET_SIZE(self->upgrades);
-    jlen = PyList_GET_SIZE(other->upgrades);
+    ilen = PySequence_Fast_GET_SIZE(self->upgrades);
+    jlen = PySequence_Fast_GET_SIZE(other->upgrades);
     for (i = 0; i != ilen; i++) {
-        PyObject *item = PyList_GET_ITEM(self->upgrades, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(self->upgrades, i);
         for (j = 0; j != jlen; j++)
-            if (item == PyList_GET_ITEM(other->upgrades, j))
+            if (item == PySequence_Fast_GET_ITEM(other->upgrades, j))
                 break;
         if (j == jlen) {
             ret = Py_False;
@@ -367,12 +409,12 @@ Package_equals(PackageObject *self, PackageObject *other)
         }
     }
 
-    ilen = PyList_GET_SIZE(self->conflicts);
-    jlen = PyList_GET_SIZE(other->conflicts);
+    ilen = PySequence_Fast_GET_SIZE(self->conflicts);
+    jlen = PySequence_Fast_GET_SIZE(other->conflicts);
     for (i = 0; i != ilen; i++) {
-        PyObject *item = PyList_GET_ITEM(self->conflicts, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(self->conflicts, i);
         for (j = 0; j != jlen; j++)
-            if (item == PyList_GET_ITEM(other->conflicts, j))
+            if (item == PySequence_Fast_GET_ITEM(other->conflicts, j))
                 break;
         if (j == jlen) {
             ret = Py_False;
@@ -382,8 +424,8 @@ Package_equals(PackageObject *self, PackageObject *other)
 
     ilen = 0;
     jlen = 0;
-    for (i = 0; i != PyList_GET_SIZE(self->provides); i++) {
-        PyObject *item = PyList_GET_ITEM(self->provides, i);
+    for (i = 0; i != PySequence_Fast_GET_SIZE(self->provides); i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(self->provides, i);
         if (!PyObject_IsInstance(item, (PyObject *)&Provides_Type)) {
             PyErr_SetString(PyExc_TypeError, "Provides instance expected");
             return NULL;
@@ -391,8 +433,8 @@ Package_equals(PackageObject *self, PackageObject *other)
         if (STR(((ProvidesObject *)item)->name)[0] != '/')
             ilen += 1;
     }
-    for (j = 0; j != PyList_GET_SIZE(other->provides); j++) {
-        PyObject *item = PyList_GET_ITEM(other->provides, j);
+    for (j = 0; j != PySequence_Fast_GET_SIZE(other->provides); j++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(other->provides, j);
         if (!PyObject_IsInstance(item, (PyObject *)&Provides_Type)) {
             PyErr_SetString(PyExc_TypeError, "Provides instance expected");
             return NULL;
@@ -405,13 +447,13 @@ Package_equals(PackageObject *self, PackageObject *other)
         goto exit;
     }
 
-    ilen = PyList_GET_SIZE(self->provides);
-    jlen = PyList_GET_SIZE(other->provides);
+    ilen = PySequence_Fast_GET_SIZE(self->provides);
+    jlen = PySequence_Fast_GET_SIZE(other->provides);
     for (i = 0; i != ilen; i++) {
-        PyObject *item = PyList_GET_ITEM(self->provides, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(self->provides, i);
         if (STR(((ProvidesObject *)item)->name)[0] == '/') {
             for (j = 0; j != jlen; j++)
-                if (item == PyList_GET_ITEM(other->provides, j))
+                if (item == PySequence_Fast_GET_ITEM(other->provides, j))
                     break;
             if (j == jlen) {
                 ret = Py_False;
@@ -422,8 +464,8 @@ Package_equals(PackageObject *self, PackageObject *other)
 
     ilen = 0;
     jlen = 0;
-    for (i = 0; i != PyList_GET_SIZE(self->requires); i++) {
-        PyObject *item = PyList_GET_ITEM(self->requires, i);
+    for (i = 0; i != PySequence_Fast_GET_SIZE(self->requires); i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(self->requires, i);
         if (!PyObject_IsInstance(item, (PyObject *)&Depends_Type)) {
             PyErr_SetString(PyExc_TypeError, "Depends instance expected");
             return NULL;
@@ -431,8 +473,8 @@ Package_equals(PackageObject *self, PackageObject *other)
         if (STR(((DependsObject *)item)->name)[0] != '/')
             ilen += 1;
     }
-    for (j = 0; j != PyList_GET_SIZE(other->requires); j++) {
-        PyObject *item = PyList_GET_ITEM(other->requires, j);
+    for (j = 0; j != PySequence_Fast_GET_SIZE(other->requires); j++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(other->requires, j);
         if (!PyObject_IsInstance(item, (PyObject *)&Depends_Type)) {
             PyErr_SetString(PyExc_TypeError, "Depends instance expected");
             return NULL;
@@ -445,13 +487,13 @@ Package_equals(PackageObject *self, PackageObject *other)
         goto exit;
     }
 
-    ilen = PyList_GET_SIZE(self->requires);
-    jlen = PyList_GET_SIZE(other->requires);
+    ilen = PySequence_Fast_GET_SIZE(self->requires);
+    jlen = PySequence_Fast_GET_SIZE(other->requires);
     for (i = 0; i != ilen; i++) {
-        PyObject *item = PyList_GET_ITEM(self->requires, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(self->requires, i);
         if (STR(((DependsObject *)item)->name)[0] != '/') {
             for (j = 0; j != jlen; j++)
-                if (item == PyList_GET_ITEM(other->requires, j))
+                if (item == PySequence_Fast_GET_ITEM(other->requires, j))
                     break;
             if (j == jlen) {
                 ret = Py_False;
@@ -462,8 +504,8 @@ Package_equals(PackageObject *self, PackageObject *other)
 
     ilen = 0;
     jlen = 0;
-    for (i = 0; i != PyList_GET_SIZE(self->recommends); i++) {
-        PyObject *item = PyList_GET_ITEM(self->recommends, i);
+    for (i = 0; i != PySequence_Fast_GET_SIZE(self->recommends); i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(self->recommends, i);
         if (!PyObject_IsInstance(item, (PyObject *)&Depends_Type)) {
             PyErr_SetString(PyExc_TypeError, "Depends instance expected");
             return NULL;
@@ -471,8 +513,8 @@ Package_equals(PackageObject *self, PackageObject *other)
         if (STR(((DependsObject *)item)->name)[0] != '/')
             ilen += 1;
     }
-    for (j = 0; j != PyList_GET_SIZE(other->recommends); j++) {
-        PyObject *item = PyList_GET_ITEM(other->recommends, j);
+    for (j = 0; j != PySequence_Fast_GET_SIZE(other->recommends); j++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(other->recommends, j);
         if (!PyObject_IsInstance(item, (PyObject *)&Depends_Type)) {
             PyErr_SetString(PyExc_TypeError, "Depends instance expected");
             return NULL;
@@ -485,13 +527,13 @@ Package_equals(PackageObject *self, PackageObject *other)
         goto exit;
     }
 
-    ilen = PyList_GET_SIZE(self->recommends);
-    jlen = PyList_GET_SIZE(other->recommends);
+    ilen = PySequence_Fast_GET_SIZE(self->recommends);
+    jlen = PySequence_Fast_GET_SIZE(other->recommends);
     for (i = 0; i != ilen; i++) {
-        PyObject *item = PyList_GET_ITEM(self->recommends, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(self->recommends, i);
         if (STR(((DependsObject *)item)->name)[0] != '/') {
             for (j = 0; j != jlen; j++)
-                if (item == PyList_GET_ITEM(other->recommends, j))
+                if (item == PySequence_Fast_GET_ITEM(other->recommends, j))
                     break;
             if (j == jlen) {
                 ret = Py_False;
@@ -502,8 +544,8 @@ Package_equals(PackageObject *self, PackageObject *other)
 
     ilen = 0;
     jlen = 0;
-    for (i = 0; i != PyList_GET_SIZE(self->recommends); i++) {
-        PyObject *item = PyList_GET_ITEM(self->recommends, i);
+    for (i = 0; i != PySequence_Fast_GET_SIZE(self->recommends); i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(self->recommends, i);
         if (!PyObject_IsInstance(item, (PyObject *)&Depends_Type)) {
             PyErr_SetString(PyExc_TypeError, "Depends instance expected");
             return NULL;
@@ -511,8 +553,8 @@ Package_equals(PackageObject *self, PackageObject *other)
         if (STR(((DependsObject *)item)->name)[0] != '/')
             ilen += 1;
     }
-    for (j = 0; j != PyList_GET_SIZE(other->recommends); j++) {
-        PyObject *item = PyList_GET_ITEM(other->recommends, j);
+    for (j = 0; j != PySequence_Fast_GET_SIZE(other->recommends); j++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(other->recommends, j);
         if (!PyObject_IsInstance(item, (PyObject *)&Depends_Type)) {
             PyErr_SetString(PyExc_TypeError, "Depends instance expected");
             return NULL;
@@ -525,13 +567,13 @@ Package_equals(PackageObject *self, PackageObject *other)
         goto exit;
     }
 
-    ilen = PyList_GET_SIZE(self->recommends);
-    jlen = PyList_GET_SIZE(other->recommends);
+    ilen = PySequence_Fast_GET_SIZE(self->recommends);
+    jlen = PySequence_Fast_GET_SIZE(other->recommends);
     for (i = 0; i != ilen; i++) {
-        PyObject *item = PyList_GET_ITEM(self->recommends, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(self->recommends, i);
         if (STR(((DependsObject *)item)->name)[0] != '/') {
             for (j = 0; j != jlen; j++)
-                if (item == PyList_GET_ITEM(other->recommends, j))
+                if (item == PySequence_Fast_GET_ITEM(other->recommends, j))
                     break;
             if (j == jlen) {
                 ret = Py_False;
@@ -943,8 +985,12 @@ Provides_search(PackageObject *self, PyObject *searcher)
         }
         Py_DECREF(res);
 
-        tmp = PyString_FromFormat("%s-%s", PyString_AS_STRING(self->name),
-                                           PyString_AS_STRING(self->version));
+        /* "%s-%s" % (self.name, self.version) */
+        if (PyString_Check(self->version))
+            tmp = PyString_FromFormat("%s-%s", PyString_AS_STRING(self->name),
+                                      PyString_AS_STRING(self->version));
+        else
+            tmp = PyString_FromFormat("%s-None", PyString_AS_STRING(self->name));
         if (tmp == NULL)
             return NULL;
         res = PyObject_CallFunction(globdistance, "OOOO",
@@ -1180,6 +1226,36 @@ Depends_matches(DependsObject *self, PyObject *prv)
     return Py_False;
 }
 
+static PyObject *
+Depends_getMatches(DependsObject *self, PyObject *provides)
+{
+    PyObject *seq, *ret;
+    int i, len;
+    /* return [prv for prv in provides if self.matches(prv)] */
+    seq = PySequence_Fast(provides, "provides must be a sequence");
+    if (!seq) return NULL;
+    ret = PyList_New(0);
+    if (!ret) goto error;
+    len = PySequence_Fast_GET_SIZE(seq);
+    for (i = 0; i != len; i++) {
+        PyObject *prv = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *res = PyObject_CallMethod((PyObject *)self, "matches",
+                                            "O", prv);
+        int rc;
+        if (!res) goto error;
+        rc = PyObject_IsTrue(res);
+        Py_DECREF(res);
+        if (rc == -1 || (rc && PyList_Append(ret, prv) == -1))
+            goto error;
+    }
+    Py_DECREF(seq);
+    return ret;
+error:
+    Py_XDECREF(ret);
+    Py_DECREF(seq);
+    return NULL;
+}
+
 static PyObject *
 Depends_str(DependsObject *self)
 {
@@ -1251,6 +1327,7 @@ static PyMethodDef Depends_methods[] = {
     {"getInitArgs", (PyCFunction)Depends_getInitArgs, METH_NOARGS, NULL},
     {"getMatchNames", (PyCFunction)Depends_getMatchNames, METH_NOARGS, NULL},
     {"matches", (PyCFunction)Depends_matches, METH_O, NULL},
+    {"getMatches", (PyCFunction)Depends_getMatches, METH_O, NULL},
     {"__reduce__", (PyCFunction)Depends__reduce__, METH_NOARGS, NULL},
     {NULL, NULL}
 };
@@ -1620,6 +1697,24 @@ Loader_load(LoaderObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+PyObject *
+Loader_canParse(LoaderObject *self, PyObject *args)
+{
+    Py_RETURN_FALSE;
+}
+
+PyObject *
+Loader_parse(LoaderObject *self, PyObject *prog)
+{
+    return PyList_New(0);
+}
+
+PyObject *
+Loader_loadRecords(LoaderObject *self, PyObject *records)
+{
+    Py_RETURN_NONE;
+}
+
 PyObject *
 Loader_unload(LoaderObject *self, PyObject *args)
 {
@@ -1644,6 +1739,33 @@ mylist(PyObject *obj, PyObject **ret)
     return 1;
 }
 
+/*
+   Names, versions, relations and paths kept by the cache are interned,
+   so that the same string coming from different packages and channels
+   is stored once.
+*/
+static void
+poolString(PyObject **str)
+{
+    if (PyString_CheckExact(*str))
+        PyString_InternInPlace(str);
+}
+
+static void
+poolRelation(PyObject *rel)
+{
+    if (PyObject_TypeCheck(rel, &Provides_Type)) {
+        ProvidesObject *prvobj = (ProvidesObject *)rel;
+        poolString(&prvobj->name);
+        poolString(&prvobj->version);
+    } else if (PyObject_TypeCheck(rel, &Depends_Type)) {
+        DependsObject *depobj = (DependsObject *)rel;
+        poolString(&depobj->name);
+        poolString(&depobj->relation);
+        poolString(&depobj->version);
+    }
+}
+
 PyObject *
 Loader_buildPackage(LoaderObject *self, PyObject *args)
 {
@@ -1729,6 +1851,7 @@ Loader_buildPackage(LoaderObject *self, PyObject *args)
                 Py_DECREF(callargs);
                 if (!prv) return NULL;
                 prvobj = (ProvidesObject *)prv;
+                poolRelation(prv);
 
                 /* cache._objmap[args] = prv */
                 PyDict_SetItem(cache->_objmap, args, prv);
@@ -1782,6 +1905,7 @@ Loader_buildPackage(LoaderObject *self, PyObject *args)
                 Py_DECREF(callargs);
                 if (!req) return NULL;
                 reqobj = (DependsObject *)req;
+                poolRelation(req);
 
                 /* cache._objmap[args] = req */
                 PyDict_SetItem(cache->_objmap, args, req);
@@ -1835,59 +1959,7 @@ Loader_buildPackage(LoaderObject *self, PyObject *args)
                 Py_DECREF(callargs);
                 if (!rec) return NULL;
                 recobj = (DependsObject *)rec;
-
-                /* cache._objmap[args] = rec */
-                PyDict_SetItem(cache->_objmap, args, rec);
-                Py_DECREF(rec);
-
-                /* cache._recommends.append(rec) */
-                PyList_Append(cache->_recommends, rec);
-            }
-
-            /* relpkgs.append(rec.packages) */
-            PyList_Append(relpkgs, recobj->packages);
-
-            /* pkg.recommends.append(rec) */
-            Py_INCREF(rec);
-            PyList_SET_ITEM(pkgobj->recommends, i, rec);
-        }
-    }
-
-    /* if recargs: */
-    if (recargs) {
-        int i = 0;
-        int len = PyList_GET_SIZE(recargs);
-        /* pkg.recommends = [] */
-        Py_DECREF(pkgobj->recommends);
-        pkgobj->recommends = PyList_New(len);
-        /* for args in recargs: */
-        for (; i != len; i++) {
-            PyObject *args = PyList_GET_ITEM(recargs, i);
-            DependsObject *recobj;
-            PyObject *rec;
-            
-            if (!PyTuple_Check(args)) {
-                PyErr_SetString(PyExc_TypeError,
-                                "Item in recargs is not a tuple");
-                return NULL;
-            }
-
-            /* rec = cache._objmap.get(args) */
-            rec = PyDict_GetItem(cache->_objmap, args);
-            recobj = (DependsObject *)rec;
-
-            /* if not rec: */
-            if (!rec) {
-                if (!PyTuple_Check(args) || PyTuple_GET_SIZE(args) < 2) {
-                    PyErr_SetString(PyExc_ValueError, "Invalid recargs tuple");
-                    return NULL;
-                }
-                /* rec = args[0](*args[1:]) */
-                callargs = PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args));
-                rec = PyObject_CallObject(PyTuple_GET_ITEM(args, 0), callargs);
-                Py_DECREF(callargs);
-                if (!rec) return NULL;
-                recobj = (DependsObject *)rec;
+                poolRelation(rec);
 
                 /* cache._objmap[args] = rec */
                 PyDict_SetItem(cache->_objmap, args, rec);
@@ -1941,6 +2013,7 @@ Loader_buildPackage(LoaderObject *self, PyObject *args)
                 Py_DECREF(callargs);
                 if (!upg) return NULL;
                 upgobj = (DependsObject *)upg;
+                poolRelation(upg);
 
                 /* cache._objmap[args] = upg */
                 PyDict_SetItem(cache->_objmap, args, upg);
@@ -1994,6 +2067,7 @@ Loader_buildPackage(LoaderObject *self, PyObject *args)
                 Py_DECREF(callargs);
                 if (!cnf) return NULL;
                 cnfobj = (DependsObject *)cnf;
+                poolRelation(cnf);
 
                 /* cache._objmap[args] = cnf */
                 PyDict_SetItem(cache->_objmap, args, cnf);
@@ -2058,6 +2132,9 @@ Loader_buildPackage(LoaderObject *self, PyObject *args)
     if (!found) {
         int i, len;
 
+        poolString(&pkgobj->name);
+        poolString(&pkgobj->version);
+
         /* cache._packages.append(pkg) */
         PyList_Append(cache->_packages, pkg);
 
@@ -2143,6 +2220,7 @@ Loader_buildFileProvides(LoaderObject *self, PyObject *args)
                             "Instance must be a Provides subclass");
             return NULL;
         }
+        poolRelation(prv);
 
         /* cache._objmap[prvargs] = prv */
         PyDict_SetItem(cache->_objmap, prvargs, prv);
@@ -2523,6 +2601,9 @@ static PyMethodDef Loader_methods[] = {
     {"getInfo", (PyCFunction)Loader_getInfo, METH_O, NULL},
     {"reset", (PyCFunction)Loader_reset, METH_NOARGS, NULL},
     {"load", (PyCFunction)Loader_load, METH_NOARGS, NULL},
+    {"canParse", (PyCFunction)Loader_canParse, METH_NOARGS, NULL},
+    {"parse", (PyCFunction)Loader_parse, METH_O, NULL},
+    {"loadRecords", (PyCFunction)Loader_loadRecords, METH_O, NULL},
     {"unload", (PyCFunction)Loader_unload, METH_NOARGS, NULL},
     {"loadFileProvides", (PyCFunction)Loader_loadFileProvides, METH_O, NULL},
     {"buildPackage", (PyCFunction)Loader_buildPackage, METH_VARARGS, NULL},
@@ -2600,6 +2681,10 @@ Cache_init(CacheObject *self, PyObject *args)
     self->_upgrades = PyList_New(0);
     self->_conflicts = PyList_New(0);
     self->_objmap = PyDict_New();
+    self->_loaded = PyDict_New();
+    self->_searchindex = Py_None;
+    Py_INCREF(Py_None);
+    self->_compacted = 0;
     return 0;
 }
 
@@ -2614,6 +2699,8 @@ Cache_traverse(CacheObject *self, visitproc visit, void *arg)
     Py_VISIT(self->_upgrades);
     Py_VISIT(self->_conflicts);
     Py_VISIT(self->_objmap);
+    Py_VISIT(self->_loaded);
+    Py_VISIT(self->_searchindex);
     return 0;
 }
 
@@ -2628,6 +2715,8 @@ Cache_clear(CacheObject *self)
     Py_CLEAR(self->_upgrades);
     Py_CLEAR(self->_conflicts);
     Py_CLEAR(self->_objmap);
+    Py_CLEAR(self->_loaded);
+    Py_CLEAR(self->_searchindex);
     return 0;
 }
 
@@ -2642,13 +2731,150 @@ Cache_dealloc(CacheObject *self)
     Py_XDECREF(self->_upgrades);
     Py_XDECREF(self->_conflicts);
     Py_XDECREF(self->_objmap);
+    Py_XDECREF(self->_loaded);
+    Py_XDECREF(self->_searchindex);
     self->ob_type->tp_free((PyObject *)self);
 }
 
+/*
+   Relation lists don't change until the next reload, so once the
+   cache is loaded they are turned into tuples, which are allocated
+   in a single block of the exact size. Cache_thaw() turns them back
+   into lists before the cache is changed. When thawing, empty
+   dependency links are left as empty tuples, as in a fresh relation.
+*/
+static int
+setFrozen(PyObject **lst, int frozen, int keepempty)
+{
+    PyObject *new;
+    if (frozen) {
+        if (!PyList_Check(*lst))
+            return 0;
+        new = PyList_AsTuple(*lst);
+    } else {
+        if (!PyTuple_Check(*lst) ||
+            (keepempty && PyTuple_GET_SIZE(*lst) == 0))
+            return 0;
+        new = PySequence_List(*lst);
+    }
+    if (!new) return -1;
+    Py_DECREF(*lst);
+    *lst = new;
+    return 0;
+}
+
+static int
+setPackageFrozen(PackageObject *pkg, int frozen)
+{
+    PyObject **fields[5];
+    int i, j, len;
+
+    fields[0] = &pkg->provides;
+    fields[1] = &pkg->requires;
+    fields[2] = &pkg->recommends;
+    fields[3] = &pkg->upgrades;
+    fields[4] = &pkg->conflicts;
+
+    for (i = 0; i != 5; i++) {
+        PyObject *lst = *fields[i];
+        if (!SEQ_CHECK(lst))
+            continue;
+        len = PySequence_Fast_GET_SIZE(lst);
+        for (j = 0; j != len; j++) {
+            PyObject *rel = PySequence_Fast_GET_ITEM(lst, j);
+            if (i == 0 && PyObject_TypeCheck(rel, &Provides_Type)) {
+                ProvidesObject *prv = (ProvidesObject *)rel;
+                if (setFrozen(&prv->packages, frozen, 0) == -1 ||
+                    setFrozen(&prv->requiredby, frozen, 1) == -1 ||
+                    setFrozen(&prv->recommendedby, frozen, 1) == -1 ||
+                    setFrozen(&prv->upgradedby, frozen, 1) == -1 ||
+                    setFrozen(&prv->conflictedby, frozen, 1) == -1)
+                    return -1;
+            } else if (i != 0 && PyObject_TypeCheck(rel, &Depends_Type)) {
+                DependsObject *dep = (DependsObject *)rel;
+                if (setFrozen(&dep->packages, frozen, 0) == -1 ||
+                    setFrozen(&dep->providedby, frozen, 1) == -1)
+                    return -1;
+            }
+        }
+        if (setFrozen(fields[i], frozen, 0) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+PyObject *
+Cache_compact(CacheObject *self, PyObject *args)
+{
+    int i, len;
+    if (!self->_compacted) {
+        len = PyList_GET_SIZE(self->_packages);
+        for (i = 0; i != len; i++) {
+            PyObject *pkg = PyList_GET_ITEM(self->_packages, i);
+            if (setPackageFrozen((PackageObject *)pkg, 1) == -1)
+                return NULL;
+        }
+        self->_compacted = 1;
+    }
+    Py_RETURN_NONE;
+}
+
+static int
+thawPackages(PyObject *packages)
+{
+    int i, len;
+    if (!PyList_Check(packages))
+        return 0;
+    len = PyList_GET_SIZE(packages);
+    for (i = 0; i != len; i++) {
+        PyObject *pkg = PyList_GET_ITEM(packages, i);
+        if (PyObject_TypeCheck(pkg, &Package_Type) &&
+            setPackageFrozen((PackageObject *)pkg, 0) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+   Packages of loaders being retracted are thawed as well, since they
+   may be added back later. The search index is dropped, since it
+   only knows about the packages it was built for.
+*/
+static int
+Cache_thaw(CacheObject *self)
+{
+    PyObject *key, *value;
+    Py_ssize_t pos;
+    int i, len;
+    Py_XDECREF(self->_searchindex);
+    self->_searchindex = Py_None;
+    Py_INCREF(Py_None);
+    if (!self->_compacted)
+        return 0;
+    if (thawPackages(self->_packages) == -1)
+        return -1;
+    len = PyList_GET_SIZE(self->_loaders);
+    for (i = 0; i != len; i++) {
+        PyObject *loader = PyList_GET_ITEM(self->_loaders, i);
+        if (thawPackages(((LoaderObject *)loader)->_packages) == -1)
+            return -1;
+    }
+    pos = 0;
+    while (PyDict_Next(self->_loaded, &pos, &key, &value)) {
+        if (PyObject_TypeCheck(key, &Loader_Type) &&
+            thawPackages(((LoaderObject *)key)->_packages) == -1)
+            return -1;
+    }
+    self->_compacted = 0;
+    return 0;
+}
+
 PyObject *
 Cache_reset(CacheObject *self, PyObject *args)
 {
     int i, len;
+    if (Cache_thaw(self) == -1)
+        return NULL;
     len = PyList_GET_SIZE(self->_provides);
     for (i = 0; i != len; i++) {
         ProvidesObject *prvobj;
@@ -2722,6 +2948,7 @@ Cache_reset(CacheObject *self, PyObject *args)
     LIST_CLEAR(self->_upgrades);
     LIST_CLEAR(self->_conflicts);
     PyDict_Clear(self->_objmap);
+    PyDict_Clear(self->_loaded);
     Py_RETURN_NONE;
 }
 
@@ -2742,91 +2969,564 @@ Cache_addLoader(CacheObject *self, PyObject *loader)
     Py_RETURN_NONE;
 }
 
-PyObject *
-Cache_removeLoader(CacheObject *self, PyObject *loader)
+/* lst[:] = [x for x in lst if x not in exclude] */
+static int
+filterList(PyObject *lst, PyObject *exclude)
 {
-    if (loader != Py_None) {
-        int i, len;
-        len = PyList_GET_SIZE(self->_loaders);
-        for (i = len-1; i >= 0; i--)
-            if (PyList_GET_ITEM(self->_loaders, i) == loader)
-                PyList_SetSlice(self->_loaders, i, i+1, (PyObject *)NULL);
-        if (i >= 0) {
-            CALLMETHOD(loader, "setCache", "O", Py_None);
-            CALLMETHOD(loader, "unload", NULL);
+    PyObject *newlst;
+    int i, len;
+    int ret = 0;
+    len = PyList_GET_SIZE(lst);
+    newlst = PyList_New(0);
+    if (!newlst) return -1;
+    for (i = 0; i != len; i++) {
+        PyObject *item = PyList_GET_ITEM(lst, i);
+        if (!PyDict_GetItem(exclude, item) &&
+            PyList_Append(newlst, item) == -1) {
+            Py_DECREF(newlst);
+            return -1;
         }
     }
-    Py_RETURN_NONE;
+    if (PyList_GET_SIZE(newlst) != len)
+        ret = PyList_SetSlice(lst, 0, len, newlst);
+    Py_DECREF(newlst);
+    return ret;
 }
 
-PyObject *
-Cache__reload(CacheObject *self, PyObject *args)
+/* dict.fromkeys(seq, True) */
+static PyObject *
+dictFromKeys(PyObject *seq)
 {
-    /*
-      packages = {}
-      provides = {}
-      requires = {}
-      recommends = {}
-      upgrades = {}
-      conflicts = {}
-      objmap = self._objmap
-    */
-    PyObject *packages = PyDict_New();
-    PyObject *provides = PyDict_New();
-    PyObject *requires = PyDict_New();
-    PyObject *recommends = PyDict_New();
-    PyObject *upgrades = PyDict_New();
-    PyObject *conflicts = PyDict_New();
-    PyObject *objmap = self->_objmap;
-    int i, ilen;
-    if (!packages || !provides || !requires || !recommends || !conflicts )
-        return NULL;
-
-    /* for loader in loaders: */
-    ilen = PyList_GET_SIZE(self->_loaders);
-    for (i = 0; i != ilen; i++) {
-        int j, jlen;
-        LoaderObject *loader =
-                        (LoaderObject *)PyList_GET_ITEM(self->_loaders, i);
-        if (!PyObject_IsInstance((PyObject *)loader,
-                                 (PyObject *)&Loader_Type)) {
-            PyErr_SetString(PyExc_TypeError,
-                            "Loader is not a Loader instance");
+    PyObject *dict = PyDict_New();
+    int i, len;
+    if (!dict) return NULL;
+    len = PySequence_Fast_GET_SIZE(seq);
+    for (i = 0; i != len; i++) {
+        if (PyDict_SetItem(dict, PySequence_Fast_GET_ITEM(seq, i),
+                           Py_True) == -1) {
+            Py_DECREF(dict);
             return NULL;
         }
+    }
+    return dict;
+}
 
-        /* for pkg in loader._packages: */
-        jlen = PyList_GET_SIZE(loader->_packages);
-        for (j = 0; j != jlen; j++) {
-            PackageObject *pkg = (PackageObject *)
-                                    PyList_GET_ITEM(loader->_packages, j);
-            if (!PyObject_IsInstance((PyObject *)pkg,
-                                     (PyObject *)&Package_Type)) {
-                PyErr_SetString(PyExc_TypeError,
-                                "Package is not a Package instance");
-                return NULL;
-            }
+/*
+   lst = dict.get(key)
+   if lst:
+       lst.append(item)
+   else:
+       dict[key] = [item]
+*/
+static int
+appendToDictList(PyObject *dict, PyObject *key, PyObject *item)
+{
+    PyObject *lst = PyDict_GetItem(dict, key);
+    if (lst)
+        return PyList_Append(lst, item);
+    lst = PyList_New(1);
+    if (!lst) return -1;
+    Py_INCREF(item);
+    PyList_SET_ITEM(lst, 0, item);
+    if (PyDict_SetItem(dict, key, lst) == -1) {
+        Py_DECREF(lst);
+        return -1;
+    }
+    Py_DECREF(lst);
+    return 0;
+}
 
-            /* if pkg in packages: */
-            if (PyDict_GetItem(packages, (PyObject *)pkg)) {
+static int
+appendToLink(PyObject **lst, PyObject *item)
+{
+    /* Links are empty tuples until the first item is appended. */
+    PyObject *_lst;
+    if (PyList_Check(*lst))
+        return PyList_Append(*lst, item);
+    _lst = PyList_New(1);
+    if (!_lst) return -1;
+    Py_INCREF(item);
+    PyList_SET_ITEM(_lst, 0, item);
+    Py_DECREF(*lst);
+    *lst = _lst;
+    return 0;
+}
 
-                /* pkg.installed |= loader._installed */
-                if (loader->_installed == Py_True) {
-                    Py_DECREF(pkg->installed);
-                    pkg->installed = loader->_installed;
-                    Py_INCREF(pkg->installed);
-                }
+PyObject *
+Cache__retract(CacheObject *self, PyObject *loader)
+{
+    PyObject *pkgs = NULL, *kept = NULL, *removed = NULL;
+    PyObject *prvtouched = NULL, *deptouched = NULL, *dead = NULL;
+    PyObject *fixprv = NULL, *fixdep = NULL;
+    PyObject *ret = NULL;
+    PyObject *lsts[4];
+    PyObject *key, *value;
+    Py_ssize_t pos;
+    int i, len;
+    int j, jlen;
+    int k;
 
-            } else {
+    if (!PyObject_IsInstance(loader, (PyObject *)&Loader_Type)) {
+        PyErr_SetString(PyExc_TypeError, "Loader is not a Loader instance");
+        return NULL;
+    }
 
-                PyObject *args;
-                PyObject *lst;
-                int k, klen;
-                int l, llen;
+    /* self._thaw() */
+    if (Cache_thaw(self) == -1)
+        goto error;
 
-                /* pkg.installed = loader._installed */
-                Py_DECREF(pkg->installed);
-                pkg->installed = loader->_installed;
+    /* del self._loaded[loader] */
+    if (PyDict_DelItem(self->_loaded, loader) == -1)
+        goto error;
+
+    /* pkgs = dict.fromkeys(loader._packages, False) */
+    pkgs = dictFromKeys(((LoaderObject *)loader)->_packages);
+    if (!pkgs) goto error;
+
+    /*
+       kept = {}
+       for other in self._loaded:
+           installed = other._installed
+           for pkg in other._packages:
+               if pkg in pkgs:
+                   kept[pkg] = kept.get(pkg) or installed
+    */
+    kept = PyDict_New();
+    if (!kept) goto error;
+    pos = 0;
+    while (PyDict_Next(self->_loaded, &pos, &key, &value)) {
+        LoaderObject *other = (LoaderObject *)key;
+        len = PyList_GET_SIZE(other->_packages);
+        for (i = 0; i != len; i++) {
+            PyObject *pkg = PyList_GET_ITEM(other->_packages, i);
+            if (PyDict_GetItem(pkgs, pkg)) {
+                PyObject *installed = PyDict_GetItem(kept, pkg);
+                if (!installed || installed != Py_True)
+                    PyDict_SetItem(kept, pkg, other->_installed);
+            }
+        }
+    }
+    Py_CLEAR(pkgs);
+
+    /*
+       removed = {}
+       for pkg in pkgs:
+           if pkg in kept:
+               pkg.installed = kept[pkg]
+               if loader in pkg.loaders:
+                   del pkg.loaders[loader]
+           else:
+               removed[pkg] = True
+    */
+    removed = PyDict_New();
+    if (!removed) goto error;
+    len = PyList_GET_SIZE(((LoaderObject *)loader)->_packages);
+    for (i = 0; i != len; i++) {
+        PackageObject *pkg = (PackageObject *)
+            PyList_GET_ITEM(((LoaderObject *)loader)->_packages, i);
+        PyObject *installed = PyDict_GetItem(kept, (PyObject *)pkg);
+        if (installed) {
+            Py_INCREF(installed);
+            Py_DECREF(pkg->installed);
+            pkg->installed = installed;
+            if (PyDict_GetItem(pkg->loaders, loader))
+                PyDict_DelItem(pkg->loaders, loader);
+        } else {
+            PyDict_SetItem(removed, (PyObject *)pkg, Py_True);
+        }
+    }
+    Py_CLEAR(kept);
+
+    /* if not removed: return */
+    if (PyDict_Size(removed) == 0)
+        goto done;
+
+    /*
+       touched = {}
+       for pkg in removed:
+           for prv in pkg.provides:
+               touched[prv] = True
+           for req in pkg.requires:
+               touched[req] = True
+           ...
+    */
+    prvtouched = PyDict_New();
+    deptouched = PyDict_New();
+    if (!prvtouched || !deptouched) goto error;
+    pos = 0;
+    while (PyDict_Next(removed, &pos, &key, &value)) {
+        PackageObject *pkg = (PackageObject *)key;
+        jlen = PySequence_Fast_GET_SIZE(pkg->provides);
+        for (j = 0; j != jlen; j++)
+            PyDict_SetItem(prvtouched,
+                           PySequence_Fast_GET_ITEM(pkg->provides, j),
+                           Py_True);
+        lsts[0] = pkg->requires;
+        lsts[1] = pkg->recommends;
+        lsts[2] = pkg->upgrades;
+        lsts[3] = pkg->conflicts;
+        for (k = 0; k != 4; k++) {
+            jlen = PySequence_Fast_GET_SIZE(lsts[k]);
+            for (j = 0; j != jlen; j++)
+                PyDict_SetItem(deptouched,
+                               PySequence_Fast_GET_ITEM(lsts[k], j),
+                               Py_True);
+        }
+    }
+
+    /*
+       dead = {}
+       for rel in touched:
+           rel.packages[:] = [x for x in rel.packages if x not in removed]
+           if not rel.packages:
+               dead[rel] = True
+    */
+    dead = PyDict_New();
+    if (!dead) goto error;
+    pos = 0;
+    while (PyDict_Next(prvtouched, &pos, &key, &value)) {
+        PyObject *packages = ((ProvidesObject *)key)->packages;
+        if (filterList(packages, removed) == -1)
+            goto error;
+        if (PyList_GET_SIZE(packages) == 0)
+            PyDict_SetItem(dead, key, Py_True);
+    }
+    pos = 0;
+    while (PyDict_Next(deptouched, &pos, &key, &value)) {
+        PyObject *packages = ((DependsObject *)key)->packages;
+        if (filterList(packages, removed) == -1)
+            goto error;
+        if (PyList_GET_SIZE(packages) == 0)
+            PyDict_SetItem(dead, key, Py_True);
+    }
+    Py_CLEAR(prvtouched);
+    Py_CLEAR(deptouched);
+
+    /* self._packages[:] = [x for x in self._packages if x not in removed] */
+    if (filterList(self->_packages, removed) == -1)
+        goto error;
+
+    /* if not dead: return */
+    if (PyDict_Size(dead) == 0)
+        goto done;
+
+    /*
+       fixdep = {}
+       for prv in self._provides:
+           if prv in dead:
+               for dep in (prv.requiredby, prv.recommendedby,
+                           prv.upgradedby, prv.conflictedby):
+                   fixdep.update(dict.fromkeys(dep, True))
+    */
+    fixdep = PyDict_New();
+    if (!fixdep) goto error;
+    len = PyList_GET_SIZE(self->_provides);
+    for (i = 0; i != len; i++) {
+        ProvidesObject *prv = (ProvidesObject *)
+                                PyList_GET_ITEM(self->_provides, i);
+        if (!PyDict_GetItem(dead, (PyObject *)prv))
+            continue;
+        lsts[0] = prv->requiredby;
+        lsts[1] = prv->recommendedby;
+        lsts[2] = prv->upgradedby;
+        lsts[3] = prv->conflictedby;
+        for (k = 0; k != 4; k++) {
+            jlen = PySequence_Fast_GET_SIZE(lsts[k]);
+            for (j = 0; j != jlen; j++)
+                PyDict_SetItem(fixdep, PySequence_Fast_GET_ITEM(lsts[k], j),
+                               Py_True);
+        }
+    }
+
+    /*
+       fixprv = {}
+       for lst in (self._requires, self._recommends,
+                   self._upgrades, self._conflicts):
+           for dep in lst:
+               if dep in dead:
+                   fixprv.update(dict.fromkeys(dep.providedby, True))
+           lst[:] = [x for x in lst if x not in dead]
+    */
+    fixprv = PyDict_New();
+    if (!fixprv) goto error;
+    lsts[0] = self->_requires;
+    lsts[1] = self->_recommends;
+    lsts[2] = self->_upgrades;
+    lsts[3] = self->_conflicts;
+    for (k = 0; k != 4; k++) {
+        len = PyList_GET_SIZE(lsts[k]);
+        for (i = 0; i != len; i++) {
+            DependsObject *dep = (DependsObject *)PyList_GET_ITEM(lsts[k], i);
+            if (!PyDict_GetItem(dead, (PyObject *)dep))
+                continue;
+            jlen = PySequence_Fast_GET_SIZE(dep->providedby);
+            for (j = 0; j != jlen; j++)
+                PyDict_SetItem(fixprv,
+                               PySequence_Fast_GET_ITEM(dep->providedby, j),
+                               Py_True);
+        }
+        if (filterList(lsts[k], dead) == -1)
+            goto error;
+    }
+
+    /* self._provides[:] = [x for x in self._provides if x not in dead] */
+    if (filterList(self->_provides, dead) == -1)
+        goto error;
+
+    /*
+       for dep in fixdep:
+           if dep not in dead:
+               dep.providedby[:] = [x for x in dep.providedby
+                                    if x not in dead]
+    */
+    pos = 0;
+    while (PyDict_Next(fixdep, &pos, &key, &value)) {
+        DependsObject *dep = (DependsObject *)key;
+        if (!PyDict_GetItem(dead, key) && PyList_Check(dep->providedby) &&
+            filterList(dep->providedby, dead) == -1)
+            goto error;
+    }
+
+    /*
+       for prv in fixprv:
+           if prv not in dead:
+               for lst in (prv.requiredby, prv.recommendedby,
+                           prv.upgradedby, prv.conflictedby):
+                   if lst:
+                       lst[:] = [x for x in lst if x not in dead]
+    */
+    pos = 0;
+    while (PyDict_Next(fixprv, &pos, &key, &value)) {
+        ProvidesObject *prv = (ProvidesObject *)key;
+        if (PyDict_GetItem(dead, key))
+            continue;
+        lsts[0] = prv->requiredby;
+        lsts[1] = prv->recommendedby;
+        lsts[2] = prv->upgradedby;
+        lsts[3] = prv->conflictedby;
+        for (k = 0; k != 4; k++) {
+            if (PyList_Check(lsts[k]) && filterList(lsts[k], dead) == -1)
+                goto error;
+        }
+    }
+
+done:
+    ret = Py_None;
+    Py_INCREF(ret);
+error:
+    Py_XDECREF(pkgs);
+    Py_XDECREF(kept);
+    Py_XDECREF(removed);
+    Py_XDECREF(prvtouched);
+    Py_XDECREF(deptouched);
+    Py_XDECREF(dead);
+    Py_XDECREF(fixprv);
+    Py_XDECREF(fixdep);
+    return ret;
+}
+
+PyObject *
+Cache_removeLoader(CacheObject *self, PyObject *loader)
+{
+    if (loader != Py_None) {
+        int i, len;
+        int found = 0;
+        len = PyList_GET_SIZE(self->_loaders);
+        for (i = len-1; i >= 0; i--) {
+            if (PyList_GET_ITEM(self->_loaders, i) == loader) {
+                PyList_SetSlice(self->_loaders, i, i+1, (PyObject *)NULL);
+                found = 1;
+            }
+        }
+        if (found) {
+            if (PyDict_GetItem(self->_loaded, loader)) {
+                PyObject *ret = Cache__retract(self, loader);
+                if (!ret) return NULL;
+                Py_DECREF(ret);
+            }
+            CALLMETHOD(loader, "setCache", "O", Py_None);
+            CALLMETHOD(loader, "unload", NULL);
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+PyObject *
+Cache__reload(CacheObject *self, PyObject *args)
+{
+    PyObject *packages = NULL;
+    PyObject *provides = NULL;
+    PyObject *requires = NULL;
+    PyObject *recommends = NULL;
+    PyObject *upgrades = NULL;
+    PyObject *conflicts = NULL;
+    PyObject *objmap = self->_objmap;
+    PyObject *loaders;
+    PyObject *keys = NULL;
+    PyObject *lst;
+    PyObject *ret;
+    PyObject *result = NULL;
+    int i, ilen;
+
+    /* loaders = dict.fromkeys(self._loaders, True) */
+    loaders = dictFromKeys(self->_loaders);
+    if (!loaders) return NULL;
+
+    /*
+      for loader in self._loaded.keys():
+          if loader not in loaders:
+              self._retract(loader)
+    */
+    keys = PyDict_Keys(self->_loaded);
+    if (!keys) goto error;
+    ilen = PyList_GET_SIZE(keys);
+    for (i = 0; i != ilen; i++) {
+        PyObject *loader = PyList_GET_ITEM(keys, i);
+        if (!PyDict_GetItem(loaders, loader)) {
+            ret = Cache__retract(self, loader);
+            if (!ret) goto error;
+            Py_DECREF(ret);
+        }
+    }
+    Py_CLEAR(keys);
+
+    /*
+      if not self._loaded:
+          self.reset()
+      elif not [x for x in self._loaders if x not in self._loaded]:
+          return
+    */
+    if (PyDict_Size(self->_loaded) == 0) {
+        ret = Cache_reset(self, NULL);
+        if (!ret) goto error;
+        Py_DECREF(ret);
+    } else {
+        ilen = PyList_GET_SIZE(self->_loaders);
+        for (i = 0; i != ilen; i++) {
+            if (!PyDict_GetItem(self->_loaded,
+                                PyList_GET_ITEM(self->_loaders, i)))
+                break;
+        }
+        if (i == ilen)
+            goto done;
+    }
+
+    /* self._thaw() */
+    if (Cache_thaw(self) == -1)
+        goto error;
+
+    /*
+      packages = dict.fromkeys(self._packages, True)
+      provides = dict.fromkeys(self._provides, True)
+      requires = dict.fromkeys(self._requires, True)
+      recommends = dict.fromkeys(self._recommends, True)
+      upgrades = dict.fromkeys(self._upgrades, True)
+      conflicts = dict.fromkeys(self._conflicts, True)
+    */
+    packages = dictFromKeys(self->_packages);
+    provides = dictFromKeys(self->_provides);
+    requires = dictFromKeys(self->_requires);
+    recommends = dictFromKeys(self->_recommends);
+    upgrades = dictFromKeys(self->_upgrades);
+    conflicts = dictFromKeys(self->_conflicts);
+    if (!packages || !provides || !requires || !recommends ||
+        !upgrades || !conflicts)
+        goto error;
+
+    /*
+      if self._loaded:
+          for pkg in self._packages:
+              objmap.setdefault(pkg.getInitArgs(), []).append(pkg)
+          for lst in (self._provides, self._requires, self._recommends,
+                      self._upgrades, self._conflicts):
+              for rel in lst:
+                  objmap[rel.getInitArgs()] = rel
+    */
+    if (PyDict_Size(self->_loaded) != 0) {
+        PyObject *lsts[5];
+        PyObject *initargs;
+        int k;
+        ilen = PyList_GET_SIZE(self->_packages);
+        for (i = 0; i != ilen; i++) {
+            PyObject *pkg = PyList_GET_ITEM(self->_packages, i);
+            initargs = PyObject_CallMethod(pkg, "getInitArgs", NULL);
+            if (!initargs) goto error;
+            lst = PyDict_GetItem(objmap, initargs);
+            if (!lst) {
+                lst = PyList_New(0);
+                PyDict_SetItem(objmap, initargs, lst);
+                Py_DECREF(lst);
+            }
+            PyList_Append(lst, pkg);
+            Py_DECREF(initargs);
+        }
+        lsts[0] = self->_provides;
+        lsts[1] = self->_requires;
+        lsts[2] = self->_recommends;
+        lsts[3] = self->_upgrades;
+        lsts[4] = self->_conflicts;
+        for (k = 0; k != 5; k++) {
+            ilen = PyList_GET_SIZE(lsts[k]);
+            for (i = 0; i != ilen; i++) {
+                PyObject *rel = PyList_GET_ITEM(lsts[k], i);
+                initargs = PyObject_CallMethod(rel, "getInitArgs", NULL);
+                if (!initargs) goto error;
+                PyDict_SetItem(objmap, initargs, rel);
+                Py_DECREF(initargs);
+            }
+        }
+    }
+
+    /*
+      for loader in self._loaders:
+          if loader in self._loaded:
+              continue
+    */
+    ilen = PyList_GET_SIZE(self->_loaders);
+    for (i = 0; i != ilen; i++) {
+        int j, jlen;
+        LoaderObject *loader =
+                        (LoaderObject *)PyList_GET_ITEM(self->_loaders, i);
+        if (!PyObject_IsInstance((PyObject *)loader,
+                                 (PyObject *)&Loader_Type)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "Loader is not a Loader instance");
+            goto error;
+        }
+        if (PyDict_GetItem(self->_loaded, (PyObject *)loader))
+            continue;
+
+        /* for pkg in loader._packages: */
+        jlen = PyList_GET_SIZE(loader->_packages);
+        for (j = 0; j != jlen; j++) {
+            PackageObject *pkg = (PackageObject *)
+                                    PyList_GET_ITEM(loader->_packages, j);
+            if (!PyObject_IsInstance((PyObject *)pkg,
+                                     (PyObject *)&Package_Type)) {
+                PyErr_SetString(PyExc_TypeError,
+                                "Package is not a Package instance");
+                goto error;
+            }
+
+            /* if pkg in packages: */
+            if (PyDict_GetItem(packages, (PyObject *)pkg)) {
+
+                /* pkg.installed |= loader._installed */
+                if (loader->_installed == Py_True) {
+                    Py_DECREF(pkg->installed);
+                    pkg->installed = loader->_installed;
+                    Py_INCREF(pkg->installed);
+                }
+
+            } else {
+
+                PyObject *args;
+                PyObject *lst;
+                int k, klen;
+
+                /* pkg.installed = loader._installed */
+                Py_DECREF(pkg->installed);
+                pkg->installed = loader->_installed;
                 Py_INCREF(pkg->installed);
 
                 /* packages[pkg] = True */
@@ -2835,7 +3535,7 @@ Cache__reload(CacheObject *self, PyObject *args)
                 /* objmap.setdefault(pkg.getInitArgs(), []).append(pkg) */
                 args = PyObject_CallMethod((PyObject *)pkg, "getInitArgs",
                                            NULL);
-                if (!args) return NULL;
+                if (!args) goto error;
                 lst = PyDict_GetItem(objmap, args);
                 if (!lst) {
                     lst = PyList_New(0);
@@ -2851,15 +3551,11 @@ Cache__reload(CacheObject *self, PyObject *args)
                          del pkg.loaders[pkgloader]
                 */
                 lst = PyDict_Keys(pkg->loaders);
+                if (!lst) goto error;
                 klen = PyList_GET_SIZE(lst);
                 for (k = 0; k != klen; k++) {
                     PyObject *pkgloader = PyList_GET_ITEM(lst, k);
-                    llen = PyList_GET_SIZE(self->_loaders);
-                    for (l = 0; l != llen; l++) {
-                        if (PyList_GET_ITEM(self->_loaders, l) == pkgloader)
-                            break;
-                    }
-                    if (l == llen)
+                    if (!PyDict_GetItem(loaders, pkgloader))
                         PyDict_DelItem(pkg->loaders, pkgloader);
                 }
                 Py_DECREF(lst);
@@ -2881,7 +3577,7 @@ Cache__reload(CacheObject *self, PyObject *args)
                             PyDict_SetItem(provides, prv, Py_True);
                             args = PyObject_CallMethod(prv, "getInitArgs",
                                                        NULL);
-                            if (!args) return NULL;
+                            if (!args) goto error;
                             PyDict_SetItem(objmap, args, prv);
                             Py_DECREF(args);
                         }
@@ -2905,7 +3601,7 @@ Cache__reload(CacheObject *self, PyObject *args)
                             PyDict_SetItem(requires, req, Py_True);
                             args = PyObject_CallMethod(req, "getInitArgs",
                                                        NULL);
-                            if (!args) return NULL;
+                            if (!args) goto error;
                             PyDict_SetItem(objmap, args, req);
                             Py_DECREF(args);
                         }
@@ -2929,31 +3625,7 @@ Cache__reload(CacheObject *self, PyObject *args)
                             PyDict_SetItem(recommends, rec, Py_True);
                             args = PyObject_CallMethod(rec, "getInitArgs",
                                                        NULL);
-                            if (!args) return NULL;
-                            PyDict_SetItem(objmap, args, rec);
-                            Py_DECREF(args);
-                        }
-                    }
-                }
-
-                /*
-                   for rec in pkg.recommends:
-                       rec.packages.append(pkg)
-                       if rec not in recommends:
-                           recommends[rec] = True
-                           objmap[rec.getInitArgs()] = rec
-                */
-                if (PyList_Check(pkg->recommends)) {
-                    klen = PyList_GET_SIZE(pkg->recommends);
-                    for (k = 0; k != klen; k++) {
-                        PyObject *rec = PyList_GET_ITEM(pkg->recommends, k);
-                        PyList_Append(((DependsObject *)rec)->packages,
-                                      (PyObject *)pkg);
-                        if (!PyDict_GetItem(recommends, rec)) {
-                            PyDict_SetItem(recommends, rec, Py_True);
-                            args = PyObject_CallMethod(rec, "getInitArgs",
-                                                       NULL);
-                            if (!args) return NULL;
+                            if (!args) goto error;
                             PyDict_SetItem(objmap, args, rec);
                             Py_DECREF(args);
                         }
@@ -2977,7 +3649,7 @@ Cache__reload(CacheObject *self, PyObject *args)
                             PyDict_SetItem(upgrades, upg, Py_True);
                             args = PyObject_CallMethod(upg, "getInitArgs",
                                                        NULL);
-                            if (!args) return NULL;
+                            if (!args) goto error;
                             PyDict_SetItem(objmap, args, upg);
                             Py_DECREF(args);
                         }
@@ -3001,7 +3673,7 @@ Cache__reload(CacheObject *self, PyObject *args)
                             PyDict_SetItem(conflicts, cnf, Py_True);
                             args = PyObject_CallMethod(cnf, "getInitArgs",
                                                        NULL);
-                            if (!args) return NULL;
+                            if (!args) goto error;
                             PyDict_SetItem(objmap, args, cnf);
                             Py_DECREF(args);
                         }
@@ -3017,49 +3689,92 @@ Cache__reload(CacheObject *self, PyObject *args)
     /* self._packages[:] = packages.keys() */
     Py_DECREF(self->_packages);
     self->_packages = PyDict_Keys(packages);
-    Py_DECREF(packages);
 
     /* self._provides[:] = provides.keys() */
     Py_DECREF(self->_provides);
     self->_provides = PyDict_Keys(provides);
-    Py_DECREF(provides);
 
     /* self._requires[:] = requires.keys() */
     Py_DECREF(self->_requires);
     self->_requires = PyDict_Keys(requires);
-    Py_DECREF(requires);
 
     /* self._recommends[:] = recommends.keys() */
     Py_DECREF(self->_recommends);
     self->_recommends = PyDict_Keys(recommends);
-    Py_DECREF(recommends);
 
     /* self._upgrades[:] = upgrades.keys() */
     Py_DECREF(self->_upgrades);
     self->_upgrades = PyDict_Keys(upgrades);
-    Py_DECREF(upgrades);
 
     /* self._conflicts[:] = conflicts.keys() */
     Py_DECREF(self->_conflicts);
     self->_conflicts = PyDict_Keys(conflicts);
-    Py_DECREF(conflicts);
 
-    Py_INCREF(Py_None);
-    return Py_None;
+done:
+    result = Py_None;
+    Py_INCREF(result);
+error:
+    Py_XDECREF(packages);
+    Py_XDECREF(provides);
+    Py_XDECREF(requires);
+    Py_XDECREF(recommends);
+    Py_XDECREF(upgrades);
+    Py_XDECREF(conflicts);
+    Py_XDECREF(keys);
+    Py_DECREF(loaders);
+    return result;
 }
 
-PyObject *
-Cache_load(CacheObject *self, PyObject *args)
+static PyObject *
+Cache__load(CacheObject *self)
 {
     int i, len;
     int total = 1;
     PyObject *hooks;
     PyObject *prog;
+    PyObject *linked;
+    PyObject *loaders;
+    PyObject *records;
+    PyObject *index;
     PyObject *ret;
 
+    /*
+       linked = None
+       if self._loaded:
+           linked = [dict.fromkeys(lst, True)
+                     for lst in (self._provides, self._requires,
+                                 self._recommends, self._upgrades,
+                                 self._conflicts)]
+    */
+    if (PyDict_Size(self->_loaded) != 0) {
+        linked = PyList_New(5);
+        if (!linked) return NULL;
+        PyList_SET_ITEM(linked, 0, dictFromKeys(self->_provides));
+        PyList_SET_ITEM(linked, 1, dictFromKeys(self->_requires));
+        PyList_SET_ITEM(linked, 2, dictFromKeys(self->_recommends));
+        PyList_SET_ITEM(linked, 3, dictFromKeys(self->_upgrades));
+        PyList_SET_ITEM(linked, 4, dictFromKeys(self->_conflicts));
+        for (i = 0; i != 5; i++) {
+            if (!PyList_GET_ITEM(linked, i)) {
+                Py_DECREF(linked);
+                return NULL;
+            }
+        }
+    } else {
+        linked = Py_None;
+        Py_INCREF(linked);
+    }
+
+    /* index = self._searchindex */
+    index = self->_searchindex;
+    Py_XINCREF(index);
+
     ret = Cache__reload(self, NULL);
-    if (ret == NULL)
+    if (ret == NULL) {
+        Py_DECREF(linked);
+        Py_XDECREF(index);
         return NULL;
+    }
     Py_DECREF(ret);
 
     prog = PyObject_CallMethod(getIface(), "getProgress", "OO",
@@ -3068,32 +3783,131 @@ Cache_load(CacheObject *self, PyObject *args)
     CALLMETHOD(prog, "setTopic", "O", _("Updating cache..."));
     CALLMETHOD(prog, "set", "ii", 0, 1);
     CALLMETHOD(prog, "show", NULL);
+
+    /*
+       loaders = [x for x in self._loaders
+                  if not x._packages and x not in self._loaded]
+    */
+    loaders = PyList_New(0);
     len = PyList_GET_SIZE(self->_loaders);
     for (i = 0; i != len; i++) {
         PyObject *loader = PyList_GET_ITEM(self->_loaders, i);
-        if (PyList_GET_SIZE(((LoaderObject *)loader)->_packages) == 0) {
-            PyObject *res = PyObject_CallMethod(loader, "getLoadSteps", NULL);
-            if (!res) {
-                Py_DECREF(prog);
-                return NULL;
-            }
-            total += PyInt_AsLong(res);
-            Py_DECREF(res);
+        if (PyList_GET_SIZE(((LoaderObject *)loader)->_packages) == 0 &&
+            !PyDict_GetItem(self->_loaded, loader))
+            PyList_Append(loaders, loader);
+    }
+
+    len = PyList_GET_SIZE(loaders);
+    for (i = 0; i != len; i++) {
+        PyObject *loader = PyList_GET_ITEM(loaders, i);
+        PyObject *res = PyObject_CallMethod(loader, "getLoadSteps", NULL);
+        if (!res) {
+            Py_DECREF(prog);
+            Py_DECREF(linked);
+            Py_DECREF(loaders);
+            Py_XDECREF(index);
+            return NULL;
         }
+        total += PyInt_AsLong(res);
+        Py_DECREF(res);
     }
     CALLMETHOD(prog, "set", "ii", 0, total);
     CALLMETHOD(prog, "show", NULL);
-    len = PyList_GET_SIZE(self->_loaders);
+
+    /* records = parseLoaders(loaders, prog) */
+    records = PyObject_CallFunctionObjArgs(getParseLoaders(), loaders,
+                                           prog, NULL);
+    if (!records || !PyDict_Check(records)) {
+        if (records) {
+            PyErr_SetString(PyExc_TypeError,
+                            "parseLoaders() must return a dictionary");
+            Py_DECREF(records);
+        }
+        Py_DECREF(prog);
+        Py_DECREF(linked);
+        Py_DECREF(loaders);
+        Py_XDECREF(index);
+        return NULL;
+    }
+
+    /*
+       for loader in loaders:
+           if loader in records:
+               loader.loadRecords(records[loader])
+           else:
+               loader.load()
+    */
     for (i = 0; i != len; i++) {
-        PyObject *loader = PyList_GET_ITEM(self->_loaders, i);
-        if (PyList_GET_SIZE(((LoaderObject *)loader)->_packages) == 0)
+        PyObject *loader = PyList_GET_ITEM(loaders, i);
+        PyObject *lst = PyDict_GetItem(records, loader);
+        if (lst)
+            CALLMETHOD(loader, "loadRecords", "O", lst);
+        else
             CALLMETHOD(loader, "load", NULL);
     }
-    CALLMETHOD(self, "loadFileProvides", NULL);
+    Py_DECREF(records);
+    Py_DECREF(loaders);
+    CALLMETHOD(self, "loadFileProvides", "O", linked);
     hooks = getHooks();
     CALLMETHOD(hooks, "call", "sO", "cache-loaded-pre-link", self);
     PyDict_Clear(self->_objmap);
-    CALLMETHOD(self, "linkDeps", NULL);
+    CALLMETHOD(self, "linkDeps", "O", linked);
+    Py_DECREF(linked);
+
+    /*
+       for loader in self._loaders:
+           self._loaded[loader] = True
+    */
+    len = PyList_GET_SIZE(self->_loaders);
+    for (i = 0; i != len; i++)
+        PyDict_SetItem(self->_loaded, PyList_GET_ITEM(self->_loaders, i),
+                       Py_True);
+
+    /*
+       A cache from the cache file is rebuilt out of the same packages,
+       so its search index is still good for them.
+
+       if (index and self._searchindex is not index and
+           index.covers(self._packages, self._provides)):
+           self._searchindex = index
+    */
+    if (index && index != Py_None && index != self->_searchindex) {
+        ret = PyObject_CallMethod(index, "covers", "OO",
+                                  self->_packages, self->_provides);
+        if (!ret) {
+            Py_DECREF(prog);
+            Py_DECREF(index);
+            return NULL;
+        }
+        if (PyObject_IsTrue(ret)) {
+            Py_XDECREF(self->_searchindex);
+            self->_searchindex = index;
+            Py_INCREF(index);
+        }
+        Py_DECREF(ret);
+    }
+    Py_XDECREF(index);
+
+    /*
+       if sysconf.get("cache-compact", False):
+           self.compact()
+    */
+    ret = PyObject_CallMethod(getSysConf(), "get", "sO",
+                              "cache-compact", Py_False);
+    if (!ret) {
+        Py_DECREF(prog);
+        return NULL;
+    }
+    if (PyObject_IsTrue(ret)) {
+        Py_DECREF(ret);
+        ret = Cache_compact(self, NULL);
+        if (!ret) {
+            Py_DECREF(prog);
+            return NULL;
+        }
+    }
+    Py_DECREF(ret);
+
     CALLMETHOD(prog, "setDone", NULL);
     CALLMETHOD(prog, "show", NULL);
     CALLMETHOD(prog, "stop", NULL);
@@ -3102,6 +3916,54 @@ Cache_load(CacheObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+PyObject *
+Cache_load(CacheObject *self, PyObject *args)
+{
+    PyObject *gc = getGC();
+    PyObject *enabled;
+    PyObject *ret;
+    PyObject *type, *value, *tb;
+
+    /*
+       enabled = gc.isenabled()
+       gc.disable()
+       try:
+           self._load()
+       finally:
+           if enabled:
+               gc.enable()
+    */
+    if (!gc) return NULL;
+    enabled = PyObject_CallMethod(gc, "isenabled", NULL);
+    if (!enabled) return NULL;
+    if (PyObject_IsTrue(enabled)) {
+        ret = PyObject_CallMethod(gc, "disable", NULL);
+        if (!ret) {
+            Py_DECREF(enabled);
+            return NULL;
+        }
+        Py_DECREF(ret);
+    }
+    ret = Cache__load(self);
+    if (PyObject_IsTrue(enabled)) {
+        PyObject *res;
+        PyErr_Fetch(&type, &value, &tb);
+        res = PyObject_CallMethod(gc, "enable", NULL);
+        if (!res) {
+            Py_XDECREF(type);
+            Py_XDECREF(value);
+            Py_XDECREF(tb);
+            Py_XDECREF(ret);
+            Py_DECREF(enabled);
+            return NULL;
+        }
+        Py_DECREF(res);
+        PyErr_Restore(type, value, tb);
+    }
+    Py_DECREF(enabled);
+    return ret;
+}
+
 PyObject *
 Cache_unload(CacheObject *self, PyObject *args)
 {
@@ -3115,503 +3977,342 @@ Cache_unload(CacheObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+/*
+   Returns the item-th dictionary of linked relations, as given
+   to loadFileProvides() and linkDeps(), or NULL if nothing was
+   linked yet.
+*/
+static int
+getLinked(PyObject *linked, int item, PyObject **dict)
+{
+    *dict = NULL;
+    if (linked == Py_None || !PyObject_IsTrue(linked))
+        return 0;
+    if (!PyList_Check(linked) || PyList_GET_SIZE(linked) != 5 ||
+        !PyDict_Check(PyList_GET_ITEM(linked, item))) {
+        PyErr_SetString(PyExc_TypeError,
+                        "linked must be a list with 5 dictionaries");
+        return -1;
+    }
+    *dict = PyList_GET_ITEM(linked, item);
+    return 0;
+}
+
 PyObject *
 Cache_loadFileProvides(CacheObject *self, PyObject *args)
 {
-    PyObject *fndict = PyDict_New();
+    PyObject *linked = Py_None;
+    PyObject *reqlinked;
+    PyObject *fndict;
+    PyObject *newfndict;
     int i, len;
+    if (!PyArg_ParseTuple(args, "|O", &linked))
+        return NULL;
+    if (getLinked(linked, 1, &reqlinked) == -1)
+        return NULL;
+    fndict = PyDict_New();
+    newfndict = PyDict_New();
     len = PyList_GET_SIZE(self->_requires);
     for (i = 0; i != len; i++) {
         DependsObject *req =
             (DependsObject *)PyList_GET_ITEM(self->_requires, i);
-        if (STR(req->name)[0] == '/')
+        if (STR(req->name)[0] == '/') {
             PyDict_SetItem(fndict, req->name, req->name);
+            if (reqlinked && !PyDict_GetItem(reqlinked, (PyObject *)req))
+                PyDict_SetItem(newfndict, req->name, req->name);
+        }
     }
     len = PyList_GET_SIZE(self->_loaders);
     for (i = 0; i != len; i++) {
         PyObject *loader = PyList_GET_ITEM(self->_loaders, i);
-        CALLMETHOD(loader, "loadFileProvides", "O", fndict);
+        if (!PyDict_GetItem(self->_loaded, loader))
+            CALLMETHOD(loader, "loadFileProvides", "O", fndict);
+        else if (PyDict_Size(newfndict) != 0)
+            CALLMETHOD(loader, "loadFileProvides", "O", newfndict);
     }
+    Py_DECREF(fndict);
+    Py_DECREF(newfndict);
     Py_RETURN_NONE;
 }
 
-PyObject *
-Cache_linkDeps(CacheObject *self, PyObject *args)
-{
-    int i, j, len;
-    PyObject *reqnames, *recnames, *upgnames, *cnfnames;
-    PyObject *lst;
+/*
+   Dependency classes registered with registerMatcher() have their
+   matches() logic implemented here, so that linkDeps() may check
+   them without calling into Python. The matcher is only used while
+   the class keeps the matches() and getMatchNames() methods it had
+   when registered.
+*/
 
-    /* reqnames = {} */
-    reqnames = PyDict_New();
-    /* for req in self._requires: */
-    len = PyList_GET_SIZE(self->_requires);
-    for (i = 0; i != len; i++) {
-        PyObject *req = PyList_GET_ITEM(self->_requires, i);
+#define MATCH_ANYPRVVERSION 1 /* Unversioned provides match anything. */
+#define MATCH_SPLITARCH     2 /* Versions may have an @arch suffix. */
 
-        /* for name in req.getMatchNames(): */
-        PyObject *names = PyObject_CallMethod(req, "getMatchNames", NULL);
-        PyObject *seq = PySequence_Fast(names, "getMatchNames() returned "
-                                               "non-sequence object");
-        int nameslen;
-        if (!seq) return NULL;
-        nameslen = PySequence_Fast_GET_SIZE(seq);
-        for (j = 0; j != nameslen; j++) {
-            PyObject *name = PySequence_Fast_GET_ITEM(seq, j);
-            
-            /* lst = reqnames.get(name) */
-            lst = PyDict_GetItem(reqnames, name);
-
-            /* 
-               if lst:
-                   lst.append(req)
-               else:
-                   reqnames[name] = [req]
-            */
-            if (lst) {
-                PyList_Append(lst, req);
-            } else {
-                lst = PyList_New(1);
-                Py_INCREF(req);
-                PyList_SET_ITEM(lst, 0, req);
-                PyDict_SetItem(reqnames, name, lst);
-                Py_DECREF(lst);
-            }
-        }
+/*
+   Takes the provided version, the relation, the required version and
+   whether to ignore @arch suffixes. Returns -1 on errors.
+*/
+typedef int (*CheckDepFunc)(PyObject *, const char *, PyObject *, int);
 
-        Py_DECREF(names);
-        Py_DECREF(seq);
-    }
+typedef struct {
+    PyTypeObject *prvtype;
+    PyObject *matches;
+    PyObject *getmatchnames;
+    CheckDepFunc checkdep;
+    int flags;
+} DependsMatcher;
 
-    /* recnames = {} */
-    recnames = PyDict_New();
-    /* for rec in self._recommends: */
-    len = PyList_GET_SIZE(self->_recommends);
-    for (i = 0; i != len; i++) {
-        PyObject *rec = PyList_GET_ITEM(self->_recommends, i);
+static PyObject *Matchers = NULL;
 
-        /* for name in rec.getMatchNames(): */
-        PyObject *names = PyObject_CallMethod(rec, "getMatchNames", NULL);
-        PyObject *seq = PySequence_Fast(names, "getMatchNames() returned "
-                                               "non-sequence object");
-        int nameslen;
-        if (!seq) return NULL;
-        nameslen = PySequence_Fast_GET_SIZE(seq);
-        for (j = 0; j != nameslen; j++) {
-            PyObject *name = PySequence_Fast_GET_ITEM(seq, j);
-            
-            /* lst = recnames.get(name) */
-            lst = PyDict_GetItem(recnames, name);
-
-            /* 
-               if lst:
-                   lst.append(rec)
-               else:
-                   recnames[name] = [rec]
-            */
-            if (lst) {
-                PyList_Append(lst, rec);
-            } else {
-                lst = PyList_New(1);
-                Py_INCREF(rec);
-                PyList_SET_ITEM(lst, 0, rec);
-                PyDict_SetItem(recnames, name, lst);
-                Py_DECREF(lst);
-            }
-        }
+static PyObject *
+getTypeAttr(PyTypeObject *type, const char *name)
+{
+    PyObject *str = PyString_InternFromString(name);
+    PyObject *attr;
+    if (!str) return NULL;
+    attr = _PyType_Lookup(type, str);
+    Py_DECREF(str);
+    return attr;
+}
 
-        Py_DECREF(names);
-        Py_DECREF(seq);
+static DependsMatcher *
+getMatcher(PyTypeObject *type)
+{
+    static PyObject *matchesstr = NULL;
+    static PyObject *getmatchnamesstr = NULL;
+    DependsMatcher *matcher;
+    PyObject *o;
+    if (!Matchers)
+        return NULL;
+    o = PyDict_GetItem(Matchers, (PyObject *)type);
+    if (!o)
+        return NULL;
+    if (!matchesstr) {
+        matchesstr = PyString_InternFromString("matches");
+        getmatchnamesstr = PyString_InternFromString("getMatchNames");
+        if (!matchesstr || !getmatchnamesstr)
+            return NULL;
     }
+    matcher = (DependsMatcher *)PyCObject_AsVoidPtr(o);
+    if (_PyType_Lookup(type, matchesstr) != matcher->matches ||
+        _PyType_Lookup(type, getmatchnamesstr) != matcher->getmatchnames)
+        return NULL;
+    return matcher;
+}
 
-    /* recnames = {} */
-    recnames = PyDict_New();
-    /* for rec in self._recommends: */
-    len = PyList_GET_SIZE(self->_recommends);
-    for (i = 0; i != len; i++) {
-        PyObject *rec = PyList_GET_ITEM(self->_recommends, i);
-
-        /* for name in rec.getMatchNames(): */
-        PyObject *names = PyObject_CallMethod(rec, "getMatchNames", NULL);
-        PyObject *seq = PySequence_Fast(names, "getMatchNames() returned "
-                                               "non-sequence object");
-        int nameslen;
-        if (!seq) return NULL;
-        nameslen = PySequence_Fast_GET_SIZE(seq);
-        for (j = 0; j != nameslen; j++) {
-            PyObject *name = PySequence_Fast_GET_ITEM(seq, j);
-            
-            /* lst = recnames.get(name) */
-            lst = PyDict_GetItem(recnames, name);
-
-            /* 
-               if lst:
-                   lst.append(rec)
-               else:
-                   recnames[name] = [rec]
-            */
-            if (lst) {
-                PyList_Append(lst, rec);
-            } else {
-                lst = PyList_New(1);
-                Py_INCREF(rec);
-                PyList_SET_ITEM(lst, 0, rec);
-                PyDict_SetItem(recnames, name, lst);
-                Py_DECREF(lst);
-            }
-        }
-
-        Py_DECREF(names);
-        Py_DECREF(seq);
-    }
+#define VERSION_EMPTY(o) \
+    ((o) == Py_None || (PyString_Check(o) && PyString_GET_SIZE(o) == 0))
 
-    /* upgnames = {} */
-    upgnames = PyDict_New();
-    /* for upg in self._upgrades: */
-    len = PyList_GET_SIZE(self->_upgrades);
-    for (i = 0; i != len; i++) {
-        PyObject *upg = PyList_GET_ITEM(self->_upgrades, i);
+/*
+   Returns 1 if dep matches prv, 0 if it doesn't, and -1 if the
+   matcher can't tell, in which case dep.matches() must be used.
+*/
+static int
+matchDepends(DependsMatcher *matcher, DependsObject *dep,
+             ProvidesObject *prv)
+{
+    int rc;
 
-        /* for name in upg.getMatchNames(): */
-        PyObject *names = PyObject_CallMethod(upg, "getMatchNames", NULL);
-        PyObject *seq = PySequence_Fast(names, "getMatchNames() returned "
-                                               "non-sequence object");
-        int nameslen;
-        if (!seq) return NULL;
-        nameslen = PySequence_Fast_GET_SIZE(seq);
-        for (j = 0; j != nameslen; j++) {
-            PyObject *name = PySequence_Fast_GET_ITEM(seq, j);
-            
-            /* lst = upgnames.get(name) */
-            lst = PyDict_GetItem(upgnames, name);
-
-            /* 
-               if lst:
-                   lst.append(upg)
-               else:
-                   upgnames[name] = [upg]
-            */
-            if (lst) {
-                PyList_Append(lst, upg);
-            } else {
-                lst = PyList_New(1);
-                Py_INCREF(upg);
-                PyList_SET_ITEM(lst, 0, upg);
-                PyDict_SetItem(upgnames, name, lst);
-                Py_DECREF(lst);
-            }
-        }
+    /*
+       if not isinstance(prv, prvtype) and type(prv) is not Provides:
+           return False
+    */
+    if (prv->ob_type != &Provides_Type &&
+        !PyType_IsSubtype(prv->ob_type, matcher->prvtype))
+        return 0;
 
-        Py_DECREF(names);
-        Py_DECREF(seq);
-    }
+    if (VERSION_EMPTY(dep->version))
+        return 1;
+    if (VERSION_EMPTY(prv->version))
+        return (matcher->flags & MATCH_ANYPRVVERSION) != 0;
+    if (!PyString_Check(dep->version) || !PyString_Check(prv->version) ||
+        !PyString_Check(dep->relation))
+        return -1;
 
-    /* cnfnames = {} */
-    cnfnames = PyDict_New();
-    /* for cnf in self._conflicts: */
-    len = PyList_GET_SIZE(self->_conflicts);
-    for (i = 0; i != len; i++) {
-        PyObject *cnf = PyList_GET_ITEM(self->_conflicts, i);
+    /* return checkdep(prv.version, self.relation, self.version) */
+    rc = matcher->checkdep(prv->version, STR(dep->relation), dep->version,
+                           matcher->flags & MATCH_SPLITARCH);
+    if (rc == -1)
+        PyErr_Clear();
+    return rc;
+}
 
-        /* for name in cnf.getMatchNames(): */
-        PyObject *names = PyObject_CallMethod(cnf, "getMatchNames", NULL);
-        PyObject *seq = PySequence_Fast(names, "getMatchNames() returned "
-                                               "non-sequence object");
-        int nameslen;
-        if (!seq) return NULL;
-        nameslen = PySequence_Fast_GET_SIZE(seq);
-        for (j = 0; j != nameslen; j++) {
-            PyObject *name = PySequence_Fast_GET_ITEM(seq, j);
-            
-            /* lst = cnfnames.get(name) */
-            lst = PyDict_GetItem(cnfnames, name);
-
-            /* 
-               if lst:
-                   lst.append(cnf)
-               else:
-                   cnfnames[name] = [cnf]
-            */
-            if (lst) {
-                PyList_Append(lst, cnf);
-            } else {
-                lst = PyList_New(1);
-                Py_INCREF(cnf);
-                PyList_SET_ITEM(lst, 0, cnf);
-                PyDict_SetItem(cnfnames, name, lst);
-                Py_DECREF(lst);
-            }
-        }
+/*
+   Link the given dependencies with the provides matching them. The
+   byoffset is the offset of the provides field holding the reverse
+   links (requiredby, recommendedby, etc). When prvlinked is given,
+   pairs where both sides are in prvlinked and deplinked are skipped,
+   since they were linked before.
+*/
+static int
+linkDepsKind(CacheObject *self, PyObject *deps, size_t byoffset,
+             PyObject *prvlinked, PyObject *deplinked)
+{
+    PyObject *depnames = NULL, *newdepnames = NULL;
+    PyObject *names = NULL, *seq = NULL;
+    PyObject *lst;
+    PyTypeObject *lasttype = NULL;
+    DependsMatcher *matcher = NULL;
+    int i, j, len;
+    int ret = -1;
 
-        Py_DECREF(names);
-        Py_DECREF(seq);
-    }
+    /*
+       depnames = {}
+       newdepnames = {}
+    */
+    depnames = PyDict_New();
+    newdepnames = PyDict_New();
+    if (!depnames || !newdepnames)
+        goto done;
 
-    /* for prv in self._provides: */
-    len = PyList_GET_SIZE(self->_provides);
+    /* for dep in deps: */
+    len = PyList_GET_SIZE(deps);
     for (i = 0; i != len; i++) {
-        ProvidesObject *prv;
-
-        prv = (ProvidesObject *)PyList_GET_ITEM(self->_provides, i);
-
-        /* lst = reqnames.get(prv.name) */
-        lst = PyDict_GetItem(reqnames, prv->name);
-
-        /* if lst: */
-        if (lst) {
-            /* for req in lst: */
-            int reqlen = PyList_GET_SIZE(lst);
-            for (j = 0; j != reqlen; j++) {
-                DependsObject *req = (DependsObject *)PyList_GET_ITEM(lst, j);
-                /* if req.matches(prv): */
-                PyObject *ret = PyObject_CallMethod((PyObject *)req, "matches",
-                                                    "O", (PyObject *)prv);
-                if (!ret) return NULL;
-                if (PyObject_IsTrue(ret)) {
-                    /*
-                       if req.providedby:
-                           req.providedby.append(prv)
-                       else:
-                           req.providedby = [prv]
-                    */
-                    if (PyList_Check(req->providedby)) {
-                        PyList_Append(req->providedby, (PyObject *)prv);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(prv);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)prv);
-                        Py_DECREF(req->providedby);
-                        req->providedby = _lst;
-                    }
-
-                    /*
-                       if prv.requiredby:
-                           prv.requiredby.append(prv)
-                       else:
-                           prv.requiredby = [prv]
-                    */
-                    if (PyList_Check(prv->requiredby)) {
-                        PyList_Append(prv->requiredby, (PyObject *)req);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(req);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)req);
-                        Py_DECREF(prv->requiredby);
-                        prv->requiredby = _lst;
-                    }
-                }
-                Py_DECREF(ret);
-            }
-        }
-
-        /* lst = recnames.get(prv.name) */
-        lst = PyDict_GetItem(recnames, prv->name);
-
-        /* if lst: */
-        if (lst) {
-            /* for rec in lst: */
-            int reclen = PyList_GET_SIZE(lst);
-            for (j = 0; j != reclen; j++) {
-                DependsObject *rec = (DependsObject *)PyList_GET_ITEM(lst, j);
-                /* if rec.matches(prv): */
-                PyObject *ret = PyObject_CallMethod((PyObject *)rec, "matches",
-                                                    "O", (PyObject *)prv);
-                if (!ret) return NULL;
-                if (PyObject_IsTrue(ret)) {
-                    /*
-                       if rec.providedby:
-                           rec.providedby.append(prv)
-                       else:
-                           rec.providedby = [prv]
-                    */
-                    if (PyList_Check(rec->providedby)) {
-                        PyList_Append(rec->providedby, (PyObject *)prv);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(prv);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)prv);
-                        Py_DECREF(rec->providedby);
-                        rec->providedby = _lst;
-                    }
-
-                    /*
-                       if prv.recommendedby:
-                           prv.recommendedby.append(prv)
-                       else:
-                           prv.recommendedby = [prv]
-                    */
-                    if (PyList_Check(prv->recommendedby)) {
-                        PyList_Append(prv->recommendedby, (PyObject *)rec);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(rec);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)rec);
-                        Py_DECREF(prv->recommendedby);
-                        prv->recommendedby = _lst;
-                    }
-                }
-                Py_DECREF(ret);
-            }
-        }
-
-        /* lst = recnames.get(prv.name) */
-        lst = PyDict_GetItem(recnames, prv->name);
-
-        /* if lst: */
-        if (lst) {
-            /* for rec in lst: */
-            int reclen = PyList_GET_SIZE(lst);
-            for (j = 0; j != reclen; j++) {
-                DependsObject *rec = (DependsObject *)PyList_GET_ITEM(lst, j);
-                /* if rec.matches(prv): */
-                PyObject *ret = PyObject_CallMethod((PyObject *)rec, "matches",
-                                                    "O", (PyObject *)prv);
-                if (!ret) return NULL;
-                if (PyObject_IsTrue(ret)) {
-                    /*
-                       if rec.providedby:
-                           rec.providedby.append(prv)
-                       else:
-                           rec.providedby = [prv]
-                    */
-                    if (PyList_Check(rec->providedby)) {
-                        PyList_Append(rec->providedby, (PyObject *)prv);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(prv);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)prv);
-                        Py_DECREF(rec->providedby);
-                        rec->providedby = _lst;
-                    }
-
-                    /*
-                       if prv.recommendedby:
-                           prv.recommendedby.append(prv)
-                       else:
-                           prv.recommendedby = [prv]
-                    */
-                    if (PyList_Check(prv->recommendedby)) {
-                        PyList_Append(prv->recommendedby, (PyObject *)rec);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(rec);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)rec);
-                        Py_DECREF(prv->recommendedby);
-                        prv->recommendedby = _lst;
-                    }
-                }
-                Py_DECREF(ret);
-            }
-        }
-
-        /* lst = upgnames.get(prv.name) */
-        lst = PyDict_GetItem(upgnames, prv->name);
+        PyObject *dep = PyList_GET_ITEM(deps, i);
+        int nameslen;
 
-        /* if lst: */
-        if (lst) {
+        /* isnew = linked and dep not in deplinked */
+        int isnew = prvlinked && !PyDict_GetItem(deplinked, dep);
 
-            /* for upg in lst: */
-            int upglen = PyList_GET_SIZE(lst);
-            for (j = 0; j != upglen; j++) {
-                DependsObject *upg = (DependsObject *)PyList_GET_ITEM(lst, j);
-                /* if upg.matches(prv): */
-                PyObject *ret = PyObject_CallMethod((PyObject *)upg, "matches",
-                                                    "O", (PyObject *)prv);
-                if (!ret) return NULL;
-                if (PyObject_IsTrue(ret)) {
-                    /*
-                       if upg.providedby:
-                           upg.providedby.append(prv)
-                       else:
-                           upg.providedby = [prv]
-                    */
-                    if (PyList_Check(upg->providedby)) {
-                        PyList_Append(upg->providedby, (PyObject *)prv);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(prv);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)prv);
-                        Py_DECREF(upg->providedby);
-                        upg->providedby = _lst;
-                    }
+        if (dep->ob_type != lasttype) {
+            lasttype = dep->ob_type;
+            matcher = getMatcher(lasttype);
+        }
+        if (matcher && PyString_CheckExact(((DependsObject *)dep)->name)) {
+            /* The name is the only match name. Interning it makes
+               the lookups below cheaper and shares it in memory. */
+            PyObject **name = &((DependsObject *)dep)->name;
+            PyString_InternInPlace(name);
+            if (appendToDictList(depnames, *name, dep) == -1)
+                goto done;
+            if (isnew && appendToDictList(newdepnames, *name, dep) == -1)
+                goto done;
+            continue;
+        }
 
-                    /*
-                       if prv.upgradedby:
-                           prv.upgradedby.append(prv)
-                       else:
-                           prv.upgradedby = [prv]
-                    */
-                    if (PyList_Check(prv->upgradedby)) {
-                        PyList_Append(prv->upgradedby, (PyObject *)upg);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(upg);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)upg);
-                        Py_DECREF(prv->upgradedby);
-                        prv->upgradedby = _lst;
-                    }
-                }
-                Py_DECREF(ret);
-            }
+        /* for name in dep.getMatchNames(): */
+        names = PyObject_CallMethod(dep, "getMatchNames", NULL);
+        if (!names)
+            goto done;
+        seq = PySequence_Fast(names, "getMatchNames() returned "
+                                     "non-sequence object");
+        if (!seq)
+            goto done;
+        nameslen = PySequence_Fast_GET_SIZE(seq);
+        for (j = 0; j != nameslen; j++) {
+            PyObject *name = PySequence_Fast_GET_ITEM(seq, j);
+            if (appendToDictList(depnames, name, dep) == -1)
+                goto done;
+            if (isnew && appendToDictList(newdepnames, name, dep) == -1)
+                goto done;
         }
+        Py_CLEAR(names);
+        Py_CLEAR(seq);
+    }
+
+    /* for prv in self._provides: */
+    len = PyList_GET_SIZE(self->_provides);
+    for (i = 0; i != len; i++) {
+        ProvidesObject *prv;
+        PyObject **by;
+
+        prv = (ProvidesObject *)PyList_GET_ITEM(self->_provides, i);
+        by = (PyObject **)((char *)prv + byoffset);
+        if (PyString_CheckExact(prv->name))
+            PyString_InternInPlace(&prv->name);
 
-        /* lst = cnfnames.get(prv.name) */
-        lst = PyDict_GetItem(cnfnames, prv->name);
+        /*
+           if linked and prv in prvlinked:
+               lst = newdepnames.get(prv.name)
+           else:
+               lst = depnames.get(prv.name)
+        */
+        if (prvlinked && PyDict_GetItem(prvlinked, (PyObject *)prv))
+            lst = PyDict_GetItem(newdepnames, prv->name);
+        else
+            lst = PyDict_GetItem(depnames, prv->name);
 
         /* if lst: */
         if (lst) {
-
-            /* for cnf in lst: */
-            int cnflen = PyList_GET_SIZE(lst);
-            for (j = 0; j != cnflen; j++) {
-                DependsObject *cnf = (DependsObject *)PyList_GET_ITEM(lst, j);
-                /* if cnf.matches(prv): */
-                PyObject *ret = PyObject_CallMethod((PyObject *)cnf, "matches",
-                                                    "O", (PyObject *)prv);
-                if (!ret) return NULL;
-                if (PyObject_IsTrue(ret)) {
+            /* for dep in lst: */
+            int deplen = PyList_GET_SIZE(lst);
+            for (j = 0; j != deplen; j++) {
+                DependsObject *dep = (DependsObject *)PyList_GET_ITEM(lst, j);
+                int rc = -1;
+
+                /* if dep.matches(prv): */
+                if (dep->ob_type != lasttype) {
+                    lasttype = dep->ob_type;
+                    matcher = getMatcher(lasttype);
+                }
+                if (matcher)
+                    rc = matchDepends(matcher, dep, prv);
+                if (rc == -1) {
+                    PyObject *res = PyObject_CallMethod((PyObject *)dep,
+                                                        "matches", "O",
+                                                        (PyObject *)prv);
+                    if (!res)
+                        goto done;
+                    rc = PyObject_IsTrue(res);
+                    Py_DECREF(res);
+                    if (rc == -1)
+                        goto done;
+                }
+                if (rc) {
                     /*
-                       if cnf.providedby:
-                           cnf.providedby.append(prv)
+                       if dep.providedby:
+                           dep.providedby.append(prv)
                        else:
-                           cnf.providedby = [prv]
-                    */
-                    if (PyList_Check(cnf->providedby)) {
-                        PyList_Append(cnf->providedby, (PyObject *)prv);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(prv);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)prv);
-                        Py_DECREF(cnf->providedby);
-                        cnf->providedby = _lst;
-                    }
+                           dep.providedby = [prv]
 
-                    /*
-                       if prv.conflictedby:
-                           prv.conflictedby.append(prv)
+                       by = getattr(prv, attr)
+                       if by:
+                           by.append(dep)
                        else:
-                           prv.conflictedby = [prv]
+                           setattr(prv, attr, [dep])
                     */
-                    if (PyList_Check(prv->conflictedby)) {
-                        PyList_Append(prv->conflictedby, (PyObject *)cnf);
-                    } else {
-                        PyObject *_lst = PyList_New(1);
-                        Py_INCREF(cnf);
-                        PyList_SET_ITEM(_lst, 0, (PyObject *)cnf);
-                        Py_DECREF(prv->conflictedby);
-                        prv->conflictedby = _lst;
-                    }
+                    if (appendToLink(&dep->providedby,
+                                     (PyObject *)prv) == -1 ||
+                        appendToLink(by, (PyObject *)dep) == -1)
+                        goto done;
                 }
-                Py_DECREF(ret);
             }
         }
     }
+    ret = 0;
 
-    Py_DECREF(reqnames);
-    Py_DECREF(recnames);
-    Py_DECREF(upgnames);
-    Py_DECREF(cnfnames);
+done:
+    Py_XDECREF(names);
+    Py_XDECREF(seq);
+    Py_XDECREF(depnames);
+    Py_XDECREF(newdepnames);
+    return ret;
+}
 
+PyObject *
+Cache_linkDeps(CacheObject *self, PyObject *args)
+{
+    PyObject *linked = Py_None;
+    PyObject *prvlinked, *reqlinked, *reclinked, *upglinked, *cnflinked;
+    if (!PyArg_ParseTuple(args, "|O", &linked))
+        return NULL;
+    if (getLinked(linked, 0, &prvlinked) == -1 ||
+        getLinked(linked, 1, &reqlinked) == -1 ||
+        getLinked(linked, 2, &reclinked) == -1 ||
+        getLinked(linked, 3, &upglinked) == -1 ||
+        getLinked(linked, 4, &cnflinked) == -1)
+        return NULL;
+    if (linkDepsKind(self, self->_requires,
+                     offsetof(ProvidesObject, requiredby),
+                     prvlinked, reqlinked) == -1 ||
+        linkDepsKind(self, self->_recommends,
+                     offsetof(ProvidesObject, recommendedby),
+                     prvlinked, reclinked) == -1 ||
+        linkDepsKind(self, self->_upgrades,
+                     offsetof(ProvidesObject, upgradedby),
+                     prvlinked, upglinked) == -1 ||
+        linkDepsKind(self, self->_conflicts,
+                     offsetof(ProvidesObject, conflictedby),
+                     prvlinked, cnflinked) == -1)
+        return NULL;
     Py_RETURN_NONE;
 }
 
@@ -3753,10 +4454,42 @@ Cache_getConflicts(CacheObject *self, PyObject *args)
     return lst;
 }
 
+PyObject *
+Cache_setSearchIndex(CacheObject *self, PyObject *index)
+{
+    Py_XDECREF(self->_searchindex);
+    self->_searchindex = index;
+    Py_INCREF(index);
+    Py_RETURN_NONE;
+}
+
+/*
+   Returns the objects which may match the searcher, as told by the
+   given method of the search index, or all of them without an index.
+*/
+static PyObject *
+getSearchCandidates(CacheObject *self, PyObject *searcher,
+                    const char *method, PyObject *all)
+{
+    PyObject *objs;
+    if (!self->_searchindex || self->_searchindex == Py_None) {
+        Py_INCREF(all);
+        return all;
+    }
+    objs = PyObject_CallMethod(self->_searchindex, (char *)method,
+                               "O", searcher);
+    if (objs && !PyList_Check(objs)) {
+        PyErr_SetString(PyExc_TypeError, "Search index must return a list");
+        Py_DECREF(objs);
+        return NULL;
+    }
+    return objs;
+}
+
 PyObject *
 Cache_search(CacheObject *self, PyObject *searcher)
 {
-    PyObject *lst, *res;
+    PyObject *lst, *res, *objs;
     int i, j, k;
 
     lst = PyObject_GetAttrString(searcher, "nameversion");
@@ -3765,10 +4498,15 @@ Cache_search(CacheObject *self, PyObject *searcher)
         return NULL;
     }
     if (PyList_GET_SIZE(lst) != 0) {
-        for (i = 0; i != PyList_GET_SIZE(self->_packages); i++) {
-            PyObject *pkg = PyList_GET_ITEM(self->_packages, i);
+        objs = getSearchCandidates(self, searcher, "getPackages",
+                                   self->_packages);
+        if (objs == NULL)
+            return NULL;
+        for (i = 0; i != PyList_GET_SIZE(objs); i++) {
+            PyObject *pkg = PyList_GET_ITEM(objs, i);
             CALLMETHOD(pkg, "search", "O", searcher);
         }
+        Py_DECREF(objs);
     }
     Py_DECREF(lst);
 
@@ -3778,10 +4516,15 @@ Cache_search(CacheObject *self, PyObject *searcher)
         return NULL;
     }
     if (PyList_GET_SIZE(lst) != 0) {
-        for (i = 0; i != PyList_GET_SIZE(self->_provides); i++) {
-            PyObject *prv = PyList_GET_ITEM(self->_provides, i);
+        objs = getSearchCandidates(self, searcher, "getProvides",
+                                   self->_provides);
+        if (objs == NULL)
+            return NULL;
+        for (i = 0; i != PyList_GET_SIZE(objs); i++) {
+            PyObject *prv = PyList_GET_ITEM(objs, i);
             CALLMETHOD(prv, "search", "O", searcher);
         }
+        Py_DECREF(objs);
     }
     Py_DECREF(lst);
 
@@ -3928,24 +4671,205 @@ Cache_search(CacheObject *self, PyObject *searcher)
 }
 
 
+static int
+appendLinkPairs(PyObject *pairs, PyObject *rel, PyObject *linked)
+{
+    /* pairs.append((rel, list(linked))) */
+    PyObject *lst, *pair;
+    int rc;
+    lst = PySequence_List(linked);
+    if (!lst) return -1;
+    pair = PyTuple_Pack(2, rel, lst);
+    Py_DECREF(lst);
+    if (!pair) return -1;
+    rc = PyList_Append(pairs, pair);
+    Py_DECREF(pair);
+    return rc;
+}
+
+static PyObject *
+getLinks(CacheObject *self)
+{
+    /*
+       Pairs of relations and what they're linked to by linkDeps(),
+       in providedby, requiredby, recommendedby, upgradedby and
+       conflictedby order.
+
+       providedby = {}
+       for lst in (self._requires, self._recommends,
+                   self._upgrades, self._conflicts):
+           for dep in lst:
+               if dep.providedby:
+                   providedby[dep] = list(dep.providedby)
+       links = [providedby.items()]
+       for attr in LINKATTRS:
+           links.append([(prv, list(getattr(prv, attr)))
+                         for prv in self._provides if getattr(prv, attr)])
+       return links
+    */
+    PyObject *lsts[4];
+    size_t offsets[4];
+    PyObject *links, *pairs, *seen;
+    int i, j, len;
+
+    lsts[0] = self->_requires;
+    lsts[1] = self->_recommends;
+    lsts[2] = self->_upgrades;
+    lsts[3] = self->_conflicts;
+    offsets[0] = offsetof(ProvidesObject, requiredby);
+    offsets[1] = offsetof(ProvidesObject, recommendedby);
+    offsets[2] = offsetof(ProvidesObject, upgradedby);
+    offsets[3] = offsetof(ProvidesObject, conflictedby);
+
+    links = PyList_New(0);
+    seen = PyDict_New();
+    pairs = PyList_New(0);
+    if (!links || !seen || !pairs)
+        goto error;
+    for (i = 0; i != 4; i++) {
+        len = PyList_GET_SIZE(lsts[i]);
+        for (j = 0; j != len; j++) {
+            PyObject *dep = PyList_GET_ITEM(lsts[i], j);
+            PyObject *providedby = ((DependsObject *)dep)->providedby;
+            int rc = PyObject_IsTrue(providedby);
+            if (rc == -1)
+                goto error;
+            if (!rc || PyDict_GetItem(seen, dep))
+                continue;
+            if (PyDict_SetItem(seen, dep, Py_True) == -1 ||
+                appendLinkPairs(pairs, dep, providedby) == -1)
+                goto error;
+        }
+    }
+    if (PyList_Append(links, pairs) == -1)
+        goto error;
+    Py_CLEAR(pairs);
+
+    len = PyList_GET_SIZE(self->_provides);
+    for (i = 0; i != 4; i++) {
+        pairs = PyList_New(0);
+        if (!pairs)
+            goto error;
+        for (j = 0; j != len; j++) {
+            PyObject *prv = PyList_GET_ITEM(self->_provides, j);
+            PyObject *by = *(PyObject **)((char *)prv + offsets[i]);
+            int rc = PyObject_IsTrue(by);
+            if (rc == -1 ||
+                (rc && appendLinkPairs(pairs, prv, by) == -1))
+                goto error;
+        }
+        if (PyList_Append(links, pairs) == -1)
+            goto error;
+        Py_CLEAR(pairs);
+    }
+
+    Py_DECREF(seen);
+    return links;
+
+error:
+    Py_XDECREF(links);
+    Py_XDECREF(seen);
+    Py_XDECREF(pairs);
+    return NULL;
+}
+
+static int
+setLinks(PyObject *links)
+{
+    /*
+       for dep, prvs in links[0]:
+           dep.providedby = list(prvs)
+       for attr, lst in zip(LINKATTRS, links[1:]):
+           for prv, deps in lst:
+               setattr(prv, attr, list(deps))
+    */
+    size_t offsets[5];
+    int i, j, len;
+
+    offsets[0] = offsetof(DependsObject, providedby);
+    offsets[1] = offsetof(ProvidesObject, requiredby);
+    offsets[2] = offsetof(ProvidesObject, recommendedby);
+    offsets[3] = offsetof(ProvidesObject, upgradedby);
+    offsets[4] = offsetof(ProvidesObject, conflictedby);
+
+    if (!PyList_Check(links) || PyList_GET_SIZE(links) != 5) {
+        PyErr_SetString(StateVersionError, "");
+        return -1;
+    }
+    for (i = 0; i != 5; i++) {
+        PyObject *pairs = PyList_GET_ITEM(links, i);
+        PyTypeObject *type = i == 0 ? &Depends_Type : &Provides_Type;
+        if (!PyList_Check(pairs)) {
+            PyErr_SetString(StateVersionError, "");
+            return -1;
+        }
+        len = PyList_GET_SIZE(pairs);
+        for (j = 0; j != len; j++) {
+            PyObject *pair = PyList_GET_ITEM(pairs, j);
+            PyObject *rel, *lst, **attr;
+            if (!PyTuple_Check(pair) || PyTuple_GET_SIZE(pair) != 2 ||
+                !PyObject_TypeCheck(PyTuple_GET_ITEM(pair, 0), type)) {
+                PyErr_SetString(StateVersionError, "");
+                return -1;
+            }
+            rel = PyTuple_GET_ITEM(pair, 0);
+            lst = PySequence_List(PyTuple_GET_ITEM(pair, 1));
+            if (!lst) return -1;
+            attr = (PyObject **)((char *)rel + offsets[i]);
+            Py_XDECREF(*attr);
+            *attr = lst;
+        }
+    }
+    return 0;
+}
+
 #define Cache__stateversion__ 1
 
 static PyObject *
 Cache__getstate__(CacheObject *self, PyObject *args)
 {
-    PyObject *state = PyDict_New();
+    PyObject *state, *version = NULL, *loaded = NULL, *links = NULL;
+    state = PyDict_New();
     if (!state) return NULL;
-    PyDict_SetItemString(state, "__stateversion__",
-                         PyInt_FromLong(Cache__stateversion__));
-    PyDict_SetItemString(state, "_loaders", self->_loaders);
-    PyDict_SetItemString(state, "_packages", self->_packages);
+    version = PyInt_FromLong(Cache__stateversion__);
+    if (!version ||
+        PyDict_SetItemString(state, "__stateversion__", version) == -1 ||
+        PyDict_SetItemString(state, "_loaders", self->_loaders) == -1 ||
+        PyDict_SetItemString(state, "_packages", self->_packages) == -1)
+        goto error;
+
+    /*
+       Loaders already linked are saved with the links, so that
+       loading again only links the relations of new loaders.
+
+       state["_loaded"] = self._loaded.keys()
+       state["_links"] = self._getLinks()
+    */
+    loaded = PyDict_Keys(self->_loaded);
+    if (!loaded || PyDict_SetItemString(state, "_loaded", loaded) == -1)
+        goto error;
+    links = getLinks(self);
+    if (!links || PyDict_SetItemString(state, "_links", links) == -1)
+        goto error;
+
+    Py_DECREF(version);
+    Py_DECREF(loaded);
+    Py_DECREF(links);
     return state;
+
+error:
+    Py_XDECREF(version);
+    Py_XDECREF(loaded);
+    Py_XDECREF(links);
+    Py_DECREF(state);
+    return NULL;
 }
 
 static PyObject *
 Cache__setstate__(CacheObject *self, PyObject *state)
 {
     PyObject *provides, *requires, *recommends, *upgrades, *conflicts;
+    PyObject *links, *loaded;
     int i, ilen;
     int j, jlen;
     
@@ -3998,10 +4922,10 @@ Cache__setstate__(CacheObject *self, PyObject *state)
                prv.packages.append(pkg)
                provides[prv] = True
         */
-        if (PyList_Check(pkgobj->provides)) {
-            jlen = PyList_GET_SIZE(pkgobj->provides);
+        if (SEQ_CHECK(pkgobj->provides)) {
+            jlen = PySequence_Fast_GET_SIZE(pkgobj->provides);
             for (j = 0; j != jlen; j++) {
-                PyObject *prv = PyList_GET_ITEM(pkgobj->provides, j);
+                PyObject *prv = PySequence_Fast_GET_ITEM(pkgobj->provides, j);
                 ProvidesObject *prvobj = (ProvidesObject *)prv;
                 PyList_Append(prvobj->packages, pkg);
                 PyDict_SetItem(provides, prv, Py_True);
@@ -4013,10 +4937,10 @@ Cache__setstate__(CacheObject *self, PyObject *state)
                req.packages.append(pkg)
                requires[req] = True
         */
-        if (PyList_Check(pkgobj->requires)) {
-            jlen = PyList_GET_SIZE(pkgobj->requires);
+        if (SEQ_CHECK(pkgobj->requires)) {
+            jlen = PySequence_Fast_GET_SIZE(pkgobj->requires);
             for (j = 0; j != jlen; j++) {
-                PyObject *req = PyList_GET_ITEM(pkgobj->requires, j);
+                PyObject *req = PySequence_Fast_GET_ITEM(pkgobj->requires, j);
                 DependsObject *reqobj = (DependsObject *)req;
                 PyList_Append(reqobj->packages, pkg);
                 PyDict_SetItem(requires, req, Py_True);
@@ -4028,25 +4952,10 @@ Cache__setstate__(CacheObject *self, PyObject *state)
                rec.packages.append(pkg)
                recommends[rec] = True
         */
-        if (PyList_Check(pkgobj->recommends)) {
-            jlen = PyList_GET_SIZE(pkgobj->recommends);
+        if (SEQ_CHECK(pkgobj->recommends)) {
+            jlen = PySequence_Fast_GET_SIZE(pkgobj->recommends);
             for (j = 0; j != jlen; j++) {
-                PyObject *rec = PyList_GET_ITEM(pkgobj->recommends, j);
-                DependsObject *recobj = (DependsObject *)rec;
-                PyList_Append(recobj->packages, pkg);
-                PyDict_SetItem(recommends, rec, Py_True);
-            }
-        }
-
-        /*
-           for rec in pkg.recommends:
-               rec.packages.append(pkg)
-               recommends[rec] = True
-        */
-        if (PyList_Check(pkgobj->recommends)) {
-            jlen = PyList_GET_SIZE(pkgobj->recommends);
-            for (j = 0; j != jlen; j++) {
-                PyObject *rec = PyList_GET_ITEM(pkgobj->recommends, j);
+                PyObject *rec = PySequence_Fast_GET_ITEM(pkgobj->recommends, j);
                 DependsObject *recobj = (DependsObject *)rec;
                 PyList_Append(recobj->packages, pkg);
                 PyDict_SetItem(recommends, rec, Py_True);
@@ -4058,10 +4967,10 @@ Cache__setstate__(CacheObject *self, PyObject *state)
                upg.packages.append(pkg)
                upgrades[upg] = True
         */
-        if (PyList_Check(pkgobj->upgrades)) {
-            jlen = PyList_GET_SIZE(pkgobj->upgrades);
+        if (SEQ_CHECK(pkgobj->upgrades)) {
+            jlen = PySequence_Fast_GET_SIZE(pkgobj->upgrades);
             for (j = 0; j != jlen; j++) {
-                PyObject *upg = PyList_GET_ITEM(pkgobj->upgrades, j);
+                PyObject *upg = PySequence_Fast_GET_ITEM(pkgobj->upgrades, j);
                 DependsObject *upgobj = (DependsObject *)upg;
                 PyList_Append(upgobj->packages, pkg);
                 PyDict_SetItem(upgrades, upg, Py_True);
@@ -4073,10 +4982,10 @@ Cache__setstate__(CacheObject *self, PyObject *state)
                cnf.packages.append(pkg)
                conflicts[cnf] = True
         */
-        if (PyList_Check(pkgobj->conflicts)) {
-            jlen = PyList_GET_SIZE(pkgobj->conflicts);
+        if (SEQ_CHECK(pkgobj->conflicts)) {
+            jlen = PySequence_Fast_GET_SIZE(pkgobj->conflicts);
             for (j = 0; j != jlen; j++) {
-                PyObject *cnf = PyList_GET_ITEM(pkgobj->conflicts, j);
+                PyObject *cnf = PySequence_Fast_GET_ITEM(pkgobj->conflicts, j);
                 DependsObject *cnfobj = (DependsObject *)cnf;
                 PyList_Append(cnfobj->packages, pkg);
                 PyDict_SetItem(conflicts, cnf, Py_True);
@@ -4107,7 +5016,54 @@ Cache__setstate__(CacheObject *self, PyObject *state)
 
     /* self._objmap = {} */
     self->_objmap = PyDict_New();
-    
+
+    /* self._loaded = {} */
+    self->_loaded = PyDict_New();
+
+    /* self._searchindex = None */
+    Py_XDECREF(self->_searchindex);
+    self->_searchindex = Py_None;
+    Py_INCREF(Py_None);
+
+    /*
+       The links may also have been restored by the caller,
+       as smart.cachefile does.
+
+       if "_links" in state:
+           self._setLinks(state["_links"])
+       if "_loaded" in state:
+           self._loaded = dict.fromkeys(state["_loaded"], True)
+    */
+    links = PyDict_GetItemString(state, "_links");
+    if (links && setLinks(links) == -1)
+        return NULL;
+    loaded = PyDict_GetItemString(state, "_loaded");
+    if (loaded) {
+        PyObject *seq = PySequence_Fast(loaded, "_loaded must be "
+                                                "a sequence");
+        if (!seq) return NULL;
+        jlen = PySequence_Fast_GET_SIZE(seq);
+        for (j = 0; j != jlen; j++) {
+            if (PyDict_SetItem(self->_loaded,
+                               PySequence_Fast_GET_ITEM(seq, j),
+                               Py_True) == -1) {
+                Py_DECREF(seq);
+                return NULL;
+            }
+        }
+        Py_DECREF(seq);
+    }
+
+    /*
+       Packages were compacted when saved if their relations are
+       in tuples.
+
+       self._compacted = (self._packages and
+                          type(self._packages[0].provides) is tuple)
+    */
+    self->_compacted = (ilen != 0 && PyTuple_Check(((PackageObject *)
+                            PyList_GET_ITEM(self->_packages, 0))->provides));
+
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -4116,11 +5072,14 @@ static PyMethodDef Cache_methods[] = {
     {"reset", (PyCFunction)Cache_reset, METH_VARARGS, NULL},
     {"addLoader", (PyCFunction)Cache_addLoader, METH_O, NULL},
     {"removeLoader", (PyCFunction)Cache_removeLoader, METH_O, NULL},
+    {"_retract", (PyCFunction)Cache__retract, METH_O, NULL},
     {"_reload", (PyCFunction)Cache__reload, METH_NOARGS, NULL},
     {"load", (PyCFunction)Cache_load, METH_NOARGS, NULL},
     {"unload", (PyCFunction)Cache_unload, METH_NOARGS, NULL},
-    {"loadFileProvides", (PyCFunction)Cache_loadFileProvides, METH_NOARGS, NULL},
+    {"loadFileProvides", (PyCFunction)Cache_loadFileProvides, METH_VARARGS, NULL},
     {"linkDeps", (PyCFunction)Cache_linkDeps, METH_VARARGS, NULL},
+    {"compact", (PyCFunction)Cache_compact, METH_NOARGS, NULL},
+    {"setSearchIndex", (PyCFunction)Cache_setSearchIndex, METH_O, NULL},
     {"getPackages", (PyCFunction)Cache_getPackages, METH_VARARGS, NULL},
     {"getProvides", (PyCFunction)Cache_getProvides, METH_VARARGS, NULL},
     {"getRequires", (PyCFunction)Cache_getRequires, METH_VARARGS, NULL},
@@ -4143,6 +5102,9 @@ static PyMemberDef Cache_members[] = {
     {"_upgrades", T_OBJECT, OFF(_upgrades), RO, 0},
     {"_conflicts", T_OBJECT, OFF(_conflicts), RO, 0},
     {"_objmap", T_OBJECT, OFF(_objmap), RO, 0},
+    {"_loaded", T_OBJECT, OFF(_loaded), RO, 0},
+    {"_searchindex", T_OBJECT, OFF(_searchindex), RO, 0},
+    {"_compacted", T_INT, OFF(_compacted), RO, 0},
     {NULL}
 };
 #undef OFF
@@ -4192,7 +5154,364 @@ statichere PyTypeObject Cache_Type = {
 };
 
 
+/* Builders for the flat tables of the on-disk cache (see cachefile.py). */
+
+#define CACHEFILE_NONE -1
+#define CACHEFILE_INSTALLED 1
+#define CACHEFILE_ESSENTIAL 2
+#define CACHEFILE_ISLIST 4
+#define CACHEFILE_RELKINDS 5
+
+static int
+getIntBuffer(PyObject *obj, const int **buf, int *len, int recsize)
+{
+    const void *ptr;
+    Py_ssize_t size;
+    if (PyObject_AsReadBuffer(obj, &ptr, &size) == -1)
+        return -1;
+    if (size % (sizeof(int)*recsize) != 0) {
+        PyErr_SetString(StateVersionError, "");
+        return -1;
+    }
+    *buf = (const int *)ptr;
+    *len = size/sizeof(int);
+    return 0;
+}
+
+static PyObject *
+getTableItem(PyObject *list, int index)
+{
+    if (index < 0 || index >= PyList_GET_SIZE(list)) {
+        PyErr_SetString(StateVersionError, "");
+        return NULL;
+    }
+    return PyList_GET_ITEM(list, index);
+}
+
+static void
+freeMatcher(void *ptr)
+{
+    DependsMatcher *matcher = (DependsMatcher *)ptr;
+    Py_DECREF(matcher->prvtype);
+    Py_XDECREF(matcher->matches);
+    Py_XDECREF(matcher->getmatchnames);
+    PyMem_Free(matcher);
+}
+
+static PyObject *
+ccache_registerMatcher(PyObject *self, PyObject *args)
+{
+    PyObject *depcls, *prvcls, *checkdep;
+    PyObject *anyprvversion, *splitarch;
+    DependsMatcher *matcher;
+    PyObject *o;
+    if (!PyArg_ParseTuple(args, "O!O!O!OO", &PyType_Type, &depcls,
+                          &PyType_Type, &prvcls, &PyCObject_Type, &checkdep,
+                          &anyprvversion, &splitarch))
+        return NULL;
+    if (!PyType_IsSubtype((PyTypeObject *)depcls, &Depends_Type) ||
+        !PyType_IsSubtype((PyTypeObject *)prvcls, &Provides_Type)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "Depends and Provides subclasses expected");
+        return NULL;
+    }
+    if (getTypeAttr((PyTypeObject *)depcls, "getMatchNames") !=
+        getTypeAttr(&Depends_Type, "getMatchNames")) {
+        PyErr_SetString(PyExc_TypeError,
+                        "Depends subclass must not change getMatchNames()");
+        return NULL;
+    }
+    if (!Matchers) {
+        Matchers = PyDict_New();
+        if (!Matchers) return NULL;
+    }
+    matcher = (DependsMatcher *)PyMem_Malloc(sizeof(DependsMatcher));
+    if (!matcher)
+        return PyErr_NoMemory();
+    Py_INCREF(prvcls);
+    matcher->prvtype = (PyTypeObject *)prvcls;
+    matcher->matches = getTypeAttr((PyTypeObject *)depcls, "matches");
+    Py_XINCREF(matcher->matches);
+    matcher->getmatchnames = getTypeAttr((PyTypeObject *)depcls,
+                                         "getMatchNames");
+    Py_XINCREF(matcher->getmatchnames);
+    matcher->checkdep = (CheckDepFunc)PyCObject_AsVoidPtr(checkdep);
+    matcher->flags = 0;
+    if (PyObject_IsTrue(anyprvversion))
+        matcher->flags |= MATCH_ANYPRVVERSION;
+    if (PyObject_IsTrue(splitarch))
+        matcher->flags |= MATCH_SPLITARCH;
+    o = PyCObject_FromVoidPtr(matcher, freeMatcher);
+    if (!o) {
+        freeMatcher(matcher);
+        return NULL;
+    }
+    PyDict_SetItem(Matchers, depcls, o);
+    Py_DECREF(o);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+ccache_buildRelations(PyObject *self, PyObject *args)
+{
+    PyObject *classes, *strings, *relbuf;
+    PyObject *relations;
+    const int *buf;
+    int i, len;
+
+    if (!PyArg_ParseTuple(args, "O!O!O", &PyList_Type, &classes,
+                          &PyList_Type, &strings, &relbuf))
+        return NULL;
+    if (getIntBuffer(relbuf, &buf, &len, 5) == -1)
+        return NULL;
+
+    relations = PyList_New(len/5);
+    if (!relations) return NULL;
+
+    for (i = 0; i != len/5; i++) {
+        const int *rec = buf+i*5;
+        PyObject *cls, *callargs, *rel;
+        int j;
+        if (rec[0] == CACHEFILE_NONE) {
+            /* Built by the caller. */
+            Py_INCREF(Py_None);
+            PyList_SET_ITEM(relations, i, Py_None);
+            continue;
+        }
+        if (rec[1] < 0 || rec[1] > 3 ||
+            !(cls = getTableItem(classes, rec[0]))) {
+            PyErr_SetString(StateVersionError, "");
+            goto error;
+        }
+        callargs = PyTuple_New(rec[1]);
+        if (!callargs) goto error;
+        for (j = 0; j != rec[1]; j++) {
+            PyObject *arg;
+            if (rec[2+j] == CACHEFILE_NONE) {
+                arg = Py_None;
+            } else if (!(arg = getTableItem(strings, rec[2+j]))) {
+                Py_DECREF(callargs);
+                goto error;
+            }
+            Py_INCREF(arg);
+            PyTuple_SET_ITEM(callargs, j, arg);
+        }
+        rel = PyObject_Call(cls, callargs, NULL);
+        Py_DECREF(callargs);
+        if (!rel) goto error;
+        PyList_SET_ITEM(relations, i, rel);
+    }
+
+    return relations;
+
+error:
+    /* Unset items are NULL, which list deallocation handles. */
+    Py_DECREF(relations);
+    return NULL;
+}
+
+static PyObject *
+ccache_buildPackages(PyObject *self, PyObject *args)
+{
+    PyObject *classes, *strings, *relations;
+    PyObject *pkgbuf, *cntbuf, *idsbuf;
+    PyObject *packages, *emptyargs;
+    const int *pkgs, *cnts, *ids;
+    int pkgslen, cntslen, idslen;
+    int i, idpos = 0;
+
+    if (!PyArg_ParseTuple(args, "O!O!O!OOO", &PyList_Type, &classes,
+                          &PyList_Type, &strings, &PyList_Type, &relations,
+                          &pkgbuf, &cntbuf, &idsbuf))
+        return NULL;
+    if (getIntBuffer(pkgbuf, &pkgs, &pkgslen, 5) == -1 ||
+        getIntBuffer(cntbuf, &cnts, &cntslen, CACHEFILE_RELKINDS) == -1 ||
+        getIntBuffer(idsbuf, &ids, &idslen, 1) == -1)
+        return NULL;
+    if (cntslen/CACHEFILE_RELKINDS != pkgslen/5) {
+        PyErr_SetString(StateVersionError, "");
+        return NULL;
+    }
+
+    packages = PyList_New(pkgslen/5);
+    emptyargs = PyTuple_New(0);
+    if (!packages || !emptyargs) {
+        Py_XDECREF(packages);
+        Py_XDECREF(emptyargs);
+        return NULL;
+    }
+
+    for (i = 0; i != pkgslen/5; i++) {
+        const int *rec = pkgs+i*5;
+        const int *cnt = cnts+i*CACHEFILE_RELKINDS;
+        PyObject *lists[CACHEFILE_RELKINDS];
+        PyObject *cls, *name, *version;
+        PackageObject *pkgobj;
+        int kind;
+
+        if (!(cls = getTableItem(classes, rec[0])) ||
+            !(name = getTableItem(strings, rec[1])) ||
+            !(version = getTableItem(strings, rec[2])))
+            goto error;
+        if (!PyType_Check(cls) ||
+            !PyType_IsSubtype((PyTypeObject *)cls, &Package_Type)) {
+            PyErr_SetString(StateVersionError, "");
+            goto error;
+        }
+
+        for (kind = 0; kind != CACHEFILE_RELKINDS; kind++) {
+            int islist = rec[3] & (CACHEFILE_ISLIST << kind);
+            int j;
+            if (cnt[kind] < 0 || idpos+cnt[kind] > idslen) {
+                PyErr_SetString(StateVersionError, "");
+                lists[kind] = NULL;
+            } else if (islist) {
+                lists[kind] = PyList_New(cnt[kind]);
+            } else {
+                lists[kind] = PyTuple_New(cnt[kind]);
+            }
+            if (!lists[kind]) {
+                while (kind--)
+                    Py_DECREF(lists[kind]);
+                goto error;
+            }
+            for (j = 0; j != cnt[kind]; j++) {
+                PyObject *rel = getTableItem(relations, ids[idpos++]);
+                if (!rel) {
+                    do {
+                        Py_DECREF(lists[kind]);
+                    } while (kind--);
+                    goto error;
+                }
+                Py_INCREF(rel);
+                if (islist)
+                    PyList_SET_ITEM(lists[kind], j, rel);
+                else
+                    PyTuple_SET_ITEM(lists[kind], j, rel);
+            }
+        }
+
+        pkgobj = (PackageObject *)
+                 ((PyTypeObject *)cls)->tp_new((PyTypeObject *)cls,
+                                               emptyargs, NULL);
+        if (!pkgobj) {
+            for (kind = 0; kind != CACHEFILE_RELKINDS; kind++)
+                Py_DECREF(lists[kind]);
+            goto error;
+        }
+        Py_INCREF(name);
+        pkgobj->name = name;
+        Py_INCREF(version);
+        pkgobj->version = version;
+        pkgobj->provides = lists[0];
+        pkgobj->requires = lists[1];
+        pkgobj->recommends = lists[2];
+        pkgobj->upgrades = lists[3];
+        pkgobj->conflicts = lists[4];
+        pkgobj->installed = (rec[3] & CACHEFILE_INSTALLED) ? Py_True
+                                                           : Py_False;
+        Py_INCREF(pkgobj->installed);
+        pkgobj->essential = (rec[3] & CACHEFILE_ESSENTIAL) ? Py_True
+                                                           : Py_False;
+        Py_INCREF(pkgobj->essential);
+        pkgobj->priority = PyInt_FromLong(rec[4]);
+        pkgobj->loaders = PyDict_New();
+        if (!pkgobj->priority || !pkgobj->loaders) {
+            Py_DECREF(pkgobj);
+            goto error;
+        }
+        PyList_SET_ITEM(packages, i, (PyObject *)pkgobj);
+    }
+
+    Py_DECREF(emptyargs);
+    return packages;
+
+error:
+    Py_DECREF(emptyargs);
+    Py_DECREF(packages);
+    return NULL;
+}
+
+static PyObject *
+ccache_buildLinks(PyObject *self, PyObject *args)
+{
+    /*
+       for attr in ("providedby",)+LINKATTRS:
+           count = linkbuf[pos]
+           for i in range(count):
+               rel, n = linkbuf[pos:pos+2]
+               setattr(relations[rel], attr,
+                       [relations[x] for x in linkbuf[pos:pos+n]])
+    */
+    PyObject *relations, *linkbuf;
+    const int *buf;
+    size_t offsets[5];
+    int len, pos = 0;
+    int kind;
+
+    if (!PyArg_ParseTuple(args, "O!O", &PyList_Type, &relations, &linkbuf))
+        return NULL;
+    if (getIntBuffer(linkbuf, &buf, &len, 1) == -1)
+        return NULL;
+
+    offsets[0] = offsetof(DependsObject, providedby);
+    offsets[1] = offsetof(ProvidesObject, requiredby);
+    offsets[2] = offsetof(ProvidesObject, recommendedby);
+    offsets[3] = offsetof(ProvidesObject, upgradedby);
+    offsets[4] = offsetof(ProvidesObject, conflictedby);
+
+    for (kind = 0; kind != 5; kind++) {
+        PyTypeObject *type = kind == 0 ? &Depends_Type : &Provides_Type;
+        int i, count;
+        if (pos >= len)
+            goto corrupted;
+        count = buf[pos++];
+        for (i = 0; i < count; i++) {
+            PyObject *rel, *lst, **attr;
+            int j, n;
+            if (pos+2 > len)
+                goto corrupted;
+            rel = getTableItem(relations, buf[pos]);
+            n = buf[pos+1];
+            pos += 2;
+            if (!rel)
+                return NULL;
+            if (!PyObject_TypeCheck(rel, type) || n < 0 || pos+n > len)
+                goto corrupted;
+            lst = PyList_New(n);
+            if (!lst)
+                return NULL;
+            for (j = 0; j != n; j++) {
+                PyObject *item = getTableItem(relations, buf[pos+j]);
+                if (!item) {
+                    Py_DECREF(lst);
+                    return NULL;
+                }
+                Py_INCREF(item);
+                PyList_SET_ITEM(lst, j, item);
+            }
+            pos += n;
+            attr = (PyObject **)((char *)rel + offsets[kind]);
+            Py_XDECREF(*attr);
+            *attr = lst;
+        }
+    }
+    Py_RETURN_NONE;
+
+corrupted:
+    PyErr_SetString(StateVersionError, "");
+    return NULL;
+}
+
 static PyMethodDef ccache_methods[] = {
+    {"buildRelations", (PyCFunction)ccache_buildRelations,
+     METH_VARARGS, NULL},
+    {"buildPackages", (PyCFunction)ccache_buildPackages,
+     METH_VARARGS, NULL},
+    {"buildLinks", (PyCFunction)ccache_buildLinks,
+     METH_VARARGS, NULL},
+    {"registerMatcher", (PyCFunction)ccache_registerMatcher,
+     METH_VARARGS, NULL},
     {NULL, NULL}
 };
 
@@ -25,6 +25,7 @@ import os
 
 from smart.backends.deb.loader import DebTagFileLoader
 from smart.util.filetools import getFileDigest
+from smart.uncompress import Uncompressor
 from smart.backends.deb.base import getArchitecture
 from smart.channel import PackageChannel
 from smart.const import SUCCEEDED, NEVER
@@ -195,10 +196,18 @@ class APTDEBChannel(PackageChannel):
 
     def _enqueuePackages(self, fetcher, checksum=None, component=None):
         info = {}
+        # Compressed files may be kept as they are, since the loader
+        # is able to uncompress them on the fly. It seeks to each
+        # package, though, so that's only done for formats which
+        # may seek backwards cheaply, and those are preferred then.
+        keepcompressed = sysconf.get("keep-compressed", False)
         url = self._getURL("Packages", component)
         subpath = self._getURL("Packages", component, subpath=True)
         if checksum is not None:
-            if subpath+".lzma" in checksum:
+            if keepcompressed and subpath+".gz" in checksum:
+                compressed_subpath = subpath+".gz"
+                url += ".gz"
+            elif subpath+".lzma" in checksum:
                 compressed_subpath = subpath+".lzma"
                 url += ".lzma"
             elif subpath+".bz2" in checksum:
@@ -212,7 +221,8 @@ class APTDEBChannel(PackageChannel):
             else:
                 return None
             if compressed_subpath:
-                info["uncomp"] = True
+                info["uncomp"] = not (keepcompressed and
+                                      Uncompressor.isSeekable(url))
                 info["md5"] = checksum[compressed_subpath].get("md5", None)
                 info["sha1"] = checksum[compressed_subpath].get("sha1", None)
                 info["sha256"] = checksum[compressed_subpath].get("sha256", None)
@@ -229,8 +239,9 @@ class APTDEBChannel(PackageChannel):
                 info["size"] =  checksum[subpath]["size"]
         else:
             # Default to Packages.gz when we can't find out.
-            info["uncomp"] = True
             url += ".gz"
+            info["uncomp"] = not (keepcompressed and
+                                  Uncompressor.isSeekable(url))
         return fetcher.enqueue(url, **info)
 
     def fetch(self, fetcher, progress):
@@ -260,6 +260,10 @@ class RPMMetaDataChannel(PackageChannel, MirrorsChannel):
         else:
             filelists = info["filelists"]
 
+        # Compressed files may be kept as they are, since the loader
+        # is able to uncompress them on the fly.
+        uncomp = not sysconf.get("keep-compressed", False)
+
         fetcher.reset()
         item = fetcher.enqueue(primary["url"],
                                md5=primary.get("md5"),
@@ -268,7 +272,7 @@ class RPMMetaDataChannel(PackageChannel, MirrorsChannel):
                                uncomp_sha=primary.get("uncomp_sha"),
                                sha256=primary.get("sha256"),
                                uncomp_sha256=primary.get("uncomp_sha256"),
-                               uncomp=True)
+                               uncomp=uncomp)
         flitem = fetcher.enqueue(filelists["url"],
                                  md5=filelists.get("md5"),
                                  uncomp_md5=filelists.get("uncomp_md5"),
@@ -276,7 +280,7 @@ class RPMMetaDataChannel(PackageChannel, MirrorsChannel):
                                  uncomp_sha=filelists.get("uncomp_sha"),
                                  sha256=filelists.get("sha256"),
                                  uncomp_sha256=filelists.get("uncomp_sha256"),
-                                 uncomp=True)
+                                 uncomp=uncomp)
         if "updateinfo" in info:
             uiitem = fetcher.enqueue(info["updateinfo"]["url"],
                                    md5=info["updateinfo"].get("md5"),
@@ -293,6 +297,11 @@ class RPMMetaDataChannel(PackageChannel, MirrorsChannel):
                                        self._baseurl)
             loader.setChannel(self)
             self._loaders.append(loader)
+            try:
+                loader.buildPathIndex()
+            except (IOError, OSError, SyntaxError, Error), e:
+                iface.debug(_("Failed building path index for '%s': %s")
+                            % (self, e))
             if "updateinfo" in info:
                 if uiitem.getStatus() == SUCCEEDED:
                     localpath = uiitem.getTargetPath()
@@ -331,13 +340,17 @@ class RPMMetaDataChannel(PackageChannel, MirrorsChannel):
             if type in oldinfo:
                 url = oldinfo[type]["url"]
                 if url and info[type]["url"] != oldinfo[type]["url"]:
-                    path = self.getLocalPath(fetcher, url)
-                    if os.path.exists(path):
-                       os.unlink(path)
-                    handler = uncompressor.getHandler(path)
-                    path = handler.getTargetPath(path)
+                    comppath = self.getLocalPath(fetcher, url)
+                    if os.path.exists(comppath):
+                       os.unlink(comppath)
+                    handler = uncompressor.getHandler(comppath)
+                    path = handler.getTargetPath(comppath)
                     if os.path.exists(path):
                        os.unlink(path)
+                    for ext in (".idx", ".info"):
+                        for name in (path+ext, comppath+ext):
+                            if os.path.exists(name):
+                               os.unlink(name)
 
         self._digest = digest
 
@@ -203,8 +203,13 @@ def main(ctrl, opts):
 
     if opts.clear_history is not None:
         if opts.clear_history:
-            history = sysconf.get("mirrors-history", [])
-            history[:] = [x for x in history if x[0] not in opts.clear_history]
+            history = sysconf.get("mirrors-history", {})
+            if type(history) is dict:
+                for url in opts.clear_history:
+                    history.pop(url, None)
+            else:
+                history = [x for x in history
+                           if x[0] not in opts.clear_history]
             sysconf.set("mirrors-history", history)
         else:
             history = sysconf.remove("mirrors-history")
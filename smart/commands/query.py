@@ -432,9 +432,8 @@ def main(ctrl, opts, reloadchannels=True):
     for pkg in packages:
         output.showPackage(pkg)
         if pkg.provides and (opts.show_provides or whoprovides):
-            pkg.provides.sort()
             first = True
-            for prv in pkg.provides:
+            for prv in sorted(pkg.provides):
                 if whoprovides:
                     for whoprv in whoprovides:
                         if (prv.name == whoprv.name and
@@ -446,22 +445,19 @@ def main(ctrl, opts, reloadchannels=True):
                 output.showProvides(pkg, prv)
                 if opts.show_requiredby and prv.requiredby:
                     for req in prv.requiredby:
-                        req.packages.sort()
-                        for reqpkg in req.packages:
+                        for reqpkg in sorted(req.packages):
                             if opts.installed and not reqpkg.installed:
                                 continue
                             output.showRequiredBy(pkg, prv, req, reqpkg)
                 if opts.show_upgradedby and prv.upgradedby:
                     for upg in prv.upgradedby:
-                        upg.packages.sort()
-                        for upgpkg in upg.packages:
+                        for upgpkg in sorted(upg.packages):
                             if opts.installed and not upgpkg.installed:
                                 continue
                             output.showUpgradedBy(pkg, prv, upg, upgpkg)
                 if opts.show_conflictedby and prv.conflictedby:
                     for cnf in prv.conflictedby:
-                        cnf.packages.sort()
-                        for cnfpkg in cnf.packages:
+                        for cnfpkg in sorted(cnf.packages):
                             if cnfpkg is pkg:
                                 continue
                             if opts.installed and not cnfpkg.installed:
@@ -469,9 +465,8 @@ def main(ctrl, opts, reloadchannels=True):
                             output.showConflictedBy(pkg, prv, cnf, cnfpkg)
         if pkg.requires and (opts.show_requires or opts.show_prerequires
                              or whorequires):
-            pkg.requires.sort()
             first = True
-            for req in pkg.requires:
+            for req in sorted(pkg.requires):
                 if opts.show_prerequires and not isinstance(req, PreRequires):
                     continue
                 if whorequires:
@@ -484,29 +479,25 @@ def main(ctrl, opts, reloadchannels=True):
                 output.showRequires(pkg, req)
                 if opts.show_providedby and req.providedby:
                     for prv in req.providedby:
-                        prv.packages.sort()
-                        for prvpkg in prv.packages:
+                        for prvpkg in sorted(prv.packages):
                             if opts.installed and not prvpkg.installed:
                                 continue
                             output.showRequiresProvidedBy(pkg, req,
                                                           prv, prvpkg)
         if pkg.recommends and (opts.show_recommends):
-            pkg.recommends.sort()
             first = True
-            for req in pkg.recommends:
+            for req in sorted(pkg.recommends):
                 output.showRecommends(pkg, req)
                 if opts.show_providedby and req.providedby:
                     for prv in req.providedby:
-                        prv.packages.sort()
-                        for prvpkg in prv.packages:
+                        for prvpkg in sorted(prv.packages):
                             if opts.installed and not prvpkg.installed:
                                 continue
                             output.showRecommendsProvidedBy(pkg, req,
                                                           prv, prvpkg)
         if pkg.upgrades and (opts.show_upgrades or whoupgrades):
-            pkg.upgrades.sort()
             first = True
-            for upg in pkg.upgrades:
+            for upg in sorted(pkg.upgrades):
                 if whoupgrades:
                     matchnames = upg.getMatchNames()
                     for whoupg in whoupgrades:
@@ -517,16 +508,14 @@ def main(ctrl, opts, reloadchannels=True):
                 output.showUpgrades(pkg, upg)
                 if opts.show_providedby and upg.providedby:
                     for prv in upg.providedby:
-                        prv.packages.sort()
-                        for prvpkg in prv.packages:
+                        for prvpkg in sorted(prv.packages):
                             if opts.installed and not prvpkg.installed:
                                 continue
                             output.showUpgradesProvidedBy(pkg, upg,
                                                           prv, prvpkg)
         if pkg.conflicts and (opts.show_conflicts or whoconflicts):
-            pkg.conflicts.sort()
             first = True
-            for cnf in pkg.conflicts:
+            for cnf in sorted(pkg.conflicts):
                 if whoconflicts:
                     matchnames = cnf.getMatchNames()
                     for whocnf in whoconflicts:
@@ -537,8 +526,7 @@ def main(ctrl, opts, reloadchannels=True):
                 output.showConflicts(pkg, cnf)
                 if opts.show_providedby and cnf.providedby:
                     for prv in cnf.providedby:
-                        prv.packages.sort()
-                        for prvpkg in prv.packages:
+                        for prvpkg in sorted(prv.packages):
                             if prvpkg is pkg:
                                 continue
                             if opts.installed and not prvpkg.installed:
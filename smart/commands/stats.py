@@ -20,6 +20,7 @@
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
 from smart.util.strtools import sizeToStr
+from smart.cache import getStringPoolStats
 from smart.option import OptionParser
 from smart import *
 import re
@@ -61,4 +62,8 @@ def main(ctrl, opts, reloadchannels=True):
     print _("Total Upgrades:"), len(cache.getUpgrades())
     print _("Total Conflicts:"), len(cache.getConflicts())
 
+    stats = getStringPoolStats(cache)
+    print _("Pooled Strings:"), stats["strings"]
+    print _("Memory Saved by Pooling:"), sizeToStr(stats["saved"])
+
 # vim:ts=4:sw=4:et
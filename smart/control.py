@@ -19,8 +19,7 @@
 # along with Smart Package Manager; if not, write to the Free Software
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
-import cPickle
-import sys, os
+import sys, os, re
 import copy
 import time
 import tempfile
@@ -30,8 +29,9 @@ from smart.transaction import ChangeSet, ChangeSetSplitter, INSTALL, REMOVE
 from smart.util.filetools import compareFiles, setCloseOnExecAll
 from smart.util.objdigest import getObjectDigest
 from smart.util.pathlocks import PathLocks
-from smart.util.strtools import strToBool
+from smart.util.strtools import strToBool, distance_many
 from smart.util.metalink import Metalink, Metafile
+from smart.cachefile import dumpCache, loadCache
 from smart.searcher import Searcher
 from smart.media import MediaSet
 from smart.progress import Progress
@@ -46,6 +46,8 @@ from smart import *
 if sys.version_info < (2, 4):
     from sets import Set as set
 
+_versionre = re.compile("[-_][0-9]")
+
 
 class Control(object):
 
@@ -200,13 +202,11 @@ class Control(object):
                 cachepath = os.path.join(sysconf.get("data-dir"), "cache")
                 if sysconf.get("disk-cache", True):
                     iface.showStatus(_("Saving cache..."))
-                    cachefile = open(cachepath+".new", "w")
                     state = (self.__stateversion__,
                              self._cache,
                              self._channels,
                              self._sysconfchannels)
-                    cPickle.dump(state, cachefile, 2)
-                    cachefile.close()
+                    dumpCache(state, cachepath+".new")
                     os.rename(cachepath+".new", cachepath)
                     iface.hideStatus()
                 elif os.path.isfile(cachepath):
@@ -252,11 +252,8 @@ class Control(object):
             cachepath = os.path.join(sysconf.get("data-dir"), "cache")
             if os.path.isfile(cachepath) and sysconf.get("disk-cache", True):
                 iface.showStatus(_("Loading cache..."))
-                cachefile = open(cachepath)
                 try:
-                    state = cPickle.load(cachefile)
-                    if state[0] != self.__stateversion__:
-                        raise StateVersionError
+                    state = loadCache(cachepath, self.__stateversion__)
                 except:
                     if sysconf.get("log-level") == DEBUG:
                         import traceback
@@ -272,7 +269,6 @@ class Control(object):
                         if (alias not in channels or
                             not isEnabled(alias, channels[alias])):
                             self.removeChannel(alias)
-                cachefile.close()
                 iface.hideStatus()
 
         for alias in channels:
@@ -368,8 +364,6 @@ class Control(object):
 
         self._fetcher.setForceMountedCopy(True)
 
-        self._cache.reset()
-
         # Do the real work.
         result = True
         for channel in channels:
@@ -895,6 +889,9 @@ class Control(object):
                 searcher.addProvides(s, suggestioncutoff)
             self._cache.search(searcher)
             objects = searcher.getResults()
+            if not objects and "*" not in s and "?" not in s and \
+                    not searcher.hasAutoMeaning(s):
+                suggestions = self._suggestNames(s_name, suggestioncutoff)
 
         if objects:
             bestratio = objects[0][0]
@@ -912,6 +909,30 @@ class Control(object):
                     ratio = bestratio
         return ratio, results, suggestions
 
+    def _suggestNames(self, s, cutoff):
+        # Packages with names close to the one given, for when the
+        # search found nothing. A misspelled name followed by a version
+        # is usually too far from every name-version to be found.
+        match = _versionre.search(s)
+        if match:
+            s = s[:match.start()]
+        packages = {}
+        for pkg in self._cache.getPackages():
+            name = pkg.name.lower()
+            if name in packages:
+                packages[name].append(pkg)
+            else:
+                packages[name] = [pkg]
+        names = packages.keys()
+        suggestions = []
+        for name, (_, ratio) in zip(names,
+                                    distance_many(s.lower(), names, cutoff)):
+            if ratio:
+                suggestions.extend([(ratio, pkg) for pkg in packages[name]])
+        suggestions.sort()
+        suggestions.reverse()
+        return suggestions
+
 class AvailableChannelSet(object):
 
     def __init__(self, fetcher, channels=None, progress=None):
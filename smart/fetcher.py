@@ -24,6 +24,8 @@ from smart.util.strtools import sizeToStr, speedToStr, secondsToStr
 from smart.media import MediaSet, DeviceMedia
 from smart.uncompress import Uncompressor
 from smart.mirror import MirrorSystem
+from smart.util.filetools import getFileDigests, getFilesDigests
+from smart.util.filetools import hashFile, DIGESTS
 from smart.const import *
 from smart import *
 import tempfile
@@ -36,14 +38,72 @@ import os
 import re
 import signal
 import threading
+import select
+import fcntl
+import marshal
+
+from collections import deque
 
 MAXRETRIES = 30
 SPEEDDELAY = 1
 CANCELDELAY = 2
+# Longest run() waits for handlers to wake it up, before ticking
+# them anyway.
+TICKDELAY = 0.5
 MAXACTIVEDOWNLOADS = 10
 SOCKETTIMEOUT = 600
+# Files at least SEGMENTEDSIZE long are fetched in segments from up to
+# MAXSEGMENTSOURCES mirrors at once. Segments are sized for about
+# SEGMENTTIME seconds of transfer from the mirror taking them.
+SEGMENTEDSIZE = 64*1024*1024
+MAXSEGMENTSOURCES = 4
+SEGMENTTIME = 5
+MINSEGMENTSIZE = 1024*1024
+MAXSEGMENTSIZE = 32*1024*1024
+# Downloads smaller than JOURNALSIZE are fetched again from the start
+# rather than journaled.
+JOURNALNAME = "fetch-journal"
+JOURNALSIZE = 256*1024
 
 class FetcherCancelled(Error): pass
+class RangesUnsupported(Error): pass
+
+class WakeUpPipe(object):
+    """
+    Pipe written to by handler threads when there's something for
+    Fetcher.run() to do, so that it can wait in select() instead of
+    polling them.
+    """
+
+    def __init__(self):
+        self._rfd, self._wfd = os.pipe()
+        for fd in (self._rfd, self._wfd):
+            fcntl.fcntl(fd, fcntl.F_SETFD, fcntl.FD_CLOEXEC)
+            flags = fcntl.fcntl(fd, fcntl.F_GETFL)
+            fcntl.fcntl(fd, fcntl.F_SETFL, flags|os.O_NONBLOCK)
+
+    def __del__(self, close=os.close):
+        close(self._rfd)
+        close(self._wfd)
+
+    def wakeUp(self):
+        try:
+            os.write(self._wfd, "x")
+        except OSError:
+            # The pipe is full, so there's a wake up pending already.
+            pass
+
+    def wait(self, timeout):
+        try:
+            if not select.select([self._rfd], [], [], timeout)[0]:
+                return
+        except select.error:
+            return
+        try:
+            while len(os.read(self._rfd, 4096)) == 4096:
+                pass
+        except OSError:
+            pass
 
 class Fetcher(object):
 
@@ -68,15 +128,35 @@ class Fetcher(object):
         self._activedownloads = 0
         self._activedownloadslock = thread.allocate_lock()
         self._maxactivedownloads = 0
+        self._digestcache = {}
+        self._journals = {}
+        self._journalslock = thread.allocate_lock()
+        self._wakeup = None
+        self._changed = deque()
         self.time = 0
         self._eta = 0
 
     def reset(self):
         self._items.clear()
+        self._changed.clear()
         self._uncompressing = 0
+        self._mirrorsystem.resetLoad()
 
     def cancel(self):
         self._cancel = True
+        self.wakeUp()
+
+    def wakeUp(self):
+        # Handlers call it when run() should tick them, which is when
+        # some download ends, or makes room for another one.
+        if self._wakeup:
+            self._wakeup.wakeUp()
+
+    def itemChanged(self, item):
+        # Items report here when they succeed or fail, so that run()
+        # goes over those only.
+        self._changed.append(item)
+        self.wakeUp()
 
     def getItem(self, url):
         return self._items.get(url)
@@ -168,6 +248,8 @@ class Fetcher(object):
             self._activedownloads += value
             result = True
         self._activedownloadslock.release()
+        if value < 0:
+            self.wakeUp()
         return result
 
     def getActiveDownloads(self):
@@ -186,8 +268,11 @@ class Fetcher(object):
         return item
 
     def runLocal(self):
-        for handler in self._handlers.values():
-            handler.runLocal()
+        try:
+            for handler in self._handlers.values():
+                handler.runLocal()
+        finally:
+            self._digestcache.clear()
 
     def run(self, what=None, progress=None):
         socket.setdefaulttimeout(sysconf.get("socket-timeout", SOCKETTIMEOUT))
@@ -229,6 +314,11 @@ class Fetcher(object):
                 topic = _("Fetching information...")
             prog.setTopic(topic)
             prog.show()
+        if not self._wakeup:
+            self._wakeup = WakeUpPipe()
+        changed = self._changed
+        changed.clear()
+        changed.extend(self._items.values())
         for handler in handlers:
             handler.start()
         active = handlers[:]
@@ -256,17 +346,19 @@ class Fetcher(object):
                     prog.show()
                     break
                 prog.show()
+                self._wakeup.wait(0.1)
                 continue
             for handler in active[:]:
                 if not handler.tick():
                     active.remove(handler)
             if self._speedupdated+SPEEDDELAY < self.time:
                 self._speedupdated = self.time
-                updatespeed = True
-            else:
-                updatespeed = False
-            for url in self._items:
-                item = self._items[url]
+                for item in self._items.values():
+                    if item.getStatus() is RUNNING:
+                        item.updateSpeed()
+                        item.updateETA()
+            while changed:
+                item = changed.popleft()
                 if item.getStatus() == FAILED:
                     if (item.getRetries() < MAXRETRIES and
                         item.setNextURL()):
@@ -278,9 +370,6 @@ class Fetcher(object):
                     continue
                 elif (item.getStatus() != SUCCEEDED or
                       not item.getInfo("uncomp")):
-                    if updatespeed:
-                        item.updateSpeed()
-                        item.updateETA()
                     continue
                 localpath = item.getTargetPath()
                 if localpath in uncompchecked:
@@ -298,7 +387,8 @@ class Fetcher(object):
                 else:
                     item.setSucceeded(uncomppath)
             prog.show()
-            time.sleep(0.1)
+            if active or self._uncompressing:
+                self._wakeup.wait(TICKDELAY)
         for handler in handlers:
             handler.stop()
         if not progress:
@@ -323,6 +413,7 @@ class Fetcher(object):
             else:
                 item.setSucceeded(uncomppath)
         self._uncompressing -= 1
+        self.wakeUp()
 
     def getLocalSchemes(self):
         return self._localschemes
@@ -364,6 +455,83 @@ class Fetcher(object):
                     item.getInfo(prefix+"sha") or
                     item.getInfo(prefix+"sha256"))
 
+    def getDigestChecks(self, item, uncomp=False):
+        # The digests validate() checks, as (kind, digest) tuples. The
+        # SHA256 digest supersedes the SHA one.
+        if uncomp:
+            prefix = "uncomp_"
+        else:
+            prefix = ""
+        checks = []
+        for kind in ("md5", "sha256", "sha"):
+            digest = item.getInfo(prefix+kind)
+            if digest:
+                checks.append((kind, digest))
+                if kind == "sha256":
+                    break
+        return checks
+
+    def getLocalDigests(self, localpath, kinds):
+        # Files hashed by hashLocalFiles(), or while being downloaded,
+        # are looked up in the digest cache once, if unchanged since.
+        cached = self._digestcache.pop(localpath, None)
+        if cached:
+            st = os.stat(localpath)
+            stamp, digests = cached
+            if (stamp == (st.st_size, st.st_mtime) and
+                not [x for x in kinds if x not in digests]):
+                return digests
+        return getFileDigests(localpath, kinds)
+
+    def setLocalDigests(self, localpath, digests):
+        st = os.stat(localpath)
+        self._digestcache[localpath] = ((st.st_size, st.st_mtime), digests)
+
+    def getJournal(self, localpath):
+        """Return the FetchJournal of the directory of localpath."""
+        dirname = os.path.dirname(localpath)
+        self._journalslock.acquire()
+        try:
+            journal = self._journals.get(dirname)
+            if not journal:
+                journal = self._journals[dirname] = FetchJournal(dirname)
+            return journal
+        finally:
+            self._journalslock.release()
+
+    def hashLocalFiles(self, requests):
+        """
+        Hash the local files which are about to be validated, given as
+        (item, localpath, uncomp) tuples, at once, so that validate()
+        doesn't have to go over each of them in turn. Digests are only
+        kept while running local handlers.
+        """
+        hashing = []
+        for item, localpath, uncomp in requests:
+            if uncomp:
+                prefix = "uncomp_"
+            else:
+                prefix = ""
+            kinds = [x[0] for x in self.getDigestChecks(item, uncomp)]
+            if (not kinds or item.getInfo(prefix+"validate") or
+                not os.path.isfile(localpath)):
+                continue
+            size = item.getInfo(prefix+"size")
+            if size and os.path.getsize(localpath) != size:
+                continue
+            hashing.append((localpath, kinds))
+        if len(hashing) < 2:
+            return
+        stamps = []
+        for localpath, kinds in hashing:
+            st = os.stat(localpath)
+            stamps.append((st.st_size, st.st_mtime))
+        results = getFilesDigests(hashing)
+        for (localpath, kinds), stamp, digests in \
+                zip(hashing, stamps, results):
+            if digests:
+                self._digestcache[localpath] = (stamp, digests)
+
     def validate(self, item, localpath, withreason=False, uncomp=False):
         try:
             if not os.path.isfile(localpath):
@@ -391,56 +559,23 @@ class Fetcher(object):
                     raise Error, _("Unexpected size (expected %d, got %d)") % \
                                  (size, lsize)
 
-            filemd5 = item.getInfo(uncompprefix+"md5")
-            if filemd5:
-                try:
-                    from hashlib import md5
-                except ImportError:
-                    from md5 import md5
-                digest = md5()
-                file = open(localpath)
-                data = file.read(BLOCKSIZE)
-                while data:
-                    digest.update(data)
-                    data = file.read(BLOCKSIZE)
-                lfilemd5 = digest.hexdigest()
-                if lfilemd5 != filemd5:
-                    raise Error, _("Invalid MD5 (expected %s, got %s)") % \
-                                 (filemd5, lfilemd5)
-
-            filesha256 = item.getInfo(uncompprefix+"sha256")
-            if filesha256:
-                try:
-                    from hashlib import sha256
-                except ImportError:
-                    from smart.util.sha256 import sha256
-                digest = sha256()
-                file = open(localpath)
-                data = file.read(BLOCKSIZE)
-                while data:
-                    digest.update(data)
-                    data = file.read(BLOCKSIZE)
-                lfilesha256 = digest.hexdigest()
-                if lfilesha256 != filesha256:
-                   raise Error, _("Invalid SHA256 (expected %s, got %s)") % \
-                                 (filesha256, lfilesha256)
-            else:
-                filesha = item.getInfo(uncompprefix+"sha")
-                if filesha:
-                    try:
-                        from hashlib import sha1 as sha
-                    except ImportError:
-                        from sha import sha
-                    digest = sha()
-                    file = open(localpath)
-                    data = file.read(BLOCKSIZE)
-                    while data:
-                        digest.update(data)
-                        data = file.read(BLOCKSIZE)
-                    lfilesha = digest.hexdigest()
-                    if lfilesha != filesha:
+            checks = self.getDigestChecks(item, uncomp)
+            if checks:
+                digests = self.getLocalDigests(localpath,
+                                               [x[0] for x in checks])
+                for kind, filedigest in checks:
+                    lfiledigest = digests[kind]
+                    if lfiledigest == filedigest:
+                        continue
+                    if kind == "md5":
+                        raise Error, _("Invalid MD5 (expected %s, got %s)") % \
+                                     (filedigest, lfiledigest)
+                    elif kind == "sha256":
+                        raise Error, _("Invalid SHA256 (expected %s, got %s)") % \
+                                     (filedigest, lfiledigest)
+                    else:
                         raise Error, _("Invalid SHA (expected %s, got %s)") % \
-                                     (filesha, lfilesha)
+                                     (filedigest, lfiledigest)
         except Error, reason:
             if withreason:
                 return False, reason
@@ -509,6 +644,13 @@ class FetchItem(object):
     def getURL(self):
         return self._urlobj
 
+    def getSources(self):
+        return self._mirror.getSources()
+
+    def setLatency(self, latency):
+        # Seconds the server took to start answering.
+        self._mirror.addInfo(latency=latency)
+
     def setURL(self, url):
         self._urlobj.set(url)
 
@@ -597,6 +739,7 @@ class FetchItem(object):
         if self._status is not FAILED:
             self._status = SUCCEEDED
             self._targetpath = targetpath
+            self._mirror.release()
             if self._starttime:
                 if fetchedsize:
                     now = self._fetcher.time
@@ -607,14 +750,18 @@ class FetchItem(object):
                     self._speed = fetchedsize/timedelta
                 self._progress.setSubDone(self._urlobj.original)
                 self._progress.show()
+            # Last, since the fetcher may go on with the item right away.
+            self._fetcher.itemChanged(self)
 
     def setFailed(self, reason):
         self._status = FAILED
         self._failedreason = reason
+        self._mirror.release()
         if self._starttime:
             self._mirror.addInfo(failed=1)
             self._progress.setSubStopped(self._urlobj.original)
             self._progress.show()
+        self._fetcher.itemChanged(self)
 
     def setCancelled(self):
         self.setFailed(_("Cancelled"))
@@ -691,6 +838,141 @@ class URL(object):
             url += self.query
         return url
 
+class DigestFile(object):
+    """
+    File being downloaded, which feeds the data written to it into
+    the digests validate() checks for the item, so that the complete
+    file doesn't have to be read again to be validated. When appending
+    to a partial download, what's already there is hashed first.
+    """
+
+    def __init__(self, fetcher, item, path, mode="w"):
+        self._fetcher = fetcher
+        self._kinds = [x[0] for x in fetcher.getDigestChecks(item)]
+        self._digests = [DIGESTS[x]() for x in self._kinds]
+        if self._digests and mode == "a" and os.path.isfile(path):
+            hashFile(path, self._digests)
+        self._file = open(path, mode)
+
+    def write(self, data):
+        self._file.write(data)
+        for digest in self._digests:
+            digest.update(data)
+
+    def close(self):
+        self._file.close()
+
+    def setDigests(self, localpath):
+        """Tell the fetcher the digests of localpath, once renamed."""
+        if self._digests:
+            digests = {}
+            for kind, digest in zip(self._kinds, self._digests):
+                digests[kind] = digest.hexdigest()
+            self._fetcher.setLocalDigests(localpath, digests)
+
+class FetchJournal(object):
+    """
+    Journal of the partial downloads in a directory, telling later
+    runs which byte ranges of each .part file were received, and the
+    validators of the remote file they came from, so that they can be
+    resumed where they stopped. Entries are kept by file name, with
+    "url", "size", "ranges", "etag" and "modified" keys.
+    """
+
+    def __init__(self, dirname):
+        self._dirname = dirname
+        self._path = os.path.join(dirname, JOURNALNAME)
+        self._lock = thread.allocate_lock()
+        self._entries = None
+
+    def _load(self):
+        # The lock must be held.
+        if self._entries is None:
+            try:
+                file = open(self._path)
+                try:
+                    self._entries = marshal.load(file)
+                finally:
+                    file.close()
+            except (IOError, EOFError, ValueError, TypeError):
+                self._entries = {}
+            if type(self._entries) is not dict:
+                self._entries = {}
+        return self._entries
+
+    def _save(self, entries):
+        # Entries whose partial file is gone are dropped on the way.
+        for name in entries.keys():
+            if not os.path.isfile(os.path.join(self._dirname, name+".part")):
+                del entries[name]
+        try:
+            if entries:
+                tmppath = self._path+".tmp"
+                file = open(tmppath, "w")
+                try:
+                    marshal.dump(entries, file)
+                finally:
+                    file.close()
+                os.rename(tmppath, self._path)
+            elif os.path.isfile(self._path):
+                os.unlink(self._path)
+        except (IOError, OSError):
+            pass # Downloads just won't resume.
+
+    def _change(self, localpath, entry, merge):
+        self._lock.acquire()
+        try:
+            entries = self._load()
+            name = os.path.basename(localpath)
+            if entry is None:
+                if name not in entries:
+                    return
+                del entries[name]
+            elif merge and name in entries:
+                entries[name].update(entry)
+            else:
+                entries[name] = entry
+            self._save(entries)
+        finally:
+            self._lock.release()
+
+    def get(self, localpath):
+        self._lock.acquire()
+        try:
+            entry = self._load().get(os.path.basename(localpath))
+        finally:
+            self._lock.release()
+        if entry and os.path.isfile(localpath+".part"):
+            return entry
+        return None
+
+    def set(self, localpath, **info):
+        self._change(localpath, info, False)
+
+    def begin(self, localpath, **info):
+        """
+        Record that the download of localpath is starting over or
+        resuming, unless it's too small to be worth resuming.
+        """
+        if info.get("size") and info["size"] < JOURNALSIZE:
+            self.remove(localpath)
+        else:
+            self.set(localpath, **info)
+
+    def update(self, localpath, **info):
+        self._change(localpath, info, True)
+
+    def remove(self, localpath):
+        self._change(localpath, None, False)
+
+def getIfRange(entry):
+    # Validator to send in If-Range when resuming the download of a
+    # journal entry, if there's one. Weak ETags can't be used there.
+    etag = entry.get("etag")
+    if etag and not etag.startswith("W/"):
+        return etag
+    return entry.get("modified")
+
 class FetcherHandler(object):
     def __init__(self, fetcher):
         self._fetcher = fetcher
@@ -739,6 +1021,37 @@ class FetcherHandler(object):
     def getLocalPath(self, item):
         return self._fetcher.getLocalPath(item)
 
+    def getPartSize(self, item, localpath, size=None):
+        """
+        Return how much of the partial download of localpath can be
+        resumed, and its journal entry, which only has validators when
+        it came from the current URL. The partial file is cut back to
+        what the journal says was received, and isn't resumed when it
+        has holes, or isn't smaller than size.
+        """
+        localpathpart = localpath+".part"
+        if not os.path.isfile(localpathpart):
+            return 0, {}
+        partsize = os.path.getsize(localpathpart)
+        entry = self._fetcher.getJournal(localpath).get(localpath) or {}
+        ranges = entry.get("ranges")
+        if ranges is not None:
+            if len(ranges) == 1 and ranges[0][0] == 0:
+                partsize = min(partsize, ranges[0][1])
+            else:
+                partsize = 0
+        if not partsize or size and partsize >= size:
+            return 0, {}
+        if partsize < os.path.getsize(localpathpart):
+            file = open(localpathpart, "r+")
+            try:
+                file.truncate(partsize)
+            finally:
+                file.close()
+        if entry.get("url") != item.getURL().original:
+            entry = {}
+        return partsize, entry
+
     def runLocal(self, caching=None):
         # That's part of the caching magic.
         fetcher = self._fetcher
@@ -746,6 +1059,16 @@ class FetcherHandler(object):
             caching = fetcher.getCaching()
         if caching is not NEVER:
             uncompressor = fetcher.getUncompressor()
+            requests = []
+            for item in self._queue:
+                localpath = self.getLocalPath(item)
+                uncomphandler = uncompressor.getHandler(localpath)
+                if uncomphandler and item.getInfo("uncomp"):
+                    uncomppath = uncomphandler.getTargetPath(localpath)
+                    requests.append((item, uncomppath, True))
+                else:
+                    requests.append((item, localpath, False))
+            fetcher.hashLocalFiles(requests)
             for i in range(len(self._queue)-1,-1,-1):
                 item = self._queue[i]
                 localpath = self.getLocalPath(item)
@@ -870,25 +1193,59 @@ class FileHandler(FetcherHandler):
             retries = 0
             filepath = item.getURL().path
             localpath = self.getLocalPath(item)
+            localpathpart = localpath+".part"
+            journal = self._fetcher.getJournal(localpath)
             assert filepath != localpath
             while retries < self.RETRIES:
                 try:
+                    st = os.stat(filepath)
+                    partsize, partinfo = self.getPartSize(item, localpath,
+                                                          st.st_size)
                     input = open(filepath)
-                    output = open(localpath, "w")
-                    while True:
-                        data = input.read(BLOCKSIZE)
-                        if not data:
-                            break
-                        output.write(data)
+                    if (partsize and partinfo.get("size") == st.st_size and
+                        partinfo.get("modified") == st.st_mtime):
+                        input.seek(partsize)
+                        openmode = "a"
+                    else:
+                        partsize = 0
+                        openmode = "w"
+                    output = DigestFile(self._fetcher, item, localpathpart,
+                                        openmode)
+                    journal.begin(localpath, url=item.getURL().original,
+                                  size=st.st_size, modified=st.st_mtime)
+                    current = partsize
+                    complete = False
+                    try:
+                        while True:
+                            data = input.read(BLOCKSIZE)
+                            if not data:
+                                break
+                            output.write(data)
+                            current += len(data)
+                        complete = True
+                    finally:
+                        output.close()
+                        input.close()
+                        if not complete:
+                            journal.update(localpath, ranges=[(0, current)])
+                    os.rename(localpathpart, localpath)
+                    journal.remove(localpath)
+                    output.setDigests(localpath)
                 except (IOError, OSError), e:
                     error = unicode(e)
                     retries += 1
                 else:
-                    item.setSucceeded(localpath)
+                    valid, reason = self._fetcher.validate(item, localpath,
+                                                           withreason=True)
+                    if valid:
+                        item.setSucceeded(localpath)
+                    else:
+                        item.setFailed(reason)
                     break
             else:
                 item.setFailed(error)
         self._active = False
+        self._fetcher.wakeUp()
 
 Fetcher.setHandler("file", FileHandler, local=True)
 
@@ -954,7 +1311,8 @@ class FTPHandler(FetcherHandler):
                     hostactive = [x for x in self._active
                                   if self._active[x] == url.host]
                     maxactive = self._activelimit.get(url.host,
-                                                      self.MAXPERHOST)
+                                    sysconf.get("max-downloads-per-host",
+                                                self.MAXPERHOST))
                     if (len(hostactive) < maxactive and
                         self.changeActiveDownloads(+1)):
                         del self._queue[i]
@@ -1056,9 +1414,12 @@ class FTPHandler(FetcherHandler):
                 not fetcher.validate(item, localpath)):
 
                 localpathpart = localpath+".part"
-                if (os.path.isfile(localpathpart) and
-                    (not total or os.path.getsize(localpathpart) < total)):
-                    rest = os.path.getsize(localpathpart)
+                rest, partinfo = self.getPartSize(item, localpath, total)
+                if rest and partinfo and (partinfo.get("size") != total or
+                                          partinfo.get("modified") != mtime):
+                    # The file changed since the partial one was fetched.
+                    rest = 0
+                if rest:
                     openmode = "a"
                     item.current = rest
                 else:
@@ -1067,10 +1428,14 @@ class FTPHandler(FetcherHandler):
                     item.current = 0
 
                 try:
-                    local = open(localpathpart, openmode)
+                    local = DigestFile(fetcher, item, localpathpart, openmode)
                 except (IOError, OSError), e:
                     raise Error, "%s: %s" % (localpathpart, e)
 
+                journal = fetcher.getJournal(localpath)
+                journal.begin(localpath, url=url.original, size=total,
+                              modified=mtime)
+
                 def write(data):
                     if self._cancel:
                         raise FetcherCancelled
@@ -1078,6 +1443,7 @@ class FTPHandler(FetcherHandler):
                     item.current += len(data)
                     item.progress(item.current, total)
 
+                complete = False
                 try:
                     try:
                         ftp.retrbinary("RETR "+filename, write, BLOCKSIZE,
@@ -1085,13 +1451,19 @@ class FTPHandler(FetcherHandler):
                     except ftplib.error_perm:
                         iface.debug("Server does not support resume. \
                                     Restarting...")
+                    complete = True
                 finally:
                     local.close()
+                    if not complete:
+                        journal.update(localpath,
+                                       ranges=[(0, item.current)])
 
                 if mtime:
                     os.utime(localpathpart, (mtime, mtime))
 
                 os.rename(localpathpart, localpath)
+                journal.remove(localpath)
+                local.setDigests(localpath)
 
                 valid, reason = fetcher.validate(item, localpath,
                                                  withreason=True)
@@ -1139,21 +1511,468 @@ class FTPHandler(FetcherHandler):
 
 Fetcher.setHandler("ftp", FTPHandler)
 
+class PooledResponse(object):
+    """
+    File object for an HTTP response, which puts the connection back
+    in its pool once the response was read to the end.
+    """
+
+    def __init__(self, pool, key, conn, response):
+        self._pool = pool
+        self._key = key
+        self._conn = conn
+        self._response = response
+
+    def read(self, amt=None):
+        return self._response.read(amt)
+
+    def readline(self):
+        line = []
+        while True:
+            c = self._response.read(1)
+            line.append(c)
+            if not c or c == "\n":
+                return "".join(line)
+
+    def readlines(self):
+        return self.read().splitlines(True)
+
+    def close(self):
+        response = self._response
+        if response:
+            self._response = None
+            if not response.isclosed() and response.length == 0:
+                response.read()
+            if response.isclosed() and not response.will_close:
+                self._pool.put(self._key, self._conn)
+            else:
+                response.close()
+                self._conn.close()
+
+class HTTPConnectionPool(object):
+    """
+    Persistent HTTP connections, by scheme and host, which are used
+    again by later requests to the same server instead of connecting
+    for each one of them.
+    """
+
+    def __init__(self):
+        self._idle = {}
+        self._lock = thread.allocate_lock()
+
+    def put(self, key, conn):
+        self._lock.acquire()
+        self._idle.setdefault(key, []).append(conn)
+        self._lock.release()
+
+    def close(self):
+        self._lock.acquire()
+        idle = self._idle
+        self._idle = {}
+        self._lock.release()
+        for conns in idle.values():
+            for conn in conns:
+                conn.close()
+
+    def request(self, scheme, host, selector, headers, context=None):
+        """
+        Send a GET request, and return a PooledResponse for it, along
+        with the response status, reason and headers.
+        """
+        import httplib
+        key = (scheme, host)
+        while True:
+            self._lock.acquire()
+            idle = self._idle.get(key)
+            if idle:
+                conn = idle.pop()
+            else:
+                conn = None
+            self._lock.release()
+            if conn:
+                reused = True
+            else:
+                reused = False
+                if scheme == "https":
+                    if context is not None:
+                        conn = httplib.HTTPSConnection(host, context=context)
+                    else:
+                        conn = httplib.HTTPSConnection(host)
+                else:
+                    conn = httplib.HTTPConnection(host)
+            try:
+                conn.request("GET", selector, headers=headers)
+                response = conn.getresponse()
+            except (httplib.HTTPException, socket.error), e:
+                conn.close()
+                if reused:
+                    # The server closed it meanwhile. Try another one.
+                    continue
+                if isinstance(e, httplib.BadStatusLine):
+                    # Same error as urllib's.
+                    raise IOError, ("http protocol error", 0,
+                                    "got a bad status line", None)
+                elif isinstance(e, httplib.HTTPException):
+                    raise IOError, ("http protocol error", unicode(e))
+                raise
+            return (PooledResponse(self, key, conn, response),
+                    response.status, response.reason, response.msg)
+
+class SegmentedDownload(object):
+    """
+    Download of a file with a known size in segments, through range
+    requests to several mirrors at once. Each mirror takes segments
+    sized for the throughput seen from it, and the pieces are written
+    in place in the partial file. Finished segments are recorded in
+    the FetchJournal, so that an interrupted download goes on where it
+    stopped.
+    """
+
+    def __init__(self, handler, item, sources, localpath, size):
+        self._handler = handler
+        self._item = item
+        self._sources = sources
+        self._localpath = localpath
+        self._partpath = localpath+".part"
+        self._journal = handler._fetcher.getJournal(localpath)
+        self._size = size
+        self._cond = threading.Condition()
+        self._done = []     # Fetched (start, end) ranges.
+        self._holes = []    # Ranges not taken by any mirror yet.
+        self._taken = 0
+        self._current = 0
+        self._ranged = False
+        self._cancelled = False
+        self._errmsg = None
+
+    def discard(self):
+        if os.path.isfile(self._partpath):
+            os.unlink(self._partpath)
+        self._journal.remove(self._localpath)
+
+    def load(self):
+        # Find out what an earlier download left in the partial file.
+        done = []
+        if os.path.isfile(self._partpath):
+            entry = self._journal.get(self._localpath) or {}
+            if "ranges" in entry:
+                if entry.get("size") in (None, self._size):
+                    try:
+                        last = 0
+                        for start, end in entry["ranges"]:
+                            if not last <= start < end <= self._size:
+                                raise ValueError
+                            last = end
+                        done = entry["ranges"]
+                    except (ValueError, TypeError):
+                        pass
+            else:
+                # Left by a plain download, which writes from the start.
+                partsize = os.path.getsize(self._partpath)
+                if 0 < partsize <= self._size:
+                    done = [(0, partsize)]
+        self._done = [tuple(x) for x in done]
+        self._holes = []
+        last = 0
+        for start, end in self._done + [(self._size, self._size)]:
+            if start > last:
+                self._holes.append((last, start))
+            last = end
+        self._current = self._size-sum([y-x for x, y in self._holes])
+        fd = os.open(self._partpath, os.O_WRONLY|os.O_CREAT, 0666)
+        try:
+            os.ftruncate(fd, self._size)
+        finally:
+            os.close(fd)
+        self._journal.set(self._localpath, url=self._sources[0][1],
+                          size=self._size, ranges=self._done)
+
+    def take(self, segsize):
+        # Take the next segment to fetch. With no holes left, wait for
+        # the segments in flight, since a failing mirror gives back
+        # what it didn't fetch.
+        cond = self._cond
+        cond.acquire()
+        try:
+            while not self._holes and self._taken and not self._cancelled:
+                cond.wait(TICKDELAY)
+                if self._handler._cancel:
+                    self._cancelled = True
+            if not self._holes or self._cancelled:
+                return None
+            # Leave some for the other mirrors too.
+            left = sum([y-x for x, y in self._holes])
+            segsize = max(min(segsize, left/len(self._sources)),
+                          MINSEGMENTSIZE)
+            start, end = self._holes[0]
+            if end-start < segsize+segsize/2:
+                del self._holes[0]
+            else:
+                end = start+segsize
+                self._holes[0] = (end, self._holes[0][1])
+            self._taken += 1
+            return start, end
+        finally:
+            cond.release()
+
+    def release(self, start, pos, end):
+        # The segment from start to end was fetched up to pos.
+        cond = self._cond
+        cond.acquire()
+        try:
+            self._taken -= 1
+            if pos < end:
+                self._holes.append((pos, end))
+                self._holes.sort()
+            if pos > start:
+                done = self._done
+                done.append((start, pos))
+                done.sort()
+                i = 1
+                while i < len(done):
+                    if done[i-1][1] == done[i][0]:
+                        done[i-1:i+1] = [(done[i-1][0], done[i][1])]
+                    else:
+                        i += 1
+                self._journal.update(self._localpath, ranges=done)
+            cond.notifyAll()
+        finally:
+            cond.release()
+
+    def progress(self, amount):
+        cond = self._cond
+        cond.acquire()
+        try:
+            self._current += amount
+            self._item.progress(self._current, self._size)
+        finally:
+            cond.release()
+
+    def fetchFrom(self, mirror, url):
+        # Fetch segments from the given mirror until none are left, or
+        # it fails, in which case the others take over.
+        handler = self._handler
+        mirrorsystem = handler._fetcher.getMirrorSystem()
+        scheme, rest = urllib.splittype(url)
+        host, selector = urllib.splithost(rest)
+        host = urllib.unquote(host)
+        headers = {"User-Agent": "smart/" + VERSION}
+        speed = mirrorsystem.getSpeed(mirror)
+        try:
+            file = open(self._partpath, "r+b")
+        except (IOError, OSError), e:
+            self._errmsg = "%s: %s" % (self._partpath, e)
+            return
+        try:
+            while True:
+                segsize = MINSEGMENTSIZE
+                if speed:
+                    segsize = min(max(int(speed*SEGMENTTIME), MINSEGMENTSIZE),
+                                  MAXSEGMENTSIZE)
+                segment = self.take(segsize)
+                if not segment:
+                    break
+                start, end = segment
+                pos = start
+                starttime = time.time()
+                try:
+                    headers["Range"] = "bytes=%d-%d" % (start, end-1)
+                    remote, status, reason, info = \
+                        handler._pool.request(scheme, host, selector or "/",
+                                              headers)
+                    mirrorsystem.addInfo(mirror,
+                                         latency=time.time()-starttime)
+                    try:
+                        if status == 404:
+                            raise Error, _("File not found")
+                        elif status == 200:
+                            raise RangesUnsupported
+                        elif status != 206:
+                            raise Error, reason
+                        expected = "bytes %d-%d/%d" % (start, end-1,
+                                                       self._size)
+                        if info.get("content-range") != expected:
+                            raise Error, _("Server reports unexpected size")
+                        self._ranged = True
+                        file.seek(pos)
+                        while pos < end:
+                            if handler._cancel:
+                                raise FetcherCancelled
+                            data = remote.read(min(BLOCKSIZE, end-pos))
+                            if not data:
+                                raise IOError, _("Connection closed early")
+                            file.write(data)
+                            pos += len(data)
+                            self.progress(len(data))
+                    finally:
+                        remote.close()
+                        file.flush()
+                except FetcherCancelled:
+                    self._cancelled = True
+                    self.release(start, pos, end)
+                    break
+                except RangesUnsupported:
+                    # The mirror works, it just can't take part.
+                    self._errmsg = _("Server doesn't support ranges")
+                    self.release(start, pos, end)
+                    break
+                except (IOError, OSError, Error, socket.error), e:
+                    try:
+                        errmsg = unicode(e[1])
+                    except IndexError:
+                        errmsg = unicode(e)
+                    self._errmsg = errmsg
+                    mirrorsystem.addInfo(mirror, failed=1)
+                    self.release(start, pos, end)
+                    break
+                else:
+                    elapsed = max(time.time()-starttime, 0.001)
+                    mirrorsystem.addInfo(mirror, time=elapsed, size=end-start)
+                    if speed:
+                        speed = (speed+(end-start)/elapsed)/2
+                    else:
+                        speed = (end-start)/elapsed
+                    self.release(start, pos, end)
+        finally:
+            file.close()
+
+    def run(self):
+        """
+        Fetch the missing segments, and return True once the file is
+        complete. False means that the mirrors don't answer to range
+        requests, and that the file should be fetched as a whole.
+        """
+        self.load()
+        threads = []
+        for mirror, url in self._sources[1:]:
+            t = threading.Thread(target=self.fetchFrom, args=(mirror, url))
+            t.start()
+            threads.append(t)
+        try:
+            self.fetchFrom(*self._sources[0])
+        finally:
+            for t in threads:
+                t.join()
+        if self._cancelled:
+            raise FetcherCancelled
+        if self._holes:
+            if not self._ranged:
+                self.discard()
+                return False
+            raise Error, self._errmsg
+        os.rename(self._partpath, self._localpath)
+        self._journal.remove(self._localpath)
+        return True
+
 class URLLIBHandler(FetcherHandler):
 
     MAXACTIVE = 5
+    MAXPERHOST = 5
 
     def __init__(self, *args):
         FetcherHandler.__init__(self, *args)
         self._active = 0
+        self._hostactive = {} # host -> num
         self._lock = thread.allocate_lock()
+        self._pool = HTTPConnectionPool()
+
+    def stop(self):
+        FetcherHandler.stop(self)
+        self._pool.close()
+
+    def popItem(self):
+        # Take the next item whose host isn't at its download limit.
+        # The lock must be held.
+        maxperhost = sysconf.get("max-downloads-per-host", self.MAXPERHOST)
+        for i in range(len(self._queue)-1,-1,-1):
+            host = self._queue[i].getURL().host
+            if self._hostactive.get(host, 0) < maxperhost:
+                self._hostactive[host] = self._hostactive.get(host, 0)+1
+                return self._queue.pop(i)
+        return None
+
+    def releaseHost(self, host):
+        self._lock.acquire()
+        self._hostactive[host] -= 1
+        self._lock.release()
+
+    def getSegmentSources(self, item):
+        # Mirrors to fetch the item from in segments, if it's worth it.
+        size = item.getInfo("size")
+        maxsources = sysconf.get("segmented-downloads", MAXSEGMENTSOURCES)
+        if (not size or maxsources < 2 or self._fetcher._maxdownloadrate or
+            size < sysconf.get("segmented-download-size", SEGMENTEDSIZE)):
+            return []
+        maxperhost = sysconf.get("max-downloads-per-host", self.MAXPERHOST)
+        proxies = urllib.getproxies()
+        sources = []
+        self._lock.acquire()
+        for mirror, url in item.getSources():
+            url = URL(url)
+            if (url.scheme not in ("http", "https") or url.user or
+                url.scheme in proxies):
+                if not sources:
+                    break
+                continue
+            if sources:
+                # The item's own host was counted by popItem() already.
+                if self._hostactive.get(url.host, 0) >= maxperhost:
+                    continue
+                self._hostactive[url.host] = \
+                    self._hostactive.get(url.host, 0)+1
+            sources.append((mirror, url))
+            if len(sources) == maxsources:
+                break
+        self._lock.release()
+        return sources
+
+    def fetchSegments(self, item, localpath):
+        # Fetch the item in segments from several mirrors, returning
+        # False if it must be fetched as usual instead.
+        sources = self.getSegmentSources(item)
+        try:
+            if len(sources) < 2:
+                return False
+            if (os.path.isfile(localpath) and
+                self._fetcher.validate(item, localpath)):
+                # Checked against the server as usual.
+                return False
+            download = SegmentedDownload(self, item,
+                                         [(x, y.original) for x, y in sources],
+                                         localpath, item.getInfo("size"))
+            try:
+                if not download.run():
+                    return False
+            except FetcherCancelled:
+                item.setCancelled()
+                return True
+            except (IOError, OSError, Error), e:
+                item.setFailed(unicode(e))
+                return True
+        finally:
+            for mirror, url in sources[1:]:
+                self.releaseHost(url.host)
+        valid, reason = self._fetcher.validate(item, localpath,
+                                               withreason=True)
+        if valid:
+            item.setSucceeded(localpath)
+        else:
+            os.unlink(localpath)
+            item.setFailed(reason)
+        return True
 
     def tick(self):
         self._lock.acquire()
         if self._queue:
-            while (self._active < self.MAXACTIVE and
+            maxperhost = sysconf.get("max-downloads-per-host",
+                                     self.MAXPERHOST)
+            waiting = len([x for x in self._queue
+                           if self._hostactive.get(x.getURL().host, 0) <
+                              maxperhost])
+            while (waiting and self._active < self.MAXACTIVE and
                    self.changeActiveDownloads(+1)):
                 self._active += 1
+                waiting -= 1
                 thread.start_new_thread(self.fetch, ())
         self._lock.release()
         return bool(self._queue or self._active)
@@ -1182,19 +2001,46 @@ class URLLIBHandler(FetcherHandler):
                 info.errcode = errcode
                 info.errmsg = errmsg
                 return info
+            def open_http(self, url, data=None):
+                return self.open_pooled("http", url, data)
+            def open_https(self, url, data=None):
+                return self.open_pooled("https", url, data)
+            def open_pooled(self, scheme, url, data):
+                # Requests through proxies and posts are left to urllib.
+                if data is not None or not isinstance(url, str):
+                    open = getattr(urllib.FancyURLopener, "open_"+scheme)
+                    return open(self, url, data)
+                import base64
+                host, selector = urllib.splithost(url)
+                if not host:
+                    raise IOError, ("http error", "no host given")
+                user_passwd, host = urllib.splituser(host)
+                host = urllib.unquote(host)
+                headers = dict(self.addheaders)
+                if user_passwd:
+                    auth = base64.b64encode(urllib.unquote(user_passwd))
+                    headers["Authorization"] = "Basic %s" % auth
+                fp, errcode, errmsg, info = \
+                    self.pool.request(scheme, host, selector or "/",
+                                      headers, getattr(self, "context", None))
+                if 200 <= errcode < 300:
+                    return urllib.addinfourl(fp, info, scheme+":"+url,
+                                             errcode)
+                return self.http_error(url, fp, errcode, errmsg, info)
 
         opener = Opener()
+        opener.pool = self._pool
         
         fetcher = self._fetcher
 
         while not self._cancel:
 
             self._lock.acquire()
-            if not self._queue:
-                self._lock.release()
-                break
-            item = self._queue.pop()
+            item = self.popItem()
             self._lock.release()
+            if not item:
+                break
+            host = item.getURL().host
 
             url = item.getURL()
 
@@ -1203,6 +2049,10 @@ class URLLIBHandler(FetcherHandler):
 
             item.start()
 
+            if self.fetchSegments(item, self.getLocalPath(item)):
+                self.releaseHost(host)
+                continue
+
             try:
 
                 localpath = self.getLocalPath(item)
@@ -1222,19 +2072,22 @@ class URLLIBHandler(FetcherHandler):
                                      rfc822.formatdate(mtime))
 
                 localpathpart = localpath+".part"
-                if os.path.isfile(localpathpart):
-                    partsize = os.path.getsize(localpathpart)
-                    if not size or partsize < size:
-                        opener.addheader("range", "bytes=%d-" % partsize)
-                else:
-                    partsize = 0
-
+                partsize, partinfo = self.getPartSize(item, localpath, size)
+                if partsize:
+                    opener.addheader("range", "bytes=%d-" % partsize)
+                    ifrange = getIfRange(partinfo)
+                    if ifrange:
+                        opener.addheader("if-range", ifrange)
+
+                requesttime = time()
                 remote = opener.open(url.original)
+                item.setLatency(time()-requesttime)
 
                 if hasattr(remote, "errcode") and remote.errcode == 416:
                     # Range not satisfiable, try again without it.
+                    remote.close()
                     opener.addheaders = [x for x in opener.addheaders
-                                         if x[0] != "range"]
+                                         if x[0] not in ("range", "if-range")]
                     remote = opener.open(url.original)
 
                 if hasattr(remote, "errcode") and remote.errcode != 206:
@@ -1261,15 +2114,21 @@ class URLLIBHandler(FetcherHandler):
                     raise Error, _("Server reports unexpected size")
 
                 try:
-                    local = open(localpathpart, openmode)
+                    local = DigestFile(fetcher, item, localpathpart, openmode)
                 except (IOError, OSError), e:
                     raise IOError, "%s: %s" % (localpathpart, e)
 
+                journal = fetcher.getJournal(localpath)
+                journal.begin(localpath, url=url.original, size=total,
+                              etag=info.get("etag"),
+                              modified=info.get("last-modified"))
+
                 rate_limit = self._fetcher._maxdownloadrate
                 if rate_limit:
                     rate_limit /= self._active
                     start = time()
 
+                complete = False
                 try:
                     data = remote.read(BLOCKSIZE)
                     while data:
@@ -1287,11 +2146,16 @@ class URLLIBHandler(FetcherHandler):
                                 if sleep_time > 0:
                                     sleep(sleep_time)
                         data = remote.read(BLOCKSIZE)
+                    complete = True
                 finally:
                     local.close()
                     remote.close()
+                    if not complete:
+                        journal.update(localpath, ranges=[(0, current)])
 
                 os.rename(localpathpart, localpath)
+                journal.remove(localpath)
+                local.setDigests(localpath)
 
                 valid, reason = fetcher.validate(item, localpath,
                                                  withreason=True)
@@ -1321,6 +2185,7 @@ class URLLIBHandler(FetcherHandler):
                             os.utime(localpath, (mtime, mtime))
 
             except urllib.addinfourl, remote:
+                remote.close()
                 if remote.errcode == 304: # Not modified
                     item.setSucceeded(localpath)
                 elif remote.errcode == 404:
@@ -1339,6 +2204,8 @@ class URLLIBHandler(FetcherHandler):
             except FetcherCancelled:
                 item.setCancelled()
 
+            self.releaseHost(host)
+
         self._lock.acquire()
         self._active -= 1
         self._lock.release()
@@ -1454,7 +2321,7 @@ class URLLIB2Handler(FetcherHandler):
                     raise Error, _("Server reports unexpected size")
 
                 try:
-                    local = open(localpathpart, openmode)
+                    local = DigestFile(fetcher, item, localpathpart, openmode)
                 except (IOError, OSError), e:
                     raise IOError, "%s: %s" % (localpathpart, e)
 
@@ -1470,6 +2337,7 @@ class URLLIB2Handler(FetcherHandler):
                     remote.close()
 
                 os.rename(localpathpart, localpath)
+                local.setDigests(localpath)
 
                 valid, reason = fetcher.validate(url, localpath,
                                                  withreason=True)
@@ -1533,6 +2401,13 @@ class PyCurlHandler(FetcherHandler):
         self._activelimit = {} # host -> num
         self._running = False
         self._multi = pycurl.CurlMulti()
+        if hasattr(pycurl, "M_PIPELINING"):
+            # Multiplex transfers to the same host over one HTTP/2
+            # connection, where libcurl and the server support it.
+            try:
+                self._multi.setopt(pycurl.M_PIPELINING, 2)
+            except pycurl.error:
+                pass
         self._lock = thread.allocate_lock()
 
     def tick(self):
@@ -1581,6 +2456,8 @@ class PyCurlHandler(FetcherHandler):
 
                 http_code = handle.getinfo(pycurl.HTTP_CODE)
 
+                fetcher.getJournal(localpath).remove(localpath)
+
                 if (http_code == 404 or
                     handle.getinfo(pycurl.SIZE_DOWNLOAD) == 0):
                     # Not modified or not found
@@ -1592,6 +2469,7 @@ class PyCurlHandler(FetcherHandler):
                     mtime = handle.getinfo(pycurl.INFO_FILETIME)
                     if mtime != -1:
                         os.utime(localpath, (mtime, mtime))
+                    local.setDigests(localpath)
 
                 del self._active[handle]
                 userhost = (url.user, url.host, url.port)
@@ -1603,6 +2481,8 @@ class PyCurlHandler(FetcherHandler):
                     valid, reason = fetcher.validate(item, localpath,
                                                      withreason=True)
                     if valid:
+                        item.setLatency(handle.getinfo(
+                                            pycurl.STARTTRANSFER_TIME))
                         fetchedsize = handle.getinfo(pycurl.SIZE_DOWNLOAD)
                         item.setSucceeded(localpath, fetchedsize)
                     elif handle.partsize:
@@ -1630,8 +2510,23 @@ class PyCurlHandler(FetcherHandler):
                 userhost = (url.user, url.host, url.port)
                 self._inactive[handle] = userhost
 
+                # Keep track of the partial file, to resume it later.
+                info = {}
+                for line in handle.headers:
+                    name, sep, value = line.partition(":")
+                    name = name.strip().lower()
+                    if name in ("etag", "last-modified"):
+                        info[name] = value.strip()
+                fetched = handle.partsize+int(handle.getinfo(
+                                                    pycurl.SIZE_DOWNLOAD))
+                fetcher.getJournal(localpath).set(localpath,
+                    url=url.original, size=item.getInfo("size"),
+                    etag=info.get("etag"), modified=info.get("last-modified"),
+                    ranges=[(0, fetched)])
+
                 if handle.partsize and "byte ranges" in errmsg:
                     os.unlink(localpath+".part")
+                    fetcher.getJournal(localpath).remove(localpath)
                     item.reset()
                     self._queue.append(item)
                 elif handle.active and "password" in errmsg:
@@ -1655,7 +2550,8 @@ class PyCurlHandler(FetcherHandler):
                     hostactive = [x for x in self._active
                                      if self._active[x] == schemehost]
                     maxactive = self._activelimit.get(url.host,
-                                                      self.MAXPERHOST)
+                                    sysconf.get("max-downloads-per-host",
+                                                self.MAXPERHOST))
                     if (len(hostactive) < maxactive and
                         self.changeActiveDownloads(+1)):
 
@@ -1676,12 +2572,8 @@ class PyCurlHandler(FetcherHandler):
 
                         size = item.getInfo("size")
 
-                        if os.path.isfile(localpathpart):
-                            partsize = os.path.getsize(localpathpart)
-                            if size and partsize >= size:
-                                partsize = 0
-                        else:
-                            partsize = 0
+                        partsize, partinfo = self.getPartSize(item, localpath,
+                                                              size)
                         handle.partsize = partsize
                         if partsize:
                             openmode = "a"
@@ -1692,7 +2584,8 @@ class PyCurlHandler(FetcherHandler):
                             handle.setopt(pycurl.RESUME_FROM_LARGE, 0L)
 
                         try:
-                            local = open(localpathpart, openmode)
+                            local = DigestFile(fetcher, item, localpathpart,
+                                               openmode)
                         except (IOError, OSError), e:
                             item.setFailed("%s: %s" % (localpathpart, e))
                             del self._active[handle]
@@ -1722,12 +2615,26 @@ class PyCurlHandler(FetcherHandler):
                         handle.setopt(pycurl.LOW_SPEED_TIME, SOCKETTIMEOUT)
                         handle.setopt(pycurl.NOPROGRESS, 1)
                         handle.setopt(pycurl.PROGRESSFUNCTION, progress)
-                        handle.setopt(pycurl.WRITEDATA, local)
+                        handle.setopt(pycurl.WRITEFUNCTION, local.write)
                         handle.setopt(pycurl.FOLLOWLOCATION, 1)
                         handle.setopt(pycurl.MAXREDIRS, 5)
-                        handle.setopt(pycurl.HTTPHEADER, ["Pragma:"])
+                        headers = ["Pragma:"]
+                        ifrange = getIfRange(partinfo)
+                        if (partsize and ifrange and
+                            url.scheme in ("http", "https")):
+                            headers.append("If-Range: "+ifrange)
+                        handle.setopt(pycurl.HTTPHEADER, headers)
+                        handle.headers = []
+                        handle.setopt(pycurl.HEADERFUNCTION,
+                                      handle.headers.append)
                         handle.setopt(pycurl.USERAGENT, "smart/" + VERSION)
                         handle.setopt(pycurl.FAILONERROR, 1)
+                        if hasattr(pycurl, "CURL_HTTP_VERSION_2TLS"):
+                            try:
+                                handle.setopt(pycurl.HTTP_VERSION,
+                                         pycurl.CURL_HTTP_VERSION_2TLS)
+                            except pycurl.error:
+                                pass
 
                         # check if we have a valid local file and use I-M-S
                         if fetcher.validate(item, localpath):
@@ -1758,17 +2665,23 @@ class PyCurlHandler(FetcherHandler):
         import pycurl
         multi = self._multi
         mp = pycurl.E_CALL_MULTI_PERFORM
+        running = 0
         while self._queue or self._active:
             self._lock.acquire()
             res = mp
             while res == mp:
                 res, num = multi.perform()
             self._lock.release()
+            if num < running:
+                # Some transfer is done, and tick() will handle it.
+                self._fetcher.wakeUp()
+            running = num
             multi.select(1.0)
         # Keep in mind that even though the while above has exited due to
         # self._active being False, it may actually be true *here* due to
         # race conditions.
         self._running = False
+        self._fetcher.wakeUp()
 
 try:
     import pycurl
@@ -21,52 +21,184 @@
 #
 from smart import *
 import random
-import time
+import thread
 
-HISTORYPERMIRROR = 20
-HISTORYCUTDELAY = 60
-GRANULARITY = 100
+# Weight of each new sample in the moving averages of MirrorStats.
+ALPHA = 0.2
+# Upper bounds, in seconds, of the latency histogram buckets. Anything
+# slower goes into one more bucket.
+LATENCYBOUNDS = [0.01*2**i for i in range(12)]
+# Mirrors are compared by how long they're expected to take to fetch
+# this many bytes.
+REFERENCESIZE = 1024*1024
+
+class MirrorStats(object):
+    """
+    Statistics of downloads from one mirror, as moving averages which
+    are updated in constant time by each sample: bytes and seconds of
+    transfers, for the throughput, the failure rate, and a decaying
+    histogram of latencies, for percentiles. The state is kept as a
+    small tuple, which is what gets saved.
+    """
+
+    def __init__(self, state=None):
+        if state:
+            (self.size, self.time, self.failrate,
+             self.latencies) = state[0], state[1], state[2], list(state[3])
+        else:
+            self.size = 0.0
+            self.time = 0.0
+            self.failrate = 0.0
+            self.latencies = [0.0]*(len(LATENCYBOUNDS)+1)
+
+    def getState(self):
+        return (round(self.size, 1), round(self.time, 4),
+                round(self.failrate, 4),
+                tuple([round(x, 4) for x in self.latencies]))
+
+    def addSample(self, size=0, time=0, failed=0, latency=None):
+        if size and time:
+            if self.time:
+                self.size += ALPHA*(size-self.size)
+                self.time += ALPHA*(time-self.time)
+            else:
+                self.size = float(size)
+                self.time = float(time)
+        if failed or size and time:
+            self.failrate += ALPHA*((failed and 1 or 0)-self.failrate)
+        if latency is not None:
+            latencies = self.latencies
+            for i in range(len(latencies)):
+                latencies[i] *= 1-ALPHA
+            for i, bound in enumerate(LATENCYBOUNDS):
+                if latency <= bound:
+                    break
+            else:
+                i = len(LATENCYBOUNDS)
+            latencies[i] += ALPHA
+
+    def getThroughput(self):
+        # In bytes per second, or None if nothing was fetched yet.
+        if self.time:
+            return self.size/self.time
+        return None
+
+    def getLatency(self, percentile=50):
+        # Upper bound of the given percentile of latencies, or zero
+        # when none were seen.
+        total = sum(self.latencies)
+        if not total:
+            return 0
+        wanted = total*percentile/100.0
+        current = 0
+        for i, count in enumerate(self.latencies):
+            current += count
+            if current >= wanted:
+                break
+        if i < len(LATENCYBOUNDS):
+            return LATENCYBOUNDS[i]
+        return LATENCYBOUNDS[-1]*2
+
+    def getCost(self):
+        # Seconds expected to fetch REFERENCESIZE bytes, counting the
+        # retries failures take, or None if nothing was fetched yet.
+        throughput = self.getThroughput()
+        if not throughput:
+            return None
+        cost = self.getLatency()+REFERENCESIZE/throughput
+        return cost/(1-min(self.failrate, 0.9))
 
 class MirrorSystem(object):
 
     def __init__(self):
         self._mirrors = {}
-        self._history = []
-        self._penality = {}
-        self._changed = False
+        self._stats = {}
+        self._load = {}
+        self._lock = thread.allocate_lock()
         self._historychanged = False
-        self._lastcuttime = 0
 
     def getMirrors(self):
         return self._mirrors
 
     def setMirrors(self, mirrors):
-        self._changed = True
         self._mirrors = mirrors
 
     def getHistory(self):
-        return self._history
+        history = {}
+        for mirror, stats in self._stats.items():
+            history[mirror] = stats.getState()
+        return history
 
     def setHistory(self, history):
-        self._changed = True
-        self._history = history
-        self._historychanged = False
+        self._stats.clear()
+        if type(history) is dict:
+            for mirror, state in history.items():
+                try:
+                    self._stats[mirror] = MirrorStats(state)
+                except (TypeError, ValueError, IndexError):
+                    pass
+        else:
+            # Old format, as a list of (mirror, info) with the newest
+            # entries first.
+            for mirror, info in history[::-1]:
+                try:
+                    self.addInfo(mirror, **info)
+                except TypeError:
+                    pass
+        # Old lists are saved again in the compact format.
+        self._historychanged = type(history) is not dict
 
     def getHistoryChanged(self):
         return self._historychanged
 
     def addInfo(self, mirror, **info):
         if mirror:
-            self._changed = True
-            self._history.insert(0, (mirror, info))
-            self._historychanged = True
-            now = time.time()
-            if now-self._lastcuttime > HISTORYCUTDELAY:
-                self._lastcuttime = now
-                count = 0
-                for origin in self._mirrors:
-                    count += 1+len(self._mirrors[origin])
-                del self._history[count*HISTORYPERMIRROR:]
+            self._lock.acquire()
+            try:
+                stats = self._stats.get(mirror)
+                if not stats:
+                    stats = self._stats[mirror] = MirrorStats()
+                stats.addSample(**info)
+                self._historychanged = True
+            finally:
+                self._lock.release()
+
+    def getSpeed(self, mirror):
+        # Throughput seen from the mirror, in bytes per second, or None
+        # if nothing was fetched from it yet.
+        stats = self._stats.get(mirror)
+        if stats:
+            return stats.getThroughput()
+        return None
+
+    def getCost(self, mirror):
+        # Seconds the mirror is expected to take for a download. Those
+        # never used are taken as good as the best one, so that they
+        # get their share and are measured, and those which just failed
+        # as bad as the worst one.
+        stats = self._stats.get(mirror)
+        cost = stats and stats.getCost()
+        if cost is None:
+            costs = [x.getCost() for x in self._stats.values()]
+            costs = [x for x in costs if x is not None] or [1.0]
+            if stats and stats.failrate:
+                cost = max(costs)/(1-min(stats.failrate, 0.9))
+            else:
+                cost = min(costs)
+        return cost
+
+    def getLoadCost(self, mirror):
+        # Seconds until a new download from the mirror is expected to
+        # be done, after the ones already assigned to it.
+        return self.getCost(mirror)*(self._load.get(mirror, 0)+1)
+
+    def changeLoad(self, mirror, value):
+        self._lock.acquire()
+        self._load[mirror] = max(self._load.get(mirror, 0)+value, 0)
+        self._lock.release()
+
+    def resetLoad(self):
+        self._load.clear()
 
     def get(self, url): 
         elements = {}
@@ -82,43 +214,12 @@ class MirrorSystem(object):
         return MirrorItem(self, url, elements)
 
     def getPenalities(self):
-        self.updatePenality()
-        return self._penality
-
-    def updatePenality(self):
-        if not self._changed:
-            return
-        self._changed = False
-        self._penality.clear()
-        data = {}
-        for mirror, info in self._history:
-            if mirror not in data:
-                mirrordata = data.setdefault(mirror, {"size": 0, "time": 0,
-                                                      "failed": 0})
-            else:
-                mirrordata = data[mirror]
-            mirrordata["size"] += info.get("size", 0)
-            mirrordata["time"] += info.get("time", 0)
-            mirrordata["failed"] += info.get("failed", 0)
-        maxpenality = 1
-        justerrors = []
-        for mirror in data:
-            mirrordata = data[mirror]
-            if mirrordata["size"]:
-                penality = (mirrordata["time"]*1000000)/mirrordata["size"]
-                penality += mirrordata["failed"]*(penality*0.1)
-                # Integer division by granularity ensures that mirrors
-                # which are close enough will be considered equal to
-                # distribute load.
-                penality /= GRANULARITY
-                self._penality[mirror] = penality
-                if penality > maxpenality:
-                    maxpenality = penality
-            elif mirrordata["failed"]:
-                justerrors.append(mirror)
-        if justerrors:
-            for mirror in justerrors:
-                self._penality[mirror] = maxpenality
+        # Expected milliseconds per download, for the mirrors with
+        # statistics.
+        penalities = {}
+        for mirror in self._stats:
+            penalities[mirror] = int(self.getCost(mirror)*1000)
+        return penalities
 
 class MirrorElement(object):
 
@@ -135,9 +236,9 @@ class MirrorElement(object):
         rc = -cmp(self.mirror.startswith("file://"),
                   other.mirror.startswith("file://"))
         if rc == 0:
-            # Otherwise, check penality.
-            pen = self._system._penality
-            rc = cmp(pen.get(self.mirror, 0), pen.get(other.mirror, 0))
+            # Otherwise, check the expected cost.
+            rc = cmp(self._system.getCost(self.mirror),
+                     other._system.getCost(other.mirror))
         return rc
 
 class MirrorItem(object):
@@ -147,23 +248,51 @@ class MirrorItem(object):
         self._url = url
         self._elements = elements
         self._current = None
+        self._loaded = False
 
     def addInfo(self, **info):
         if self._current and hasattr(self._current, 'mirror'):
             self._system.addInfo(self._current.mirror, **info)
 
+    def release(self):
+        # The download from the current mirror is over.
+        if self._loaded:
+            self._loaded = False
+            self._system.changeLoad(self._current.mirror, -1)
+
     def getNext(self):
+        self.release()
         if self._elements:
-            self._system.updatePenality()
+            # Local files go first. Otherwise, take the mirror expected
+            # to be done soonest, given what was assigned to it already,
+            # so that parallel downloads are spread by throughput.
+            system = self._system
             random.shuffle(self._elements)
-            self._elements.sort()
-            #for i, item in enumerate(self._elements):
-            #    penality = self._system.getPenalities().get(item.mirror, 0)
-            #    print "%d. %s (%d)" % (i, item.mirror, penality)
-            self._current = elem = self._elements.pop(0)
+            elem = min(self._elements,
+                       key=lambda x: (not x.mirror.startswith("file://"),
+                                      system.getLoadCost(x.mirror)))
+            self._elements.remove(elem)
+            self._current = elem
+            if elem.mirror:
+                system.changeLoad(elem.mirror, +1)
+                self._loaded = True
             return elem.mirror+self._url[len(elem.origin):]
         else:
             self._current = None
             return None
 
+    def getSources(self):
+        # The (mirror, url) pairs of the current mirror and of the ones
+        # still left, best ones first, without changing the current one.
+        sources = []
+        if self._current:
+            elems = [self._current]
+        else:
+            elems = []
+        elems.extend(sorted(self._elements))
+        for elem in elems:
+            url = elem.mirror+self._url[len(elem.origin):]
+            sources.append((elem.mirror, url))
+        return sources
+
 # vim:ts=4:sw=4:et
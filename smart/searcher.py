@@ -22,7 +22,10 @@
 from smart.util.strtools import globdistance
 from smart.cache import Provides
 from smart import *
+import marshal
 import fnmatch
+import string
+import array
 import re
 
 def _stripeol(pattern):
@@ -220,3 +223,265 @@ class Searcher(object):
         s = _stripeol(fnmatch.translate(s)).replace("\ ", " ")
         p = re.compile("\s+".join(s.split()), self.ignorecase and re.I or 0)
         self.description.append(p)
+
+# Trigram index of names and versions.
+#
+# The search() methods of packages and provides compare the patterns
+# against the name, and against the name joined to the version (or
+# parts of it) by "-", "_" or "@". The index keeps, for every trigram,
+# the objects having it in any of these strings, so that objects which
+# can't match a pattern are skipped without computing distances.
+#
+# A pattern matching a string with at most k edits has all but k*3 of
+# the trigrams in its literal parts in that string. The number of edits
+# allowed depends on the cutoff and on the length of the string, which
+# is why the index also keeps the length of the longest string of each
+# object.
+
+GRAMSIZE = 3
+
+# Float slack for the cutoff computation in globdistance().
+CUTOFFSLACK = 0.001
+
+# Strings longer than that are truncated by globdistance().
+MAXPATTERN = 1024
+
+_lower = string.maketrans(string.ascii_uppercase, string.ascii_lowercase)
+_epochre = re.compile("[0-9]+:")
+
+def getGrams(s):
+    s = s.translate(_lower)
+    return [s[i:i+GRAMSIZE] for i in range(len(s)-GRAMSIZE+1)]
+
+def getTargetStrings(name, version):
+    """
+    Return all strings which search() methods of the backends compare
+    patterns against, for the given name and version: the name alone,
+    joined to the version with "-" or "_", with or without the epoch,
+    the release and the @arch suffix.
+    """
+    targets = {name: True}
+    versions = [version]
+    noepoch = _epochre.sub("", version)
+    if noepoch != version:
+        versions.append(noepoch)
+    for v in versions:
+        at = v.rfind("@")
+        if at != -1 and at > v.rfind("-"):
+            base, arch = v[:at], v[at:]
+            targets[name+arch] = True
+        else:
+            base, arch = v, ""
+        targets[name+"-"+v] = True
+        targets[name+"_"+v] = True
+        # Releases are split at the first or at the last dash.
+        bases = [base]
+        dash = base.find("-")
+        while dash != -1:
+            bases.append(base[:dash])
+            dash = base.find("-", dash+1)
+        for b in bases:
+            targets[name+"-"+b] = True
+            targets[name+"_"+b] = True
+            if arch:
+                targets[name+"-"+b+arch] = True
+    return targets.keys()
+
+def getTargetGrams(name, version):
+    """
+    Return the trigrams of all strings which search() methods build
+    from the given name and version.
+    """
+    grams = set()
+    for target in getTargetStrings(name, str(version)):
+        grams.update(getGrams(target))
+    return grams
+
+def getPatternGrams(pattern):
+    """Return the trigrams in the literal parts of a glob pattern."""
+    grams = set()
+    for part in pattern.replace("?", "*").split("*"):
+        grams.update(getGrams(part))
+    return list(grams)
+
+def dumpGramIndex(objects):
+    """
+    Build the index of the given Package or Provides objects, and
+    return it as a string. Objects are referred to by their position.
+    """
+    postings = {}
+    lengths = array.array("H")
+    for i in range(len(objects)):
+        obj = objects[i]
+        name = obj.name
+        version = str(obj.version)
+        if type(name) is unicode:
+            name = name.encode("utf-8")
+        if type(version) is unicode:
+            version = version.encode("utf-8")
+        lengths.append(min(len(name)+len(version)+1, 0xffff))
+        for gram in getTargetGrams(name, version):
+            lst = postings.get(gram)
+            if lst is None:
+                postings[gram] = [i]
+            else:
+                lst.append(i)
+    grams = postings.keys()
+    grams.sort()
+    offsets = array.array("i", [0])
+    ids = array.array("i")
+    for gram in grams:
+        ids.extend(postings[gram])
+        offsets.append(len(ids))
+    return marshal.dumps(("".join(grams), offsets.tostring(),
+                          ids.tostring(), lengths.tostring()))
+
+class GramIndex(object):
+    """Index built by dumpGramIndex() for the given objects."""
+
+    def __init__(self, objects, data):
+        # Copied, since the cache changes its own lists in place.
+        self._objects = objects[:]
+        self._data = data
+        self._grams = None
+
+    def _decode(self):
+        grams, offsets, ids, lengths = marshal.loads(self._data)
+        self._grams = dict([(grams[i:i+GRAMSIZE], i//GRAMSIZE)
+                            for i in range(0, len(grams), GRAMSIZE)])
+        self._offsets = array.array("i", offsets)
+        self._ids = array.array("i", ids)
+        self._lengths = array.array("H", lengths)
+        self._data = None
+        if self._lengths:
+            self._medianlength = sorted(self._lengths)[len(self._lengths)//2]
+        else:
+            self._medianlength = 0
+
+    def _getPostings(self, grams):
+        if self._grams is None:
+            self._decode()
+        offsets = self._offsets
+        postings = []
+        for gram in grams:
+            i = self._grams.get(gram)
+            if i is None:
+                postings.append(())
+            else:
+                postings.append(self._ids[offsets[i]:offsets[i+1]])
+        return postings
+
+    def _getCandidates(self, pattern, cutoff):
+        # Return the positions of the objects which may match the
+        # pattern with the given cutoff, or None if all of them may.
+        if (type(cutoff) is not float or cutoff <= 0 or
+            len(pattern) > MAXPATTERN):
+            return None
+        try:
+            pattern = str(pattern)
+        except UnicodeError:
+            return None
+        grams = getPatternGrams(pattern)
+        ngrams = len(grams)
+        if not ngrams:
+            return None
+
+        if cutoff >= 1.0:
+            # No edits allowed, so every trigram must be there.
+            postings = self._getPostings(grams)
+            postings.sort(lambda x, y: cmp(len(x), len(y)))
+            result = set(postings[0])
+            for ids in postings[1:]:
+                if not result:
+                    break
+                result.intersection_update(ids)
+            return list(result)
+
+        # Edits allowed against a string of the given length.
+        patlen = len(pattern)
+        slack = 1.0-cutoff
+        if "*" in pattern:
+            maxedits = None
+        else:
+            # Without "*" the length differs by the edits at most,
+            # which bounds the string length by patlen/cutoff.
+            maxedits = int(patlen*slack/cutoff+CUTOFFSLACK)
+        def edits(length):
+            k = int(max(patlen, length)*slack+CUTOFFSLACK)
+            if maxedits is not None and k > maxedits:
+                return maxedits
+            return k
+
+        # Strings long enough may match without sharing any trigram.
+        needed = (ngrams+GRAMSIZE-1)//GRAMSIZE
+        minlength = None
+        if maxedits is None or maxedits >= needed:
+            minlength = 0
+            while edits(minlength) < needed:
+                minlength += 1
+            if self._grams is None:
+                self._decode()
+            if minlength <= self._medianlength:
+                # Most objects are candidates anyway.
+                return None
+
+        counts = {}
+        for ids in self._getPostings(grams):
+            for id in ids:
+                counts[id] = counts.get(id, 0)+1
+        lengths = self._lengths
+        result = [id for id in counts
+                  if counts[id] >= ngrams-GRAMSIZE*edits(lengths[id])]
+        if minlength is not None:
+            result.extend([id for id in range(len(lengths))
+                           if lengths[id] >= minlength and id not in counts])
+        return result
+
+    def getCandidates(self, patterns):
+        """
+        Return the objects which may match any of the given (pattern,
+        cutoff) pairs, which are all of them when the patterns are too
+        short or too common to rule any out.
+        """
+        found = {}
+        for pattern, cutoff in patterns:
+            ids = self._getCandidates(pattern, cutoff)
+            if ids is None:
+                return self._objects[:]
+            for id in ids:
+                found[id] = True
+        objects = self._objects
+        ids = found.keys()
+        ids.sort()
+        return [objects[id] for id in ids]
+
+    def covers(self, objects):
+        """Tell if the index was built for exactly the given objects."""
+        if len(objects) != len(self._objects):
+            return False
+        known = dict.fromkeys(self._objects, True)
+        for obj in objects:
+            if obj not in known:
+                return False
+        return True
+
+class SearchIndex(object):
+    """
+    Trigram indexes of the packages and of the provides in a cache,
+    used by Cache.search() to skip the ones which can't match the
+    nameversion and provides patterns of a searcher.
+    """
+
+    def __init__(self, packages, pkgdata, provides, prvdata):
+        self._packages = GramIndex(packages, pkgdata)
+        self._provides = GramIndex(provides, prvdata)
+
+    def getPackages(self, searcher):
+        return self._packages.getCandidates(searcher.nameversion)
+
+    def getProvides(self, searcher):
+        return self._provides.getCandidates(searcher.provides)
+
+    def covers(self, packages, provides):
+        return (self._packages.covers(packages) and
+                self._provides.covers(provides))
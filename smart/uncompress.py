@@ -19,11 +19,19 @@
 # along with Smart Package Manager; if not, write to the Free Software
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
+import bisect
+import sys
 import os
 
 from smart.const import BLOCKSIZE
 from smart import *
 
+# Uncompressed bytes between the checkpoints kept by UncompressedFile.
+CHECKPOINTSIZE = 1024*1024
+
+# Usual ratio between uncompressed and compressed sizes of indexes.
+COMPRESSIONRATIO = 5
+
 class Uncompressor(object):
 
     _handlers = [] 
@@ -38,6 +46,16 @@ class Uncompressor(object):
                 return handler
     getHandler = classmethod(getHandler)
 
+    def isSeekable(self, localpath):
+        """
+        Tell if the file object returned by open() for localpath
+        seeks backwards without uncompressing everything again
+        from the start.
+        """
+        handler = self.getHandler(localpath)
+        return not handler or handler.isSeekable()
+    isSeekable = classmethod(isSeekable)
+
     def uncompress(self, localpath):
         for handler in self._handlers:
             if handler.query(localpath):
@@ -45,6 +63,173 @@ class Uncompressor(object):
         else:
             raise Error, _("Unknown compressed file: %s") % localpath
 
+    def open(self, localpath):
+        """
+        Return a file object with the uncompressed contents of
+        localpath, or localpath itself opened when it's not
+        compressed. The uncompressed data is never written to disk.
+        """
+        for handler in self._handlers:
+            if handler.query(localpath):
+                return handler.open(localpath)
+        return open(localpath)
+
+class UncompressedFile(object):
+    """
+    Read-only file object uncompressing localpath on the fly.
+
+    Seeking backwards restarts from the closest checkpoint taken
+    while reading, when the decompressor state may be copied, or
+    from the start of the file otherwise, which makes random access
+    quadratic.
+    """
+
+    # Exceptions raised by decompressors on invalid data.
+    errors = (IOError, ValueError)
+
+    def __init__(self, localpath):
+        self._localpath = localpath
+        try:
+            self._file = open(localpath, "rb")
+        except (IOError, OSError), e:
+            raise Error, "%s: %s" % (localpath, e)
+        self._checkpoints = []
+        self._restart(None)
+
+    def __getstate__(self):
+        return self._localpath
+
+    def __setstate__(self, state):
+        self.__init__(state)
+
+    def newDecompressor(self):
+        raise Error, _("Unsupported file type")
+
+    def _restart(self, checkpoint):
+        if checkpoint:
+            offset, fileoffset, decomp, self._fresh, self._done = checkpoint
+            self._decomp = decomp.copy()
+        else:
+            offset = fileoffset = 0
+            self._decomp = self.newDecompressor()
+            self._fresh = self._done = False
+        self._file.seek(fileoffset)
+        self._eof = False
+        self._buffer = ""
+        self._bufferpos = 0
+        self._bufferoffset = offset
+
+    def _decompress(self, data):
+        # Streams may be concatenated, and anything after the last one
+        # (as in urpmi's .cz files) is ignored.
+        chunks = []
+        while data and not self._done:
+            decomp = self._decomp
+            try:
+                chunks.append(decomp.decompress(data))
+                data = decomp.unused_data
+                self._fresh = False
+            except EOFError:
+                # The stream ended exactly before data.
+                pass
+            except self.errors, e:
+                if not self._fresh:
+                    raise Error, _("%s: %s\nPossibly corrupted "
+                                   "channel file.") % (self._localpath, e)
+                self._done = True
+                break
+            if data:
+                self._decomp = self.newDecompressor()
+                self._fresh = True
+        return "".join(chunks)
+
+    def _fill(self):
+        # Append uncompressed data to the buffer, returning False
+        # at the end of the file.
+        while not self._eof:
+            data = self._file.read(BLOCKSIZE)
+            if not data or self._done:
+                self._eof = True
+                break
+            data = self._decompress(data)
+            if data:
+                self._buffer = self._buffer[self._bufferpos:]+data
+                self._bufferoffset += self._bufferpos
+                self._bufferpos = 0
+                self._checkpoint()
+                return True
+        return False
+
+    def _checkpoint(self):
+        end = self._bufferoffset+len(self._buffer)
+        checkpoints = self._checkpoints
+        if ((not checkpoints or end >= checkpoints[-1][0]+CHECKPOINTSIZE)
+            and hasattr(self._decomp, "copy")):
+            checkpoints.append((end, self._file.tell(), self._decomp.copy(),
+                                self._fresh, self._done))
+
+    def read(self, size=-1):
+        while size < 0 or len(self._buffer)-self._bufferpos < size:
+            if not self._fill():
+                break
+        pos = self._bufferpos
+        if size < 0:
+            data = self._buffer[pos:]
+        else:
+            data = self._buffer[pos:pos+size]
+        self._bufferpos += len(data)
+        return data
+
+    def readline(self):
+        while True:
+            i = self._buffer.find("\n", self._bufferpos)
+            if i != -1:
+                return self.read(i+1-self._bufferpos)
+            if not self._fill():
+                return self.read()
+
+    def __iter__(self):
+        return self
+
+    def next(self):
+        line = self.readline()
+        if not line:
+            raise StopIteration
+        return line
+
+    def tell(self):
+        return self._bufferoffset+self._bufferpos
+
+    def seek(self, offset, whence=0):
+        if whence == 1:
+            offset += self.tell()
+        elif whence == 2:
+            self.read()
+            offset += self.tell()
+        pos = self.tell()
+        i = bisect.bisect_right(self._checkpoints, (offset, sys.maxint))
+        checkpoint = i and self._checkpoints[i-1] or None
+        if offset < self._bufferoffset:
+            self._restart(checkpoint)
+        elif checkpoint and pos < checkpoint[0] <= offset:
+            self._restart(checkpoint)
+        # Skip forward until offset.
+        while True:
+            left = offset-self._bufferoffset
+            if left <= len(self._buffer):
+                self._bufferpos = left
+                break
+            self._bufferoffset += len(self._buffer)
+            self._buffer = ""
+            self._bufferpos = 0
+            if not self._fill():
+                break
+
+    def close(self):
+        self._file.close()
+        self._buffer = ""
+        del self._checkpoints[:]
+
 class UncompressorHandler(object):
 
     def query(self, localpath):
@@ -56,6 +241,12 @@ class UncompressorHandler(object):
     def uncompress(self, localpath):
         raise Error, _("Unsupported file type")
 
+    def open(self, localpath):
+        raise Error, _("Unsupported file type")
+
+    def isSeekable(self):
+        return False
+
 class BZ2Handler(UncompressorHandler):
 
     def query(self, localpath):
@@ -79,6 +270,15 @@ class BZ2Handler(UncompressorHandler):
         except EOFError, e:
             raise Error, ("%s\nPossibly corrupted channel file.") % e
 
+    def open(self, localpath):
+        return BZ2File(localpath)
+
+class BZ2File(UncompressedFile):
+
+    def newDecompressor(self):
+        import bz2
+        return bz2.BZ2Decompressor()
+
 Uncompressor.addHandler(BZ2Handler)
 
 class LZMAHandler(UncompressorHandler):
@@ -113,6 +313,20 @@ class LZMAHandler(UncompressorHandler):
         except EOFError, e:
             raise Error, ("%s\nPossibly corrupted channel file.") % e
 
+    def open(self, localpath):
+        return LZMAFile(localpath)
+
+class LZMAFile(UncompressedFile):
+
+    def __init__(self, localpath):
+        import lzma
+        self.errors = (lzma.LZMAError, IOError, ValueError)
+        UncompressedFile.__init__(self, localpath)
+
+    def newDecompressor(self):
+        import lzma
+        return lzma.LZMADecompressor()
+
 Uncompressor.addHandler(LZMAHandler)
 
 
@@ -140,6 +354,9 @@ class XZHandler(UncompressorHandler):
         except EOFError, e:
             raise Error, ("%s\nPossibly corrupted channel file.") % e
 
+    def open(self, localpath):
+        return LZMAFile(localpath)
+
 Uncompressor.addHandler(XZHandler)
 
 class GZipHandler(UncompressorHandler):
@@ -165,6 +382,24 @@ class GZipHandler(UncompressorHandler):
         except EOFError, e:
             raise Error, ("%s\nPossibly corrupted channel file.") % e
 
+    def open(self, localpath):
+        return GZipFile(localpath)
+
+    def isSeekable(self):
+        # zlib decompressors may be copied at checkpoints.
+        return True
+
+class GZipFile(UncompressedFile):
+
+    def __init__(self, localpath):
+        import zlib
+        self.errors = (zlib.error,)
+        UncompressedFile.__init__(self, localpath)
+
+    def newDecompressor(self):
+        import zlib
+        return zlib.decompressobj(16+zlib.MAX_WBITS)
+
 Uncompressor.addHandler(GZipHandler)
 
 class ZipHandler(UncompressorHandler):
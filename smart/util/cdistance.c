@@ -32,17 +32,91 @@
 
 #define MAXSIZE 1024
 
+/* Longest string handled by bitdistance(). */
+#define MAXBITSIZE 64
+
+typedef unsigned long long bitvec;
+
 static inline int
 min2(int i, int j)        { return i<j?i:j; }
 static inline int
 min3(int i, int j, int k) { return i<j?(i<k?i:k):(j<k?j:k); };
 
+/*
+    Bit-parallel Levenshtein distance, from Myers' "A fast bit-vector
+    algorithm for approximate string matching based on dynamic
+    programming", as explained by Hyyro for the distance between
+    whole strings. The column of the distance matrix for the a string
+    is kept as bit vectors of vertical deltas, and updated for each
+    character of b with a few word operations.
+
+    The peq table must have, for each character, the bits of the
+    positions where it is in a (see setpeq()). The a string must have
+    at most MAXBITSIZE characters. Returns cutoff+1 as soon as the
+    distance is known to be larger than cutoff, unless cutoff is -1.
+
+    If anystart is set, a may start anywhere in b for free, as in a
+    glob pattern starting with '*'.
+*/
+static int
+bitdistance(bitvec *peq, int al, const char *b, int bl,
+            int cutoff, int ignorecase, int anystart)
+{
+    bitvec pv, mv, ph, mh, xv, xh, eq, last;
+    int bi, res;
+    if (al == 0)
+        return anystart?0:bl;
+    pv = ~(bitvec)0;
+    mv = 0;
+    last = (bitvec)1 << (al-1);
+    res = al;
+    for (bi = 0; bi != bl; bi++) {
+        if (ignorecase)
+            eq = peq[(unsigned char)tolower(b[bi])];
+        else
+            eq = peq[(unsigned char)b[bi]];
+        xv = eq | mv;
+        xh = (((eq & pv) + pv) ^ pv) | eq;
+        ph = mv | ~(xh | pv);
+        mh = pv & xh;
+        if (ph & last)
+            res++;
+        else if (mh & last)
+            res--;
+        ph <<= 1;
+        if (!anystart)
+            ph |= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+        /* Each remaining character lowers the distance by one at most. */
+        if (cutoff != -1 && res-(bl-bi-1) > cutoff)
+            return cutoff+1;
+    }
+    return res;
+}
+
+static void
+setpeq(bitvec *peq, const char *a, int al, int ignorecase)
+{
+    int ai;
+    memset(peq, 0, 256*sizeof(bitvec));
+    for (ai = 0; ai != al; ai++) {
+        if (ignorecase)
+            peq[(unsigned char)tolower(a[ai])] |= (bitvec)1 << ai;
+        else
+            peq[(unsigned char)a[ai]] |= (bitvec)1 << ai;
+    }
+}
+
 /*
     Compute Levenhstein distance - http://www.merriampark.com/ld.htm
+
+    If apeq isn't NULL, it has the bit vectors of a, from setpeq().
 */
 static int
 distance(const char *a, int al, const char *b, int bl,
-         int cutoff, float *ratio)
+         int cutoff, float *ratio, bitvec *apeq)
 {
     int lst[MAXSIZE];
     const char *t;
@@ -58,11 +132,22 @@ distance(const char *a, int al, const char *b, int bl,
             *ratio = 1.0;
         return 0;
     }
+    if (apeq && al <= MAXBITSIZE) {
+        res = bitdistance(apeq, al, b, bl, cutoff, 0, 0);
+        bl = al>bl?al:bl;
+        goto done;
+    }
     if (al > bl) {
         t = a; tl = al;
         a = b; al = bl;
         b = t; bl = tl;
     }
+    if (al <= MAXBITSIZE) {
+        bitvec peq[256];
+        setpeq(peq, a, al, 0);
+        res = bitdistance(peq, al, b, bl, cutoff, 0, 0);
+        goto done;
+    }
     for (bi = 0; bi != bl; bi++)
         lst[bi] = bi+1;
     for (ai = 0; ai != al; ai++) {
@@ -83,6 +168,7 @@ distance(const char *a, int al, const char *b, int bl,
         }
     }
     res = lst[bl-1];
+done:
     if (cutoff != -1 && res > cutoff) {
         if (ratio)
             *ratio = 0.0;
@@ -93,26 +179,76 @@ distance(const char *a, int al, const char *b, int bl,
     return res;
 }
 
+/*
+    Glob pattern prepared by compileglob() to be compared with many
+    strings by globmatch().
+*/
+typedef struct {
+    const char *raw;        /* Pattern as given. */
+    int rawl;
+    char a[MAXSIZE];        /* Pattern without the leading '*'s, in lower
+                               case if ignorecase is set. */
+    int al;
+    int wildstart;          /* Pattern started with '*'. */
+    int hasstar;            /* Pattern has other '*'s. */
+    int hasquestion;
+    int ignorecase;
+    int bitparallel;        /* Pattern may be given to bitdistance(). */
+    bitvec peq[256];
+} GlobPattern;
+
+static void
+compileglob(GlobPattern *g, const char *a, int al, int ignorecase)
+{
+    int ai, c;
+    if (al > MAXSIZE)
+        al = MAXSIZE;
+    g->raw = a;
+    g->rawl = al;
+    g->wildstart = 0;
+    for (; al && *a == '*'; a++, al--)
+        g->wildstart = 1;
+    g->al = al;
+    g->hasstar = memchr(a, '*', al) != NULL;
+    g->hasquestion = memchr(a, '?', al) != NULL;
+    g->ignorecase = ignorecase;
+    for (ai = 0; ai != al; ai++)
+        g->a[ai] = ignorecase?tolower(a[ai]):a[ai];
+    /* Leading '*'s and '?'s are handled by bitdistance() as well,
+       the latter by matching every character. */
+    g->bitparallel = !g->hasstar && al <= MAXBITSIZE;
+    if (g->bitparallel) {
+        setpeq(g->peq, g->a, al, 0);
+        if (g->hasquestion) {
+            for (ai = 0; ai != al; ai++) {
+                if (g->a[ai] == '?') {
+                    for (c = 0; c != 256; c++)
+                        g->peq[c] |= (bitvec)1 << ai;
+                }
+            }
+        }
+    }
+}
+
 /*
     Compute Levenhstein distance - http://www.merriampark.com/ld.htm
 
     Algorithm changed by Gustavo Niemeyer to implement wildcards support.
 */
 static int
-globdistance(const char *a, int al, const char *b, int bl,
-             int cutoff, float *ratio, int ignorecase)
+globmatch(GlobPattern *g, const char *b, int bl, int cutoff, float *ratio)
 {
     int lst[MAXSIZE];
+    char lb[MAXSIZE];
+    const char *a = g->a;
+    int al = g->al;
     int last, nextlast;
     int ai, bi, minlstbi;
-    int wildstart = 0;
     int maxl;
     int res;
-    if (al > MAXSIZE)
-        al = MAXSIZE;
     if (bl > MAXSIZE)
         bl = MAXSIZE;
-    if (al == bl && memcmp(a, b, al) == 0) {
+    if (g->rawl == bl && memcmp(g->raw, b, bl) == 0) {
         if (ratio)
             *ratio = 1.0;
         return 0;
@@ -120,12 +256,27 @@ globdistance(const char *a, int al, const char *b, int bl,
     if (bl == 0) {
         if (ratio)
             *ratio = 0.0;
-        return al;
+        return g->rawl;
+    }
+    if (g->ignorecase) {
+        for (bi = 0; bi != bl; bi++)
+            lb[bi] = tolower(b[bi]);
+        b = lb;
     }
-    for (; *a == '*'; a++, al--)
-        wildstart = 1;
     maxl = al>bl?al:bl;
-    if (wildstart) {
+    if (g->bitparallel) {
+        res = bitdistance(g->peq, al, b, bl, cutoff, 0, g->wildstart);
+        goto done;
+    }
+    if (!g->wildstart && !g->hasstar && !g->hasquestion &&
+        bl <= MAXBITSIZE) {
+        /* Without wildcards, it's the plain distance. */
+        bitvec peq[256];
+        setpeq(peq, b, bl, 0);
+        res = bitdistance(peq, bl, a, al, cutoff, 0, 0);
+        goto done;
+    }
+    if (g->wildstart) {
         for (bi = 0; bi != bl; bi++)
             lst[bi] = 0;
     } else {
@@ -155,20 +306,11 @@ globdistance(const char *a, int al, const char *b, int bl,
             }
         } else {
             last = lst[0];
-            if (ignorecase)
-                lst[0] = minlstbi = min2(lst[0]+1, ai+(tolower(b[0]) !=
-                                                       tolower(a[ai])?1:0));
-            else
-                lst[0] = minlstbi = min2(lst[0]+1, ai+(b[0] != a[ai]?1:0));
+            lst[0] = minlstbi = min2(lst[0]+1, ai+(b[0] != a[ai]?1:0));
             for (bi = 1; bi != bl; bi++) {
                 nextlast = lst[bi];
-                if (ignorecase)
-                    lst[bi] = min3(lst[bi-1]+1, lst[bi]+1,
-                                   last+(tolower(b[bi]) !=
-                                         tolower(a[ai])?1:0));
-                else
-                    lst[bi] = min3(lst[bi-1]+1, lst[bi]+1,
-                                   last+(b[bi] != a[ai]?1:0));
+                lst[bi] = min3(lst[bi-1]+1, lst[bi]+1,
+                               last+(b[bi] != a[ai]?1:0));
                 last = nextlast;
                 if (cutoff != -1 && lst[bi] < minlstbi)
                     minlstbi = lst[bi];
@@ -181,6 +323,7 @@ globdistance(const char *a, int al, const char *b, int bl,
         }
     }
     res = lst[bl-1];
+done:
     if (cutoff != -1 && res > cutoff) {
         if (ratio)
             *ratio = 0.0;
@@ -217,7 +360,7 @@ cdistance_distance(PyObject *self, PyObject *args)
             return NULL;
         }
     }
-    resulto = PyInt_FromLong(distance(a, al, b, bl, cutoff, &ratio));
+    resulto = PyInt_FromLong(distance(a, al, b, bl, cutoff, &ratio, NULL));
     if (!resulto) return NULL;
     ratioo = PyFloat_FromDouble((double)ratio);
     if (!ratioo) return NULL;
@@ -228,44 +371,296 @@ cdistance_distance(PyObject *self, PyObject *args)
     return ret;
 }
 
+static int
+getcutoff(PyObject *cutoffo, int maxl)
+{
+    if (cutoffo == Py_None)
+        return -1;
+    if (PyInt_Check(cutoffo))
+        return (int)PyInt_AsLong(cutoffo);
+    return (int)(float)(maxl-PyFloat_AsDouble(cutoffo)*maxl);
+}
+
+static PyObject *
+cdistance_distance_many(PyObject *self, PyObject *args)
+{
+    PyObject *candidates, *seq, *ret;
+    PyObject *cutoffo = Py_None;
+    const char *a, *b;
+    bitvec peq[256];
+    bitvec *apeq = NULL;
+    int al, bl;
+    int i, len;
+    float ratio;
+    if (!PyArg_ParseTuple(args, "s#O|O", &a, &al, &candidates, &cutoffo))
+        return NULL;
+    if (cutoffo != Py_None && !PyInt_Check(cutoffo) &&
+        !PyFloat_Check(cutoffo)) {
+        PyErr_SetString(PyExc_TypeError, "cutoff must be int or float");
+        return NULL;
+    }
+    seq = PySequence_Fast(candidates, "candidates must be a sequence");
+    if (!seq) return NULL;
+    len = PySequence_Fast_GET_SIZE(seq);
+    ret = PyList_New(len);
+    if (!ret) goto error;
+    /* The bit vectors of the pattern are computed only once. */
+    if (al <= MAXBITSIZE) {
+        setpeq(peq, a, al, 0);
+        apeq = peq;
+    }
+    for (i = 0; i != len; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        int res;
+        if (!PyString_Check(item)) {
+            PyErr_SetString(PyExc_TypeError, "candidates must be strings");
+            goto error;
+        }
+        b = PyString_AS_STRING(item);
+        bl = PyString_GET_SIZE(item);
+        res = distance(a, al, b, bl, getcutoff(cutoffo, al>bl?al:bl),
+                       &ratio, apeq);
+        PyList_SET_ITEM(ret, i, Py_BuildValue("(if)", res, ratio));
+        if (!PyList_GET_ITEM(ret, i))
+            goto error;
+    }
+    Py_DECREF(seq);
+    return ret;
+error:
+    Py_XDECREF(ret);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+staticforward PyTypeObject GlobPattern_Type;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *pattern;
+    PyObject *cutoff;
+    int ignorecase;
+    GlobPattern glob;
+} GlobPatternObject;
+
+static int
+GlobPattern_init(GlobPatternObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"pattern", "cutoff", "ignorecase", NULL};
+    PyObject *pattern;
+    PyObject *cutoff = Py_None;
+    int ignorecase = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oi", kwlist,
+                                     &pattern, &cutoff, &ignorecase))
+        return -1;
+    if (cutoff != Py_None && !PyInt_Check(cutoff) && !PyFloat_Check(cutoff)) {
+        PyErr_SetString(PyExc_TypeError, "cutoff must be int or float");
+        return -1;
+    }
+    /* Unicode patterns are encoded as globdistance() would do. */
+    if (PyUnicode_Check(pattern)) {
+        pattern = PyUnicode_AsEncodedString(pattern, NULL, NULL);
+        if (!pattern)
+            return -1;
+    } else if (PyString_Check(pattern)) {
+        Py_INCREF(pattern);
+    } else {
+        PyErr_SetString(PyExc_TypeError, "pattern must be a string");
+        return -1;
+    }
+    Py_XDECREF(self->pattern);
+    self->pattern = pattern;
+    Py_INCREF(cutoff);
+    Py_XDECREF(self->cutoff);
+    self->cutoff = cutoff;
+    self->ignorecase = ignorecase;
+    compileglob(&self->glob, PyString_AS_STRING(pattern),
+                PyString_GET_SIZE(pattern), ignorecase);
+    return 0;
+}
+
+static void
+GlobPattern_dealloc(GlobPatternObject *self)
+{
+    Py_XDECREF(self->pattern);
+    Py_XDECREF(self->cutoff);
+    self->ob_type->tp_free((PyObject *)self);
+}
+
+static PyObject *
+GlobPattern_globmatch(GlobPatternObject *self, PyObject *cutoffo,
+                      const char *b, int bl)
+{
+    int al, maxl, res;
+    float ratio;
+    al = PyString_GET_SIZE(self->pattern);
+    maxl = al>bl?al:bl;
+    res = globmatch(&self->glob, b, bl, getcutoff(cutoffo, maxl), &ratio);
+    return Py_BuildValue("(if)", res, ratio);
+}
+
+static PyObject *
+GlobPattern_match(GlobPatternObject *self, PyObject *args)
+{
+    const char *b;
+    int bl;
+    if (!PyArg_ParseTuple(args, "s#", &b, &bl))
+        return NULL;
+    return GlobPattern_globmatch(self, self->cutoff, b, bl);
+}
+
+static PyObject *
+GlobPattern_match_many(GlobPatternObject *self, PyObject *candidates)
+{
+    PyObject *seq, *ret;
+    int i, len;
+    seq = PySequence_Fast(candidates, "candidates must be a sequence");
+    if (!seq) return NULL;
+    len = PySequence_Fast_GET_SIZE(seq);
+    ret = PyList_New(len);
+    if (!ret) goto error;
+    for (i = 0; i != len; i++) {
+        const char *b;
+        int bl;
+        if (!PyArg_Parse(PySequence_Fast_GET_ITEM(seq, i), "s#", &b, &bl))
+            goto error;
+        PyList_SET_ITEM(ret, i,
+                        GlobPattern_globmatch(self, self->cutoff, b, bl));
+        if (!PyList_GET_ITEM(ret, i))
+            goto error;
+    }
+    Py_DECREF(seq);
+    return ret;
+error:
+    Py_XDECREF(ret);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+static PyMethodDef GlobPattern_methods[] = {
+    {"match", (PyCFunction)GlobPattern_match, METH_VARARGS, NULL},
+    {"match_many", (PyCFunction)GlobPattern_match_many, METH_O, NULL},
+    {NULL, NULL}
+};
+
+#define OFF(x) offsetof(GlobPatternObject, x)
+static PyMemberDef GlobPattern_members[] = {
+    {"pattern", T_OBJECT, OFF(pattern), RO, 0},
+    {"cutoff", T_OBJECT, OFF(cutoff), RO, 0},
+    {"ignorecase", T_INT, OFF(ignorecase), RO, 0},
+    {NULL}
+};
+#undef OFF
+
+statichere PyTypeObject GlobPattern_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                      /*ob_size*/
+    "smart.util.cdistance.GlobPattern", /*tp_name*/
+    sizeof(GlobPatternObject), /*tp_basicsize*/
+    0,                      /*tp_itemsize*/
+    (destructor)GlobPattern_dealloc, /*tp_dealloc*/
+    0,                      /*tp_print*/
+    0,                      /*tp_getattr*/
+    0,                      /*tp_setattr*/
+    0,                      /*tp_compare*/
+    0,                      /*tp_repr*/
+    0,                      /*tp_as_number*/
+    0,                      /*tp_as_sequence*/
+    0,                      /*tp_as_mapping*/
+    0,                      /*tp_hash*/
+    0,                      /*tp_call*/
+    0,                      /*tp_str*/
+    PyObject_GenericGetAttr,/*tp_getattro*/
+    PyObject_GenericSetAttr,/*tp_setattro*/
+    0,                      /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    0,                      /*tp_doc*/
+    0,                      /*tp_traverse*/
+    0,                      /*tp_clear*/
+    0,                      /*tp_richcompare*/
+    0,                      /*tp_weaklistoffset*/
+    0,                      /*tp_iter*/
+    0,                      /*tp_iternext*/
+    GlobPattern_methods,    /*tp_methods*/
+    GlobPattern_members,    /*tp_members*/
+    0,                      /*tp_getset*/
+    0,                      /*tp_base*/
+    0,                      /*tp_dict*/
+    0,                      /*tp_descr_get*/
+    0,                      /*tp_descr_set*/
+    0,                      /*tp_dictoffset*/
+    (initproc)GlobPattern_init, /*tp_init*/
+    PyType_GenericAlloc,    /*tp_alloc*/
+    PyType_GenericNew,      /*tp_new*/
+    PyObject_Del,           /*tp_free*/
+    0,                      /*tp_is_gc*/
+};
+
+/*
+    Patterns compiled by globdistance(). Searches call it with the same
+    pattern object for every string, so the last few are kept around.
+*/
+#define GLOBCACHESIZE 8
+
+static GlobPatternObject *GlobCache[GLOBCACHESIZE];
+static int GlobCacheNext = 0;
+
+static GlobPatternObject *
+getcachedglob(PyObject *pattern, int ignorecase)
+{
+    GlobPatternObject *glob;
+    int i;
+    for (i = 0; i != GLOBCACHESIZE; i++) {
+        glob = GlobCache[i];
+        if (glob && glob->pattern == pattern && glob->ignorecase == ignorecase)
+            return glob;
+    }
+    glob = (GlobPatternObject *)
+        PyObject_CallFunction((PyObject *)&GlobPattern_Type, "OOi",
+                              pattern, Py_None, ignorecase);
+    if (!glob)
+        return NULL;
+    Py_XDECREF(GlobCache[GlobCacheNext]);
+    GlobCache[GlobCacheNext] = glob;
+    GlobCacheNext = (GlobCacheNext+1)%GLOBCACHESIZE;
+    return glob;
+}
+
 static PyObject *
 cdistance_globdistance(PyObject *self, PyObject *args)
 {
-    PyObject *resulto, *ratioo, *ret;
+    PyObject *patterno;
     PyObject *cutoffo = Py_None;
+    GlobPatternObject *globo;
+    GlobPattern glob;
     const char *a, *b;
-    int cutoff = -1;
     int ignorecase = 0;
-    int al, bl, maxl;
+    int al, bl, maxl, res;
     float ratio;
     if (!PyArg_ParseTuple(args, "s#s#|Oi",
                           &a, &al, &b, &bl, &cutoffo, &ignorecase))
         return NULL;
-    maxl = al>bl?al:bl;
-    if (cutoffo != Py_None) {
-        if (PyInt_Check(cutoffo)) {
-            cutoff = (int)PyInt_AsLong(cutoffo);
-        } else if (PyFloat_Check(cutoffo)) {
-            cutoff = (int)(float)(maxl-PyFloat_AsDouble(cutoffo)*maxl);
-        } else {
-            PyErr_SetString(PyExc_TypeError, "cutoff must be int or float");
+    if (cutoffo != Py_None && !PyInt_Check(cutoffo) &&
+        !PyFloat_Check(cutoffo)) {
+        PyErr_SetString(PyExc_TypeError, "cutoff must be int or float");
+        return NULL;
+    }
+    patterno = PyTuple_GET_ITEM(args, 0);
+    if (PyString_CheckExact(patterno)) {
+        globo = getcachedglob(patterno, ignorecase);
+        if (!globo)
             return NULL;
-        }
+        return GlobPattern_globmatch(globo, cutoffo, b, bl);
     }
-    resulto = PyInt_FromLong(globdistance(a, al, b, bl,
-                                          cutoff, &ratio, ignorecase));
-    if (!resulto) return NULL;
-    ratioo = PyFloat_FromDouble((double)ratio);
-    if (!ratioo) return NULL;
-    ret = PyTuple_New(2);
-    if (!ret) return NULL;
-    PyTuple_SET_ITEM(ret, 0, resulto);
-    PyTuple_SET_ITEM(ret, 1, ratioo);
-    return ret;
+    compileglob(&glob, a, al, ignorecase);
+    maxl = al>bl?al:bl;
+    res = globmatch(&glob, b, bl, getcutoff(cutoffo, maxl), &ratio);
+    return Py_BuildValue("(if)", res, ratio);
 }
 
 static PyMethodDef cdistance_methods[] = {
     {"distance", (PyCFunction)cdistance_distance, METH_VARARGS, NULL},
+    {"distance_many", (PyCFunction)cdistance_distance_many, METH_VARARGS,
+     NULL},
     {"globdistance", (PyCFunction)cdistance_globdistance, METH_VARARGS, NULL},
     {NULL, NULL}
 };
@@ -277,6 +672,10 @@ initcdistance(void)
     m = Py_InitModule3("cdistance", cdistance_methods, "");
     if (m == NULL)
         return;
+    if (PyType_Ready(&GlobPattern_Type) < 0)
+        return;
+    Py_INCREF(&GlobPattern_Type);
+    PyModule_AddObject(m, "GlobPattern", (PyObject *)&GlobPattern_Type);
 }
 
 /* vim:ts=4:sw=4:et
@@ -25,9 +25,14 @@
 #include <Python.h>
 #include <structmember.h>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
 
 #define BLOCKSIZE 16384
@@ -45,8 +50,52 @@ typedef struct {
     char *_buf;
     int   _bufread;
     int   _bufsize;
+    int   _mapped;      /* File contents are in _map, not read through _file. */
+    char *_map;
+    long  _mapsize;
+    char *_tmp;         /* Room for keys, and values in many lines. */
+    long  _tmpsize;
+    PyObject *_fields;  /* Last fields given to advanceSection(), */
+    PyObject *_fieldlist; /* and a list with them. */
 } TagFileObject;
 
+/*
+    Map the file named _filename, or open it when it can't be mapped.
+*/
+static int
+TagFile_openFile(TagFileObject *self)
+{
+    struct stat st;
+    int fd = open(self->_filename, O_RDONLY);
+    if (fd == -1) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->_filename);
+        return -1;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            self->_mapped = 1;
+            close(fd);
+            return 0;
+        }
+        self->_map = (char *)mmap(NULL, st.st_size, PROT_READ,
+                                  MAP_SHARED, fd, 0);
+        if (self->_map != (char *)MAP_FAILED) {
+            self->_mapped = 1;
+            self->_mapsize = st.st_size;
+            close(fd);
+            return 0;
+        }
+        self->_map = NULL;
+    }
+    self->_file = fdopen(fd, "r");
+    if (!self->_file) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->_filename);
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
 static int
 TagFile_init(TagFileObject *self, PyObject *args)
 {
@@ -59,11 +108,8 @@ TagFile_init(TagFileObject *self, PyObject *args)
         return -1;
     if (PyString_Check(file)) {
         self->_filename = strdup(STR(file));
-        self->_file = fopen(self->_filename, "r");
-        if (!self->_file) {
-            PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->_filename);
+        if (TagFile_openFile(self) == -1)
             return -1;
-        }
     } else {
         PyObject *attr;
         attr = PyObject_GetAttrString(file, "read");
@@ -85,10 +131,15 @@ TagFile_dealloc(TagFileObject *self)
         Py_DECREF(self->_fileobj);
     } else {
         free(self->_filename);
-        free(self->_buf);
+        if (self->_map)
+            munmap(self->_map, self->_mapsize);
         if (self->_file)
             fclose(self->_file);
     }
+    free(self->_buf);
+    free(self->_tmp);
+    Py_XDECREF(self->_fields);
+    Py_XDECREF(self->_fieldlist);
     ((PyObject *)self)->ob_type->tp_free((PyObject *)self);
 }
 
@@ -111,11 +162,8 @@ TagFile__setstate__(TagFileObject *self, PyObject *state)
         return NULL;
     }
     self->_filename = strdup(STR(state));
-    self->_file = fopen(self->_filename, "r");
-    if (!self->_file) {
-        PyErr_SetFromErrnoWithFilename(PyExc_IOError, self->_filename);
+    if (TagFile_openFile(self) == -1)
         return NULL;
-    }
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -129,7 +177,9 @@ TagFile_setOffset(TagFileObject *self, PyObject *offset)
     }
     self->_bufread = 0;
     self->_offset = PyInt_AsLong(offset);
-    if (self->_fileobj) {
+    if (self->_mapped) {
+        /* Nothing to do. */
+    } else if (self->_fileobj) {
         PyObject *res = PyObject_CallMethod(self->_fileobj,
                                             "seek", "O", offset);
         if (!res)
@@ -151,21 +201,294 @@ TagFile_getOffset(TagFileObject *self, PyObject *args)
     return PyInt_FromLong(self->_offset);
 }
 
+static char *
+TagFile_getTmp(TagFileObject *self, long size)
+{
+    if (size > self->_tmpsize) {
+        char *tmp = (char *)realloc(self->_tmp, size);
+        if (!tmp) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        self->_tmp = tmp;
+        self->_tmpsize = size;
+    }
+    return self->_tmp;
+}
+
+/*
+    Return the start of the first line after pos with a key in it,
+    or -1 if there's none before len.
+*/
+static long
+findsectionstart(const char *buf, long pos, long len)
+{
+    long start = pos;
+    long linestart;
+    const char *p;
+    while (pos < len && (p = memchr(buf+pos, ':', len-pos))) {
+        linestart = p-buf;
+        while (linestart > start && buf[linestart-1] != '\n')
+            linestart -= 1;
+        if (!isspace((unsigned char)buf[linestart]))
+            return linestart;
+        /* Other colons in the same line don't matter. */
+        p = memchr(p, '\n', len-(p-buf));
+        if (!p)
+            break;
+        pos = p-buf+1;
+    }
+    return -1;
+}
+
+/*
+    Return the position just after the first empty line following pos,
+    or -1 if there's none before len.
+*/
+static long
+findsectionend(const char *buf, long pos, long len)
+{
+    const char *p;
+    while (pos+1 < len && (p = memchr(buf+pos, '\n', len-pos-1))) {
+        pos = p-buf;
+        if (buf[pos+1] == '\n')
+            return pos+2;
+        pos += 1;
+    }
+    return -1;
+}
+
+/*
+    Put the fields of the section at buf[pos:end], which must end with
+    an empty line, in the dictionary. The buffer is left untouched. If
+    fieldlist isn't NULL, only the keys in it are kept, and the other
+    ones and their values are not even built.
+*/
+static int
+TagFile_parseSection(TagFileObject *self, const char *buf, long pos,
+                     long end, PyObject *fieldlist)
+{
+    long keystart, keyend;
+    long valuestart, valueend, valuepos;
+    long i, keylen;
+    const char *p;
+    char *tmp;
+    int c, want;
+
+    PyObject *key, *value;
+
+    while (pos != end) {
+
+        keystart = pos;
+        keyend = -1;
+
+        for (;;) {
+            c = buf[pos];
+            if (c == '\n' || c == ':')
+                break;
+            if (c != ' ' && c != '\t')
+                keyend = pos+1;
+            pos += 1;
+        }
+        if (c == '\n') {
+            /* No key in this line. */
+            pos += 1;
+            continue;
+        }
+        if (keyend == -1)
+            keyend = pos;
+        pos += 1;
+
+        keylen = keyend-keystart;
+        tmp = TagFile_getTmp(self, keylen+1);
+        if (!tmp)
+            return -1;
+        for (i = 0; i != keylen; i++)
+            tmp[i] = tolower(buf[keystart+i]);
+
+        key = NULL;
+        if (fieldlist) {
+            /* The wanted keys are used as they are. */
+            for (i = 0; i != PyList_GET_SIZE(fieldlist); i++) {
+                PyObject *field = PyList_GET_ITEM(fieldlist, i);
+                if (PyString_GET_SIZE(field) == keylen &&
+                    memcmp(STR(field), tmp, keylen) == 0) {
+                    Py_INCREF(field);
+                    key = field;
+                    break;
+                }
+            }
+            want = key != NULL;
+        } else {
+            key = PyString_FromStringAndSize(tmp, keylen);
+            if (!key)
+                return -1;
+            want = 1;
+        }
+
+        while (buf[pos] == ' ' || buf[pos] == '\t')
+            pos += 1;
+
+        valuestart = pos;
+
+        /* There's always a newline before end. */
+        p = memchr(buf+pos, '\n', end-pos);
+        c = buf[p-buf+1];
+        if (c == '\n' || !isspace((unsigned char)c)) {
+            /* The value has a single line. */
+            valueend = p-buf;
+            while (valueend != valuestart &&
+                   (buf[valueend-1] == ' ' || buf[valueend-1] == '\t'))
+                valueend -= 1;
+            pos = p-buf+1;
+            if (!want)
+                continue;
+            value = PyString_FromStringAndSize(buf+valuestart,
+                                               valueend-valuestart);
+        } else if (!want) {
+            /* Skip the following lines starting with spaces. */
+            do {
+                pos = p-buf+1;
+                c = buf[pos];
+            } while (c != '\n' && isspace((unsigned char)c) &&
+                     (p = memchr(buf+pos, '\n', end-pos)));
+            continue;
+        } else {
+            /* Join the lines, dropping the first space of the following
+               ones, and replacing the ones with just " ." by empty
+               lines. */
+            tmp = TagFile_getTmp(self, end-valuestart);
+            if (!tmp) {
+                Py_DECREF(key);
+                return -1;
+            }
+            valuepos = 0;
+            valueend = 0;
+            for (;;) {
+                c = buf[pos];
+                if (c == '\n') {
+                    pos += 1;
+                    c = buf[pos];
+                    if (c == '\n' || !isspace((unsigned char)c))
+                        break;
+                    tmp[valuepos++] = '\n';
+                    if (buf[pos+1] == '.' && buf[pos+2] == '\n')
+                        pos += 1;
+                } else {
+                    tmp[valuepos++] = c;
+                    if (c != ' ' && c != '\t')
+                        valueend = valuepos;
+                }
+                pos += 1;
+            }
+            value = PyString_FromStringAndSize(tmp, valueend);
+        }
+        if (!value) {
+            Py_DECREF(key);
+            return -1;
+        }
+        if (PyDict_SetItem((PyObject *)&self->dict, key, value) == -1) {
+            Py_DECREF(key);
+            Py_DECREF(value);
+            return -1;
+        }
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+
+    return 0;
+}
+
+/*
+    Parse the section at _offset in place, when the file is mapped.
+*/
+static PyObject *
+TagFile_advanceMapped(TagFileObject *self, PyObject *fieldlist)
+{
+    const char *buf = self->_map;
+    long len = self->_mapsize;
+    long start, end;
+
+    if (self->_offset >= len)
+        return PyBool_FromLong(0);
+
+    start = findsectionstart(buf, self->_offset, len);
+    if (start == -1) {
+        self->_offset = len;
+        return PyBool_FromLong(0);
+    }
+
+    end = findsectionend(buf, start, len);
+    if (end != -1) {
+        if (TagFile_parseSection(self, buf, start, end, fieldlist) == -1)
+            return NULL;
+        self->_offset = end;
+    } else {
+        /* The last section isn't followed by an empty line, so
+           copy it with one. */
+        long size = len-start;
+        if (size+2 > self->_bufsize) {
+            char *newbuf = (char *)realloc(self->_buf, size+2);
+            if (!newbuf)
+                return PyErr_NoMemory();
+            self->_buf = newbuf;
+            self->_bufsize = size+2;
+        }
+        memcpy(self->_buf, buf+start, size);
+        self->_buf[size] = '\n';
+        self->_buf[size+1] = '\n';
+        end = findsectionend(self->_buf, 0, size+2);
+        if (TagFile_parseSection(self, self->_buf, 0, end, fieldlist) == -1)
+            return NULL;
+        self->_offset = start+end;
+    }
+
+    /* Sections always have a key, even if it was filtered out. */
+    return PyBool_FromLong(1);
+}
+
 static PyObject *
 TagFile_advanceSection(TagFileObject *self, PyObject *args)
 {
-    int sectionstart, sectionend;
-    int keystart, keyend;
-    int valuestart, valueend;
+    PyObject *fields = Py_None;
+    PyObject *fieldlist = NULL;
+    long sectionstart, sectionend;
     int read, pos;
-    int valuepos;
-    int c, skip;
+    int skip;
     int eof = 0;
 
-    PyObject *key, *value;
+    if (!PyArg_ParseTuple(args, "|O", &fields))
+        return NULL;
+
+    if (fields != Py_None) {
+        if (fields != self->_fields || !(PyTuple_CheckExact(fields) ||
+                                         PyFrozenSet_CheckExact(fields))) {
+            int i;
+            fieldlist = PySequence_List(fields);
+            if (!fieldlist)
+                return NULL;
+            for (i = 0; i != PyList_GET_SIZE(fieldlist); i++) {
+                if (!PyString_CheckExact(PyList_GET_ITEM(fieldlist, i))) {
+                    PyErr_SetString(PyExc_TypeError,
+                                    "fields must be strings");
+                    Py_DECREF(fieldlist);
+                    return NULL;
+                }
+            }
+            Py_INCREF(fields);
+            Py_XDECREF(self->_fields);
+            self->_fields = fields;
+            Py_XDECREF(self->_fieldlist);
+            self->_fieldlist = fieldlist;
+        }
+        fieldlist = self->_fieldlist;
+    }
 
     PyDict_Clear((PyObject *)&self->dict);
 
+    if (self->_mapped)
+        return TagFile_advanceMapped(self, fieldlist);
+
     /* Ensure we have a whole section in the buffer. */
     sectionstart = pos = 0;
     skip = 1;
@@ -218,8 +541,8 @@ TagFile_advanceSection(TagFileObject *self, PyObject *args)
                 }
             }
             if (eof) {
-                *(self->_buf+pos+read) = '\n';
-                *(self->_buf+pos+read+1) = '\n';
+                *(self->_buf+self->_bufread+read) = '\n';
+                *(self->_buf+self->_bufread+read+1) = '\n';
                 read += 2;
             }
             self->_bufread += read;
@@ -227,124 +550,36 @@ TagFile_advanceSection(TagFileObject *self, PyObject *args)
 
         /* Skip invalid lines. */
         if (skip) {
-            while (pos != self->_bufread) {
-                if (*(self->_buf+pos) == ':') {
-                    int tmppos = pos;
-                    while (tmppos > 0 && *(self->_buf+tmppos-1) != '\n')
-                        tmppos -= 1;
-                    if (!isspace(*(self->_buf+tmppos))) {
-                        pos = tmppos;
-                        break;
-                    }
-                }
-                pos += 1;
-            }
-            if (pos != self->_bufread) {
-                sectionstart = pos;
+            sectionstart = findsectionstart(self->_buf, 0, self->_bufread);
+            if (sectionstart != -1) {
+                pos = sectionstart;
                 skip = 0;
             } else if (eof) {
-                sectionstart = sectionend = pos;
+                sectionstart = sectionend = self->_bufread;
                 goto found;
             } else {
+                pos = self->_bufread;
                 continue;
             }
         }
 
-        while (pos+1 < self->_bufread) {
-            if (*(self->_buf+pos) == '\n' && *(self->_buf+pos+1) == '\n') {
-                sectionend = pos+2;
-                goto found;
-            }
-            pos += 1;
-        }
+        sectionend = findsectionend(self->_buf, pos, self->_bufread);
+        if (sectionend != -1)
+            goto found;
+        pos = self->_bufread-1;
     }
 
 found:
 
-    pos = sectionstart;
-
-restart:
-
-    while (pos != sectionend) {
-
-        keystart = pos;
-        keyend = -1;
-
-        for (;;) {
-            c = *(self->_buf+pos);
-            switch (c) {
-                case '\n':
-                    pos += 1;
-                    goto restart;
-                case ':':
-                    if (keyend == -1)
-                        keyend = pos;
-                    pos += 1;
-                    goto exitkeyloop;
-                case ' ':
-                case '\t':
-                    break;
-                default:
-                    *(self->_buf+pos) = tolower(c);
-                    keyend = pos+1;
-                    break;
-            }
-            pos += 1;
-        }
-
-exitkeyloop:
-
-        *(self->_buf+keyend) = '\0';
-
-        while (*(self->_buf+pos) == ' ' || *(self->_buf+pos) == '\t')
-            pos += 1;
-
-        valuestart = pos;
-        valuepos = pos;
-        valueend = pos;
-
-        for (;;) {
-            c = *(self->_buf+pos);
-            switch (c) {
-                case '\n':
-                    pos += 1;
-                    c = *(self->_buf+pos);
-                    if (c == '\n' || !isspace(c))
-                        goto exitvalueloop;
-                    *(self->_buf+valuepos++) = '\n';
-                    if (*(self->_buf+pos+1) == '.' &&
-                        *(self->_buf+pos+2) == '\n')
-                        pos += 1;
-                    break;
-                case ' ':
-                case '\t':
-                    *(self->_buf+valuepos++) = c;
-                    break;
-                default:
-                    *(self->_buf+valuepos++) = c;
-                    valueend = valuepos;
-                    break;
-            }
-            pos += 1;
-        }
-
-exitvalueloop:
-
-        *(self->_buf+valueend) = '\0';
-
-        key = PyString_FromString(self->_buf+keystart);
-        value = PyString_FromString(self->_buf+valuestart);
-        PyDict_SetItem((PyObject *)&self->dict, key, value);
-        Py_DECREF(key);
-        Py_DECREF(value);
-
-    }
+    if (TagFile_parseSection(self, self->_buf, sectionstart, sectionend,
+                             fieldlist) == -1)
+        return NULL;
 
     memmove(self->_buf, self->_buf+sectionend, self->_bufread-sectionend);
     self->_bufread -= sectionend;
     self->_offset += sectionend;
 
-    return PyBool_FromLong(PyDict_Size((PyObject *)&self->dict));
+    return PyBool_FromLong(sectionstart != sectionend);
 }
 
 static PyMethodDef TagFile_methods[] = {
@@ -352,7 +587,8 @@ static PyMethodDef TagFile_methods[] = {
     {"__setstate__", (PyCFunction)TagFile__setstate__, METH_O, NULL},
     {"getOffset", (PyCFunction)TagFile_getOffset, METH_NOARGS, NULL},
     {"setOffset", (PyCFunction)TagFile_setOffset, METH_O, NULL},
-    {"advanceSection", (PyCFunction)TagFile_advanceSection, METH_NOARGS, NULL},
+    {"advanceSection", (PyCFunction)TagFile_advanceSection, METH_VARARGS,
+     NULL},
     {NULL, NULL}
 };
 
@@ -45,6 +45,13 @@ def distance(a, b, cutoff=None):
         return bl, 0.0
     return res, float(bl-res)/bl
 
+def distance_many(a, candidates, cutoff=None):
+    """
+    Return the result of distance(a, b, cutoff) for each b in
+    candidates.
+    """
+    return [distance(a, b, cutoff) for b in candidates]
+
 def globdistance(a, b, cutoff=None, ignorecase=False):
     """
     Compute Levenhstein distance - http://www.merriampark.com/ld.htm
@@ -92,4 +99,22 @@ def globdistance(a, b, cutoff=None, ignorecase=False):
         return bl, 0.0
     return res, float(maxl-res)/maxl
 
+class GlobPattern(object):
+    """
+    Glob pattern to be compared with many strings. The result of
+    match(b) is the one of globdistance(pattern, b, cutoff, ignorecase).
+    """
+
+    def __init__(self, pattern, cutoff=None, ignorecase=False):
+        self.pattern = pattern
+        self.cutoff = cutoff
+        self.ignorecase = ignorecase
+
+    def match(self, b):
+        return globdistance(self.pattern, b, self.cutoff, self.ignorecase)
+
+    def match_many(self, candidates):
+        """Return the result of match(b) for each b in candidates."""
+        return [self.match(b) for b in candidates]
+
 from cdistance import *
@@ -20,44 +20,113 @@
 # Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #
 from smart.const import BLOCKSIZE
+import threading
 import resource
 import fcntl
+import mmap
 try:
-    from hashlib import md5
+    from hashlib import md5, sha1, sha256
 except ImportError:
     from md5 import md5
+    from sha import sha as sha1
+    from smart.util.sha256 import sha256
 import os
 
+# Digest constructors, by the name used in channel information.
+DIGESTS = {"md5": md5, "sha": sha1, "sha256": sha256}
+
+# Bytes of a mapped file given to each digest update. The hash
+# functions release the GIL while going over them, so several files
+# may be hashed at once in different threads.
+MAPCHUNKSIZE = 1024*1024
+
+def hashFile(path, digests):
+    """Update each of the given digest objects with the file at path."""
+    file = open(path)
+    try:
+        try:
+            map = mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ)
+        except (mmap.error, ValueError, EnvironmentError):
+            # Empty files, and files which can't be mapped.
+            map = None
+        if map is None:
+            while True:
+                data = file.read(BLOCKSIZE)
+                if not data:
+                    break
+                for digest in digests:
+                    digest.update(data)
+        else:
+            try:
+                for offset in xrange(0, len(map), MAPCHUNKSIZE):
+                    data = buffer(map, offset, MAPCHUNKSIZE)
+                    for digest in digests:
+                        digest.update(data)
+                    del data
+            finally:
+                map.close()
+    finally:
+        file.close()
+
 def getFileDigest(path, digest=None):
     if not digest:
         digest = md5()
-    file = open(path)
-    while True:
-        data = file.read(BLOCKSIZE)
-        if not data:
-            break
-        digest.update(data)
-    file.close()
+    hashFile(path, [digest])
     return digest.digest()
 
+def getFileDigests(path, kinds):
+    """
+    Return a dictionary with the hex digest of the file at path for
+    each of the given kinds (keys of DIGESTS), reading it only once.
+    """
+    digests = [DIGESTS[kind]() for kind in kinds]
+    hashFile(path, digests)
+    result = {}
+    for kind, digest in zip(kinds, digests):
+        result[kind] = digest.hexdigest()
+    return result
+
+def getFilesDigests(requests, jobs=None):
+    """
+    Hash several files at once, in up to jobs threads (by default, the
+    number of processors). requests is a list of (path, kinds) tuples,
+    and a list with the getFileDigests() result for each of them is
+    returned, with None for files which couldn't be read.
+    """
+    if jobs is None:
+        try:
+            jobs = os.sysconf("SC_NPROCESSORS_ONLN")
+        except (AttributeError, ValueError, OSError):
+            jobs = 1
+    results = [None]*len(requests)
+    pending = range(len(requests)-1, -1, -1)
+    def work():
+        while pending:
+            try:
+                i = pending.pop()
+            except IndexError:
+                break
+            path, kinds = requests[i]
+            try:
+                results[i] = getFileDigests(path, kinds)
+            except EnvironmentError:
+                pass
+    threads = []
+    for i in range(min(jobs, len(requests))-1):
+        t = threading.Thread(target=work)
+        t.start()
+        threads.append(t)
+    work()
+    for t in threads:
+        t.join()
+    return results
+
 def compareFiles(path1, path2):
     if not os.path.isfile(path1) or not os.path.isfile(path2):
         return False
     if os.path.getsize(path1) != os.path.getsize(path2):
         return False
-    path1sum = md5()
-    path2sum = md5()
-    for path, sum in [(path1, path1sum), (path2, path2sum)]:
-        file = open(path)
-        while True:
-            data = file.read(BLOCKSIZE)
-            if not data:
-                break
-            sum.update(data)
-        file.close()
-    if path1sum.digest() != path2sum.digest():
-        return False
-    return True
+    return getFileDigest(path1) == getFileDigest(path2)
 
 def setCloseOnExec(fd):
     try:
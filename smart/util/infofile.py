@@ -0,0 +1,143 @@
+#
+# This file is part of Smart Package Manager.
+#
+# Smart Package Manager is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as published
+# by the Free Software Foundation; either version 2 of the License, or (at
+# your option) any later version.
+#
+# Smart Package Manager is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Smart Package Manager; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+"""
+On-disk package information records.
+
+Loaders write the information of each package to a record file while
+loading, and keep just the record offset in memory. The records are
+decoded again when some package information is asked for, and the
+most recently used ones are kept around.
+"""
+import marshal
+import os
+
+# Number of decoded records kept by default.
+CACHESIZE = 256
+
+class LRUCache(object):
+    """Mapping keeping only the most recently used items."""
+
+    def __init__(self, size=CACHESIZE):
+        self._size = size
+        self._map = {}
+        # Circular list of [prev, next, key, value] links, with the
+        # most recently used item at the end.
+        self._root = root = [None, None, None, None]
+        root[0] = root[1] = root
+
+    def __len__(self):
+        return len(self._map)
+
+    def __contains__(self, key):
+        return key in self._map
+
+    def _unlink(self, link):
+        prev, next = link[0], link[1]
+        prev[1] = next
+        next[0] = prev
+
+    def _append(self, link):
+        root = self._root
+        last = root[0]
+        link[0] = last
+        link[1] = root
+        last[1] = root[0] = link
+
+    def get(self, key, default=None):
+        link = self._map.get(key)
+        if link is None:
+            return default
+        self._unlink(link)
+        self._append(link)
+        return link[3]
+
+    def set(self, key, value):
+        link = self._map.get(key)
+        if link is not None:
+            self._unlink(link)
+            link[3] = value
+        else:
+            if len(self._map) >= self._size:
+                oldest = self._root[1]
+                self._unlink(oldest)
+                del self._map[oldest[2]]
+            link = self._map[key] = [None, None, key, value]
+        self._append(link)
+
+    def clear(self):
+        self._map.clear()
+        root = self._root
+        root[0] = root[1] = root
+
+class InfoFileWriter(object):
+    """
+    Write records to filename. The file is only put in place by
+    close(), so readers never see a partial file.
+    """
+
+    def __init__(self, filename):
+        self._filename = filename
+        self._tmpname = "%s.%d" % (filename, os.getpid())
+        self._file = open(self._tmpname, "wb")
+
+    def write(self, record):
+        """Write a record, and return its offset."""
+        offset = self._file.tell()
+        marshal.dump(record, self._file)
+        return offset
+
+    def close(self):
+        self._file.close()
+        os.rename(self._tmpname, self._filename)
+
+    def abort(self):
+        self._file.close()
+        os.unlink(self._tmpname)
+
+class InfoFile(object):
+    """
+    Records written by InfoFileWriter. The file is opened when
+    the first record is read.
+    """
+
+    def __init__(self, filename, cachesize=CACHESIZE):
+        self._filename = filename
+        self._file = None
+        self._cache = LRUCache(cachesize)
+
+    def get(self, offset):
+        """Return the record at offset, or None if it can't be read."""
+        record = self._cache.get(offset)
+        if record is None:
+            try:
+                if not self._file:
+                    self._file = open(self._filename, "rb")
+                self._file.seek(offset)
+                record = marshal.load(self._file)
+            except (IOError, OSError, EOFError, ValueError, TypeError):
+                return None
+            self._cache.set(offset, record)
+        return record
+
+    def close(self):
+        if self._file:
+            self._file.close()
+            self._file = None
+        self._cache.clear()
+
+# vim:ts=4:sw=4:et
@@ -0,0 +1,220 @@
+#
+# This file is part of Smart Package Manager.
+#
+# Smart Package Manager is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as published
+# by the Free Software Foundation; either version 2 of the License, or (at
+# your option) any later version.
+#
+# Smart Package Manager is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Smart Package Manager; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+"""
+On-disk index of file paths.
+
+The index maps file paths to the keys (package ids, for instance) of
+the entries holding them, so that looking a few paths up doesn't need
+going over a whole file list. It is written once, and read through a
+memory map. The file holds:
+
+  - a header with the number of paths and the section offsets;
+  - the entries, as "path\\0key\\0key...", sorted by path;
+  - the offset of each entry, and of the end of the last one;
+  - a bloom filter with every path, which tells quickly that most
+    of the paths looked up are not there.
+"""
+from smart import Error
+import tempfile
+import marshal
+import struct
+import array
+import heapq
+import mmap
+import zlib
+import os
+
+MAGIC = "SMARTPATHS\0\0"
+
+FORMATVERSION = 1
+
+HEADER = "=%dsIIIIQQ" % len(MAGIC)
+
+BITSPERPATH = 10
+HASHES = 7
+
+# Number of (path, key) pairs sorted in memory at once.
+RUNSIZE = 500000
+
+def _bits(path, nbits):
+    h1 = zlib.crc32(path) & 0xffffffff
+    h2 = zlib.adler32(path) | 1
+    return [(h1+i*h2)%nbits for i in range(HASHES)]
+
+def _sortedRuns(pairs, tmpdir):
+    # Sort the pairs in runs of RUNSIZE, keeping all but the last
+    # one in temporary files, and return the number of pairs and
+    # iterators over the runs, to be merged.
+    runs = []
+    run = []
+    total = 0
+    for pair in pairs:
+        run.append(pair)
+        if len(run) == RUNSIZE:
+            run.sort()
+            file = tempfile.TemporaryFile(dir=tmpdir)
+            dumpRun(run, file)
+            file.seek(0)
+            runs.append(loadRun(file))
+            total += len(run)
+            run = []
+    run.sort()
+    total += len(run)
+    return total, runs+[iter(run)]
+
+def dumpRun(pairs, file):
+    """Write sorted (path, key) pairs to file, to be read by loadRun()."""
+    dump = marshal.dump
+    for pair in pairs:
+        dump(pair, file)
+
+def loadRun(file):
+    """Iterate over the pairs written by dumpRun(), closing file."""
+    load = marshal.load
+    try:
+        while True:
+            yield load(file)
+    except EOFError:
+        file.close()
+
+def writePathIndex(filename, pairs):
+    """
+    Write an index with the given (path, key) pairs, in any order,
+    to filename. The file is replaced atomically, so readers never
+    see a partial index.
+    """
+    total, runs = _sortedRuns(pairs, os.path.dirname(filename) or ".")
+    writeSortedPathIndex(filename, total, runs)
+
+def writeSortedPathIndex(filename, total, runs):
+    """
+    Write an index with the (path, key) pairs of runs, which are
+    iterators over sorted pairs, to filename. total is the number
+    of pairs in all of them.
+    """
+    nbits = max(total*BITSPERPATH, 8)
+    nbits += -nbits%8
+    bloom = array.array("B", [0])*(nbits/8)
+    offsets = array.array("I")
+    offset = 0
+    tmpname = "%s.%d" % (filename, os.getpid())
+    file = open(tmpname, "wb")
+    written = False
+    try:
+        headersize = struct.calcsize(HEADER)
+        file.write("\0"*headersize)
+        if len(runs) == 1:
+            merged = runs[0]
+        else:
+            merged = heapq.merge(*runs)
+        entry = None
+        for path, key in merged:
+            if not entry or path != entry[0]:
+                if entry:
+                    data = "\0".join(entry)
+                    file.write(data)
+                    offset += len(data)
+                offsets.append(offset)
+                for bit in _bits(path, nbits):
+                    bloom[bit>>3] |= 1<<(bit&7)
+                entry = [path, key]
+            elif key != entry[-1]:
+                entry.append(key)
+        if entry:
+            data = "\0".join(entry)
+            file.write(data)
+            offset += len(data)
+        npaths = len(offsets)
+        offsets.append(offset)
+        offsetspos = file.tell()
+        file.write(offsets.tostring())
+        bloompos = file.tell()
+        file.write(bloom.tostring())
+        file.seek(0)
+        file.write(struct.pack(HEADER, MAGIC, FORMATVERSION, npaths,
+                               nbits, offsets.itemsize,
+                               offsetspos, bloompos))
+        written = True
+    finally:
+        file.close()
+        if not written:
+            try:
+                os.unlink(tmpname)
+            except OSError:
+                pass
+    os.rename(tmpname, filename)
+
+class PathIndex(object):
+    """
+    Index written by writePathIndex(). Raises Error when the file
+    is not a valid index.
+    """
+
+    def __init__(self, filename):
+        file = open(filename, "rb")
+        try:
+            size = os.fstat(file.fileno()).st_size
+            headersize = struct.calcsize(HEADER)
+            if size < headersize:
+                raise Error, "Invalid path index: %s" % filename
+            self._map = mmap.mmap(file.fileno(), size,
+                                  access=mmap.ACCESS_READ)
+        finally:
+            file.close()
+        (magic, version, self._npaths, self._nbits, itemsize,
+         self._offsetspos, self._bloompos) = \
+            struct.unpack(HEADER, self._map[:headersize])
+        if (magic != MAGIC or version != FORMATVERSION or
+            itemsize != struct.calcsize("=I") or
+            self._bloompos+self._nbits/8 != size):
+            self._map.close()
+            raise Error, "Invalid path index: %s" % filename
+        self._datapos = headersize
+
+    def close(self):
+        self._map.close()
+
+    def __len__(self):
+        return self._npaths
+
+    def _getEntry(self, i):
+        start, end = struct.unpack_from("=II", self._map,
+                                        self._offsetspos+i*4)
+        return self._map[self._datapos+start:self._datapos+end]
+
+    def get(self, path):
+        """Return the list of keys holding the given path."""
+        map = self._map
+        bloompos = self._bloompos
+        for bit in _bits(path, self._nbits):
+            if not ord(map[bloompos+(bit>>3)])&(1<<(bit&7)):
+                return []
+        lo = 0
+        hi = self._npaths
+        while lo < hi:
+            mid = (lo+hi)//2
+            entry = self._getEntry(mid).split("\0")
+            if entry[0] < path:
+                lo = mid+1
+            elif entry[0] > path:
+                hi = mid
+            else:
+                return entry[1:]
+        return []
+
+# vim:ts=4:sw=4:et
@@ -22,6 +22,32 @@
 #include "Python.h"
 #include "structmember.h"
 
+#ifdef WITH_THREAD
+#include "pythread.h"
+
+/* Updates with at least this many bytes run without the GIL, so
+   that several threads may hash large buffers (mmap'ed files, for
+   instance) at once. As in hashlib, a lock is then allocated for
+   the object, so that it's only updated by one thread at a time. */
+#define GIL_MINSIZE 2048
+
+#define ENTER_SHA(obj) \
+    if ((obj)->lock) { \
+        if (!PyThread_acquire_lock((obj)->lock, 0)) { \
+            Py_BEGIN_ALLOW_THREADS \
+            PyThread_acquire_lock((obj)->lock, 1); \
+            Py_END_ALLOW_THREADS \
+        } \
+    }
+#define LEAVE_SHA(obj) \
+    if ((obj)->lock) { \
+        PyThread_release_lock((obj)->lock); \
+    }
+#else
+#define ENTER_SHA(obj)
+#define LEAVE_SHA(obj)
+#endif
+
 
 /* Endianness testing and definitions */
 #define TestEndianness(variable) {int i=1; variable=PCT_BIG_ENDIAN;\
@@ -55,6 +81,9 @@ typedef struct {
     int Endianness;
     int local;				/* unprocessed amount in data */
     int digestsize;
+#ifdef WITH_THREAD
+    PyThread_type_lock lock;
+#endif
 } SHAobject;
 
 /* When run on a little-endian CPU we need to perform byte reversal on an
@@ -365,7 +394,12 @@ static PyTypeObject SHA256type;
 static SHAobject *
 newSHA256object(void)
 {
-    return (SHAobject *)PyObject_New(SHAobject, &SHA256type);
+    SHAobject *sha = (SHAobject *)PyObject_New(SHAobject, &SHA256type);
+#ifdef WITH_THREAD
+    if (sha)
+        sha->lock = NULL;
+#endif
+    return sha;
 }
 
 /* Internal methods for a hash object */
@@ -373,6 +407,10 @@ newSHA256object(void)
 static void
 SHA_dealloc(PyObject *ptr)
 {
+#ifdef WITH_THREAD
+    if (((SHAobject *)ptr)->lock)
+        PyThread_free_lock(((SHAobject *)ptr)->lock);
+#endif
     PyObject_Del(ptr);
 }
 
@@ -389,7 +427,9 @@ SHA256_copy(SHAobject *self, PyObject *unused)
     if ( (newobj = newSHA256object())==NULL)
         return NULL;
 
+    ENTER_SHA(self);
     SHAcopy(self, newobj);
+    LEAVE_SHA(self);
     return (PyObject *)newobj;
 }
 
@@ -402,7 +442,9 @@ SHA256_digest(SHAobject *self, PyObject *unused)
     unsigned char digest[SHA_DIGESTSIZE];
     SHAobject temp;
 
+    ENTER_SHA(self);
     SHAcopy(self, &temp);
+    LEAVE_SHA(self);
     sha_final(digest, &temp);
     return PyString_FromStringAndSize((const char *)digest, self->digestsize);
 }
@@ -420,7 +462,9 @@ SHA256_hexdigest(SHAobject *self, PyObject *unused)
     int i, j;
 
     /* Get the raw (binary) digest value */
+    ENTER_SHA(self);
     SHAcopy(self, &temp);
+    LEAVE_SHA(self);
     sha_final(digest, &temp);
 
     /* Create a new string */
@@ -458,6 +502,17 @@ SHA256_update(SHAobject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "s#:update", &cp, &len))
         return NULL;
 
+#ifdef WITH_THREAD
+    if (len >= GIL_MINSIZE && self->lock == NULL)
+        self->lock = PyThread_allocate_lock();
+    if (self->lock) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(self->lock, 1);
+        sha_update(self, cp, len);
+        PyThread_release_lock(self->lock);
+        Py_END_ALLOW_THREADS
+    } else
+#endif
     sha_update(self, cp, len);
 
     Py_INCREF(Py_None);
@@ -49,10 +49,15 @@ class TagFile(dict):
     def getOffset(self):
         return self._offset
 
-    def advanceSection(self):
+    def advanceSection(self, fields=None):
+        """
+        Read the next section, returning whether there was one. If
+        fields is given, only the keys in it are kept.
+        """
+        found = False
         try:
             self.clear()
-            key = None
+            key = lastkey = None
             for line in self._file:
                 self._offset += len(line)
                 if not line:
@@ -60,7 +65,7 @@ class TagFile(dict):
                 if line[-1] == "\n":
                     line = line[:-1]
                 if not line:
-                    if key:
+                    if lastkey:
                         break
                     continue
                 if line[0].isspace():
@@ -72,12 +77,16 @@ class TagFile(dict):
                 else:
                     toks = line.split(":", 1)
                     if len(toks) == 2:
-                        key = toks[0].strip().lower()
-                        self[key] = toks[1].strip()
+                        found = True
+                        key = lastkey = toks[0].strip().lower()
+                        if fields is None or key in fields:
+                            self[key] = toks[1].strip()
+                        else:
+                            key = None
                     else:
-                        key = None
+                        key = lastkey = None
         except StopIteration:
             pass
-        return bool(self)
+        return found
 
 from ctagfile import *
@@ -0,0 +1,379 @@
+import unittest
+import cPickle
+import os
+import gc
+
+from smart.cache import Cache, Loader, Package, Provides, Requires
+from smart.cache import Upgrades, Conflicts, getStringPoolStats
+from smart import sysconf
+
+
+class CountingRequires(Requires):
+
+    matched = []
+
+    def matches(self, prv):
+        CountingRequires.matched.append((self.name, prv.name))
+        return True
+
+
+class FakeLoader(Loader):
+
+    def __init__(self, packages, installed=False):
+        Loader.__init__(self)
+        self.fake_packages = packages
+        self.setInstalled(installed)
+
+    def load(self):
+        for name, version, requires in self.fake_packages:
+            prvargs = [(Provides, name, version)]
+            reqargs = [(CountingRequires, x, None, None) for x in requires]
+            upgargs = [(Upgrades, name, "<", version)]
+            cnfargs = [(Conflicts, x, None, None) for x in requires
+                       if x.startswith("no-")]
+            pkg = self.buildPackage((Package, name, version),
+                                    prvargs, reqargs, upgargs, cnfargs)
+            pkg.loaders[self] = None
+
+
+def names(lst):
+    return sorted([str(x) for x in lst])
+
+
+class CacheTest(unittest.TestCase):
+
+    def setUp(self):
+        CountingRequires.matched[:] = []
+        self.cache = Cache()
+        self.loader1 = FakeLoader([("a", "1", ["b"]),
+                                   ("b", "1", [])])
+        self.loader2 = FakeLoader([("c", "1", ["a", "b", "no-a"]),
+                                   ("b", "1", [])], installed=True)
+        self.cache.addLoader(self.loader1)
+        self.cache.load()
+
+    def test_load(self):
+        self.assertEquals(names(self.cache.getPackages()), ["a-1", "b-1"])
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(names(req.providedby), ["b = 1"])
+        self.assertEquals(names(req.packages), ["a-1"])
+
+    def test_add_loader(self):
+        self.cache.addLoader(self.loader2)
+        CountingRequires.matched[:] = []
+        self.cache.load()
+        self.assertEquals(names(self.cache.getPackages()),
+                          ["a-1", "b-1", "c-1"])
+        # Only pairs involving new relations are checked.
+        self.assertEquals(sorted(CountingRequires.matched),
+                          [("a", "a")])
+        b = self.cache.getPackages("b")[0]
+        self.assertTrue(b.installed)
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(names(req.packages), ["a-1", "c-1"])
+        self.assertEquals(names(req.providedby), ["b = 1"])
+        prv = req.providedby[0]
+        self.assertEquals(prv.requiredby, [req])
+
+    def test_pickled_links(self):
+        self.cache.addLoader(self.loader2)
+        self.cache.load()
+        cache = cPickle.loads(cPickle.dumps(self.cache, 2))
+        loader2 = cache._loaders[1]
+        # One channel changed after a restart, so only the relations
+        # of its new loader are linked.
+        cache.removeLoader(loader2)
+        cache.addLoader(FakeLoader([("d", "1", ["a", "b"])]))
+        CountingRequires.matched[:] = []
+        cache.load()
+        self.assertEquals(CountingRequires.matched, [("a", "a")])
+        self.assertEquals(names(cache.getPackages()), ["a-1", "b-1", "d-1"])
+        req = cache.getRequires("b")[0]
+        self.assertEquals(names(req.packages), ["a-1", "d-1"])
+        self.assertEquals(names(req.providedby), ["b = 1"])
+        self.assertEquals(req.providedby[0].requiredby, [req])
+        req = cache.getRequires("a")[0]
+        self.assertEquals(names(req.providedby), ["a = 1"])
+
+    def test_add_loader_reuses_packages(self):
+        b = self.cache.getPackages("b")[0]
+        self.cache.addLoader(self.loader2)
+        self.cache.load()
+        self.assertTrue(self.cache.getPackages("b")[0] is b)
+        self.assertEquals(len(self.cache.getProvides("b")), 1)
+
+    def test_remove_loader(self):
+        self.cache.addLoader(self.loader2)
+        self.cache.load()
+        self.cache.removeLoader(self.loader1)
+        self.cache.load()
+        self.assertEquals(names(self.cache.getPackages()), ["b-1", "c-1"])
+        self.assertEquals(self.cache.getProvides("a"), [])
+        req = self.cache.getRequires("a")[0]
+        self.assertEquals(req.providedby, [])
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(names(req.packages), ["c-1"])
+        self.assertEquals(req.providedby[0].requiredby, [req])
+
+    def test_remove_keeps_shared_packages(self):
+        self.cache.addLoader(self.loader2)
+        self.cache.load()
+        b = self.cache.getPackages("b")[0]
+        self.cache.removeLoader(self.loader2)
+        self.assertEquals(names(self.cache.getPackages()), ["a-1", "b-1"])
+        self.assertTrue(self.cache.getPackages("b")[0] is b)
+        self.assertFalse(b.installed)
+        self.assertEquals(b.loaders.keys(), [self.loader1])
+        self.assertEquals(self.cache.getConflicts(), [])
+        self.assertEquals(self.cache.getProvides("a")[0].requiredby, [])
+
+    def test_reset_reloads_everything(self):
+        self.cache.reset()
+        CountingRequires.matched[:] = []
+        self.cache.load()
+        self.assertEquals(names(self.cache.getPackages()), ["a-1", "b-1"])
+        self.assertEquals(CountingRequires.matched, [("b", "b")])
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(names(req.packages), ["a-1"])
+
+
+class GCLoader(FakeLoader):
+
+    def __init__(self, packages, fail=False):
+        FakeLoader.__init__(self, packages)
+        self.fail = fail
+        self.gcenabled = None
+
+    def load(self):
+        self.gcenabled = gc.isenabled()
+        if self.fail:
+            raise RuntimeError
+        FakeLoader.load(self)
+
+
+class GCTest(unittest.TestCase):
+
+    def test_gc_paused_while_loading(self):
+        loader = GCLoader([("a", "1", [])])
+        cache = Cache()
+        cache.addLoader(loader)
+        cache.load()
+        self.assertEquals(loader.gcenabled, False)
+        self.assertTrue(gc.isenabled())
+
+    def test_gc_restored_on_error(self):
+        cache = Cache()
+        cache.addLoader(GCLoader([], fail=True))
+        self.assertRaises(RuntimeError, cache.load)
+        self.assertTrue(gc.isenabled())
+
+    def test_gc_left_disabled(self):
+        gc.disable()
+        try:
+            cache = Cache()
+            cache.addLoader(GCLoader([("a", "1", [])]))
+            cache.load()
+            self.assertFalse(gc.isenabled())
+        finally:
+            gc.enable()
+
+
+class CompactTest(unittest.TestCase):
+
+    def setUp(self):
+        self.cache = Cache()
+        self.loader1 = FakeLoader([("a", "1", ["b"]),
+                                   ("b", "1", [])])
+        self.loader2 = FakeLoader([("c", "1", ["b"])])
+        self.cache.addLoader(self.loader1)
+        sysconf.set("cache-compact", True)
+
+    def tearDown(self):
+        sysconf.remove("cache-compact")
+
+    def test_compact(self):
+        self.cache.load()
+        a = self.cache.getPackages("a")[0]
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(type(a.requires), tuple)
+        self.assertEquals(type(a.recommends), tuple)
+        self.assertEquals(req.packages, (a,))
+        self.assertEquals(type(req.providedby), tuple)
+        self.assertEquals(type(req.providedby[0].requiredby), tuple)
+        self.assertEquals(a.requires + a.recommends, (req,))
+
+    def test_compact_disabled(self):
+        sysconf.remove("cache-compact")
+        self.cache.load()
+        a = self.cache.getPackages("a")[0]
+        self.assertEquals(type(a.requires), list)
+        self.assertEquals(type(self.cache.getRequires("b")[0].packages), list)
+
+    def test_reload_after_compact(self):
+        self.cache.load()
+        self.cache.addLoader(self.loader2)
+        self.cache.load()
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(names(req.packages), ["a-1", "c-1"])
+        self.assertEquals(type(req.packages), tuple)
+        self.cache.removeLoader(self.loader2)
+        self.assertEquals(names(req.packages), ["a-1"])
+        self.cache.addLoader(self.loader2)
+        self.cache.load()
+        self.assertEquals(names(req.packages), ["a-1", "c-1"])
+
+    def test_pickled_compacted(self):
+        for compact in (False, True):
+            sysconf.set("cache-compact", compact)
+            cache = Cache()
+            cache.addLoader(FakeLoader([("a", "1", ["b"])]))
+            cache.load()
+            cache = cPickle.loads(cPickle.dumps(cache, 2))
+            self.assertEquals(bool(cache._compacted), compact)
+            a = cache.getPackages("a")[0]
+            self.assertEquals(type(a.requires), compact and tuple or list)
+
+
+class StringPoolTest(unittest.TestCase):
+
+    def test_pool_strings(self):
+        # Build equal strings which aren't the same object.
+        version = "".join(["1.", "0"])
+        loader1 = FakeLoader([("a", version, ["b"])])
+        loader2 = FakeLoader([("b", "".join(["1.", "0"]), [])])
+        cache = Cache()
+        cache.addLoader(loader1)
+        cache.addLoader(loader2)
+        cache.load()
+        a = cache.getPackages("a")[0]
+        b = cache.getPackages("b")[0]
+        self.assertTrue(a.version is b.version)
+        self.assertTrue(a.provides[0].version is b.version)
+        self.assertTrue(a.requires[0].name is b.name)
+        stats = getStringPoolStats(cache)
+        self.assertTrue(stats["strings"] > 0)
+        self.assertTrue(stats["saved"] > 0)
+
+        # Stats describe the cache as it is, not how often it loaded.
+        cache.reset()
+        self.assertEquals(getStringPoolStats(cache),
+                          {"strings": 0, "saved": 0})
+        cache.load()
+        self.assertEquals(getStringPoolStats(cache), stats)
+
+
+class MatcherLoader(Loader):
+
+    def __init__(self, prvs, deps):
+        Loader.__init__(self)
+        self.prvs = prvs
+        self.deps = deps
+
+    def load(self):
+        for i, prv in enumerate(self.prvs):
+            self.buildPackage((Package, "p%d" % i, "1"), [prv], [], [], [])
+        for i, (cls, args) in enumerate(self.deps):
+            self.buildPackage((Package, "d%d" % i, "1"), [],
+                              [(cls,)+args], [], [])
+
+
+class MatcherTest(unittest.TestCase):
+
+    def test_deb_matchers(self):
+        from smart.backends.deb.base import DebProvides, DebNameProvides
+        from smart.backends.deb.base import DebRequires, DebUpgrades
+        from smart.backends.deb.base import DebOrRequires
+        prvs = [(Provides, "a", None), (Provides, "a", "1.0"),
+                (DebProvides, "a", "2.0"), (DebNameProvides, "a", "3.0"),
+                (DebProvides, "a", None)]
+        deps = [(DebRequires, ("a", None, None)),
+                (DebRequires, ("a", ">=", "2.0")),
+                (DebRequires, ("a", "<<", "2.0")),
+                (DebRequires, ("a", "=", "3.0")),
+                (DebUpgrades, ("a", "<", "3.0")),
+                (DebOrRequires, ((("b", None, None), ("a", ">", "1.0")),)),
+                (CountingRequires, ("a", None, None))]
+        cache = Cache()
+        cache.addLoader(MatcherLoader(prvs, deps))
+        cache.load()
+        self.assertEquals(len(cache.getProvides()), len(prvs))
+        for dep in cache.getRequires() + cache.getUpgrades():
+            expected = [prv for prv in cache.getProvides()
+                        if prv.name in dep.getMatchNames() and
+                           dep.matches(prv)]
+            self.assertEquals(sorted(dep.providedby), sorted(expected))
+
+    def test_get_matches(self):
+        from smart.backends.deb.base import DebProvides, DebNameProvides
+        from smart.backends.deb.base import DebRequires, DebUpgrades
+        prvs = [Provides("a", None), Provides("a", "1.0"),
+                DebProvides("a", "2.0"), DebNameProvides("a", "3.0"),
+                DebProvides("a", None)]
+        deps = [DebRequires("a", None, None), DebRequires("a", ">=", "2.0"),
+                DebRequires("a", "<<", "2.0"), DebUpgrades("a", "<", "3.0"),
+                CountingRequires("a", None, None)]
+        for dep in deps:
+            self.assertEquals(dep.getMatches(prvs),
+                              [prv for prv in prvs if dep.matches(prv)])
+
+
+class ParseLoader(FakeLoader):
+
+    def __init__(self, packages, fail=False):
+        FakeLoader.__init__(self, packages)
+        self.fail = fail
+        self.pids = []
+
+    def canParse(self):
+        return True
+
+    def parse(self, prog):
+        if self.fail:
+            raise RuntimeError
+        for name, version, requires in self.fake_packages:
+            yield name, version, requires, os.getpid()
+
+    def loadRecords(self, records):
+        for name, version, requires, pid in records:
+            pkg = self.buildPackage((Package, name, version),
+                                    [(Provides, name, version)],
+                                    [(Requires, x, None, None)
+                                     for x in requires], [], [])
+            pkg.loaders[self] = None
+            self.pids.append(pid)
+
+
+class ParallelLoadTest(unittest.TestCase):
+
+    def setUp(self):
+        sysconf.set("load-jobs", 2)
+        self.loader1 = ParseLoader([("a", "1", ["b"])])
+        self.loader2 = ParseLoader([("b", "1", [])])
+        self.cache = Cache()
+        self.cache.addLoader(self.loader1)
+        self.cache.addLoader(self.loader2)
+
+    def tearDown(self):
+        sysconf.remove("load-jobs")
+
+    def test_parse_in_workers(self):
+        self.cache.load()
+        self.assertEquals(names(self.cache.getPackages()), ["a-1", "b-1"])
+        self.assertEquals(len(self.loader1.pids), 1)
+        self.assertNotEquals(self.loader1.pids[0], os.getpid())
+        self.assertNotEquals(self.loader2.pids[0], os.getpid())
+        req = self.cache.getRequires("b")[0]
+        self.assertEquals(names(req.packages), ["a-1"])
+
+    def test_failed_parse_falls_back_to_load(self):
+        self.loader2.fail = True
+        self.cache.load()
+        self.assertEquals(names(self.cache.getPackages()), ["a-1", "b-1"])
+        self.assertEquals(self.loader2.pids, [])
+
+    def test_single_job(self):
+        sysconf.set("load-jobs", 1)
+        self.cache.load()
+        self.assertEquals(self.loader1.pids, [])
+        self.assertEquals(self.loader2.pids, [])
+        self.assertEquals(names(self.cache.getPackages()), ["a-1", "b-1"])
@@ -0,0 +1,244 @@
+import tempfile
+import pickle
+import shutil
+import os
+
+from mocker import MockerTestCase
+
+from smart.cachefile import dumpCache, loadCache
+from smart.cache import Cache, Loader, Package, Provides, Requires
+from smart.cache import Upgrades, Conflicts, StateVersionError
+from smart.cache import getStringPoolStats
+from smart.searcher import Searcher
+from smart.control import Control
+from smart import sysconf
+
+from tests import TESTDATADIR
+
+
+class TupleRequires(Requires):
+
+    def __init__(self, nrv):
+        Requires.__init__(self, nrv[0], nrv[1], nrv[2])
+        self._nrv = nrv
+
+    def __reduce__(self):
+        return (self.__class__, (self._nrv,))
+
+
+class NameRequires(Requires):
+
+    def matches(self, prv):
+        return prv.name == self.name
+
+
+class NameUpgrades(Upgrades):
+
+    def matches(self, prv):
+        return prv.name == self.name
+
+
+class NameConflicts(Conflicts):
+
+    def matches(self, prv):
+        return prv.name == self.name
+
+
+class FakeLoader(Loader):
+
+    def load(self):
+        for name, version, requires in [("foo", "1.0", ["bar"]),
+                                        ("bar", "2.0", []),
+                                        ("baz", "3.0", ["bar", "foo"])]:
+            prvargs = [(Provides, name, version)]
+            reqargs = [(NameRequires, x, None, None) for x in requires]
+            upgargs = [(NameUpgrades, name, "<", version)]
+            cnfargs = []
+            if name == "baz":
+                cnfargs = [(NameConflicts, "foo", ">", "1.0")]
+                reqargs.append((TupleRequires, ("bar", ">=", "2.0")))
+            pkg = self.buildPackage((Package, name, version),
+                                    prvargs, reqargs, upgargs, cnfargs)
+            pkg.loaders[self] = {"offset": len(self._packages)-1}
+
+
+class CacheFileTest(MockerTestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, "cache")
+        self.cache = Cache()
+        self.cache.addLoader(FakeLoader())
+        self.cache.load()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def reload(self, stateversion=1):
+        dumpCache((1, self.cache, {"alias": "channel"}, {}), self.path)
+        return loadCache(self.path, stateversion)
+
+    def test_roundtrip(self):
+        stateversion, cache, channels, sysconfchannels = self.reload()
+        self.assertEquals(stateversion, 1)
+        self.assertEquals(channels, {"alias": "channel"})
+        self.assertEquals(sysconfchannels, {})
+        self.assertEquals(sorted([str(x) for x in cache.getPackages()]),
+                          ["bar-2.0", "baz-3.0", "foo-1.0"])
+
+    def test_relations(self):
+        cache = self.reload()[1]
+        for pkg in self.cache.getPackages():
+            newpkg = cache.getPackages(pkg.name)[0]
+            for attr in ["provides", "requires", "upgrades", "conflicts"]:
+                self.assertEquals([repr(x) for x in getattr(pkg, attr)],
+                                  [repr(x) for x in getattr(newpkg, attr)])
+                self.assertEquals(type(getattr(pkg, attr)),
+                                  type(getattr(newpkg, attr)))
+
+    def test_shared_relations(self):
+        cache = self.reload()[1]
+        foo = cache.getPackages("foo")[0]
+        baz = cache.getPackages("baz")[0]
+        self.assertTrue(foo.requires[0] is baz.requires[0])
+        self.assertEquals(foo.requires[0].packages, [foo, baz])
+
+    def test_extra_relations(self):
+        cache = self.reload()[1]
+        baz = cache.getPackages("baz")[0]
+        req = baz.requires[-1]
+        self.assertEquals(type(req), TupleRequires)
+        self.assertEquals(req._nrv, ("bar", ">=", "2.0"))
+
+    def test_loaders(self):
+        cache = self.reload()[1]
+        loader = cache._loaders[0]
+        self.assertEquals(type(loader), FakeLoader)
+        self.assertEquals([str(x) for x in loader.getPackages()],
+                          ["foo-1.0", "bar-2.0", "baz-3.0"])
+        for i, pkg in enumerate(loader.getPackages()):
+            self.assertEquals(pkg.loaders, {loader: {"offset": i}})
+
+    def test_links(self):
+        cache = self.reload()[1]
+        foo = cache.getPackages("foo")[0]
+        bar = cache.getPackages("bar")[0]
+        baz = cache.getPackages("baz")[0]
+        self.assertEquals(foo.requires[0].providedby, [bar.provides[0]])
+        self.assertEquals(bar.provides[0].requiredby,
+                          [foo.requires[0]])
+        self.assertEquals(foo.provides[0].conflictedby, [baz.conflicts[0]])
+        self.assertEquals(foo.provides[0].upgradedby, [foo.upgrades[0]])
+        self.assertEquals(cache._loaded.keys(), cache._loaders)
+
+    def test_empty_strings(self):
+        pkg = self.cache.getPackages("foo")[0]
+        pkg.requires.append(Requires("qux", "=", ""))
+        cache = self.reload()[1]
+        req = cache.getPackages("foo")[0].requires[-1]
+        self.assertEquals((req.name, req.relation, req.version),
+                          ("qux", "=", ""))
+
+    def test_stateversion_mismatch(self):
+        self.assertRaises(StateVersionError, self.reload, 2)
+
+    def test_old_format(self):
+        file = open(self.path, "w")
+        file.write("Not a cache file, but long enough to have a header.\n"*4)
+        file.close()
+        self.assertRaises(StateVersionError, loadCache, self.path, 1)
+
+    def test_truncated(self):
+        file = open(self.path, "w")
+        file.close()
+        self.assertRaises(StateVersionError, loadCache, self.path, 1)
+
+    def test_search_index(self):
+        cache = self.reload()[1]
+        searcher = Searcher()
+        searcher.addNameVersion("ba*")
+        # Too short to rule anything out.
+        self.assertEquals(sorted([str(x) for x in
+                                  cache._searchindex.getPackages(searcher)]),
+                          ["bar-2.0", "baz-3.0", "foo-1.0"])
+        searcher = Searcher()
+        searcher.addNameVersion("baz*")
+        self.assertEquals([str(x) for x in
+                           cache._searchindex.getPackages(searcher)],
+                          ["baz-3.0"])
+        searcher.addNameVersion("ba*")
+        searcher.addProvides("foo")
+        cache.search(searcher)
+        self.assertEquals(sorted([str(x) for ratio, x in
+                                  searcher.getResults()]),
+                          ["bar-2.0", "baz-3.0", "foo = 1.0"])
+
+    def test_no_search_index(self):
+        sysconf.set("search-index", False)
+        try:
+            cache = self.reload()[1]
+        finally:
+            sysconf.remove("search-index")
+        self.assertEquals(cache._searchindex, None)
+
+    def test_string_pool_stats(self):
+        # Strings shared through the cache file count as pooled too.
+        cache = self.reload()[1]
+        stats = getStringPoolStats(cache)
+        self.assertTrue(stats["strings"] > 0)
+        self.assertTrue(stats["saved"] > 0)
+
+    def test_search_index_kept_by_load(self):
+        cache = self.reload()[1]
+        index = cache._searchindex
+        cache.load()
+        self.assertTrue(cache._searchindex is index)
+        self.assertEquals(sorted([str(x) for x in cache.getPackages()]),
+                          ["bar-2.0", "baz-3.0", "foo-1.0"])
+
+    def test_search_index_dropped_by_new_loader(self):
+        cache = self.reload()[1]
+        cache.addLoader(FakeLoader())
+        cache.load()
+        self.assertEquals(cache._searchindex, None)
+
+
+class ControlCacheFileTest(MockerTestCase):
+
+    def setUp(self):
+        self.old_sysconf = pickle.dumps(sysconf.object)
+        self.datadir = tempfile.mkdtemp()
+        sysconf.setReadOnly(False)
+        sysconf.set("data-dir", self.datadir, soft=True)
+        sysconf.set("channels",
+                    {"alias": {"type": "deb-dir",
+                               "path": os.path.join(TESTDATADIR, "deb")}},
+                    soft=True)
+
+    def tearDown(self):
+        sysconf.object = pickle.loads(self.old_sysconf)
+        shutil.rmtree(self.datadir)
+
+    def test_search_index(self):
+        ctrl = Control()
+        ctrl.reloadChannels()
+        ctrl.saveSysConf()
+        self.assertTrue(os.path.isfile(os.path.join(self.datadir, "cache")))
+
+        ctrl = Control()
+        ctrl.reloadChannels()
+        self.assertNotEquals(ctrl.getCache()._searchindex, None)
+        ratio, results, suggestions = ctrl.search("name2*")
+        self.assertEquals(sorted([str(x) for x in results]),
+                          ["name2 = version2-release2",
+                           "name2_version2-release2"])
+
+    def test_search_name_suggestions(self):
+        # Too far from every name-version, but the name is close.
+        ctrl = Control()
+        ctrl.reloadChannels()
+        ratio, results, suggestions = ctrl.search("Nam2-1.0")
+        self.assertEquals(results, [])
+        self.assertEquals([str(x) for r, x in suggestions],
+                          ["name2_version2-release2"])
+        self.assertAlmostEquals(suggestions[0][0], 0.8, 5)
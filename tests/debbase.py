@@ -5,7 +5,9 @@ from tests.mocker import MockerTestCase
 import smart.backends.deb._base
 
 from smart.backends.deb.base import getArchitecture
-from smart.backends.deb.debver import splitrelease
+from smart.backends.deb.debver import splitrelease, vercmp, checkdep
+from smart.backends.deb.debver import sortversions, checkdeps
+from smart.cache import Provides, Requires
 
 
 class GetArchitectureTest(MockerTestCase):
@@ -65,3 +67,34 @@ class DebVerSplitTest(MockerTestCase):
         self.assertEquals(version, "1.0")
         self.assertEquals(release, "1_0ubuntu0.10.04")
 
+class DebVerCompareTest(MockerTestCase):
+
+    def test_vercmp(self):
+        self.assertEquals(vercmp("1.0-1", "1.0-2"), -1)
+        self.assertEquals(vercmp("1:1.0-1", "2.0-1"), 1)
+        self.assertEquals(vercmp("1.0~rc1-1", "1.0-1"), -1)
+        self.assertEquals(vercmp("1.0", "1.0-0"), -1)
+        self.assertEquals(vercmp("1.01", "1.1"), 0)
+
+    def test_checkdep(self):
+        # Parsed versions are cached, so check them twice.
+        for i in range(2):
+            self.assertTrue(checkdep("1.0-1", "<", "1.0-2"))
+            self.assertTrue(checkdep("1.0-1", "<=", "1.0-1"))
+            self.assertFalse(checkdep("1.0-1", ">", "1.0-1"))
+            self.assertTrue(checkdep("1:0.1", ">=", "2.0"))
+
+    def test_sortversions(self):
+        versions = ["1.10-1", "1.9-1", "1:0.1-1", "1.9~rc1-1", "1.9-1"]
+        sortversions(versions)
+        self.assertEquals(versions, ["1.9~rc1-1", "1.9-1", "1.9-1",
+                                     "1.10-1", "1:0.1-1"])
+
+    def test_checkdeps(self):
+        prvs = [Provides("a", "1.0"), Provides("a", None),
+                Provides("a", "2.0"), Provides("a", "1:0.5")]
+        self.assertEquals(checkdeps(Requires("a", ">=", "2.0"), prvs),
+                          [prvs[2], prvs[3]])
+        self.assertEquals(checkdeps(Requires("a", "<", "2.0"), prvs, True),
+                          [prvs[0], prvs[1]])
+        self.assertEquals(checkdeps(Requires("a", None, None), prvs), prvs)
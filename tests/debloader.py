@@ -1,7 +1,10 @@
 from StringIO import StringIO
+import tempfile
 import unittest
+import os
 
-from smart.backends.deb.loader import DebTagLoader, DEBARCH, TagFile
+from smart.backends.deb.loader import DebTagLoader, DebTagFileLoader
+from smart.backends.deb.loader import DEBARCH, TagFile
 from smart.backends.deb.base import DebBreaks
 from smart.cache import Cache
 
@@ -96,3 +99,17 @@ class DebLoaderTest(unittest.TestCase):
         except ValueError, e:
             self.fail(e)
 
+    def test_get_dict_copy(self):
+        fd, filename = tempfile.mkstemp()
+        os.write(fd, SMARTPM_SECTION)
+        os.close(fd)
+        try:
+            loader = DebTagFileLoader(filename)
+            loader.setCache(self.cache)
+            loader.load()
+            pkg = self.cache.getPackages()[0]
+            dict = loader.getDict(pkg)
+            dict["version"] = "changed"
+            self.assertEquals(loader.getDict(pkg)["version"], "0.51-1")
+        finally:
+            os.unlink(filename)
@@ -1,14 +1,17 @@
 import BaseHTTPServer
+import SocketServer
 import threading
 import unittest
 import socket
 import signal
+import sys
 import time
 import os
 
 from smart.progress import Progress
 from smart.interface import Interface
 from smart.fetcher import Fetcher
+from smart.mirror import MirrorStats
 from smart.const import VERSION, SUCCEEDED, FAILED
 from smart import fetcher, sysconf, iface
 
@@ -28,6 +31,72 @@ class HTTPServer(BaseHTTPServer.HTTPServer):
             BaseHTTPServer.HTTPServer.handle_error(self, request, client_address)
 
 
+class KeepAliveServer(SocketServer.ThreadingMixIn, BaseHTTPServer.HTTPServer):
+    """
+    HTTP/1.1 server answering requests for /<anything> with the
+    path itself, or with its data in files, and counting the
+    connections it gets and the bytes it sends.
+    """
+
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, files={}, ranges=True):
+        class Handler(BaseHTTPServer.BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.1"
+            # Send each response at once, as real servers do.
+            wbufsize = -1
+            disable_nagle_algorithm = True
+            def setup(handler):
+                BaseHTTPServer.BaseHTTPRequestHandler.setup(handler)
+                self.lock.acquire()
+                self.connections += 1
+                self.lock.release()
+            def do_GET(handler):
+                self.lock.acquire()
+                self.active += 1
+                self.maxactive = max(self.maxactive, self.active)
+                self.lock.release()
+                time.sleep(0.01)
+                data = files.get(handler.path, handler.path)
+                range = handler.headers.get("range")
+                if ranges and range:
+                    start, end = map(int, range[6:].split("-"))
+                    handler.send_response(206)
+                    handler.send_header("Content-Range", "bytes %d-%d/%d" %
+                                        (start, end, len(data)))
+                    data = data[start:end+1]
+                else:
+                    handler.send_response(200)
+                handler.send_header("Content-Length", len(data))
+                handler.end_headers()
+                handler.wfile.write(data)
+                self.lock.acquire()
+                self.active -= 1
+                self.sent += len(data)
+                self.lock.release()
+            def log_message(handler, format, *args):
+                pass
+        BaseHTTPServer.HTTPServer.__init__(self, ("127.0.0.1", 0), Handler)
+        self.lock = threading.Lock()
+        self.connections = 0
+        self.active = 0
+        self.maxactive = 0
+        self.sent = 0
+        thread = threading.Thread(target=self.serve_forever)
+        thread.setDaemon(True)
+        thread.start()
+
+    def handle_error(self, request, client_address):
+        # Clients may drop connections before reading responses out.
+        if not isinstance(sys.exc_info()[1], socket.error):
+            BaseHTTPServer.HTTPServer.handle_error(self, request,
+                                                   client_address)
+
+    def getURL(self, path):
+        return "http://127.0.0.1:%d/%s" % (self.server_address[1], path)
+
+
 class FetcherTest(MockerTestCase):
 
     def setUp(self):
@@ -126,6 +195,24 @@ class FetcherTest(MockerTestCase):
         item = self.fetcher.getItem(URL)
         self.assertEquals(item.getFailedReason(), u"File not found")
 
+    def test_item_changed_when_done(self):
+        # The fetcher may retry a changed item right away, so it's only
+        # told once the failure was recorded.
+        origin = "http://127.0.0.1:%d/" % PORT
+        mirror = "http://127.0.0.1:%d/" % (PORT+1)
+        self.fetcher.getMirrorSystem().setMirrors({origin: [mirror]})
+        item = self.fetcher.enqueue(URL)
+        self.fetcher.time = time.time()
+        item.setNextURL()
+        item.start()
+        history = []
+        self.fetcher.itemChanged = lambda item: history.append(
+            self.fetcher.getMirrorSystem().getHistory())
+        item.setFailed("Failed")
+        self.assertEquals(len(history), 1)
+        self.assertEquals(len(history[0]), 1)
+        self.assertTrue(MirrorStats(history[0].values()[0]).failrate)
+
     def test_timeout(self):
         timeout = 3
         sleep_time = 6
@@ -166,9 +253,227 @@ class FetcherTest(MockerTestCase):
         self.start_server(handler)
         self.fetcher.enqueue(URL)
         start = time.time()
-        self.fetcher.run(progress=Progress())
+        try:
+            self.fetcher.run(progress=Progress())
+        finally:
+            sysconf.remove("max-download-rate", soft=True)
         stop = time.time()
         elapsed_time = stop - start
         
         self.assertTrue(elapsed_time >= bytes / rate_limit)
     
+
+    def test_run_local_validates_cached_files(self):
+        from hashlib import md5, sha256
+        urls = ["http://127.0.0.1:%d/name%d.pkg" % (PORT, i) for i in range(3)]
+        for i, url in enumerate(urls):
+            file = open(os.path.join(self.local_path, "name%d.pkg" % i), "w")
+            file.write("data%d" % i)
+            file.close()
+        self.fetcher.enqueue(urls[0], md5=md5("data0").hexdigest())
+        self.fetcher.enqueue(urls[1], sha256=sha256("data1").hexdigest(),
+                             md5=md5("data1").hexdigest())
+        self.fetcher.enqueue(urls[2], sha256=sha256("other").hexdigest())
+        self.fetcher.runLocal()
+        self.assertEquals([self.fetcher.getItem(url).getStatus()
+                           for url in urls[:2]], [SUCCEEDED, SUCCEEDED])
+        self.assertNotEquals(self.fetcher.getItem(urls[2]).getStatus(),
+                             SUCCEEDED)
+        item = self.fetcher.getItem(urls[2])
+        valid, reason = self.fetcher.validate(
+            item, os.path.join(self.local_path, "name2.pkg"), withreason=True)
+        self.assertFalse(valid)
+        self.assertTrue(str(reason).startswith("Invalid SHA256"))
+
+    def test_validate_digests_computed_while_downloading(self):
+        from hashlib import md5, sha256
+        def handler(request):
+            request.send_response(200)
+            request.send_header("Content-Length", "4")
+            request.end_headers()
+            request.wfile.write("data")
+        hashed = []
+        def getFileDigests(path, kinds):
+            hashed.append(path)
+            return original(path, kinds)
+        original = fetcher.getFileDigests
+        fetcher.getFileDigests = getFileDigests
+        try:
+            self.start_server(handler)
+            self.fetcher.enqueue(URL, md5=md5("data").hexdigest(),
+                                 sha256=sha256("data").hexdigest())
+            self.fetcher.run(progress=Progress())
+        finally:
+            fetcher.getFileDigests = original
+        item = self.fetcher.getItem(URL)
+        self.assertEquals(item.getFailedReason(), None)
+        self.assertEquals(item.getStatus(), SUCCEEDED)
+        self.assertEquals(hashed, [])
+
+    def test_digest_file_appending(self):
+        from hashlib import md5
+        item = self.fetcher.enqueue(URL, md5=md5("data").hexdigest())
+        path = os.path.join(self.local_path, "filename.pkg")
+        open(path, "w").write("da")
+        local = fetcher.DigestFile(self.fetcher, item, path, "a")
+        local.write("ta")
+        local.close()
+        local.setDigests(path)
+        self.assertEquals(open(path).read(), "data")
+        self.assertEquals(self.fetcher.getLocalDigests(path, ["md5"]),
+                          {"md5": md5("data").hexdigest()})
+        # Digests aren't used once the file changes.
+        local.setDigests(path)
+        open(path, "a").write("!")
+        self.assertEquals(self.fetcher.getLocalDigests(path, ["md5"]),
+                          {"md5": md5("data!").hexdigest()})
+
+    def test_wake_up_pipe(self):
+        pipe = fetcher.WakeUpPipe()
+        for i in range(10000):
+            pipe.wakeUp()
+        started = time.time()
+        pipe.wait(5)
+        self.assertTrue(time.time()-started < 1)
+        # Pending wake ups were all consumed.
+        started = time.time()
+        pipe.wait(0.2)
+        self.assertTrue(time.time()-started >= 0.2)
+
+    def test_persistent_connections(self):
+        server = KeepAliveServer()
+        urls = [server.getURL("file%d" % i) for i in range(20)]
+        sysconf.set("max-downloads-per-host", 2)
+        try:
+            for url in urls:
+                self.fetcher.enqueue(url)
+            self.fetcher.run(progress=Progress())
+        finally:
+            sysconf.remove("max-downloads-per-host")
+            server.shutdown()
+            server.server_close()
+        for i, url in enumerate(urls):
+            item = self.fetcher.getItem(url)
+            self.assertEquals(item.getStatus(), SUCCEEDED)
+            self.assertEquals(open(item.getTargetPath()).read(), "/file%d" % i)
+        self.assertTrue(server.connections <= 2)
+        self.assertTrue(server.maxactive <= 2)
+
+    def fetch_segmented(self, servers, data, **info):
+        from hashlib import md5
+        url = servers[0].getURL("file")
+        mirrors = [server.getURL("") for server in servers[1:]]
+        self.fetcher.getMirrorSystem().setMirrors({servers[0].getURL(""):
+                                                   mirrors})
+        sysconf.set("segmented-download-size", 1024*1024)
+        try:
+            self.fetcher.enqueue(url, size=len(data),
+                                 md5=md5(data).hexdigest(), **info)
+            self.fetcher.run(progress=Progress())
+        finally:
+            sysconf.remove("segmented-download-size")
+            for server in servers:
+                server.shutdown()
+                server.server_close()
+        return self.fetcher.getItem(url)
+
+    def test_segmented_download(self):
+        data = "".join([chr(i%251) for i in range(5*1024*1024+100)])
+        servers = [KeepAliveServer({"/file": data}) for i in range(3)]
+        item = self.fetch_segmented(servers, data)
+        self.assertEquals(item.getStatus(), SUCCEEDED)
+        self.assertEquals(open(item.getTargetPath()).read(), data)
+        journal = self.fetcher.getJournal(item.getTargetPath())
+        self.assertEquals(journal.get(item.getTargetPath()), None)
+        self.assertEquals(sum([server.sent for server in servers]), len(data))
+        self.assertEquals(len([x for x in servers if x.sent]), 3)
+
+    def test_segmented_download_resumes(self):
+        data = "".join([chr(i%251) for i in range(3*1024*1024)])
+        localpath = os.path.join(self.local_path, "file")
+        part = open(localpath+".part", "w")
+        part.write(data[:2*1024*1024])
+        part.close()
+        # Only the second MB was recorded as fetched.
+        self.fetcher.getJournal(localpath).set(localpath, size=len(data),
+            ranges=[(1024*1024, 2*1024*1024)])
+        servers = [KeepAliveServer({"/file": data}) for i in range(2)]
+        item = self.fetch_segmented(servers, data)
+        self.assertEquals(item.getStatus(), SUCCEEDED)
+        self.assertEquals(open(localpath).read(), data)
+        self.assertEquals(sum([server.sent for server in servers]),
+                          2*1024*1024)
+
+    def test_segmented_download_without_ranges(self):
+        data = "x"*(2*1024*1024)
+        servers = [KeepAliveServer({"/file": data}, ranges=False)
+                   for i in range(2)]
+        item = self.fetch_segmented(servers, data)
+        self.assertEquals(item.getStatus(), SUCCEEDED)
+        self.assertEquals(open(item.getTargetPath()).read(), data)
+        # Mirrors without ranges work, so that isn't a failure.
+        history = self.fetcher.getMirrorSystem().getHistory()
+        self.assertEquals(len(history), 2)
+        for state in history.values():
+            self.assertEquals(MirrorStats(state).failrate, 0)
+
+    def resume_partial(self, etag):
+        localpath = os.path.join(self.local_path, "filename.pkg")
+        part = open(localpath+".part", "w")
+        part.write("01234")
+        part.close()
+        journal = self.fetcher.getJournal(localpath)
+        journal.set(localpath, url=URL, size=10, etag=etag)
+        headers = {}
+        def handler(request):
+            headers.update(request.headers)
+            if (request.headers.get("if-range") == '"new"' and
+                request.headers.get("range") == "bytes=5-"):
+                request.send_response(206)
+                request.send_header("Content-Range", "bytes 5-9/10")
+                request.send_header("Content-Length", "5")
+                request.end_headers()
+                request.wfile.write("56789")
+            else:
+                request.send_response(200)
+                request.send_header("Content-Length", "10")
+                request.end_headers()
+                request.wfile.write("abcdefghij")
+        self.start_server(handler)
+        self.fetcher.enqueue(URL)
+        self.fetcher.run(progress=Progress())
+        self.assertEquals(journal.get(localpath), None)
+        self.assertEquals(headers.get("if-range"), etag)
+        return open(localpath).read()
+
+    def test_resume_partial_download(self):
+        self.assertEquals(self.resume_partial('"new"'), "0123456789")
+
+    def test_resume_changed_file_starts_over(self):
+        self.assertEquals(self.resume_partial('"old"'), "abcdefghij")
+
+    def test_resume_file_copy(self):
+        filepath = self.makeFile("0123456789")
+        url = "file://" + filepath
+        localpath = os.path.join(self.local_path, os.path.basename(filepath))
+        part = open(localpath+".part", "w")
+        part.write("ABCDE")
+        part.close()
+        st = os.stat(filepath)
+        journal = self.fetcher.getJournal(localpath)
+        journal.set(localpath, url=url, size=10, modified=st.st_mtime,
+                    ranges=[(0, 3)])
+        self.fetcher.setForceCopy(True)
+        self.fetcher.enqueue(url)
+        self.fetcher.run(progress=Progress())
+        # The copy went on from what the journal says was copied.
+        self.assertEquals(open(localpath).read(), "ABC3456789")
+        self.assertEquals(journal.get(localpath), None)
+
+        # Partial copies of files changed since then start over.
+        os.rename(localpath, localpath+".part")
+        journal.set(localpath, url=url, size=10, modified=st.st_mtime-1)
+        self.fetcher.reset()
+        self.fetcher.enqueue(url)
+        self.fetcher.run(progress=Progress())
+        self.assertEquals(open(localpath).read(), "0123456789")
@@ -0,0 +1,99 @@
+from unittest import TestCase
+
+from smart.mirror import MirrorSystem, MirrorStats
+
+
+ORIGIN = "http://origin/"
+MIRRORS = ["http://mirror1/", "http://mirror2/"]
+
+
+class MirrorStatsTest(TestCase):
+
+    def test_throughput(self):
+        stats = MirrorStats()
+        self.assertEquals(stats.getThroughput(), None)
+        stats.addSample(size=1000, time=1)
+        self.assertEquals(stats.getThroughput(), 1000)
+        for i in range(50):
+            stats.addSample(size=4000, time=1)
+        self.assertAlmostEquals(stats.getThroughput(), 4000, 0)
+
+    def test_failure_rate(self):
+        stats = MirrorStats()
+        stats.addSample(failed=1)
+        self.assertAlmostEquals(stats.failrate, 0.2)
+        for i in range(50):
+            stats.addSample(size=1000, time=1)
+        self.assertTrue(stats.failrate < 0.001)
+
+    def test_latency_percentiles(self):
+        stats = MirrorStats()
+        self.assertEquals(stats.getLatency(), 0)
+        for i in range(10):
+            stats.addSample(latency=0.015)
+        stats.addSample(latency=1)
+        self.assertEquals(stats.getLatency(50), 0.02)
+        self.assertAlmostEquals(stats.getLatency(99), 1.28)
+
+    def test_state(self):
+        stats = MirrorStats()
+        stats.addSample(size=1000, time=2, latency=0.1)
+        stats.addSample(failed=1)
+        copy = MirrorStats(stats.getState())
+        self.assertEquals(copy.getThroughput(), 500)
+        self.assertEquals(copy.failrate, stats.failrate)
+        self.assertEquals(copy.getLatency(), stats.getLatency())
+
+
+class MirrorSystemTest(TestCase):
+
+    def setUp(self):
+        self.system = MirrorSystem()
+        self.system.setMirrors({ORIGIN: MIRRORS})
+
+    def test_old_history_format(self):
+        self.system.setHistory([(MIRRORS[0], {"size": 2000, "time": 1}),
+                                (MIRRORS[0], {"size": 1000, "time": 1}),
+                                (MIRRORS[1], {"failed": 1})])
+        self.assertTrue(self.system.getHistoryChanged())
+        history = self.system.getHistory()
+        self.assertEquals(sorted(history), sorted(MIRRORS))
+        self.assertEquals(MirrorStats(history[MIRRORS[0]]).getThroughput(),
+                          1200)
+        self.assertEquals(MirrorStats(history[MIRRORS[1]]).failrate, 0.2)
+
+    def test_spread_by_throughput(self):
+        for i in range(5):
+            self.system.addInfo(ORIGIN, size=1024*1024, time=1)
+            self.system.addInfo(MIRRORS[0], size=1024*1024, time=2)
+            self.system.addInfo(MIRRORS[1], failed=1)
+        counts = {}
+        items = []
+        for i in range(30):
+            item = self.system.get(ORIGIN+"file%d" % i)
+            mirror = item.getNext()[:-len("file%d" % i)]
+            counts[mirror] = counts.get(mirror, 0)+1
+            items.append(item)
+        # Twice as fast means about twice as many downloads, and the
+        # failing mirror only gets some once the others are busy.
+        self.assertTrue(abs(counts[ORIGIN]-2*counts[MIRRORS[0]]) <= 2)
+        self.assertTrue(0 < counts[MIRRORS[1]] < counts[MIRRORS[0]])
+
+        # Finished downloads don't count anymore.
+        for item in items:
+            item.release()
+        self.assertEquals(self.system.get(ORIGIN+"file").getNext(),
+                          ORIGIN+"file")
+
+    def test_unknown_mirrors_get_their_share(self):
+        self.system.addInfo(ORIGIN, size=1024*1024, time=1)
+        urls = [self.system.get(ORIGIN+"file").getNext() for i in range(3)]
+        self.assertEquals(sorted(urls),
+                          sorted([x+"file" for x in [ORIGIN]+MIRRORS]))
+
+    def test_get_next_after_failure(self):
+        item = self.system.get(ORIGIN+"file")
+        urls = [item.getNext() for i in range(4)]
+        self.assertEquals(sorted(urls[:3]),
+                          sorted([x+"file" for x in [ORIGIN]+MIRRORS]))
+        self.assertEquals(urls[3], None)
@@ -7,6 +7,8 @@ from mocker import MockerTestCase
 from smart.backends.rpm.base import RPMPackage, Package, Requires, Provides, \
                                     getTS, collapse_libc_requires
 from smart.backends.rpm.rpmver import checkver, splitarch, splitrelease
+from smart.backends.rpm.rpmver import vercmp, vercmppart, checkdep
+from smart.backends.rpm.rpmver import sortversions, checkdeps
 from smart import sysconf
 
 
@@ -109,6 +111,45 @@ class RPMVerCheckTest(MockerTestCase):
     def test_checkdistepoch(self):
         self.assertTrue(checkver("1-2:3", "1-2"))
 
+class RPMVerCompareTest(MockerTestCase):
+
+    def test_vercmp(self):
+        self.assertEquals(vercmp("1.0-1", "1.0-2"), -1)
+        self.assertEquals(vercmp("1:1.0-1", "2.0-1"), 1)
+        self.assertEquals(vercmp("1.0", "1.0-2"), 0)
+        self.assertEquals(vercmp("1.0a", "1.0.1"), -1)
+        self.assertEquals(vercmp("1.01", "1.1"), 0)
+        self.assertEquals(vercmp("1.0-1:2", "1.0-1:3"), 0)
+
+    def test_vercmp_is_repeatable(self):
+        # Parsed versions are cached, so compare them twice, and
+        # against the unparsed comparison.
+        versions = ["1.0", "1.0.1", "1.0a", "1.0-1", "1.0-1.fc13",
+                    "2:0.1-1", "1.0.", "1.0_", "", "10", "9.9-9"]
+        for i in range(2):
+            for v1 in versions:
+                for v2 in versions:
+                    rc = vercmppart(v1, v2)
+                    if "-" not in v1+v2 and ":" not in v1+v2:
+                        self.assertEquals(vercmp(v1, v2), rc)
+                    self.assertEquals(checkdep(v1, "=", v2),
+                                      vercmp(v1, v2) == 0)
+
+    def test_sortversions(self):
+        versions = ["1.10-1", "1.9-1", "1:0.1-1", "1.9-2", "1.9a-1"]
+        sortversions(versions)
+        self.assertEquals(versions,
+                          ["1.9-1", "1.9-2", "1.9a-1", "1.10-1", "1:0.1-1"])
+
+    def test_checkdeps(self):
+        prvs = [Provides("a", "1.0-1@i386"), Provides("a", None),
+                Provides("a", "2.0-1@x86_64"), Provides("a", "1:0.5-1")]
+        req = Requires("a", ">=", "2.0-1@i386")
+        self.assertEquals(checkdeps(req, prvs), [prvs[1], prvs[2], prvs[3]])
+        self.assertEquals(checkdeps(req, prvs, False), [prvs[2], prvs[3]])
+        req = Requires("a", "=", "1.0-1")
+        self.assertEquals(checkdeps(req, prvs), [prvs[0], prvs[1]])
+
 class RPMVerSplitTest(MockerTestCase):
 
     def test_splitarch(self):
@@ -0,0 +1,83 @@
+from StringIO import StringIO
+from unittest import TestCase
+
+from smart.backends.rpm.primary import parsePrimary
+from smart.backends.rpm.base import *
+
+
+PRIMARY = """\
+<?xml version="1.0" encoding="UTF-8"?>
+<metadata xmlns="http://linux.duke.edu/metadata/common"
+          xmlns:rpm="http://linux.duke.edu/metadata/rpm" packages="2">
+<package type="rpm">
+  <name>name1</name>
+  <arch>noarch</arch>
+  <version epoch="1" ver="version1" rel="release1"/>
+  <checksum type="sha" pkgid="YES">abc</checksum>
+  <summary>Summary1</summary>
+  <description></description>
+  <time file="1" build="2"/>
+  <size package="3" installed="4"/>
+  <location href="name1.rpm"/>
+  <format>
+    <rpm:group>Group1</rpm:group>
+    <rpm:provides>
+      <rpm:entry name="name1" flags="EQ" epoch="1" ver="version1"
+                 rel="release1"/>
+      <rpm:entry name="prv1"/>
+    </rpm:provides>
+    <rpm:requires>
+      <rpm:entry name="req1" flags="GE" ver="1.0"/>
+      <rpm:entry name="prereq1" pre="1"/>
+      <rpm:entry name="rpmlib(PayloadIsXz)"/>
+    </rpm:requires>
+    <rpm:obsoletes>
+      <rpm:entry name="obs1" flags="LT" ver="2.0" rel="1"/>
+    </rpm:obsoletes>
+    <file>/usr/bin/name1</file>
+  </format>
+</package>
+<package type="src">
+  <name>name2</name>
+</package>
+</metadata>
+"""
+
+
+class ParsePrimaryTest(TestCase):
+
+    def test_parse(self):
+        packages = list(parsePrimary(StringIO(PRIMARY)))
+        self.assertEquals(len(packages), 1)
+        (name, version, arch, disttag, distepoch, pkgid, info,
+         reqdict, recdict, prvdict, upgdict, cnfdict,
+         filedict) = packages[0]
+        self.assertEquals((name, version, arch, disttag, distepoch, pkgid),
+                          ("name1", "1:version1-release1", "noarch",
+                           None, None, "abc"))
+        self.assertEquals(info, {"sha": "abc", "summary": "Summary1",
+                                 "time": 1, "build_time": 2, "size": 3,
+                                 "installed_size": 4,
+                                 "location": "name1.rpm",
+                                 "group": "Group1"})
+        self.assertEquals(set(reqdict),
+                          set([(RPMPreRequires, "prereq1", None, None),
+                               (RPMRequires, "req1", ">=", "1.0")]))
+        self.assertEquals(recdict, {})
+        self.assertEquals(set(prvdict),
+                          set([(RPMNameProvides, "name1",
+                                "1:version1-release1@noarch"),
+                               (RPMProvides, "prv1", None)]))
+        obsoletes = (RPMObsoletes, "obs1", "<", "2.0-1")
+        self.assertEquals(upgdict, {obsoletes: True})
+        self.assertEquals(cnfdict, {obsoletes: True})
+        self.assertEquals(filedict, {"/usr/bin/name1": True})
+
+    def test_unicode(self):
+        data = PRIMARY.replace("Summary1", "Caf\xc3\xa9")
+        info = list(parsePrimary(StringIO(data)))[0][6]
+        self.assertEquals(info["summary"], u"Caf\xe9")
+
+    def test_invalid_xml(self):
+        packages = parsePrimary(StringIO(PRIMARY[:-20]))
+        self.assertRaises(SyntaxError, list, packages)
@@ -1,6 +1,10 @@
 from mocker import MockerTestCase
 
-from smart.searcher import Searcher
+from smart.searcher import Searcher, SearchIndex, dumpGramIndex
+from smart.cache import Cache, Loader, Package, Provides
+from smart.backends.deb.base import DebPackage
+from smart.backends.rpm.rpmver import splitarch, splitrelease
+from smart.util.strtools import globdistance
 
 
 class SearcherTest(MockerTestCase):
@@ -8,3 +12,103 @@ class SearcherTest(MockerTestCase):
     def test_group(self):
         searcher = Searcher()
         searcher.addGroup("foo")
+
+
+class RPMLikePackage(Package):
+    # Searches as RPMPackage, which needs the rpm module.
+
+    def search(self, searcher):
+        myname = self.name
+        myversion, myarch = splitarch(self.version)
+        ratio = 0
+        for nameversion, cutoff in searcher.nameversion:
+            if '@' in nameversion:
+                targets = ["%s-%s@%s" % (myname, myversion, myarch),
+                           "%s@%s" % (myname, myarch),
+                           "%s-%s@%s" % (myname, splitrelease(myversion)[0],
+                                         myarch)]
+            else:
+                targets = [myname, "%s-%s" % (myname, myversion),
+                           "%s-%s" % (myname, splitrelease(myversion)[0])]
+            for target in targets:
+                _, ratio1 = globdistance(nameversion, target, cutoff)
+                ratio = max(ratio, ratio1)
+        if ratio:
+            searcher.addResult(self, ratio)
+
+
+class IndexLoader(Loader):
+
+    def __init__(self, packages):
+        Loader.__init__(self)
+        self.fake_packages = packages
+
+    def load(self):
+        for cls, name, version in self.fake_packages:
+            self.buildPackage((cls, name, version),
+                              [(Provides, name, version),
+                               (Provides, "lib%s.so" % name, None)],
+                              [], [], [])
+
+
+class SearchIndexTest(MockerTestCase):
+
+    def setUp(self):
+        self.cache = Cache()
+        self.cache.addLoader(IndexLoader([
+            (Package, "python", "2.7-1"),
+            (Package, "python-devel", "1:2.7-1"),
+            (Package, "Python-Docs", "2.7-1"),
+            (DebPackage, "pyhton", "2.6-1"),
+            (DebPackage, "libgtk2.0-0", "2.24.0-1"),
+            (Package, "vim", "7.3-1"),
+            (Package, "a", "1"),
+            (RPMLikePackage, "foo", "1-2@x86_64"),
+            ]))
+        self.cache.load()
+        packages = self.cache.getPackages()
+        provides = self.cache.getProvides()
+        self.index = SearchIndex(packages, dumpGramIndex(packages),
+                                 provides, dumpGramIndex(provides))
+
+    def search(self, pattern, cutoff):
+        searcher = Searcher()
+        searcher.addNameVersion(pattern, cutoff)
+        searcher.addProvides(pattern, cutoff)
+        self.cache.search(searcher)
+        return sorted([(ratio, str(obj)) for ratio, obj in
+                       searcher.getResults()])
+
+    def test_same_results(self):
+        for pattern in ["python", "*python*", "pyth*", "python-2.7",
+                        "python-devel-2.7", "python_2.6", "pyhton-devel",
+                        "*gtk*", "libgtk2.0-0_2.24", "lib*.so", "vim",
+                        "vim-7.3", "a", "?im", "PYTHON", "*",
+                        "foo-1@x86_64", "foo@x86_64", "foo-1-2@x86_64"]:
+            for cutoff in [1.0, 0.95, 0.7, 0.3]:
+                self.cache.setSearchIndex(None)
+                expected = self.search(pattern, cutoff)
+                self.cache.setSearchIndex(self.index)
+                self.assertEquals(self.search(pattern, cutoff), expected)
+
+    def test_candidates(self):
+        searcher = Searcher()
+        searcher.addNameVersion("*devel*")
+        self.assertEquals([str(pkg) for pkg in
+                           self.index.getPackages(searcher)],
+                          ["python-devel-1:2.7-1"])
+        searcher.addNameVersion("vim", 0.3)
+        self.assertEquals(self.index.getPackages(searcher),
+                          self.cache.getPackages())
+
+    def test_dropped_on_change(self):
+        self.cache.setSearchIndex(self.index)
+        self.cache.reset()
+        self.assertEquals(self.cache._searchindex, None)
+
+    def test_short_version_with_arch(self):
+        # The trigrams across the name, the version without release
+        # and the arch must be indexed too.
+        self.cache.setSearchIndex(self.index)
+        self.assertEquals(self.search("foo-1@x86_64", 1.0),
+                          [(1.0, "foo-1-2@x86_64")])
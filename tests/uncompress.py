@@ -44,3 +44,50 @@ class UncompressorTest(unittest.TestCase):
     def test_7zip(self):
         self.uncompress_file("%s/uncompress/test.7z" % TESTDATADIR)
 
+
+    def open_file(self, file):
+        input = Uncompressor().open(file)
+        orig = open("%s/uncompress/test.txt" % TESTDATADIR).read()
+        self.assertEquals(input.read(), orig)
+        input.seek(3)
+        self.assertEquals(input.tell(), 3)
+        self.assertEquals(input.read(4), orig[3:7])
+        input.seek(0)
+        self.assertEquals(list(input), orig.splitlines(True))
+        input.close()
+
+    def test_open_gzip(self):
+        self.open_file("%s/uncompress/test.gz" % TESTDATADIR)
+
+    def test_open_bzip2(self):
+        self.open_file("%s/uncompress/test.bz2" % TESTDATADIR)
+
+    def test_open_uncompressed(self):
+        self.open_file("%s/uncompress/test.txt" % TESTDATADIR)
+
+    def test_is_seekable(self):
+        self.assertTrue(Uncompressor.isSeekable("Packages.gz"))
+        self.assertTrue(Uncompressor.isSeekable("Packages"))
+        self.assertFalse(Uncompressor.isSeekable("Packages.bz2"))
+        self.assertFalse(Uncompressor.isSeekable("Packages.lzma"))
+
+    def test_open_concatenated_gzip(self):
+        import gzip, tempfile
+        fd, path = tempfile.mkstemp(".gz")
+        os.close(fd)
+        try:
+            data = "".join(["line %d\n" % i for i in range(100000)])
+            for part in (data[:1000], data[1000:]):
+                file = gzip.GzipFile(path, "ab")
+                file.write(part)
+                file.close()
+            # Trailing data after the gzip members is ignored.
+            open(path, "ab").write("\0\0trailing")
+            input = Uncompressor().open(path)
+            self.assertEquals(input.read(), data)
+            for offset in (500000, 10, 600000, 0):
+                input.seek(offset)
+                self.assertEquals(input.read(20), data[offset:offset+20])
+            input.close()
+        finally:
+            os.unlink(path)
@@ -1,11 +1,65 @@
 from tests.mocker import MockerTestCase
 
-from smart.util.distance import globdistance
+from smart.util.distance import distance, distance_many, globdistance, \
+                                GlobPattern
 
 
 class DistanceTestBase(MockerTestCase):
 
+    def assertDistance(self, result, expected):
+        # Ratios are computed with single precision floats.
+        self.assertEquals(result[0], expected[0])
+        self.assertAlmostEquals(result[1], expected[1], 5)
+
     def test_globdistance_with_empty_values(self):
         self.assertEquals(globdistance("", ""), (0, 1.0))
         self.assertEquals(globdistance("", "a"), (1, 0.0))
         self.assertEquals(globdistance("a", ""), (1, 0.0))
+
+    def test_distance(self):
+        self.assertDistance(distance("kitten", "sitting"), (3, 4/7.))
+        self.assertDistance(distance("sitting", "kitten"), (3, 4/7.))
+        self.assertDistance(distance("kitten", "sitting", 2), (7, 0.0))
+        self.assertDistance(distance("", "abc"), (3, 0.0))
+
+    def test_distance_with_long_strings(self):
+        # Strings longer than a machine word use another algorithm.
+        a = "ab"*40
+        b = "ba"*40
+        self.assertDistance(distance(a, b), (2, 78/80.))
+        self.assertDistance(distance(a[:70], b), (10, 70/80.))
+        self.assertDistance(distance(a, b, 1), (80, 0.0))
+
+    def test_globdistance_without_wildcards(self):
+        self.assertDistance(globdistance("Smart", "smart"), (1, 0.8))
+        self.assertDistance(globdistance("Smart", "smart", None, True),
+                          (0, 1.0))
+        self.assertDistance(globdistance("smrt", "smart", 0.9), (5, 0.0))
+        self.assertDistance(globdistance("smrt", "smart", 0.8), (1, 0.8))
+
+    def test_distance_many(self):
+        candidates = ["smart", "start", "smartpm", "", "a"*100]
+        for pattern in ("smart", "a"*70):
+            for cutoff in (None, 1, 0.5):
+                self.assertEquals(distance_many(pattern, candidates, cutoff),
+                                  [distance(pattern, x, cutoff)
+                                   for x in candidates])
+
+    def test_globdistance_with_wildcards(self):
+        self.assertDistance(globdistance("sm?rt", "smart"), (0, 1.0))
+        self.assertDistance(globdistance("*art", "smart"), (0, 1.0))
+        self.assertDistance(globdistance("*ort", "smart"), (1, 0.8))
+        self.assertDistance(globdistance("sm*", "smart"), (0, 1.0))
+        self.assertDistance(globdistance("*", "smart"), (0, 1.0))
+
+    def test_glob_pattern(self):
+        candidates = ["smart", "Smart", "smartpm", "start", "", "a"*100]
+        for pattern in ("sm?rt", "*ART", "sm*", "smart", "a"*70):
+            for cutoff in (None, 1, 0.7):
+                for ignorecase in (False, True):
+                    glob = GlobPattern(pattern, cutoff, ignorecase)
+                    expected = [globdistance(pattern, x, cutoff, ignorecase)
+                                for x in candidates]
+                    self.assertEquals([glob.match(x) for x in candidates],
+                                      expected)
+                    self.assertEquals(glob.match_many(candidates), expected)
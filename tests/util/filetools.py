@@ -0,0 +1,50 @@
+import os
+
+from tests.mocker import MockerTestCase
+
+from smart.util import filetools
+from smart.util.filetools import getFileDigest, getFileDigests
+from smart.util.filetools import getFilesDigests, compareFiles
+
+try:
+    from hashlib import md5, sha1, sha256
+except ImportError:
+    from md5 import md5
+    from sha import sha as sha1
+    from smart.util.sha256 import sha256
+
+
+class DigestTest(MockerTestCase):
+
+    def test_file_digest(self):
+        filename = self.makeFile("data")
+        self.assertEquals(getFileDigest(filename), md5("data").digest())
+        self.assertEquals(getFileDigest(self.makeFile("")), md5().digest())
+        self.assertTrue(compareFiles(filename, self.makeFile("data")))
+        self.assertFalse(compareFiles(filename, self.makeFile("date")))
+
+    def test_file_digests(self):
+        # Go over more than one mapped chunk.
+        chunksize = filetools.MAPCHUNKSIZE
+        filetools.MAPCHUNKSIZE = 7
+        try:
+            data = "".join([chr(i%256) for i in range(1000)])
+            digests = getFileDigests(self.makeFile(data),
+                                     ["md5", "sha", "sha256"])
+        finally:
+            filetools.MAPCHUNKSIZE = chunksize
+        self.assertEquals(digests, {"md5": md5(data).hexdigest(),
+                                    "sha": sha1(data).hexdigest(),
+                                    "sha256": sha256(data).hexdigest()})
+        self.assertEquals(getFileDigests(self.makeFile(""), ["sha256"]),
+                          {"sha256": sha256().hexdigest()})
+
+    def test_files_digests(self):
+        requests = [(self.makeFile("data%d" % i), ["md5"]) for i in range(5)]
+        requests.insert(2, (self.makeFile(), ["md5"]))
+        results = getFilesDigests(requests, jobs=3)
+        self.assertEquals(results[2], None)
+        del results[2]
+        self.assertEquals(results, [{"md5": md5("data%d" % i).hexdigest()}
+                                    for i in range(5)])
+        self.assertEquals(getFilesDigests([]), [])
@@ -0,0 +1,57 @@
+import os
+
+from tests.mocker import MockerTestCase
+
+from smart.util.infofile import LRUCache, InfoFile, InfoFileWriter
+
+
+class LRUCacheTest(MockerTestCase):
+
+    def test_evict_least_recently_used(self):
+        cache = LRUCache(2)
+        cache.set("a", 1)
+        cache.set("b", 2)
+        self.assertEquals(cache.get("a"), 1)
+        cache.set("c", 3)
+        self.assertEquals(len(cache), 2)
+        self.assertEquals(cache.get("b"), None)
+        self.assertEquals(cache.get("a"), 1)
+        self.assertEquals(cache.get("c"), 3)
+
+    def test_set_existing(self):
+        cache = LRUCache(2)
+        cache.set("a", 1)
+        cache.set("b", 2)
+        cache.set("a", 3)
+        cache.set("c", 4)
+        self.assertEquals(cache.get("a"), 3)
+        self.assertFalse("b" in cache)
+        cache.clear()
+        self.assertEquals(len(cache), 0)
+        self.assertEquals(cache.get("a", 5), 5)
+
+
+class InfoFileTest(MockerTestCase):
+
+    def setUp(self):
+        self.filename = os.path.join(self.makeDir(), "info")
+
+    def test_write_and_get(self):
+        writer = InfoFileWriter(self.filename)
+        offset1 = writer.write({"summary": u"Summary \xe1"})
+        offset2 = writer.write({"size": 10})
+        self.assertFalse(os.path.exists(self.filename))
+        writer.close()
+        infofile = InfoFile(self.filename, cachesize=1)
+        self.assertEquals(infofile.get(offset2), {"size": 10})
+        self.assertEquals(infofile.get(offset1), {"summary": u"Summary \xe1"})
+        self.assertEquals(infofile.get(offset2), {"size": 10})
+        self.assertEquals(infofile.get(1000), None)
+        infofile.close()
+
+    def test_abort(self):
+        writer = InfoFileWriter(self.filename)
+        writer.write({})
+        writer.abort()
+        self.assertEquals(os.listdir(os.path.dirname(self.filename)), [])
+        self.assertEquals(InfoFile(self.filename).get(0), None)
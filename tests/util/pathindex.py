@@ -0,0 +1,59 @@
+import os
+
+from tests.mocker import MockerTestCase
+
+from smart.util import pathindex
+from smart.util.pathindex import PathIndex, writePathIndex
+from smart import Error
+
+
+class PathIndexTest(MockerTestCase):
+
+    def setUp(self):
+        self.filename = os.path.join(self.makeDir(), "index")
+
+    def test_get(self):
+        writePathIndex(self.filename, [("/usr/bin/b", "2"),
+                                       ("/usr/bin/a", "1"),
+                                       ("/usr/bin/b", "1"),
+                                       ("/usr/bin/b", "1")])
+        index = PathIndex(self.filename)
+        self.assertEquals(len(index), 2)
+        self.assertEquals(index.get("/usr/bin/a"), ["1"])
+        self.assertEquals(index.get("/usr/bin/b"), ["1", "2"])
+        self.assertEquals(index.get("/usr/bin/c"), [])
+        self.assertEquals(index.get("/usr/bin"), [])
+        index.close()
+
+    def test_empty(self):
+        writePathIndex(self.filename, [])
+        index = PathIndex(self.filename)
+        self.assertEquals(len(index), 0)
+        self.assertEquals(index.get("/usr/bin/a"), [])
+        index.close()
+
+    def test_merge_runs(self):
+        runsize = pathindex.RUNSIZE
+        pathindex.RUNSIZE = 10
+        try:
+            pairs = [("/p%d" % (i%17), str(i%3)) for i in range(100)]
+            writePathIndex(self.filename, pairs)
+        finally:
+            pathindex.RUNSIZE = runsize
+        index = PathIndex(self.filename)
+        self.assertEquals(len(index), 17)
+        for i in range(17):
+            keys = sorted(set([key for path, key in pairs
+                               if path == "/p%d" % i]))
+            self.assertEquals(index.get("/p%d" % i), keys)
+        index.close()
+
+    def test_no_leftovers_on_error(self):
+        # Keys must be strings.
+        self.assertRaises(TypeError, writePathIndex, self.filename,
+                          [("/usr/bin/a", 1)])
+        self.assertEquals(os.listdir(os.path.dirname(self.filename)), [])
+
+    def test_invalid(self):
+        open(self.filename, "w").write("not an index")
+        self.assertRaises(Error, PathIndex, self.filename)
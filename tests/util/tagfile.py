@@ -0,0 +1,80 @@
+from StringIO import StringIO
+
+from tests.mocker import MockerTestCase
+
+from smart.util.tagfile import TagFile
+from smart.uncompress import Uncompressor
+
+
+SECTIONS = """\
+Package: name1
+Version: 1.0
+Description: Summary
+ First line.
+ .
+ Second line.
+
+Package: name2
+Version: 2.0
+Depends: name1
+
+"""
+
+
+class TagFileTest(MockerTestCase):
+
+    def getSections(self, tagfile, fields=None):
+        sections = []
+        tagfile.setOffset(0)
+        while tagfile.advanceSection(fields):
+            sections.append((tagfile.getOffset(), dict(tagfile)))
+        return sections
+
+    def test_file_and_file_object(self):
+        filename = self.makeFile(SECTIONS)
+        expected = [(80, {"package": "name1", "version": "1.0",
+                          "description": "Summary\nFirst line.\n\n"
+                                         "Second line."}),
+                    (124, {"package": "name2", "version": "2.0",
+                           "depends": "name1"})]
+        self.assertEquals(self.getSections(TagFile(filename)), expected)
+        self.assertEquals(self.getSections(TagFile(StringIO(SECTIONS))),
+                          expected)
+
+    def test_fields(self):
+        filename = self.makeFile(SECTIONS)
+        fields = frozenset(["package", "depends"])
+        for tagfile in (TagFile(filename), TagFile(StringIO(SECTIONS))):
+            self.assertEquals(self.getSections(tagfile, fields),
+                              [(80, {"package": "name1"}),
+                               (124, {"package": "name2",
+                                      "depends": "name1"})])
+            # Sections without any of the fields are still there.
+            self.assertEquals(len(self.getSections(tagfile, ["none"])), 2)
+
+    def test_set_offset(self):
+        tagfile = TagFile(self.makeFile(SECTIONS))
+        tagfile.setOffset(80)
+        self.assertTrue(tagfile.advanceSection())
+        self.assertEquals(tagfile["package"], "name2")
+        self.assertFalse(tagfile.advanceSection())
+
+    def test_last_section_without_empty_line(self):
+        data = "Package: name1\n\nPackage: name2\nVersion: 2.0"
+        for tagfile in (TagFile(self.makeFile(data)), TagFile(StringIO(data))):
+            self.assertEquals([x[1] for x in self.getSections(tagfile)],
+                              [{"package": "name1"},
+                               {"package": "name2", "version": "2.0"}])
+
+    def test_uncompressed_file(self):
+        import gzip
+        filename = self.makeFile(suffix=".gz")
+        file = gzip.GzipFile(filename, "wb")
+        file.write(SECTIONS)
+        file.close()
+        tagfile = TagFile(Uncompressor().open(filename))
+        self.assertEquals(self.getSections(tagfile),
+                          self.getSections(TagFile(StringIO(SECTIONS))))
+        tagfile.setOffset(80)
+        self.assertTrue(tagfile.advanceSection())
+        self.assertEquals(tagfile["package"], "name2")
@@ -92,3 +92,57 @@ class YumRpmChannelTest(MockerTestCase):
         except AttributeError, error:
              # AttributeError: 'ExpatError' object has no attribute 'split'
              self.fail(error)
+
+    def test_path_index(self):
+        channel = createChannel("alias",
+                                {"type": "rpm-md",
+                                 "baseurl": "file://%s/yumrpm" % TESTDATADIR})
+        self.check_channel(channel)
+        loader = channel.getLoaders()[0]
+        self.assertTrue(os.path.isfile(loader.getPathIndexName()))
+        loader.loadFileProvides({"/tmp/file1": "/tmp/file1",
+                                 "/tmp/missing": "/tmp/missing"})
+        provides = self.cache.getProvides("/tmp/file1")
+        self.assertEquals(len(provides), 1)
+        self.assertEquals([pkg.name for pkg in provides[0].packages],
+                          ["name1"])
+        self.assertEquals(self.cache.getProvides("/tmp/missing"), [])
+
+    def test_path_index_with_load_jobs(self):
+        from smart.backends.rpm import metadata
+        channel = createChannel("alias",
+                                {"type": "rpm-md",
+                                 "baseurl": "file://%s/yumrpm" % TESTDATADIR})
+        self.check_channel(channel)
+        loader = channel.getLoaders()[0]
+        # Split the file list in one chunk per package.
+        chunksize = metadata.CHUNKSIZE
+        metadata.CHUNKSIZE = 1
+        sysconf.set("load-jobs", 2)
+        try:
+            loader.buildPathIndex()
+        finally:
+            metadata.CHUNKSIZE = chunksize
+            sysconf.remove("load-jobs")
+        loader.loadFileProvides({"/tmp/file1": "/tmp/file1",
+                                 "/tmp/file2": "/tmp/file2"})
+        for path, name in [("/tmp/file1", "name1"), ("/tmp/file2", "name2")]:
+            provides = self.cache.getProvides(path)
+            self.assertEquals(len(provides), 1)
+            self.assertEquals([pkg.name for pkg in provides[0].packages],
+                              [name])
+
+    def test_info_file(self):
+        channel = createChannel("alias",
+                                {"type": "rpm-md",
+                                 "baseurl": "file://%s/yumrpm" % TESTDATADIR})
+        self.check_channel(channel)
+        loader = channel.getLoaders()[0]
+        self.assertTrue(os.path.isfile(loader.getInfoFileName()))
+        pkg = sorted(self.cache.getPackages())[0]
+        self.assertEquals(type(pkg.loaders[loader]), int)
+        info = loader.getInfo(pkg)
+        self.assertEquals(info.getSummary(), "Summary1")
+        self.assertEquals(info.getURLs(),
+                          ["file://%s/yumrpm/name1-version1-release1.noarch.rpm"
+                           % TESTDATADIR])